@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2019 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+
+#include "super.h"
+#include "format.h"
+#include "key.h"
+#include "kvec.h"
+#include "item.h"
+#include "seg.h"
+#include "lock.h"
+#include "bench.h"
+
+/*
+ * In-kernel microbenchmarks of hot paths so that we can quantify
+ * regressions between releases without setting up a cluster.  Writing a
+ * benchmark name to the bench debugfs file runs it synchronously in the
+ * writing task and reading the file returns the results of the last
+ * run.
+ *
+ * The benchmarks only exercise in-memory paths.  Benchmark keys live in
+ * a zone past all the real zones so they can never collide with file
+ * system items, and filled segments use a segno that the server never
+ * allocates so the cache entry is never read.  Nothing is marked dirty
+ * so nothing ever reaches the device.
+ */
+
+struct bench_info {
+	struct dentry *dentry;
+	struct mutex mutex;
+	char *output;
+	size_t output_len;
+	/* stores comparison results so the compiler can't elide loops */
+	long sink;
+};
+
+#define DECLARE_BENCH_INFO(sb, name) \
+	struct bench_info *name = SCOUTFS_SB(sb)->bench_info
+
+/* a zone past the real zones so keys never collide with fs items */
+#define BENCH_ZONE		U8_MAX
+/* a segno the server never allocates so the cached seg is never read */
+#define BENCH_SEGNO		U64_MAX
+
+/*
+ * Latencies are counted in power of two nanosecond buckets.  Percentile
+ * reporting walks the buckets and returns the exclusive upper bound of
+ * the bucket that the percentile falls in.
+ */
+#define BENCH_NR_BUCKETS 40
+
+struct bench_hist {
+	u64 counts[BENCH_NR_BUCKETS];
+	u64 nr;
+};
+
+static void bench_record(struct bench_hist *hist, u64 ns)
+{
+	int i = ns ? min(fls64(ns), BENCH_NR_BUCKETS) - 1 : 0;
+
+	hist->counts[i]++;
+	hist->nr++;
+}
+
+static u64 bench_pctl(struct bench_hist *hist, unsigned int pct)
+{
+	u64 limit = div_u64(hist->nr * pct, 100);
+	u64 seen = 0;
+	int i;
+
+	for (i = 0; i < BENCH_NR_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= limit && hist->counts[i])
+			return 1ULL << (i + 1);
+	}
+
+	return 0;
+}
+
+static u64 bench_ops_sec(u64 ops, u64 ns)
+{
+	return ns ? div64_u64(ops * NSEC_PER_SEC, ns) : 0;
+}
+
+static void bench_printf(struct bench_info *binf, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	binf->output_len += vsnprintf(binf->output + binf->output_len,
+				      PAGE_SIZE - binf->output_len, fmt, args);
+	va_end(args);
+}
+
+static void bench_print_hist(struct bench_info *binf, struct bench_hist *hist)
+{
+	bench_printf(binf, "  per-op ns: p50 < %llu p99 < %llu max < %llu\n",
+		     bench_pctl(hist, 50), bench_pctl(hist, 99),
+		     bench_pctl(hist, 100));
+}
+
+static void bench_key(struct scoutfs_key *key, u64 nr)
+{
+	scoutfs_key_set_zeros(key);
+	key->sk_zone = BENCH_ZONE;
+	key->_sk_first = cpu_to_le64(nr);
+}
+
+/*
+ * Compare pairs of random keys.  A single timed comparison would mostly
+ * measure the clock so we time batches and record the per-op average of
+ * each batch in the histogram.  The comparison results are summed into
+ * memory the compiler can't prove dead so the loops aren't elided.
+ */
+#define BENCH_CMP_KEYS	4096
+#define BENCH_CMP_OPS	(4 * 1024 * 1024)
+
+static int bench_key_compare(struct super_block *sb)
+{
+	DECLARE_BENCH_INFO(sb, binf);
+	struct bench_hist hist = {{0,}};
+	struct scoutfs_key *keys;
+	ktime_t start;
+	u64 total_ns = 0;
+	u64 batch_ns;
+	long sink = 0;
+	u64 ops;
+	int i;
+
+	keys = vmalloc(BENCH_CMP_KEYS * sizeof(struct scoutfs_key));
+	if (!keys)
+		return -ENOMEM;
+
+	prandom_bytes(keys, BENCH_CMP_KEYS * sizeof(struct scoutfs_key));
+
+	for (ops = 0; ops < BENCH_CMP_OPS; ops += BENCH_CMP_KEYS - 1) {
+		start = ktime_get();
+		for (i = 0; i < BENCH_CMP_KEYS - 1; i++)
+			sink += scoutfs_key_compare(&keys[i], &keys[i + 1]);
+		batch_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		total_ns += batch_ns;
+		bench_record(&hist, div_u64(batch_ns, BENCH_CMP_KEYS - 1));
+	}
+
+	binf->sink = sink;
+
+	bench_printf(binf, "key_compare: %llu ops in %llu ns, %llu ops/sec\n",
+		     ops, total_ns, bench_ops_sec(ops, total_ns));
+	bench_print_hist(binf, &hist);
+
+	vfree(keys);
+	return 0;
+}
+
+/*
+ * Exercise the item cache with clean items: batched insertion, random
+ * lookups, and invalidation of the cached range.  A fabricated lock
+ * provides the coverage that the item calls check.  Lookups can miss if
+ * memory pressure shrinks the benchmark items away mid-run; misses walk
+ * an empty manifest range and are counted separately.
+ */
+#define BENCH_ITEM_NR		(64 * 1024)
+#define BENCH_ITEM_BATCH	1024
+#define BENCH_ITEM_VAL		32
+
+static int bench_item_cache(struct super_block *sb)
+{
+	DECLARE_BENCH_INFO(sb, binf);
+	struct bench_hist hist = {{0,}};
+	struct scoutfs_lock lck = {0,};
+	struct scoutfs_key key;
+	struct scoutfs_key end;
+	char buf[BENCH_ITEM_VAL];
+	struct kvec val;
+	LIST_HEAD(batch);
+	ktime_t start;
+	u64 insert_ns = 0;
+	u64 lookup_ns = 0;
+	u64 inval_ns;
+	u64 ns;
+	u64 misses = 0;
+	u64 nr;
+	int ret;
+	int i;
+
+	prandom_bytes(buf, sizeof(buf));
+
+	bench_key(&lck.start, 0);
+	bench_key(&lck.end, BENCH_ITEM_NR - 1);
+	lck.granted_mode = DLM_LOCK_EX;
+
+	for (nr = 0; nr < BENCH_ITEM_NR; nr += BENCH_ITEM_BATCH) {
+		start = ktime_get();
+
+		for (i = 0; i < BENCH_ITEM_BATCH; i++) {
+			bench_key(&key, nr + i);
+			kvec_init(&val, buf, sizeof(buf));
+			ret = scoutfs_item_add_batch(sb, &batch, &key, &val);
+			if (ret) {
+				scoutfs_item_free_batch(sb, &batch);
+				goto out;
+			}
+		}
+
+		bench_key(&key, nr);
+		bench_key(&end, nr + BENCH_ITEM_BATCH - 1);
+		ret = scoutfs_item_insert_batch(sb, &batch, &key, &end);
+		if (ret)
+			goto out;
+
+		insert_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+
+	bench_printf(binf, "item_insert: %u ops in %llu ns, %llu ops/sec\n",
+		     BENCH_ITEM_NR, insert_ns,
+		     bench_ops_sec(BENCH_ITEM_NR, insert_ns));
+
+	for (nr = 0; nr < BENCH_ITEM_NR; nr++) {
+		bench_key(&key, prandom_u32() & (BENCH_ITEM_NR - 1));
+		kvec_init(&val, buf, sizeof(buf));
+
+		start = ktime_get();
+		ret = scoutfs_item_lookup(sb, &key, &val, &lck);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		lookup_ns += ns;
+		bench_record(&hist, ns);
+
+		if (ret == -ENOENT)
+			misses++;
+		else if (ret < 0)
+			goto out;
+	}
+
+	bench_printf(binf,
+		     "item_lookup: %u ops in %llu ns, %llu ops/sec, %llu misses\n",
+		     BENCH_ITEM_NR, lookup_ns,
+		     bench_ops_sec(BENCH_ITEM_NR, lookup_ns), misses);
+	bench_print_hist(binf, &hist);
+
+	start = ktime_get();
+	ret = scoutfs_item_invalidate(sb, &lck.start, &lck.end);
+	inval_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		goto out;
+
+	bench_printf(binf, "item_invalidate: %u items in %llu ns\n",
+		     BENCH_ITEM_NR, inval_ns);
+	ret = 0;
+out:
+	if (ret)
+		scoutfs_item_invalidate(sb, &lck.start, &lck.end);
+	return ret;
+}
+
+/*
+ * Measure the segment fill rate by appending sorted items until
+ * segments are full.  The segments are allocated, never dirtied, and
+ * replace each other in the segment cache as each fill re-allocates the
+ * benchmark segno.
+ */
+#define BENCH_SEG_FILLS		4
+#define BENCH_SEG_VAL		64
+
+static int bench_seg_append(struct super_block *sb)
+{
+	DECLARE_BENCH_INFO(sb, binf);
+	__le32 *links[SCOUTFS_MAX_SKIP_LINKS];
+	struct scoutfs_segment *seg;
+	struct scoutfs_key key;
+	char buf[BENCH_SEG_VAL];
+	struct kvec val;
+	ktime_t start;
+	u64 total_ns = 0;
+	u64 bytes = 0;
+	u64 items = 0;
+	u64 nr = 0;
+	int ret;
+	int i;
+
+	prandom_bytes(buf, sizeof(buf));
+
+	for (i = 0; i < BENCH_SEG_FILLS; i++) {
+		ret = scoutfs_seg_alloc(sb, BENCH_SEGNO, &seg);
+		if (ret)
+			return ret;
+
+		start = ktime_get();
+		for (;;) {
+			bench_key(&key, nr++);
+			kvec_init(&val, buf, sizeof(buf));
+			if (!scoutfs_seg_append_item(sb, seg, &key, &val, 0,
+						     links))
+				break;
+			items++;
+		}
+		total_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		bytes += scoutfs_seg_total_bytes(seg);
+		scoutfs_seg_put(seg);
+	}
+
+	bench_printf(binf,
+		     "seg_append: %llu items %llu bytes in %llu ns, %llu ops/sec, %llu bytes/sec\n",
+		     items, bytes, total_ns, bench_ops_sec(items, total_ns),
+		     bench_ops_sec(bytes, total_ns));
+	return 0;
+}
+
+static struct {
+	const char *name;
+	int (*func)(struct super_block *sb);
+} benches[] = {
+	{ "key_compare", bench_key_compare },
+	{ "item_cache", bench_item_cache },
+	{ "seg_append", bench_seg_append },
+};
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct super_block *sb = file->private_data;
+	DECLARE_BENCH_INFO(sb, binf);
+	char name[32];
+	char *nl;
+	int ret = -EINVAL;
+	int i;
+
+	if (count >= sizeof(name))
+		return -EINVAL;
+	if (copy_from_user(name, ubuf, count))
+		return -EFAULT;
+	name[count] = '\0';
+	nl = strchr(name, '\n');
+	if (nl)
+		*nl = '\0';
+
+	mutex_lock(&binf->mutex);
+	binf->output_len = 0;
+	binf->output[0] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		if (!strcmp(name, benches[i].name)) {
+			ret = benches[i].func(sb);
+			break;
+		}
+	}
+	mutex_unlock(&binf->mutex);
+
+	return ret ?: count;
+}
+
+static ssize_t bench_read(struct file *file, char __user *ubuf, size_t count,
+			  loff_t *ppos)
+{
+	struct super_block *sb = file->private_data;
+	DECLARE_BENCH_INFO(sb, binf);
+	ssize_t ret;
+
+	mutex_lock(&binf->mutex);
+	ret = simple_read_from_buffer(ubuf, count, ppos, binf->output,
+				      binf->output_len);
+	mutex_unlock(&binf->mutex);
+
+	return ret;
+}
+
+static const struct file_operations bench_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = bench_write,
+	.read = bench_read,
+};
+
+int scoutfs_setup_bench(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct bench_info *binf;
+	int ret;
+
+	binf = kzalloc(sizeof(struct bench_info), GFP_KERNEL);
+	if (!binf)
+		return -ENOMEM;
+
+	mutex_init(&binf->mutex);
+	sbi->bench_info = binf;
+
+	binf->output = (char *)get_zeroed_page(GFP_KERNEL);
+	if (!binf->output) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	binf->dentry = debugfs_create_file("bench", 0644, sbi->debug_root, sb,
+					   &bench_fops);
+	if (!binf->dentry) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = 0;
+out:
+	if (ret)
+		scoutfs_destroy_bench(sb);
+	return ret;
+}
+
+void scoutfs_destroy_bench(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct bench_info *binf = sbi->bench_info;
+
+	if (binf) {
+		if (binf->dentry)
+			debugfs_remove(binf->dentry);
+		free_page((unsigned long)binf->output);
+		kfree(binf);
+		sbi->bench_info = NULL;
+	}
+}
@@ -0,0 +1,7 @@
+#ifndef _SCOUTFS_BENCH_H_
+#define _SCOUTFS_BENCH_H_
+
+int scoutfs_setup_bench(struct super_block *sb);
+void scoutfs_destroy_bench(struct super_block *sb);
+
+#endif
@@ -70,6 +70,15 @@
  * and buffer heads to cast between pointers to the blocks and the
  * buffer heads that contain reference counts of the block contents.
  *
+ * XXX A format-time larger block size (16k/64k) would flatten the tree
+ * and turn many of its random reads into fewer bigger ones, but it
+ * can't just be threaded through here.  Buffer heads can't span pages,
+ * so multi-page blocks would need their own contiguous allocations and
+ * cache instead of the bh casting above, and the ring blknos, bio
+ * submission, and item offsets would all need to learn about a
+ * metadata block size that differs from SCOUTFS_BLOCK_SIZE.  The le16
+ * item offsets cap any future block size at just under 64k.
+ *
  * We store modified blocks in a list on b_private instead of marking
  * the blocks dirty.  We don't want them written out (and possibly
  * reclaimed and re-read) before we have a chance to update their
@@ -102,7 +111,6 @@
 /*
  * XXX:
  *  - counters and tracing
- *  - could issue read-ahead around reads up to dirty blkno
  *  - have barrier as we cross to prevent refreshing clobbering stale reads
  *  - audit/comment that dirty blknos can wrap around ring
  *  - figure out some max transaction size so ring won't wrap in one
@@ -124,8 +132,28 @@ struct btree_info {
 	struct buffer_head *last_dirty_bh;
 	u64 first_dirty_blkno;
 	u64 first_dirty_seq;
+
+	/* held references pin recently walked parent blocks in memory */
+	spinlock_t pin_lock;
+	struct list_head pin_list;
+	unsigned int pin_nr;
 };
 
+/*
+ * Walks pin the parent blocks they descend through by holding buffer
+ * head references in a small lru so that reclaim can't evict the hot
+ * upper levels of the trees between operations.  A pinned buffer keeps
+ * its crc verification state so only leaf misses pay for reads and
+ * checksumming.  The pins are only references, all consistency still
+ * comes from the block header checks during the walk.
+ */
+struct btree_pin {
+	struct list_head entry;
+	struct buffer_head *bh;
+};
+
+#define BTREE_PIN_NR 32
+
 #define DECLARE_BTREE_INFO(sb, name) \
 	struct btree_info *name = SCOUTFS_SB(sb)->btree_info
 
@@ -409,17 +437,20 @@ static void swap_hdr(void *priv, void *a_ptr, void *b_ptr, int size)
  * If this additional free space would satisfy an insertion then we
  * compact the items instead of splitting the block.
  *
- * We move the free space to the center of the block by walking
- * backwards through the items in offset order and packing them towards
- * the end of the block.
+ * We move the free space to the center of the block by packing the
+ * items towards the end of the block.
  *
- * We don't have specific metadata to either walk the items in offset
- * order or to update the item offsets as we move items.  We sort the
- * item offset array to achieve both ends.  First we sort it by offset
- * so we can walk in reverse order.  As we move items we update their
- * offset and then sort by keys once we're done.
+ * In-place packing has to walk the items in reverse offset order so
+ * that moved items can't overwrite items that haven't moved yet.  We
+ * don't have metadata to walk the items in offset order so we'd have to
+ * sort the item header array by offset, move the items, and sort it by
+ * keys again.  Sorting the headers of a full block twice is a
+ * noticeable stall in the insertion path so we only fall back to it
+ * when we can't allocate a scratch block to pack through.  Packing into
+ * scratch can visit the items in any order so the header array is left
+ * sorted by keys and only the offsets are updated.
  */
-static void compact_items(struct scoutfs_btree_block *bt)
+static void compact_items_in_place(struct scoutfs_btree_block *bt)
 {
 	unsigned int nr = le16_to_cpu(bt->nr_items);
 	struct scoutfs_btree_item *from;
@@ -452,6 +483,40 @@ static void compact_items(struct scoutfs_btree_block *bt)
 		  cmp_hdr_item_key, swap_hdr);
 }
 
+static void compact_items(struct scoutfs_btree_block *bt)
+{
+	unsigned int nr = le16_to_cpu(bt->nr_items);
+	struct scoutfs_btree_item *from;
+	unsigned int bytes;
+	void *scratch;
+	unsigned int end;
+	int i;
+
+	scratch = kmalloc(SCOUTFS_BLOCK_SIZE, GFP_NOFS);
+	if (!scratch) {
+		compact_items_in_place(bt);
+		return;
+	}
+
+	end = SCOUTFS_BLOCK_SIZE;
+
+	for (i = 0; i < nr; i++) {
+		from = pos_item(bt, i);
+
+		bytes = item_bytes(from);
+		end -= bytes;
+		memcpy(scratch + end, from, bytes);
+		bt->item_hdrs[i].off = cpu_to_le16(end);
+	}
+
+	memcpy((void *)bt + end, scratch + end, SCOUTFS_BLOCK_SIZE - end);
+
+	bt->free_end = cpu_to_le16(end);
+	bt->free_reclaim = 0;
+
+	kfree(scratch);
+}
+
 /* move a number of contigous elements from the src index to the dst index */
 #define memmove_arr(arr, dst, src, nr) \
 	memmove(&(arr)[dst], &(arr)[src], (nr) * sizeof(*(arr)))
@@ -599,6 +664,74 @@ enum {
 BUFFER_FNS(ScoutfsChecked, scoutfs_checked)	/* has had crc checked */
 BUFFER_FNS(ScoutfsValidCrc, scoutfs_valid_crc)	/* crc matched */
 
+/*
+ * Pin a parent block that a walk just descended through, moving it to
+ * the front of the lru if it's already pinned.  Pinning is advisory so
+ * allocation failure just skips it.
+ */
+static void pin_parent_block(struct super_block *sb,
+			     struct scoutfs_btree_block *bt)
+{
+	DECLARE_BTREE_INFO(sb, bti);
+	struct buffer_head *bh = virt_to_bh(bt);
+	struct btree_pin *drop = NULL;
+	struct btree_pin *pin;
+
+	spin_lock(&bti->pin_lock);
+	list_for_each_entry(pin, &bti->pin_list, entry) {
+		if (pin->bh == bh) {
+			list_move(&pin->entry, &bti->pin_list);
+			spin_unlock(&bti->pin_lock);
+			return;
+		}
+	}
+	spin_unlock(&bti->pin_lock);
+
+	pin = kmalloc(sizeof(struct btree_pin), GFP_NOFS);
+	if (!pin)
+		return;
+	get_bh(bh);
+	pin->bh = bh;
+
+	spin_lock(&bti->pin_lock);
+	list_add(&pin->entry, &bti->pin_list);
+	if (++bti->pin_nr > BTREE_PIN_NR) {
+		drop = list_last_entry(&bti->pin_list, struct btree_pin,
+				       entry);
+		list_del(&drop->entry);
+		bti->pin_nr--;
+	}
+	spin_unlock(&bti->pin_lock);
+
+	if (drop) {
+		put_bh(drop->bh);
+		kfree(drop);
+	}
+}
+
+/*
+ * A walk found that a block's contents no longer match its reference.
+ * There's no point in keeping it pinned, its blkno will be re-read and
+ * re-verified once the ring rewrites it.
+ */
+static void unpin_stale_block(struct super_block *sb, struct buffer_head *bh)
+{
+	DECLARE_BTREE_INFO(sb, bti);
+	struct btree_pin *pin;
+
+	spin_lock(&bti->pin_lock);
+	list_for_each_entry(pin, &bti->pin_list, entry) {
+		if (pin->bh == bh) {
+			list_del(&pin->entry);
+			bti->pin_nr--;
+			spin_unlock(&bti->pin_lock);
+			put_bh(pin->bh);
+			kfree(pin);
+			return;
+		}
+	}
+	spin_unlock(&bti->pin_lock);
+}
 
 /*
  * Make sure that we've found a valid block and that it's the block that
@@ -679,6 +812,8 @@ retry:
 
 			scoutfs_inc_counter(sb, btree_stale_read);
 
+			unpin_stale_block(sb, bh);
+
 			lock_buffer(bh);
 			clear_buffer_uptodate(bh);
 			clear_buffer_scoutfs_valid_crc(bh);
@@ -1050,6 +1185,44 @@ out:
 	return 0;
 }
 
+/* a modest readahead window that doesn't thrash the block cache */
+#define BTREE_LEAF_READAHEAD_NR 8
+
+/*
+ * An iterating walk is about to descend from a parent into a leaf.
+ * Start reads of the next few sibling leaves in the direction of
+ * iteration so that scans of a range of items, like the server walking
+ * free extents or the manifest, aren't bound by synchronous single leaf
+ * reads.
+ *
+ * The refs can point to blocks that have since been overwritten in the
+ * ring.  That's fine, readahead only populates the cache and blocks are
+ * verified against their refs if the walk arrives at them.
+ */
+static void leaf_readahead(struct super_block *sb,
+			   struct scoutfs_btree_block *parent, unsigned pos,
+			   int flags)
+{
+	struct scoutfs_btree_ref *ref;
+	unsigned nr = le16_to_cpu(parent->nr_items);
+	int i;
+
+	for (i = 1; i <= BTREE_LEAF_READAHEAD_NR; i++) {
+		if (flags & BTW_PREV) {
+			if (pos < i)
+				break;
+			ref = item_val(pos_item(parent, pos - i));
+		} else {
+			if (pos + i >= nr)
+				break;
+			ref = item_val(pos_item(parent, pos + i));
+		}
+
+		sb_breadahead(sb, le64_to_cpu(ref->blkno));
+		scoutfs_inc_counter(sb, btree_leaf_readahead);
+	}
+}
+
 /* XXX bleh, this should probably share code with the key_buf equivalent */
 static void inc_key(u8 *bytes, unsigned *len)
 {
@@ -1160,6 +1333,10 @@ restart:
 			break;
 		}
 
+		/* keep the hot upper levels pinned across operations */
+		if (level > 0)
+			pin_parent_block(sb, bt);
+
 		/*
 		 * Splitting and merging can add or remove parents or
 		 * change the pos we take through parents to reach the
@@ -1214,6 +1391,11 @@ restart:
 			memcpy(iter_key, item_key(item), *iter_len);
 		}
 
+		/* start sibling leaf reads for read-only iteration */
+		if (level == 1 && (flags & (BTW_NEXT | BTW_PREV)) &&
+		    !(flags & BTW_DIRTY))
+			leaf_readahead(sb, bt, pos, flags);
+
 		put_btree_block(parent);
 		parent = bt;
 		bt = NULL;
@@ -1706,6 +1888,8 @@ int scoutfs_btree_setup(struct super_block *sb)
 		return -ENOMEM;
 
 	mutex_init(&bti->mutex);
+	spin_lock_init(&bti->pin_lock);
+	INIT_LIST_HEAD(&bti->pin_list);
 
 	sbi->btree_info = bti;
 
@@ -1717,7 +1901,16 @@ int scoutfs_btree_setup(struct super_block *sb)
 void scoutfs_btree_destroy(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
-
-	kfree(sbi->btree_info);
-	sbi->btree_info = NULL;
+	struct btree_info *bti = sbi->btree_info;
+	struct btree_pin *pin;
+	struct btree_pin *tmp;
+
+	if (bti) {
+		list_for_each_entry_safe(pin, tmp, &bti->pin_list, entry) {
+			put_bh(pin->bh);
+			kfree(pin);
+		}
+		kfree(bti);
+		sbi->btree_info = NULL;
+	}
 }
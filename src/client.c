@@ -13,6 +13,7 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/buffer_head.h>
 #include <asm/ioctls.h>
 #include <linux/net.h>
 #include <linux/inet.h>
@@ -57,6 +58,22 @@ struct client_info {
 	struct workqueue_struct *workq;
 	struct delayed_work connect_dwork;
 
+	/* a commit_segment response carries the next transaction's segno */
+	atomic64_t next_segno;
+
+	/* the server's compaction debt as of our last commit response */
+	atomic64_t compact_debt;
+
+	/* statfs results are cached for a short lease */
+	spinlock_t statfs_lock;
+	struct scoutfs_net_statfs statfs;
+	unsigned long statfs_expires;
+
+	/* snapshot mounts read from one pinned root for their lifetime */
+	struct mutex snap_mutex;
+	bool snap_root_valid;
+	struct scoutfs_btree_root snap_root;
+
 	/* connection timeouts are tracked across attempts */
 	unsigned long conn_retry_ms;
 };
@@ -149,6 +166,11 @@ int scoutfs_client_alloc_segno(struct super_block *sb, u64 *segno)
 	__le64 lesegno;
 	int ret;
 
+	/* use a segno handed to us by a previous commit_segment response */
+	*segno = atomic64_xchg(&client->next_segno, 0);
+	if (*segno != 0)
+		return 0;
+
 	ret = scoutfs_net_sync_request(sb, client->conn,
 				       SCOUTFS_NET_CMD_ALLOC_SEGNO,
 				       NULL, 0, &lesegno, sizeof(lesegno));
@@ -177,6 +199,71 @@ int scoutfs_client_record_segment(struct super_block *sb,
 					&net_ment, sizeof(net_ment), NULL, 0);
 }
 
+/*
+ * Finish a transaction commit with a single round trip to the server:
+ * record the written level 0 segments, trade the used seq for the next
+ * one, and stash the segno that the next transaction will write to.
+ */
+int scoutfs_client_commit_segments(struct super_block *sb,
+				   struct scoutfs_segment **segs,
+				   unsigned int nr, u64 *seq)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	struct scoutfs_net_commit_segment_response resp;
+	struct scoutfs_net_commit_segment *ncs;
+	struct scoutfs_manifest_entry ment;
+	unsigned int bytes;
+	unsigned int i;
+	int ret;
+
+	if (WARN_ON_ONCE(nr < 1 || nr > SCOUTFS_COMMIT_SEGMENT_MAX_NR))
+		return -EINVAL;
+
+	bytes = SCOUTFS_NET_COMMIT_SEGMENT_BYTES(nr);
+	ncs = kmalloc(bytes, GFP_NOFS);
+	if (!ncs)
+		return -ENOMEM;
+
+	ncs->used_seq = cpu_to_le64p(seq);
+	ncs->nr_ments = nr;
+	for (i = 0; i < nr; i++) {
+		scoutfs_seg_init_ment(&ment, 0, segs[i]);
+		scoutfs_init_ment_to_net(&ncs->ments[i], &ment);
+	}
+
+	ret = scoutfs_net_sync_request(sb, client->conn,
+				       SCOUTFS_NET_CMD_COMMIT_SEGMENT,
+				       ncs, bytes, &resp, sizeof(resp));
+	if (ret == 0) {
+		*seq = le64_to_cpu(resp.next_seq);
+		if (resp.next_segno != 0)
+			atomic64_set(&client->next_segno,
+				     le64_to_cpu(resp.next_segno));
+		atomic64_set(&client->compact_debt,
+			     le64_to_cpu(resp.compact_debt));
+	}
+
+	kfree(ncs);
+	return ret;
+}
+
+/*
+ * The server's compaction debt as of our last commit response: the
+ * number of segments that levels hold over their compaction targets.
+ * Transaction holders use it to back off smoothly as compaction falls
+ * behind and it's published in sysfs so schedulers can steer load away
+ * before the server blocks commits behind a full level 0.
+ */
+u64 scoutfs_client_compact_debt(struct super_block *sb)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+
+	if (!client)
+		return 0;
+
+	return atomic64_read(&client->compact_debt);
+}
+
 int scoutfs_client_advance_seq(struct super_block *sb, u64 *seq)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
@@ -209,26 +296,89 @@ int scoutfs_client_get_last_seq(struct super_block *sb, u64 *seq)
 	return ret;
 }
 
+/*
+ * Snapshot mounts read from the one root that the server pinned for us
+ * when we first asked.  We fetch it once and serve all manifest reads
+ * from the cached copy so the tree never changes under the mount.
+ */
+static int client_get_snap_root(struct super_block *sb,
+				struct scoutfs_btree_root *root)
+{
+	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	int ret = 0;
+
+	mutex_lock(&client->snap_mutex);
+
+	if (!client->snap_root_valid) {
+		ret = scoutfs_net_sync_request(sb, client->conn,
+					SCOUTFS_NET_CMD_GET_SNAP_ROOT,
+					NULL, 0, &client->snap_root,
+					sizeof(struct scoutfs_btree_root));
+		if (ret == 0)
+			client->snap_root_valid = true;
+	}
+
+	if (ret == 0)
+		*root = client->snap_root;
+
+	mutex_unlock(&client->snap_mutex);
+
+	return ret;
+}
+
 int scoutfs_client_get_manifest_root(struct super_block *sb,
 				     struct scoutfs_btree_root *root)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
 
+	if (SCOUTFS_SB(sb)->opts.snapshot)
+		return client_get_snap_root(sb, root);
+
 	return scoutfs_net_sync_request(sb, client->conn,
 					SCOUTFS_NET_CMD_GET_MANIFEST_ROOT,
 					NULL, 0, root,
 					sizeof(struct scoutfs_btree_root));
 }
 
+/*
+ * Monitoring agents tend to call statfs on every mount every few
+ * seconds.  The values we report are already stale the moment the
+ * server samples them so we're free to answer from a recently cached
+ * copy instead of hammering the server with a round trip per call.
+ * The lease is short enough that df converges quickly after large
+ * allocations or frees.
+ */
+#define STATFS_LEASE_J	(2 * HZ)
+
 int scoutfs_client_statfs(struct super_block *sb,
 			  struct scoutfs_net_statfs *nstatfs)
 {
 	struct client_info *client = SCOUTFS_SB(sb)->client_info;
+	int ret;
 
-	return scoutfs_net_sync_request(sb, client->conn,
-					SCOUTFS_NET_CMD_STATFS, NULL, 0,
-					nstatfs,
-					sizeof(struct scoutfs_net_statfs));
+	spin_lock(&client->statfs_lock);
+	if (time_before(jiffies, client->statfs_expires)) {
+		memcpy(nstatfs, &client->statfs, sizeof(*nstatfs));
+		spin_unlock(&client->statfs_lock);
+		scoutfs_inc_counter(sb, statfs_cached);
+		return 0;
+	}
+	spin_unlock(&client->statfs_lock);
+
+	scoutfs_inc_counter(sb, statfs_refresh);
+
+	ret = scoutfs_net_sync_request(sb, client->conn,
+				       SCOUTFS_NET_CMD_STATFS, NULL, 0,
+				       nstatfs,
+				       sizeof(struct scoutfs_net_statfs));
+	if (ret == 0) {
+		spin_lock(&client->statfs_lock);
+		memcpy(&client->statfs, nstatfs, sizeof(*nstatfs));
+		client->statfs_expires = jiffies + STATFS_LEASE_J;
+		spin_unlock(&client->statfs_lock);
+	}
+
+	return ret;
 }
 
 /*
@@ -245,6 +395,7 @@ static int client_greeting(struct super_block *sb,
 	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_net_greeting *gr = resp;
+	__le64 lenode_id;
 	int ret = 0;
 
 	if (error) {
@@ -292,6 +443,15 @@ static int client_greeting(struct super_block *sb,
 		complete(&client->node_id_comp);
 	}
 
+	/* register as the standby with each server we greet */
+	if (sbi->opts.standby) {
+		lenode_id = cpu_to_le64(sbi->node_id);
+		ret = scoutfs_net_submit_request(sb, conn,
+						 SCOUTFS_NET_CMD_RING_ADVERT,
+						 &lenode_id, sizeof(lenode_id),
+						 NULL, NULL, NULL);
+	}
+
 out:
 	return ret;
 }
@@ -386,6 +546,13 @@ static int client_compact(struct super_block *sb,
 	}
 	req = arg;
 
+	/* snapshot mounts are read-only and can't write output segments */
+	if (SCOUTFS_SB(sb)->opts.snapshot) {
+		ret = scoutfs_net_response(sb, conn, cmd, id, -EROFS,
+					   &req->id, sizeof(req->id));
+		goto out;
+	}
+
 	trace_scoutfs_client_compact_start(sb, le64_to_cpu(req->id),
 					   req->last_level, req->flags);
 
@@ -410,8 +577,43 @@ out:
 	return ret;
 }
 
+/*
+ * The server advertises the btree ring blocks that its last commit
+ * wrote.  We're the registered standby so we read them ahead to keep
+ * our block cache tracking the server's btree.  If we're later elected
+ * server we start with a warm cache instead of re-reading the ring.
+ * The reads are only a cache hint so we never fail the request.
+ */
+static int client_ring_advert(struct super_block *sb,
+			      struct scoutfs_net_connection *conn,
+			      u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	struct scoutfs_net_ring_advert *adv;
+	u64 blkno;
+	u64 nr;
+	u64 i;
+	int ret;
+
+	if (arg_len != sizeof(struct scoutfs_net_ring_advert)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	adv = arg;
+
+	blkno = le64_to_cpu(adv->blkno);
+	nr = le64_to_cpu(adv->nr);
+
+	for (i = 0; i < nr; i++)
+		sb_breadahead(sb, blkno + i);
+	scoutfs_add_counter(sb, standby_advert_blocks, nr);
+	ret = 0;
+out:
+	return scoutfs_net_response(sb, conn, cmd, id, ret, NULL, 0);
+}
+
 static scoutfs_net_request_t client_req_funcs[] = {
 	[SCOUTFS_NET_CMD_COMPACT]		= client_compact,
+	[SCOUTFS_NET_CMD_RING_ADVERT]		= client_ring_advert,
 };
 
 /*
@@ -459,6 +661,11 @@ int scoutfs_client_setup(struct super_block *sb)
 	client->sb = sb;
 	init_completion(&client->node_id_comp);
 	atomic_set(&client->shutting_down, 0);
+	atomic64_set(&client->next_segno, 0);
+	atomic64_set(&client->compact_debt, 0);
+	spin_lock_init(&client->statfs_lock);
+	client->statfs_expires = jiffies;
+	mutex_init(&client->snap_mutex);
 	INIT_DELAYED_WORK(&client->connect_dwork,
 			  scoutfs_client_connect_worker);
 
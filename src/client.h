@@ -10,6 +10,10 @@ int scoutfs_client_free_extents(struct super_block *sb,
 int scoutfs_client_alloc_segno(struct super_block *sb, u64 *segno);
 int scoutfs_client_record_segment(struct super_block *sb,
 				  struct scoutfs_segment *seg, u8 level);
+int scoutfs_client_commit_segments(struct super_block *sb,
+				   struct scoutfs_segment **segs,
+				   unsigned int nr, u64 *seq);
+u64 scoutfs_client_compact_debt(struct super_block *sb);
 u64 *scoutfs_client_bulk_alloc(struct super_block *sb);
 int scoutfs_client_advance_seq(struct super_block *sb, u64 *seq);
 int scoutfs_client_get_last_seq(struct super_block *sb, u64 *seq);
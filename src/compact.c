@@ -41,19 +41,30 @@
  * from the two input segments are copied into new output segments in
  * sorted order.  Space is reclaimed as duplicate or deletion items are
  * removed and fewer segments are written than were read.
+ *
+ * The merge consumes the input segments in sort order so we don't need
+ * them all in memory at once.  We keep reads for a fixed number of
+ * upcoming inputs in flight while merging the current ones and drop
+ * each input as the merge moves past it, bounding the memory of a
+ * compaction regardless of how many inputs it has.
  */
 
+/* input segment reads in flight past the one being merged */
+#define COMPACT_INPUT_READAHEAD 2
+
 struct compact_seg {
 	struct list_head entry;
 
 	u64 segno;
 	u64 seq;
 	u8 level;
+	u32 nr_deletions;
 	struct scoutfs_key first;
 	struct scoutfs_key last;
 	struct scoutfs_segment *seg;
 	int off;
 	bool part_of_move;
+	bool waited;
 };
 
 struct compact_cursor {
@@ -110,26 +121,20 @@ static void free_cseg_list(struct super_block *sb, struct list_head *list)
 	}
 }
 
-static int read_segment(struct super_block *sb, struct compact_seg *cseg)
+static int submit_segment(struct super_block *sb, struct compact_seg *cseg)
 {
 	struct scoutfs_segment *seg;
-	int ret;
 
 	if (cseg == NULL || cseg->seg)
 		return 0;
 
 	seg = scoutfs_seg_submit_read(sb, cseg->segno);
-	if (IS_ERR(seg)) {
-		ret = PTR_ERR(seg);
-	} else {
-		cseg->seg = seg;
-		scoutfs_inc_counter(sb, compact_segment_read);
-		ret = scoutfs_seg_wait(sb, cseg->seg, cseg->segno, cseg->seq);
-	}
+	if (IS_ERR(seg))
+		return PTR_ERR(seg);
 
-	/* XXX verify read segment metadata */
-
-	return ret;
+	cseg->seg = seg;
+	scoutfs_inc_counter(sb, compact_segment_read);
+	return 0;
 }
 
 static struct compact_seg *next_spos(struct compact_cursor *curs,
@@ -141,6 +146,58 @@ static struct compact_seg *next_spos(struct compact_cursor *curs,
 	return list_next_entry(cseg, entry);
 }
 
+/*
+ * Wait for a segment that the merge needs, first making sure that reads
+ * for it and for a bounded number of the input segments after it are in
+ * flight.  The merge of the current segments overlaps with the reads of
+ * the upcoming segments without ever holding the entire input set in
+ * memory.
+ */
+static int read_segment(struct super_block *sb, struct compact_cursor *curs,
+			struct compact_seg *cseg)
+{
+	struct compact_seg *ra;
+	int nr;
+	int ret;
+
+	if (cseg == NULL || cseg->waited)
+		return 0;
+
+	ret = submit_segment(sb, cseg);
+	if (ret)
+		return ret;
+
+	ra = cseg;
+	for (nr = 0; nr < COMPACT_INPUT_READAHEAD; nr++) {
+		ra = next_spos(curs, ra);
+		if (!ra)
+			break;
+		ret = submit_segment(sb, ra);
+		if (ret)
+			return ret;
+	}
+
+	ret = scoutfs_seg_wait(sb, cseg->seg, cseg->segno, cseg->seq);
+	if (ret == 0)
+		cseg->waited = true;
+
+	/* XXX verify read segment metadata */
+
+	return ret;
+}
+
+/*
+ * The merge has consumed all of an input segment's items.  Drop the
+ * segment so that the memory of a large compaction is bounded by the
+ * readahead window, not the total number of inputs.
+ */
+static void drop_consumed_segment(struct compact_seg *cseg)
+{
+	scoutfs_seg_put(cseg->seg);
+	cseg->seg = NULL;
+	cseg->waited = false;
+}
+
 /*
  * Point the caller's key and value kvecs at the next item that should
  * be copied from the upper or lower segments.  We use the item that has
@@ -166,12 +223,14 @@ retry:
 	if (upper) {
 		ret = scoutfs_seg_get_item(upper->seg, upper->off,
 					   item_key, item_val, item_flags);
-		if (ret < 0)
+		if (ret < 0) {
+			drop_consumed_segment(upper);
 			upper = NULL;
+		}
 	}
 
 	while (lower) {
-		ret = read_segment(sb, lower);
+		ret = read_segment(sb, curs, lower);
 		if (ret)
 			goto out;
 
@@ -180,6 +239,7 @@ retry:
 					   &lower_flags);
 		if (ret == 0)
 			break;
+		drop_consumed_segment(lower);
 		lower = next_spos(curs, lower);
 	}
 
@@ -275,15 +335,14 @@ static int compact_segments(struct super_block *sb,
 		/*
 		 * If we're at the start of the upper segment and
 		 * there's no lower segment then we might as well just
-		 * move the segment in the manifest.  We can't do this
-		 * if we're moving to the last level because we might
-		 * need to drop any deletion items.
-		 *
-		 * XXX We should have metadata in the manifest to tell
-		 * us that there's no deletion items in the segment.
+		 * move the segment in the manifest.  Moves to the last
+		 * level have to drop deletion items so they're only
+		 * allowed when the manifest entry says the segment has
+		 * none.
 		 */
 		if (upper && upper->off == 0 && !lower && !curs->sticky &&
-		    ((upper->level + 1) < curs->last_level)) {
+		    (((upper->level + 1) < curs->last_level) ||
+		     upper->nr_deletions == 0)) {
 
 			/*
 			 * XXX blah!  these csegs are getting
@@ -300,6 +359,7 @@ static int compact_segments(struct super_block *sb,
 			cseg->segno = upper->segno;
 			cseg->seq = upper->seq;
 			cseg->level = upper->level + 1;
+			cseg->nr_deletions = upper->nr_deletions;
 			cseg->seg = upper->seg;
 			if (cseg->seg)
 				scoutfs_seg_get(cseg->seg);
@@ -316,7 +376,7 @@ static int compact_segments(struct super_block *sb,
 		}
 
 		/* we're going to need its next key */
-		ret = read_segment(sb, upper);
+		ret = read_segment(sb, curs, upper);
 		if (ret)
 			break;
 
@@ -333,7 +393,7 @@ static int compact_segments(struct super_block *sb,
 		 * its neighbours.
 		 */
 
-		ret = read_segment(sb, lower);
+		ret = read_segment(sb, curs, lower);
 		if (ret)
 			break;
 
@@ -590,6 +650,7 @@ static int prepare_curs(struct super_block *sb, struct compact_cursor *curs,
 		cseg->segno = ment.segno;
 		cseg->seq = ment.seq;
 		cseg->level = ment.level;
+		cseg->nr_deletions = ment.nr_deletions;
 
 		if (!curs->upper)
 			curs->upper = cseg;
@@ -651,13 +712,19 @@ int scoutfs_compact(struct super_block *sb,
 	/* fill entries for written output segments */
 	nr = 0;
 	list_for_each_entry(cseg, &results, entry) {
-		/* XXX moved upper segments won't have read the segment :P */
-		if (cseg->seg)
+		/*
+		 * Moved segments weren't appended to so their cached
+		 * seg, if any, hasn't counted deletion items.  Their
+		 * entry carries the count from the input entry instead.
+		 */
+		if (cseg->seg && !cseg->part_of_move) {
 			scoutfs_seg_init_ment(&ment, cseg->level, cseg->seg);
-		else
+		} else {
 			scoutfs_manifest_init_entry(&ment, cseg->level,
 						    cseg->segno, cseg->seq,
 						    &cseg->first, &cseg->last);
+			ment.nr_deletions = cseg->nr_deletions;
+		}
 
 		trace_scoutfs_compact_output(sb, ment.level, ment.segno,
 					    ment.seq, &ment.first,
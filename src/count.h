@@ -205,7 +205,8 @@ static inline const struct scoutfs_item_count SIC_RENAME(unsigned old_len,
  * item with the header and name.  Any previously existing items are
  * deleted which dirties their key but removes their value.  The two
  * sets of items are indexed by different ids so their items don't
- * overlap.
+ * overlap.  The packed item that stores all of the inode's small
+ * xattrs can be rewritten in full by any set.
  */
 static inline const struct scoutfs_item_count SIC_XATTR_SET(unsigned old_parts,
 							    bool creating,
@@ -217,6 +218,9 @@ static inline const struct scoutfs_item_count SIC_XATTR_SET(unsigned old_parts,
 
 	__count_dirty_inode(&cnt);
 
+	cnt.items++;
+	cnt.vals += SCOUTFS_MAX_VAL_SIZE;
+
 	if (old_parts)
 		cnt.items += old_parts;
 
@@ -253,6 +257,35 @@ static inline const struct scoutfs_item_count SIC_WRITE_BEGIN(void)
 	return cnt;
 }
 
+/*
+ * An inline data write dirties the inode and creates or updates the
+ * single inline data item.
+ */
+static inline const struct scoutfs_item_count SIC_INLINE_WRITE(void)
+{
+	struct scoutfs_item_count cnt = {0,};
+
+	__count_dirty_inode(&cnt);
+
+	cnt.items += 1;
+	cnt.vals += SCOUTFS_INLINE_DATA_MAX_SIZE;
+
+	return cnt;
+}
+
+/*
+ * Converting inline data to extents allocates the first block through
+ * the write_begin extent counts and deletes the inline item.
+ */
+static inline const struct scoutfs_item_count SIC_INLINE_CONVERT(void)
+{
+	struct scoutfs_item_count cnt = SIC_WRITE_BEGIN();
+
+	cnt.items += 1;
+
+	return cnt;
+}
+
 /*
  * Truncating an extent can:
  *  - delete existing file extent,
@@ -292,6 +325,20 @@ static inline const struct scoutfs_item_count SIC_RETURN_EXTENTS(void)
 	return cnt;
 }
 
+/*
+ * Adding an extent granted by the server can, at most, delete two
+ * neighbouring free extents and insert one merged extent, all with
+ * indexed copies.
+ */
+static inline const struct scoutfs_item_count SIC_REFILL_EXTENT(void)
+{
+	struct scoutfs_item_count cnt = {0,};
+
+	cnt.items += (2 + 1) * 2;
+
+	return cnt;
+}
+
 /*
  * Fallocating an extent can, at most:
  *  - allocate from the server: delete two free and insert merged
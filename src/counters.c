@@ -30,9 +30,42 @@ static struct attribute scoutfs_counter_attrs[] = {
 	EXPAND_EACH_COUNTER
 };
 
+#undef EXPAND_LATENCY
+#define EXPAND_LATENCY(which) \
+	{ .name = __stringify(which) "_latency", .mode = 0444 },
+static struct attribute scoutfs_latency_attrs[] = {
+	EXPAND_EACH_LATENCY
+};
+
 /* zero BSS and + 1 makes this null terminated */
 #define NR_ATTRS ARRAY_SIZE(scoutfs_counter_attrs)
-static struct attribute *scoutfs_counter_attr_ptrs[NR_ATTRS + 1];
+#define NR_LATENCY_ATTRS ARRAY_SIZE(scoutfs_latency_attrs)
+static struct attribute *scoutfs_counter_attr_ptrs[NR_ATTRS +
+						   NR_LATENCY_ATTRS + 1];
+
+/*
+ * Latency files have a line per bucket with the bucket's upper bound in
+ * microseconds and the number of events it counted.
+ */
+static ssize_t scoutfs_latency_attr_show(struct scoutfs_latency *lat,
+					 char *buf)
+{
+	ssize_t len = 0;
+	u64 total;
+	int cpu;
+	int i;
+
+	for (i = 0; i < SCOUTFS_LATENCY_NR_BUCKETS; i++) {
+		total = 0;
+		for_each_possible_cpu(cpu)
+			total += per_cpu_ptr(lat->buckets, cpu)->counts[i];
+
+		len += snprintf(buf + len, PAGE_SIZE - len, "%llu %llu\n",
+				i ? 1ULL << i : 0ULL, total);
+	}
+
+	return len;
+}
 
 static ssize_t scoutfs_counter_attr_show(struct kobject *kobj,
 				         struct attribute *attr, char *buf)
@@ -41,14 +74,39 @@ static ssize_t scoutfs_counter_attr_show(struct kobject *kobj,
 	struct percpu_counter *pcpu;
 	size_t index;
 
-	/* use the index in the _attrs array to discover the pcpu pointer */
+	/* use the index in the _attrs arrays to discover the pointers */
 	counters = container_of(kobj, struct scoutfs_counters, kobj);
+
+	if (attr >= scoutfs_latency_attrs &&
+	    attr < scoutfs_latency_attrs + NR_LATENCY_ATTRS) {
+		index = attr - scoutfs_latency_attrs;
+		return scoutfs_latency_attr_show(&counters->FIRST_LATENCY +
+						 index, buf);
+	}
+
 	index = attr - scoutfs_counter_attrs;
 	pcpu = &counters->FIRST_COUNTER + index;
 
 	return snprintf(buf, PAGE_SIZE, "%lld\n", percpu_counter_sum(pcpu));
 }
 
+/*
+ * Record the time since an event started in its power of two bucket.
+ * This can be called from any context, including end_io.
+ */
+void __scoutfs_latency_since(struct scoutfs_latency *lat, ktime_t start)
+{
+	s64 usec = ktime_to_us(ktime_sub(ktime_get(), start));
+	int i;
+
+	if (usec <= 0)
+		i = 0;
+	else
+		i = min_t(int, fls64(usec), SCOUTFS_LATENCY_NR_BUCKETS - 1);
+
+	this_cpu_inc(lat->buckets->counts[i]);
+}
+
 static void scoutfs_counters_kobj_release(struct kobject *kobj)
 {
 	struct scoutfs_counters *counters;
@@ -73,6 +131,7 @@ int scoutfs_setup_counters(struct super_block *sb)
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_counters *counters;
 	struct percpu_counter *pcpu;
+	struct scoutfs_latency *lat;
 	int ret;
 
 	counters = kzalloc(sizeof(struct scoutfs_counters), GFP_KERNEL);
@@ -86,6 +145,14 @@ int scoutfs_setup_counters(struct super_block *sb)
 			goto out;
 	}
 
+	scoutfs_foreach_latency(sb, lat) {
+		lat->buckets = alloc_percpu(struct scoutfs_latency_buckets);
+		if (!lat->buckets) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
 	init_completion(&counters->comp);
 	ret = kobject_init_and_add(&counters->kobj, &scoutfs_counters_ktype,
 				    scoutfs_sysfs_sb_dir(sb), "counters");
@@ -94,6 +161,8 @@ out:
 		/* tear down partial to avoid destroying null kobjs */
 		scoutfs_foreach_counter(sb, pcpu)
 			percpu_counter_destroy(pcpu);
+		scoutfs_foreach_latency(sb, lat)
+			free_percpu(lat->buckets);
 		kfree(counters);
 		sbi->counters = NULL;
 	}
@@ -106,6 +175,7 @@ void scoutfs_destroy_counters(struct super_block *sb)
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_counters *counters = sbi->counters;
 	struct percpu_counter *pcpu;
+	struct scoutfs_latency *lat;
 
 	/* this only destroys fully initialized counters */
 	if (!counters)
@@ -118,6 +188,9 @@ void scoutfs_destroy_counters(struct super_block *sb)
 	scoutfs_foreach_counter(sb, pcpu)
 		percpu_counter_destroy(pcpu);
 
+	scoutfs_foreach_latency(sb, lat)
+		free_percpu(lat->buckets);
+
 	kfree(counters);
 	sbi->counters = NULL;
 }
@@ -129,4 +202,7 @@ void __init scoutfs_init_counters(void)
 	/* not ARRAY_SIZE because that would clobber null term */
 	for (i = 0; i < NR_ATTRS; i++)
 		scoutfs_counter_attr_ptrs[i] = &scoutfs_counter_attrs[i];
+	for (i = 0; i < NR_LATENCY_ATTRS; i++)
+		scoutfs_counter_attr_ptrs[NR_ATTRS + i] =
+			&scoutfs_latency_attrs[i];
 }
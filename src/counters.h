@@ -4,6 +4,7 @@
 #include <linux/kobject.h>
 #include <linux/completion.h>
 #include <linux/percpu_counter.h>
+#include <linux/ktime.h>
 
 #include "super.h"
 
@@ -12,6 +13,7 @@
  * other places by this macro.  Don't forget to update LAST_COUNTER.
  */
 #define EXPAND_EACH_COUNTER					\
+	EXPAND_COUNTER(btree_leaf_readahead)			\
 	EXPAND_COUNTER(btree_read_error)			\
 	EXPAND_COUNTER(btree_stale_read)			\
 	EXPAND_COUNTER(btree_write_error)			\
@@ -40,9 +42,16 @@
 	EXPAND_COUNTER(corrupt_symlink_inode_size)		\
 	EXPAND_COUNTER(corrupt_symlink_missing_item)		\
 	EXPAND_COUNTER(corrupt_symlink_not_null_term)		\
+	EXPAND_COUNTER(data_direct_read)			\
+	EXPAND_COUNTER(data_direct_write)			\
 	EXPAND_COUNTER(data_end_writeback_page)			\
+	EXPAND_COUNTER(data_extent_cache_hit)			\
+	EXPAND_COUNTER(data_inline_convert)			\
+	EXPAND_COUNTER(data_inline_read)			\
+	EXPAND_COUNTER(data_inline_write)			\
 	EXPAND_COUNTER(data_invalidatepage)			\
 	EXPAND_COUNTER(data_readpage)				\
+	EXPAND_COUNTER(data_readpages_pages)			\
 	EXPAND_COUNTER(data_write_begin)			\
 	EXPAND_COUNTER(data_write_end)				\
 	EXPAND_COUNTER(data_writepage)				\
@@ -53,6 +62,7 @@
 	EXPAND_COUNTER(dentry_revalidate_rcu)			\
 	EXPAND_COUNTER(dentry_revalidate_root)			\
 	EXPAND_COUNTER(dentry_revalidate_valid)			\
+	EXPAND_COUNTER(dir_backref_cache_hit)			\
 	EXPAND_COUNTER(dir_backref_excessive_retries)		\
 	EXPAND_COUNTER(extent_add)				\
 	EXPAND_COUNTER(extent_delete)				\
@@ -60,6 +70,11 @@
 	EXPAND_COUNTER(extent_next)				\
 	EXPAND_COUNTER(extent_prev)				\
 	EXPAND_COUNTER(extent_remove)				\
+	EXPAND_COUNTER(getattr_cached)				\
+	EXPAND_COUNTER(getattr_refresh)				\
+	EXPAND_COUNTER(iget_cached)				\
+	EXPAND_COUNTER(iget_refresh)				\
+	EXPAND_COUNTER(inode_index_lock_borrowed)		\
 	EXPAND_COUNTER(item_alloc)				\
 	EXPAND_COUNTER(item_batch_duplicate)			\
 	EXPAND_COUNTER(item_batch_inserted)			\
@@ -69,10 +84,13 @@
 	EXPAND_COUNTER(item_lookup_hit)				\
 	EXPAND_COUNTER(item_lookup_miss)			\
 	EXPAND_COUNTER(item_range_alloc)			\
+	EXPAND_COUNTER(item_range_detach)			\
 	EXPAND_COUNTER(item_range_free)				\
 	EXPAND_COUNTER(item_range_hit)				\
 	EXPAND_COUNTER(item_range_insert)			\
 	EXPAND_COUNTER(item_range_miss)				\
+	EXPAND_COUNTER(item_range_reattach)			\
+	EXPAND_COUNTER(item_range_reattach_miss)		\
 	EXPAND_COUNTER(item_shrink)				\
 	EXPAND_COUNTER(item_shrink_alone)			\
 	EXPAND_COUNTER(item_shrink_empty_range)			\
@@ -86,6 +104,7 @@
 	EXPAND_COUNTER(lock_ast_edeadlk)			\
 	EXPAND_COUNTER(lock_ast_error)				\
 	EXPAND_COUNTER(lock_bast)				\
+	EXPAND_COUNTER(lock_bast_commit_kick)			\
 	EXPAND_COUNTER(lock_dlm_call)				\
 	EXPAND_COUNTER(lock_dlm_call_error)			\
 	EXPAND_COUNTER(lock_free)				\
@@ -99,9 +118,14 @@
 	EXPAND_COUNTER(lock_shrink)				\
 	EXPAND_COUNTER(lock_write_dirty_item)			\
 	EXPAND_COUNTER(lock_unlock)				\
+	EXPAND_COUNTER(manifest_bloom_cache_hit)		\
+	EXPAND_COUNTER(manifest_bloom_skip_read)		\
+	EXPAND_COUNTER(manifest_compact_deletions)		\
 	EXPAND_COUNTER(manifest_compact_migrate)		\
+	EXPAND_COUNTER(manifest_compact_read_hint)		\
 	EXPAND_COUNTER(manifest_hard_stale_error)		\
 	EXPAND_COUNTER(manifest_read_excluded_key)		\
+	EXPAND_COUNTER(manifest_readahead_segment)		\
 	EXPAND_COUNTER(net_dropped_response)			\
 	EXPAND_COUNTER(net_send_bytes)				\
 	EXPAND_COUNTER(net_send_error)				\
@@ -111,33 +135,81 @@
 	EXPAND_COUNTER(net_recv_invalid_message)		\
 	EXPAND_COUNTER(net_recv_messages)			\
 	EXPAND_COUNTER(net_unknown_request)			\
+	EXPAND_COUNTER(orphan_delete_batch)			\
+	EXPAND_COUNTER(orphan_delete_queued)			\
 	EXPAND_COUNTER(seg_alloc)				\
+	EXPAND_COUNTER(seg_bloom_hit)				\
+	EXPAND_COUNTER(seg_bloom_miss)				\
+	EXPAND_COUNTER(seg_comp_cache_drop)			\
+	EXPAND_COUNTER(seg_comp_cache_hit)			\
+	EXPAND_COUNTER(seg_comp_cache_store)			\
+	EXPAND_COUNTER(seg_compress_write)			\
 	EXPAND_COUNTER(seg_csum_error)				\
+	EXPAND_COUNTER(seg_decompress)				\
 	EXPAND_COUNTER(seg_free)				\
+	EXPAND_COUNTER(seg_page_pool_hit)			\
+	EXPAND_COUNTER(seg_page_pool_miss)			\
 	EXPAND_COUNTER(seg_shrink)				\
 	EXPAND_COUNTER(seg_stale_read)				\
 	EXPAND_COUNTER(server_alloc_segno)			\
+	EXPAND_COUNTER(server_alloc_segno_indexed)		\
+	EXPAND_COUNTER(server_alloc_segno_sweep)		\
 	EXPAND_COUNTER(server_extent_alloc)			\
 	EXPAND_COUNTER(server_extent_alloc_error)		\
 	EXPAND_COUNTER(server_free_extent)			\
 	EXPAND_COUNTER(server_free_pending_extent)		\
 	EXPAND_COUNTER(server_free_pending_error)		\
 	EXPAND_COUNTER(server_free_segno)			\
+	EXPAND_COUNTER(server_snap_defer_frees)			\
+	EXPAND_COUNTER(standby_advert_blocks)			\
+	EXPAND_COUNTER(statfs_cached)				\
+	EXPAND_COUNTER(statfs_refresh)				\
+	EXPAND_COUNTER(trans_commit_fill)			\
 	EXPAND_COUNTER(trans_commit_fsync)			\
 	EXPAND_COUNTER(trans_commit_full)			\
 	EXPAND_COUNTER(trans_commit_item_flush)			\
 	EXPAND_COUNTER(trans_commit_sync_fs)			\
 	EXPAND_COUNTER(trans_commit_timer)			\
+	EXPAND_COUNTER(trans_hold_nested)			\
+	EXPAND_COUNTER(trans_hold_throttle)			\
 	EXPAND_COUNTER(trans_level0_seg_write_bytes)		\
 	EXPAND_COUNTER(trans_level0_seg_writes)			\
 	EXPAND_COUNTER(trans_write_item)			\
-	EXPAND_COUNTER(trans_write_deletion_item)
+	EXPAND_COUNTER(trans_write_deletion_item)		\
+	EXPAND_COUNTER(warm_read_item)
 
-#define FIRST_COUNTER	btree_read_error
-#define LAST_COUNTER	trans_write_deletion_item
+#define FIRST_COUNTER	btree_leaf_readahead
+#define LAST_COUNTER	warm_read_item
+
+/*
+ * Latency histograms count events in power of two microsecond buckets.
+ * The first bucket counts sub-microsecond events and the last bucket
+ * counts everything slower than its bound.  The buckets are percpu so
+ * recording in hot paths doesn't bounce cachelines.
+ */
+#define EXPAND_EACH_LATENCY			\
+	EXPAND_LATENCY(item_lookup)		\
+	EXPAND_LATENCY(lock_wait)		\
+	EXPAND_LATENCY(seg_read)		\
+	EXPAND_LATENCY(trans_hold)
+
+#define FIRST_LATENCY	item_lookup
+#define LAST_LATENCY	trans_hold
+
+#define SCOUTFS_LATENCY_NR_BUCKETS 18
+
+struct scoutfs_latency_buckets {
+	u64 counts[SCOUTFS_LATENCY_NR_BUCKETS];
+};
+
+struct scoutfs_latency {
+	struct scoutfs_latency_buckets __percpu *buckets;
+};
 
 #undef EXPAND_COUNTER
 #define EXPAND_COUNTER(which) struct percpu_counter which;
+#undef EXPAND_LATENCY
+#define EXPAND_LATENCY(which) struct scoutfs_latency which;
 
 struct scoutfs_counters {
 	/* $sysfs/fs/scoutfs/$id/counters/ */
@@ -145,6 +217,7 @@ struct scoutfs_counters {
 	struct completion comp;
 
 	EXPAND_EACH_COUNTER
+	EXPAND_EACH_LATENCY
 };
 
 #define scoutfs_foreach_counter(sb, pcpu) 			\
@@ -158,6 +231,16 @@ struct scoutfs_counters {
 #define scoutfs_add_counter(sb, which, cnt) \
 	percpu_counter_add(&SCOUTFS_SB(sb)->counters->which, cnt)
 
+#define scoutfs_foreach_latency(sb, lat) 			\
+	for (lat = &SCOUTFS_SB(sb)->counters->FIRST_LATENCY;	\
+	     lat <= &SCOUTFS_SB(sb)->counters->LAST_LATENCY;	\
+	     lat++)
+
+#define scoutfs_latency_since(sb, which, start) \
+	__scoutfs_latency_since(&SCOUTFS_SB(sb)->counters->which, start)
+
+void __scoutfs_latency_since(struct scoutfs_latency *lat, ktime_t start);
+
 void __init scoutfs_init_counters(void);
 int scoutfs_setup_counters(struct super_block *sb);
 void scoutfs_destroy_counters(struct super_block *sb);
@@ -27,6 +27,7 @@
 #include "super.h"
 #include "inode.h"
 #include "key.h"
+#include "bio.h"
 #include "data.h"
 #include "kvec.h"
 #include "trans.h"
@@ -78,6 +79,11 @@
  * Send free extents back to the server if we have plenty locally.
  */
 #define NODE_FREE_HIGH_WATER_BLOCKS (SERVER_ALLOC_BLOCKS * 16)
+/*
+ * Ask the server for more free extents in the background before
+ * writers drain the node's pool and have to ask synchronously.
+ */
+#define NODE_FREE_LOW_WATER_BLOCKS SERVER_ALLOC_BLOCKS
 
 struct data_info {
 	struct super_block *sb;
@@ -85,6 +91,7 @@ struct data_info {
 	atomic64_t node_free_blocks;
 	struct workqueue_struct *workq;
 	struct work_struct return_work;
+	struct work_struct refill_work;
 };
 
 #define DECLARE_DATA_INFO(sb, name) \
@@ -370,6 +377,231 @@ out:
 	return ret;
 }
 
+/*
+ * Serve repeated get_block calls on a mapped extent from the inode's
+ * tiny extent cache instead of searching the item cache.  The cache is
+ * only used while its recorded lock coverage holds, so a remote node
+ * invalidating our lock also invalidates the cache.
+ *
+ * The cache only ever holds fully mapped written online extents, so
+ * it's safe to serve write calls as well as reads.  A write to a
+ * cached block doesn't allocate or convert anything, it just needs the
+ * mapping.  This keeps streaming rewrites from paying an item search
+ * for every 4KB page in write_begin.
+ */
+static bool cached_extent_mapping(struct inode *inode, sector_t iblock,
+				  struct buffer_head *bh)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	bool hit = false;
+	u64 offset;
+
+	spin_lock(&si->ext_cache_lock);
+	if (si->ext_cache_len &&
+	    iblock >= si->ext_cache_start &&
+	    iblock < si->ext_cache_start + si->ext_cache_len &&
+	    scoutfs_lock_is_covered(sb, &si->ext_cache_cov)) {
+		offset = iblock - si->ext_cache_start;
+		map_bh(bh, sb, si->ext_cache_map + offset);
+		bh->b_size = min_t(u64, bh->b_size,
+				   (si->ext_cache_len - offset) <<
+					SCOUTFS_BLOCK_SHIFT);
+		hit = true;
+	}
+	spin_unlock(&si->ext_cache_lock);
+
+	return hit;
+}
+
+/* only fully mapped written online extents are safe to serve blindly */
+static void cache_extent_mapping(struct inode *inode,
+				 struct scoutfs_extent *ext,
+				 struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+
+	if (!ext->map || (ext->flags & (SEF_UNWRITTEN | SEF_OFFLINE)))
+		return;
+
+	spin_lock(&si->ext_cache_lock);
+	si->ext_cache_start = ext->start;
+	si->ext_cache_len = ext->len;
+	si->ext_cache_map = ext->map;
+	spin_unlock(&si->ext_cache_lock);
+
+	scoutfs_lock_add_coverage(sb, lock, &si->ext_cache_cov);
+}
+
+/* the inode's extent items are changing, stop using the cached copy */
+static void forget_cached_extent(struct inode *inode)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+
+	spin_lock(&si->ext_cache_lock);
+	si->ext_cache_len = 0;
+	spin_unlock(&si->ext_cache_lock);
+}
+
+/*
+ * Small file contents live in a single inline data item next to the
+ * inode instead of in an allocated extent.  This avoids a server extent
+ * allocation and a 4KB block IO for every tiny file.  The persistent
+ * inode flag records that the item exists so the hot paths can test it
+ * without an item search.  The item never holds more than the first
+ * i_size bytes; bytes past the item's length read as zero.
+ */
+static void init_inline_data_key(struct scoutfs_key *key, u64 ino)
+{
+	*key = (struct scoutfs_key) {
+		.sk_zone = SCOUTFS_FS_ZONE,
+		.ski_ino = cpu_to_le64(ino),
+		.sk_type = SCOUTFS_INLINE_DATA_TYPE,
+	};
+}
+
+static bool inline_data_file(struct inode *inode)
+{
+	return S_ISREG(inode->i_mode) &&
+	       (SCOUTFS_I(inode)->flags & SCOUTFS_INO_FLAG_INLINE_DATA);
+}
+
+/*
+ * Fill a locked page from the inline data item and mark it uptodate.
+ * The item holds at most the first i_size bytes, anything past its
+ * length reads as zeros.  A missing item is a sparse file.
+ */
+static int fill_page_from_inline(struct inode *inode, struct page *page,
+				 struct scoutfs_lock *lock)
+{
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_key key;
+	void *addr;
+	void *buf;
+	int ret;
+
+	buf = kmalloc(SCOUTFS_INLINE_DATA_MAX_SIZE, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = 0;
+	if (page->index == 0) {
+		init_inline_data_key(&key, scoutfs_ino(inode));
+		ret = scoutfs_item_lookup_buf(sb, &key, buf,
+					      SCOUTFS_INLINE_DATA_MAX_SIZE,
+					      lock);
+		if (ret == -ENOENT)
+			ret = 0;
+		if (ret < 0)
+			goto out;
+
+		ret = min_t(loff_t, ret, i_size_read(inode));
+	}
+
+	addr = kmap_atomic(page);
+	memcpy(addr, buf, ret);
+	memset(addr + ret, 0, PAGE_SIZE - ret);
+	kunmap_atomic(addr);
+	SetPageUptodate(page);
+
+	scoutfs_inc_counter(sb, data_inline_read);
+	ret = 0;
+out:
+	kfree(buf);
+	return ret;
+}
+
+/*
+ * A small write can land in the inline item when the file is already
+ * inline or when it's empty with no extent items at all, which rules
+ * out preallocated or offline extents past i_size.  Staging writes
+ * always go through extents.  Errors fall back to the extent path.
+ */
+static bool can_write_inline(struct inode *inode, loff_t pos, unsigned len,
+			     struct scoutfs_lock *lock)
+{
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_extent ext;
+	int ret;
+
+	if (SCOUTFS_I(inode)->staging ||
+	    pos + len > SCOUTFS_INLINE_DATA_MAX_SIZE)
+		return false;
+
+	if (inline_data_file(inode))
+		return true;
+
+	if (i_size_read(inode) != 0)
+		return false;
+
+	scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
+			    scoutfs_ino(inode), 0, 1, 0, 0);
+	ret = scoutfs_extent_next(sb, data_extent_io, &ext, lock);
+	return ret == -ENOENT;
+}
+
+/*
+ * Truncate an inline data file to the already updated i_size.  The item
+ * only ever holds the first i_size bytes so truncating down has to trim
+ * the stored contents, otherwise stale bytes would reappear if the file
+ * was later extended.  Truncating to zero removes the item entirely.
+ */
+static int truncate_inline_data(struct super_block *sb, struct inode *inode,
+				struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	loff_t size = i_size_read(inode);
+	struct scoutfs_key key;
+	LIST_HEAD(ind_locks);
+	void *buf = NULL;
+	int ret;
+
+	init_inline_data_key(&key, scoutfs_ino(inode));
+
+	if (size > 0) {
+		buf = kmalloc(SCOUTFS_INLINE_DATA_MAX_SIZE, GFP_NOFS);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	ret = scoutfs_inode_index_lock_hold(inode, &ind_locks, true,
+					    SIC_INLINE_WRITE());
+	if (ret)
+		goto out;
+
+	ret = scoutfs_dirty_inode_item(inode, lock);
+	if (ret)
+		goto release;
+
+	if (size == 0) {
+		ret = scoutfs_item_delete(sb, &key, lock);
+		if (ret == -ENOENT)
+			ret = 0;
+		if (ret == 0)
+			si->flags &= ~SCOUTFS_INO_FLAG_INLINE_DATA;
+	} else {
+		ret = scoutfs_item_lookup_buf(sb, &key, buf,
+					      SCOUTFS_INLINE_DATA_MAX_SIZE,
+					      lock);
+		if (ret > size) {
+			ret = scoutfs_item_update_buf(sb, &key, buf, size,
+						      lock);
+		} else if (ret >= 0 || ret == -ENOENT) {
+			ret = 0;
+		}
+	}
+
+	if (ret == 0)
+		scoutfs_update_inode_item(inode, lock, &ind_locks);
+release:
+	scoutfs_release_trans(sb);
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+out:
+	kfree(buf);
+	return ret;
+}
+
 /*
  * Free blocks inside the logical block range from 'iblock' to 'last',
  * inclusive.
@@ -393,6 +625,8 @@ int scoutfs_data_truncate_items(struct super_block *sb, struct inode *inode,
 {
 	struct scoutfs_item_count cnt = SIC_TRUNC_EXTENT(inode);
 	DECLARE_DATA_INFO(sb, datinf);
+	bool from_start = iblock == 0;
+	struct scoutfs_key key;
 	LIST_HEAD(ind_locks);
 	s64 ret = 0;
 
@@ -407,6 +641,12 @@ int scoutfs_data_truncate_items(struct super_block *sb, struct inode *inode,
 	if (WARN_ON_ONCE(last < iblock))
 		return -EINVAL;
 
+	if (inode && !offline && inline_data_file(inode))
+		return truncate_inline_data(sb, inode, lock);
+
+	if (inode)
+		forget_cached_extent(inode);
+
 	while (iblock <= last) {
 		if (inode)
 			ret = scoutfs_inode_index_lock_hold(inode, &ind_locks,
@@ -440,6 +680,18 @@ int scoutfs_data_truncate_items(struct super_block *sb, struct inode *inode,
 		ret = 0;
 	}
 
+	/* an unreachable inode being deleted also drops its inline item */
+	if (ret == 0 && !inode && from_start) {
+		ret = scoutfs_hold_trans(sb, SIC_EXACT(1, 0));
+		if (ret == 0) {
+			init_inline_data_key(&key, ino);
+			ret = scoutfs_item_delete(sb, &key, lock);
+			if (ret == -ENOENT)
+				ret = 0;
+			scoutfs_release_trans(sb);
+		}
+	}
+
 	return ret;
 }
 
@@ -481,6 +733,7 @@ static int find_free_extent(struct super_block *sb, u64 len,
 			    struct scoutfs_extent *ext)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	DECLARE_DATA_INFO(sb, datinf);
 	int ret;
 
 	len = min(len, MAX_EXTENT_BLOCKS);
@@ -513,6 +766,11 @@ static int find_free_extent(struct super_block *sb, u64 len,
 				    sbi->node_id, ext->start,
 				    min(ext->len, len), 0, 0);
 
+	/* refill the pool in the background before writers drain it */
+	if (ret == 0 && (atomic64_read(&datinf->node_free_blocks) <
+			 NODE_FREE_LOW_WATER_BLOCKS))
+		queue_work(datinf->workq, &datinf->refill_work);
+
 	trace_scoutfs_data_find_free_extent(sb, ext);
 	return ret;
 }
@@ -711,6 +969,12 @@ static int scoutfs_get_block(struct inode *inode, sector_t iblock,
 		goto out;
 	}
 
+	/* cached extents are written and online, fine for reads or writes */
+	if (cached_extent_mapping(inode, iblock, bh)) {
+		scoutfs_inc_counter(sb, data_extent_cache_hit);
+		return 0;
+	}
+
 	/* look for the extent that overlaps our iblock */
 	scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
 			    scoutfs_ino(inode), iblock, 1, 0, 0);
@@ -770,6 +1034,7 @@ out:
 		map_bh(bh, inode->i_sb, ext.map + offset);
 		bh->b_size = min_t(u64, bh->b_size,
 				   (ext.len - offset) << SCOUTFS_BLOCK_SHIFT);
+		cache_extent_mapping(inode, &ext, lock);
 	}
 
 	trace_scoutfs_get_block(sb, scoutfs_ino(inode), iblock, create,
@@ -777,6 +1042,79 @@ out:
 	return ret;
 }
 
+/*
+ * A write is landing past the inline size limit.  Replay the inline
+ * contents through the normal allocating write path in our own
+ * transaction before the caller's write begins: fill the first page
+ * from the item, allocate and dirty its block, and delete the item.
+ * The dirty data is written out with the transaction that commits the
+ * allocation, like any other buffered write.
+ */
+static int convert_inline_data(struct inode *inode, struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct address_space *mapping = inode->i_mapping;
+	loff_t size = i_size_read(inode);
+	struct page *page = NULL;
+	struct scoutfs_key key;
+	LIST_HEAD(ind_locks);
+	u64 ind_seq;
+	int ret;
+
+	do {
+		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+		      scoutfs_inode_index_prepare(sb, &ind_locks, inode,
+						  true) ?:
+		      scoutfs_inode_index_try_lock_hold(sb, &ind_locks, ind_seq,
+							SIC_INLINE_CONVERT());
+	} while (ret > 0);
+	if (ret < 0)
+		return ret;
+
+	ret = scoutfs_dirty_inode_item(inode, lock);
+	if (ret)
+		goto out;
+
+	if (size > 0) {
+		page = grab_cache_page(mapping, 0);
+		if (!page) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (!PageUptodate(page)) {
+			ret = fill_page_from_inline(inode, page, lock);
+			if (ret)
+				goto out;
+		}
+
+		ret = __block_write_begin(page, 0, size, scoutfs_get_block);
+		if (ret)
+			goto out;
+		block_write_end(NULL, mapping, 0, size, size, page, NULL);
+	}
+
+	init_inline_data_key(&key, scoutfs_ino(inode));
+	ret = scoutfs_item_delete(sb, &key, lock);
+	if (ret == -ENOENT)
+		ret = 0;
+	if (ret)
+		goto out;
+
+	si->flags &= ~SCOUTFS_INO_FLAG_INLINE_DATA;
+	scoutfs_update_inode_item(inode, lock, &ind_locks);
+	scoutfs_inc_counter(sb, data_inline_convert);
+out:
+	if (page) {
+		unlock_page(page);
+		page_cache_release(page);
+	}
+	scoutfs_release_trans(sb);
+	scoutfs_inode_index_unlock(sb, &ind_locks);
+	return ret;
+}
+
 /*
  * This is almost never used.  We can't block on a cluster lock while
  * holding the page lock because lock invalidation gets the page lock
@@ -807,17 +1145,75 @@ static int scoutfs_readpage(struct file *file, struct page *page)
 		return ret;
 	}
 
-	ret = mpage_readpage(page, scoutfs_get_block);
+	if (inline_data_file(inode)) {
+		ret = fill_page_from_inline(inode, page, inode_lock);
+		unlock_page(page);
+	} else {
+		ret = mpage_readpage(page, scoutfs_get_block);
+	}
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
 	return ret;
 }
 
+/* pages locked in the page cache waiting for one read bio to complete */
+struct readpages_io {
+	struct page **pages;
+	unsigned int nr;
+};
+
+static void readpages_end_io(struct super_block *sb, void *data, int err)
+{
+	struct readpages_io *rio = data;
+	struct page *page;
+	unsigned int i;
+
+	for (i = 0; i < rio->nr; i++) {
+		page = rio->pages[i];
+		if (err)
+			SetPageError(page);
+		else
+			SetPageUptodate(page);
+		unlock_page(page);
+	}
+
+	kfree(rio->pages);
+	kfree(rio);
+}
+
+/*
+ * Submit one bio for a run of contiguous locked pages that map to
+ * contiguous blocks.  The rio and its pages are freed by the end_io
+ * once the io completes, errors here fail the whole run.
+ */
+static void submit_readpages_io(struct super_block *sb,
+				struct readpages_io *rio, u64 blkno)
+{
+	scoutfs_add_counter(sb, data_readpages_pages, rio->nr);
+	scoutfs_bio_submit(sb, READ, rio->pages, blkno, rio->nr,
+			   readpages_end_io, rio);
+}
+
+/*
+ * Readahead resolves each extent item once and issues single large
+ * bios for runs of pages that it maps, instead of walking the extent
+ * items under get_block for every 4KB page.  Pages in holes or under
+ * unwritten extents are zeroed in place.  Offline extents and errors
+ * just stop readahead, leaving the remaining pages for readpage to
+ * read, or fail, one at a time.
+ */
 static int scoutfs_readpages(struct file *file, struct address_space *mapping,
 			     struct list_head *pages, unsigned nr_pages)
 {
 	struct inode *inode = file->f_inode;
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_lock *inode_lock = NULL;
+	struct readpages_io *rio = NULL;
+	struct scoutfs_extent ext;
+	struct page *page;
+	bool have_ext = false;
+	u64 rio_blkno = 0;
+	u64 next_index = 0;
+	u64 iblock;
 	int ret;
 
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, SCOUTFS_LKF_REFRESH_INODE,
@@ -825,8 +1221,107 @@ static int scoutfs_readpages(struct file *file, struct address_space *mapping,
 	if (ret)
 		return ret;
 
-	ret = mpage_readpages(mapping, pages, nr_pages, scoutfs_get_block);
+	/*
+	 * Leave inline files to readpage, returning without consuming
+	 * the pages releases them and readahead falls back to reading
+	 * the single page that's actually needed.
+	 */
+	if (inline_data_file(inode)) {
+		ret = 0;
+		goto unlock;
+	}
+
+	if (SCOUTFS_BLOCK_SIZE != PAGE_CACHE_SIZE) {
+		ret = mpage_readpages(mapping, pages, nr_pages,
+				      scoutfs_get_block);
+		goto unlock;
+	}
+
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		iblock = page->index;
+
+		/* resolve the next extent once per extent, not per page */
+		if (!have_ext || iblock >= ext.start + ext.len) {
+			scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
+					    scoutfs_ino(inode), iblock, 1,
+					    0, 0);
+			ret = scoutfs_extent_next(sb, data_extent_io, &ext,
+						  inode_lock);
+			if (ret == -ENOENT) {
+				/* no more extents, the rest is a hole */
+				scoutfs_extent_init(&ext,
+						    SCOUTFS_FILE_EXTENT_TYPE,
+						    scoutfs_ino(inode),
+						    SCOUTFS_BLOCK_MAX, 1,
+						    0, 0);
+				ret = 0;
+			} else if (ret < 0) {
+				break;
+			} else {
+				cache_extent_mapping(inode, &ext, inode_lock);
+			}
+			have_ext = true;
+		}
+
+		/* leave pages under offline extents for readpage to fail */
+		if (iblock >= ext.start && (ext.flags & SEF_OFFLINE)) {
+			ret = 0;
+			break;
+		}
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_NOFS)) {
+			/* raced with someone else reading it */
+			page_cache_release(page);
+			continue;
+		}
+
+		if (iblock < ext.start || !ext.map ||
+		    (ext.flags & SEF_UNWRITTEN)) {
+			zero_user(page, 0, PAGE_CACHE_SIZE);
+			SetPageUptodate(page);
+			unlock_page(page);
+			page_cache_release(page);
+			continue;
+		}
+
+		/* submit a run that's broken by a gap or a new extent */
+		if (rio && (iblock != next_index ||
+			    rio_blkno + rio->nr !=
+				ext.map + (iblock - ext.start))) {
+			submit_readpages_io(sb, rio, rio_blkno);
+			rio = NULL;
+		}
+
+		if (!rio) {
+			rio = kmalloc(sizeof(struct readpages_io), GFP_NOFS);
+			if (rio)
+				rio->pages = kcalloc(nr_pages,
+						     sizeof(struct page *),
+						     GFP_NOFS);
+			if (!rio || !rio->pages) {
+				kfree(rio);
+				rio = NULL;
+				zero_user(page, 0, PAGE_CACHE_SIZE);
+				unlock_page(page);
+				page_cache_release(page);
+				ret = -ENOMEM;
+				break;
+			}
+			rio->nr = 0;
+			rio_blkno = ext.map + (iblock - ext.start);
+		}
+
+		rio->pages[rio->nr++] = page;
+		next_index = iblock + 1;
+		page_cache_release(page);
+	}
 
+	if (rio)
+		submit_readpages_io(sb, rio, rio_blkno);
+unlock:
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
 	return ret;
 }
@@ -846,8 +1341,66 @@ static int scoutfs_writepages(struct address_space *mapping,
 struct write_begin_data {
 	struct list_head ind_locks;
 	struct scoutfs_lock *lock;
+	bool inline_data;
 };
 
+/*
+ * Begin a write that lands entirely in the inline data item.  We hold
+ * the transaction that write_end will fill the item under and read the
+ * existing contents into the page so partial copies land on valid
+ * data.  The page is never dirtied, the item is the only copy that's
+ * written out.
+ */
+static int scoutfs_write_begin_inline(struct inode *inode,
+				      struct address_space *mapping,
+				      loff_t pos, unsigned flags,
+				      struct page **pagep,
+				      struct write_begin_data *wbd)
+{
+	struct super_block *sb = inode->i_sb;
+	struct page *page;
+	u64 ind_seq;
+	int ret;
+
+	do {
+		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
+		      scoutfs_inode_index_prepare(sb, &wbd->ind_locks, inode,
+						  true) ?:
+		      scoutfs_inode_index_try_lock_hold(sb, &wbd->ind_locks,
+							ind_seq,
+							SIC_INLINE_WRITE());
+	} while (ret > 0);
+	if (ret < 0)
+		return ret;
+
+	ret = scoutfs_dirty_inode_item(inode, wbd->lock);
+	if (ret)
+		goto out;
+
+	page = grab_cache_page_write_begin(mapping, 0, flags | AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (!PageUptodate(page)) {
+		ret = fill_page_from_inline(inode, page, wbd->lock);
+		if (ret) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto out;
+		}
+	}
+
+	*pagep = page;
+	wbd->inline_data = true;
+	ret = 0;
+out:
+	if (ret)
+		scoutfs_release_trans(sb);
+	return ret;
+}
+
 static int scoutfs_write_begin(struct file *file,
 			       struct address_space *mapping, loff_t pos,
 			       unsigned len, unsigned flags,
@@ -867,6 +1420,7 @@ static int scoutfs_write_begin(struct file *file,
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&wbd->ind_locks);
+	wbd->inline_data = false;
 	*fsdata = wbd;
 
 	wbd->lock = scoutfs_per_task_get(&si->pt_data_lock);
@@ -875,6 +1429,19 @@ static int scoutfs_write_begin(struct file *file,
 		goto out;
 	}
 
+	if (can_write_inline(inode, pos, len, wbd->lock)) {
+		ret = scoutfs_write_begin_inline(inode, mapping, pos, flags,
+						 pagep, wbd);
+		goto out;
+	}
+
+	/* writes that outgrow the inline item convert it to extents */
+	if (inline_data_file(inode)) {
+		ret = convert_inline_data(inode, wbd->lock);
+		if (ret < 0)
+			goto out;
+	}
+
 	do {
 		ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
 		      scoutfs_inode_index_prepare(sb, &wbd->ind_locks, inode,
@@ -918,6 +1485,59 @@ static int writepages_sync_none(struct address_space *mapping, loff_t start,
 	return mapping->a_ops->writepages(mapping, &wbc);
 }
 
+/*
+ * End an inline write by copying the first bytes of the page into the
+ * inline data item.  The page has the full contents, old data read in
+ * write_begin and the new user copy, so we always store the entire
+ * prefix up to the written size.  The first write creates the item and
+ * sets the persistent inode flag.
+ */
+static int scoutfs_write_end_inline(struct inode *inode, struct page *page,
+				    loff_t pos, unsigned copied,
+				    struct scoutfs_lock *lock)
+{
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_key key;
+	loff_t size;
+	void *addr;
+	int ret;
+
+	if (copied == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	size = max_t(loff_t, i_size_read(inode), pos + copied);
+	if (WARN_ON_ONCE(size > SCOUTFS_INLINE_DATA_MAX_SIZE)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	init_inline_data_key(&key, scoutfs_ino(inode));
+	addr = kmap(page);
+	if (si->flags & SCOUTFS_INO_FLAG_INLINE_DATA) {
+		ret = scoutfs_item_update_buf(sb, &key, addr, size, lock);
+	} else {
+		ret = scoutfs_item_create_buf(sb, &key, addr, size, lock);
+		if (ret == 0)
+			si->flags |= SCOUTFS_INO_FLAG_INLINE_DATA;
+	}
+	kunmap(page);
+	if (ret)
+		goto out;
+
+	if (pos + copied > i_size_read(inode))
+		i_size_write(inode, pos + copied);
+
+	scoutfs_inc_counter(sb, data_inline_write);
+	ret = copied;
+out:
+	unlock_page(page);
+	page_cache_release(page);
+	return ret;
+}
+
 static int scoutfs_write_end(struct file *file, struct address_space *mapping,
 			     loff_t pos, unsigned len, unsigned copied,
 			     struct page *page, void *fsdata)
@@ -931,7 +1551,12 @@ static int scoutfs_write_end(struct file *file, struct address_space *mapping,
 	trace_scoutfs_write_end(sb, scoutfs_ino(inode), page->index, (u64)pos,
 				len, copied);
 
-	ret = generic_write_end(file, mapping, pos, len, copied, page, fsdata);
+	if (wbd->inline_data)
+		ret = scoutfs_write_end_inline(inode, page, pos, copied,
+					       wbd->lock);
+	else
+		ret = generic_write_end(file, mapping, pos, len, copied, page,
+					fsdata);
 	if (ret > 0) {
 		if (!si->staging) {
 			scoutfs_inode_set_data_seq(inode);
@@ -939,7 +1564,8 @@ static int scoutfs_write_end(struct file *file, struct address_space *mapping,
 		}
 
 		scoutfs_update_inode_item(inode, wbd->lock, &wbd->ind_locks);
-		scoutfs_inode_queue_writeback(inode);
+		if (!wbd->inline_data)
+			scoutfs_inode_queue_writeback(inode);
 	}
 	scoutfs_release_trans(sb);
 	scoutfs_inode_index_unlock(sb, &wbd->ind_locks);
@@ -1174,28 +1800,116 @@ out:
 }
 
 
+/* enough extent items per item cache lock hold to stream huge files */
+#define DATA_EXTENT_BATCH_NR 128
+
+/*
+ * Copy a batch of the file's extents whose items end at or after iblock
+ * out of the item cache in one walk instead of re-searching from the
+ * root for every extent.  Returns the number of extents filled,
+ * -ENOENT when there are none, or another errno on failure.
+ */
+static int file_extent_batch(struct super_block *sb, u64 ino, u64 iblock,
+			     struct scoutfs_extent *exts, unsigned int nr,
+			     struct scoutfs_lock *lock)
+{
+	struct scoutfs_file_extent *fexs;
+	struct scoutfs_key *keys;
+	struct kvec *vals;
+	struct scoutfs_key key;
+	struct scoutfs_key last;
+	int ret;
+	int i;
+
+	keys = kmalloc(nr * (sizeof(keys[0]) + sizeof(vals[0]) +
+			     sizeof(fexs[0])), GFP_NOFS);
+	if (!keys)
+		return -ENOMEM;
+	vals = (void *)(keys + nr);
+	fexs = (void *)(vals + nr);
+
+	init_file_extent_key(&key, ino, iblock);
+	init_file_extent_key(&last, ino, U64_MAX);
+
+	for (i = 0; i < nr; i++)
+		kvec_init(&vals[i], &fexs[i], sizeof(fexs[i]));
+
+	ret = scoutfs_item_next_batch(sb, &key, &last, keys, vals, nr, lock);
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < ret; i++) {
+		if (vals[i].iov_len != sizeof(fexs[i])) {
+			ret = -EIO;
+			goto out;
+		}
+
+		ret = init_extent_from_item(&exts[i], &keys[i], &fexs[i]);
+		if (ret < 0)
+			goto out;
+	}
+	ret = i;
+out:
+	kfree(keys);
+	return ret;
+}
+
+/*
+ * Return a batch of the file's extents whose items end at or after
+ * iblock for SCOUTFS_IOC_FILE_EXTENTS.  Returns the number of extents
+ * filled or -errno, with -ENOENT indicating the end of the file's
+ * extents.
+ */
+int scoutfs_data_file_extents(struct inode *inode, u64 iblock,
+			      struct scoutfs_extent *exts, unsigned int nr)
+{
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_lock *lock = NULL;
+	int ret;
+
+	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, 0, inode, &lock);
+	if (ret)
+		return ret;
+
+	ret = file_extent_batch(sb, scoutfs_ino(inode), iblock, exts, nr,
+				lock);
+	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+	return ret;
+}
+
 /*
  * Return all the file's extents whose blocks overlap with the caller's
  * byte region.  We set _LAST on the last extent and _UNKNOWN on offline
  * extents.
+ *
+ * The extent items are copied out of the item cache in batches so that
+ * fiemap over files with millions of extents doesn't re-walk the cache
+ * from the root for every extent.
  */
 int scoutfs_data_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 			u64 start, u64 len)
 {
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_lock *inode_lock = NULL;
-	struct scoutfs_extent ext;
+	struct scoutfs_extent *exts = NULL;
+	struct scoutfs_extent *ext;
 	u64 blk_off;
 	u64 logical = 0;
 	u64 phys = 0;
 	u64 size = 0;
 	u32 flags = 0;
+	unsigned int nr = 0;
+	unsigned int i = 0;
 	int ret;
 
 	ret = fiemap_check_flags(fieinfo, FIEMAP_FLAG_SYNC);
 	if (ret)
 		return ret;
 
+	exts = kmalloc(DATA_EXTENT_BATCH_NR * sizeof(exts[0]), GFP_NOFS);
+	if (!exts)
+		return -ENOMEM;
+
 	/* XXX overkill? */
 	mutex_lock(&inode->i_mutex);
 
@@ -1206,18 +1920,24 @@ int scoutfs_data_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 	blk_off = start >> SCOUTFS_BLOCK_SHIFT;
 
 	for (;;) {
-		scoutfs_extent_init(&ext, SCOUTFS_FILE_EXTENT_TYPE,
-				    scoutfs_ino(inode), blk_off, 1, 0, 0);
-		ret = scoutfs_extent_next(sb, data_extent_io, &ext, inode_lock);
-		/* fiemap will return last and stop when we see enoent */
-		if (ret < 0 && ret != -ENOENT)
-			break;
+		if (i == nr) {
+			ret = file_extent_batch(sb, scoutfs_ino(inode),
+						blk_off, exts,
+						DATA_EXTENT_BATCH_NR,
+						inode_lock);
+			/* fiemap will return last and stop on enoent */
+			if (ret < 0 && ret != -ENOENT)
+				break;
+			nr = ret < 0 ? 0 : ret;
+			i = 0;
+		}
 
-		if (ret == 0)
-			trace_scoutfs_data_fiemap_extent(sb, &ext);
+		ext = i < nr ? &exts[i++] : NULL;
+		if (ext)
+			trace_scoutfs_data_fiemap_extent(sb, ext);
 
 		if (size) {
-			if (ret == -ENOENT)
+			if (!ext)
 				flags |= FIEMAP_EXTENT_LAST;
 			ret = fiemap_fill_next_extent(fieinfo, logical, phys,
 						      size, flags);
@@ -1228,25 +1948,74 @@ int scoutfs_data_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 			}
 		}
 
-		logical = ext.start << SCOUTFS_BLOCK_SHIFT;
-		phys = ext.map << SCOUTFS_BLOCK_SHIFT;
-		size = ext.len << SCOUTFS_BLOCK_SHIFT;
+		if (!ext) {
+			ret = 0;
+			break;
+		}
+
+		logical = ext->start << SCOUTFS_BLOCK_SHIFT;
+		phys = ext->map << SCOUTFS_BLOCK_SHIFT;
+		size = ext->len << SCOUTFS_BLOCK_SHIFT;
 		flags = 0;
-		if (ext.flags & SEF_OFFLINE)
+		if (ext->flags & SEF_OFFLINE)
 			flags |= FIEMAP_EXTENT_UNKNOWN;
-		if (ext.flags & SEF_UNWRITTEN)
+		if (ext->flags & SEF_UNWRITTEN)
 			flags |= FIEMAP_EXTENT_UNWRITTEN;
 
-		blk_off = ext.start + ext.len;
+		blk_off = ext->start + ext->len;
 	}
 
 	scoutfs_unlock(sb, inode_lock, DLM_LOCK_PR);
 out:
 	mutex_unlock(&inode->i_mutex);
+	kfree(exts);
 
 	return ret;
 }
 
+/*
+ * O_DIRECT moves data straight between user buffers and the device
+ * using our extent items, so staging in huge archived files doesn't
+ * double buffer through the page cache and evict the hot metadata
+ * working set.
+ *
+ * The file paths hold the cluster lock in a mode that excludes writers
+ * and the write path holds i_mutex itself, so generic DIO_LOCKING would
+ * only acquire i_mutex after the cluster lock and invert our ordering.
+ *
+ * Writes that would allocate can't go direct because each block
+ * allocation needs the held transaction that the buffered write_begin
+ * path provides.  DIO_SKIP_HOLES makes writes over holes inside i_size
+ * return short, and we refuse writes that reach past the last full
+ * block so the generic code never asks us to allocate; either way
+ * __generic_file_aio_write finishes the job through the page cache.
+ */
+static ssize_t scoutfs_direct_IO(int rw, struct kiocb *iocb,
+				 const struct iovec *iov, loff_t offset,
+				 unsigned long nr_segs)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct super_block *sb = inode->i_sb;
+
+	/* inline files have no extents, short returns go buffered */
+	if (inline_data_file(inode))
+		return 0;
+
+	if (rw == WRITE) {
+		if (offset + iov_length(iov, nr_segs) >
+		    round_down(i_size_read(inode), SCOUTFS_BLOCK_SIZE))
+			return 0;
+		scoutfs_inc_counter(sb, data_direct_write);
+	} else {
+		scoutfs_inc_counter(sb, data_direct_read);
+	}
+
+	return __blockdev_direct_IO(rw, iocb, inode, sb->s_bdev, iov, offset,
+				    nr_segs, scoutfs_get_block, NULL, NULL,
+				    DIO_SKIP_HOLES);
+}
+
 const struct address_space_operations scoutfs_file_aops = {
 	.readpage		= scoutfs_readpage,
 	.readpages		= scoutfs_readpages,
@@ -1254,6 +2023,7 @@ const struct address_space_operations scoutfs_file_aops = {
 	.writepages		= scoutfs_writepages,
 	.write_begin		= scoutfs_write_begin,
 	.write_end		= scoutfs_write_end,
+	.direct_IO		= scoutfs_direct_IO,
 };
 
 const struct file_operations scoutfs_file_fops = {
@@ -1319,7 +2089,13 @@ static void scoutfs_data_return_server_extents_worker(struct work_struct *work)
 		trace_scoutfs_data_return_server_extent(sb, &ext);
 
 		ext.type = SCOUTFS_FREE_EXTENT_BLKNO_TYPE;
-		ext.len = min(ext.len, free - NODE_FREE_HIGH_WATER_BLOCKS);
+		/*
+		 * Return whole extents so that frees the extent core
+		 * merged aren't split back into fragments that churn
+		 * the server's btree, only splitting when a huge extent
+		 * would drain the pool under the refill low water mark.
+		 */
+		ext.len = min(ext.len, free - NODE_FREE_LOW_WATER_BLOCKS);
 
 		ret = scoutfs_extent_remove(sb, data_extent_io, &ext,
 					    sbi->node_id_lock);
@@ -1356,6 +2132,38 @@ out:
 		queue_work(datinf->workq, &datinf->return_work);
 }
 
+/*
+ * Ask the server for more free extents when the node's pool falls below
+ * the low water mark.  Writers used to pay the server round trip
+ * synchronously in the allocation path every time the pool ran dry.
+ * Refilling in the background keeps the round trip off the write path,
+ * while the synchronous request in find_free_extent remains as the
+ * fallback when allocation outruns the refill.  Each work call requests
+ * one extent so that the work can be easily canceled during unmount.
+ */
+static void scoutfs_data_refill_server_extents_worker(struct work_struct *work)
+{
+	struct data_info *datinf = container_of(work, struct data_info,
+						refill_work);
+	struct super_block *sb = datinf->sb;
+	int ret;
+
+	ret = scoutfs_hold_trans(sb, SIC_REFILL_EXTENT());
+	if (ret)
+		return;
+
+	down_write(&datinf->alloc_rwsem);
+	ret = get_server_extent(sb);
+	up_write(&datinf->alloc_rwsem);
+
+	scoutfs_release_trans(sb);
+
+	/* keep refilling if we're still under the water mark */
+	if (ret == 0 && (atomic64_read(&datinf->node_free_blocks) <
+			 NODE_FREE_LOW_WATER_BLOCKS))
+		queue_work(datinf->workq, &datinf->refill_work);
+}
+
 int scoutfs_data_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
@@ -1370,6 +2178,8 @@ int scoutfs_data_setup(struct super_block *sb)
 	atomic64_set(&datinf->node_free_blocks, 0);
 	INIT_WORK(&datinf->return_work,
 		  scoutfs_data_return_server_extents_worker);
+	INIT_WORK(&datinf->refill_work,
+		  scoutfs_data_refill_server_extents_worker);
 
 	datinf->workq = alloc_workqueue("scoutfs_data", WQ_UNBOUND, 1);
 	if (!datinf->workq) {
@@ -1388,6 +2198,7 @@ void scoutfs_data_destroy(struct super_block *sb)
 
 	if (datinf) {
 		if (datinf->workq) {
+			cancel_work_sync(&datinf->refill_work);
 			cancel_work_sync(&datinf->return_work);
 			destroy_workqueue(datinf->workq);
 			datinf->workq = NULL;
@@ -9,6 +9,9 @@ int scoutfs_data_truncate_items(struct super_block *sb, struct inode *inode,
 				struct scoutfs_lock *lock);
 int scoutfs_data_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 			u64 start, u64 len);
+struct scoutfs_extent;
+int scoutfs_data_file_extents(struct inode *inode, u64 iblock,
+			      struct scoutfs_extent *exts, unsigned int nr);
 long scoutfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len);
 
 int scoutfs_data_setup(struct super_block *sb);
@@ -17,6 +17,8 @@
 #include <linux/uio.h>
 #include <linux/xattr.h>
 #include <linux/namei.h>
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
 
 #include "format.h"
 #include "file.h"
@@ -418,6 +420,15 @@ static struct dentry *scoutfs_lookup(struct inode *dir, struct dentry *dentry,
 	if (ret == -ENOENT) {
 		ino = 0;
 		ret = 0;
+		/*
+		 * Cover the negative dentry so that repeated lookups of
+		 * the same absent name are satisfied by revalidation
+		 * while we hold the lock, without descending into the
+		 * item cache every time.  Local creates instantiate
+		 * this very dentry and remote creates drop coverage
+		 * with the lock.
+		 */
+		update_dentry_info(sb, dentry, 0, 0, dir_lock);
 	} else if (ret == 0) {
 		ino = le64_to_cpu(dent.ino);
 		update_dentry_info(sb, dentry, le64_to_cpu(dent.hash),
@@ -458,10 +469,17 @@ static int dir_emit_dots(struct file *file, void *dirent, filldir_t filldir)
 	return 1;
 }
 
+/* enough dirent items per item cache lock hold to fill typical buffers */
+#define READDIR_BATCH_NR 16
+
 /*
  * readdir simply iterates over the dirent items for the dir inode and
  * uses their offset as the readdir position.
  *
+ * The dirent items are copied out of the item cache in batches so that
+ * we don't re-walk the cache from the root for every entry in enormous
+ * directories.
+ *
  * It will need to be careful not to read past the region of the dirent
  * hash offset keys that it has access to.
  */
@@ -470,71 +488,188 @@ static int scoutfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 	struct inode *inode = file_inode(file);
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_dirent *dent;
+	struct scoutfs_key keys[READDIR_BATCH_NR];
+	struct kvec vals[READDIR_BATCH_NR];
 	struct scoutfs_key key;
 	struct scoutfs_key last_key;
 	struct scoutfs_lock *dir_lock;
-	struct kvec val;
+	unsigned int bytes;
+	char *dents = NULL;
+	bool filled = false;
 	int name_len;
+	int nr;
+	int i;
 	u64 pos;
 	int ret;
 
 	if (!dir_emit_dots(file, dirent, filldir))
 		return 0;
 
-	dent = alloc_dirent(SCOUTFS_NAME_LEN);
-	if (!dent) {
+	bytes = dirent_bytes(SCOUTFS_NAME_LEN);
+	dents = kmalloc(READDIR_BATCH_NR * bytes, GFP_NOFS);
+	if (!dents) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
 	init_dirent_key(&last_key, SCOUTFS_READDIR_TYPE, scoutfs_ino(inode),
 			SCOUTFS_DIRENT_LAST_POS, 0);
-	kvec_init(&val, dent, dirent_bytes(SCOUTFS_NAME_LEN));
 
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, 0, inode, &dir_lock);
 	if (ret)
 		goto out;
 
-	for (;;) {
+	while (!filled) {
 		init_dirent_key(&key, SCOUTFS_READDIR_TYPE, scoutfs_ino(inode),
 				file->f_pos, 0);
 
-		ret = scoutfs_item_next(sb, &key, &last_key, &val, dir_lock);
+		for (i = 0; i < READDIR_BATCH_NR; i++)
+			kvec_init(&vals[i], dents + (i * bytes), bytes);
+
+		ret = scoutfs_item_next_batch(sb, &key, &last_key, keys, vals,
+					      READDIR_BATCH_NR, dir_lock);
 		if (ret < 0) {
 			if (ret == -ENOENT)
 				ret = 0;
 			break;
 		}
+		nr = ret;
+
+		for (i = 0; i < nr; i++) {
+			dent = vals[i].iov_base;
+			name_len = vals[i].iov_len -
+				   sizeof(struct scoutfs_dirent);
+			if (name_len < 1 || name_len > SCOUTFS_NAME_LEN) {
+				scoutfs_corruption(sb,
+					SC_DIRENT_READDIR_NAME_LEN,
+					corrupt_dirent_readdir_name_len,
+					"dir_ino %llu pos %llu key "SK_FMT" len %d",
+					scoutfs_ino(inode), file->f_pos,
+					SK_ARG(&keys[i]), name_len);
+				ret = -EIO;
+				goto unlock;
+			}
 
-		name_len = ret - sizeof(struct scoutfs_dirent);
-		if (name_len < 1 || name_len > SCOUTFS_NAME_LEN) {
-			scoutfs_corruption(sb, SC_DIRENT_READDIR_NAME_LEN,
-					   corrupt_dirent_readdir_name_len,
-					   "dir_ino %llu pos %llu key "SK_FMT" len %d",
-					   scoutfs_ino(inode), file->f_pos,
-					   SK_ARG(&key), name_len);
-			ret = -EIO;
-			goto out;
-		}
+			pos = le64_to_cpu(keys[i].skd_major);
 
-		pos = le64_to_cpu(key.skd_major);
+			if (filldir(dirent, dent->name, name_len, pos,
+				    le64_to_cpu(dent->ino),
+				    dentry_type(dent->type))) {
+				ret = 0;
+				filled = true;
+				break;
+			}
 
-		if (filldir(dirent, dent->name, name_len, pos,
-			    le64_to_cpu(dent->ino), dentry_type(dent->type))) {
-			ret = 0;
-			break;
+			file->f_pos = pos + 1;
 		}
-
-		file->f_pos = pos + 1;
 	}
 
-out:
+unlock:
 	scoutfs_unlock(sb, dir_lock, DLM_LOCK_PR);
-
-	kfree(dent);
+out:
+	kfree(dents);
 	return ret;
 }
 
+/*
+ * Resolving an inode's path walks link backref items parent by parent
+ * up to the root.  Bulk callers resolve paths for enormous numbers of
+ * inodes and rediscover the same few top level directory components
+ * over and over.  We cache the first link backref of recently resolved
+ * inodes in a small fixed table.  Each cached component records
+ * coverage of the inode's lock so that another node changing its links
+ * naturally invalidates our copy, and local link changes forget the
+ * component directly.
+ */
+#define BACKREF_CACHE_SHIFT 10
+#define BACKREF_CACHE_NR (1 << BACKREF_CACHE_SHIFT)
+
+struct backref_cache_entry {
+	struct scoutfs_lock_coverage cov;
+	u64 ino;
+	u64 dir_ino;
+	u64 dir_pos;
+	u16 name_len;
+	struct scoutfs_dirent dent;
+	/* the full name is stored after dent in dent.name[0] */
+	u8 name[SCOUTFS_NAME_LEN];
+};
+
+struct dir_info {
+	spinlock_t lock;
+	struct backref_cache_entry *backref_entries;
+};
+
+#define DECLARE_DIR_INFO(sb, name) \
+	struct dir_info *name = SCOUTFS_SB(sb)->dir_info
+
+static struct backref_cache_entry *backref_cache_entry(struct dir_info *dinf,
+							u64 ino)
+{
+	return &dinf->backref_entries[hash_64(ino, BACKREF_CACHE_SHIFT)];
+}
+
+/*
+ * Copy the cached first link backref of the inode into the caller's
+ * entry.  The copy is only served while the lock coverage that was
+ * recorded when the component was cached still holds.
+ */
+static bool lookup_cached_backref(struct super_block *sb, u64 ino,
+				  struct scoutfs_link_backref_entry *ent)
+{
+	DECLARE_DIR_INFO(sb, dinf);
+	struct backref_cache_entry *bce;
+	bool hit = false;
+
+	spin_lock(&dinf->lock);
+	bce = backref_cache_entry(dinf, ino);
+	if (bce->ino == ino && scoutfs_lock_is_covered(sb, &bce->cov)) {
+		ent->dir_ino = bce->dir_ino;
+		ent->dir_pos = bce->dir_pos;
+		ent->name_len = bce->name_len;
+		memcpy(&ent->dent, &bce->dent, dirent_bytes(bce->name_len));
+		hit = true;
+	}
+	spin_unlock(&dinf->lock);
+
+	return hit;
+}
+
+/* the caller still holds the lock on the inode that found the backref */
+static void cache_backref(struct super_block *sb,
+			  struct scoutfs_link_backref_entry *ent, u64 ino,
+			  struct scoutfs_lock *lock)
+{
+	DECLARE_DIR_INFO(sb, dinf);
+	struct backref_cache_entry *bce;
+
+	spin_lock(&dinf->lock);
+	bce = backref_cache_entry(dinf, ino);
+	bce->ino = ino;
+	bce->dir_ino = ent->dir_ino;
+	bce->dir_pos = ent->dir_pos;
+	bce->name_len = ent->name_len;
+	memcpy(&bce->dent, &ent->dent, dirent_bytes(ent->name_len));
+	/* covering inside our lock orders racing stores that collide */
+	scoutfs_lock_add_coverage(sb, lock, &bce->cov);
+	spin_unlock(&dinf->lock);
+}
+
+/* the inode's link backref items are changing, stop serving cached copies */
+static void forget_cached_backref(struct super_block *sb, u64 ino)
+{
+	DECLARE_DIR_INFO(sb, dinf);
+	struct backref_cache_entry *bce;
+
+	spin_lock(&dinf->lock);
+	bce = backref_cache_entry(dinf, ino);
+	if (bce->ino == ino) {
+		scoutfs_lock_del_coverage(sb, &bce->cov);
+		bce->ino = 0;
+	}
+	spin_unlock(&dinf->lock);
+}
+
 /*
  * Add all the items for the named link to the inode in the dir.  Only
  * items are modified.  The caller is responsible for locking, entering
@@ -553,7 +688,7 @@ static int add_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
 	struct scoutfs_dirent *dent;
 	bool del_ent = false;
 	bool del_rdir = false;
-	struct kvec val;
+	unsigned int bytes;
 	int ret;
 
 	dent = alloc_dirent(name_len);
@@ -572,19 +707,21 @@ static int add_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
 	init_dirent_key(&ent_key, SCOUTFS_DIRENT_TYPE, dir_ino, hash, pos);
 	init_dirent_key(&rdir_key, SCOUTFS_READDIR_TYPE, dir_ino, pos, 0);
 	init_dirent_key(&lb_key, SCOUTFS_LINK_BACKREF_TYPE, ino, dir_ino, pos);
-	kvec_init(&val, dent, dirent_bytes(name_len));
+	bytes = dirent_bytes(name_len);
 
-	ret = scoutfs_item_create(sb, &ent_key, &val, dir_lock);
+	ret = scoutfs_item_create_buf(sb, &ent_key, dent, bytes, dir_lock);
 	if (ret)
 		goto out;
 	del_ent = true;
 
-	ret = scoutfs_item_create(sb, &rdir_key, &val, dir_lock);
+	ret = scoutfs_item_create_buf(sb, &rdir_key, dent, bytes, dir_lock);
 	if (ret)
 		goto out;
 	del_rdir = true;
 
-	ret = scoutfs_item_create(sb, &lb_key, &val, inode_lock);
+	ret = scoutfs_item_create_buf(sb, &lb_key, dent, bytes, inode_lock);
+	if (ret == 0)
+		forget_cached_backref(sb, ino);
 out:
 	if (ret < 0) {
 		if (del_ent)
@@ -629,6 +766,7 @@ static int del_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
 	} else {
 		scoutfs_item_free_batch(sb, &dir_saved);
 		scoutfs_item_free_batch(sb, &inode_saved);
+		forget_cached_backref(sb, ino);
 	}
 
 	return ret;
@@ -642,6 +780,18 @@ static int del_entry_items(struct super_block *sb, u64 dir_ino, u64 hash,
  * so we roll our own comparion between the two instead of pushing
  * complexity down the locking paths that acquire existing inodes in
  * order.
+ *
+ * XXX Creates from many nodes into one landing directory serialize on
+ * the dir's EX lock here.  Sharding the dirent key space into multiple
+ * lock ranges by name hash doesn't get us out of that today.  The
+ * inode group lock's range covers all of the dir's fs items, and the
+ * lock range tree refuses overlapping ranges, so hash shard locks
+ * would need the dirent keys carved out of the group lock's range in
+ * every mount's lock space.  And every create still updates the shared
+ * dir inode item -- i_size, mtime, next_readdir_pos -- under the EX
+ * lock, so the item would bounce between nodes anyway.  Parallel
+ * creates need per-shard readdir position allocation and delta-merged
+ * dir inode updates before finer locks can help.
  */
 static struct inode *lock_hold_create(struct inode *dir, struct dentry *dentry,
 				      umode_t mode, dev_t rdev,
@@ -984,7 +1134,6 @@ static int symlink_item_ops(struct super_block *sb, int op, u64 ino,
 			    size_t size)
 {
 	struct scoutfs_key key;
-	struct kvec val;
 	unsigned bytes;
 	unsigned nr;
 	int ret;
@@ -999,12 +1148,14 @@ static int symlink_item_ops(struct super_block *sb, int op, u64 ino,
 
 		init_symlink_key(&key, ino, i);
 		bytes = min_t(u64, size, SCOUTFS_MAX_VAL_SIZE);
-		kvec_init(&val, (void *)target, bytes);
 
 		if (op == SYM_CREATE)
-			ret = scoutfs_item_create(sb, &key, &val, lock);
+			ret = scoutfs_item_create_buf(sb, &key, (void *)target,
+						      bytes, lock);
 		else if (op == SYM_LOOKUP)
-			ret = scoutfs_item_lookup_exact(sb, &key, &val, lock);
+			ret = scoutfs_item_lookup_exact_buf(sb, &key,
+							    (void *)target,
+							    bytes, lock);
 		else if (op == SYM_DELETE)
 			ret = scoutfs_item_delete(sb, &key, lock);
 		if (ret)
@@ -1234,6 +1385,15 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 
 	INIT_LIST_HEAD(&ent->head);
 
+	/* searches from the start of the key space can hit the cache */
+	if (dir_ino == 0 && dir_pos == 0 &&
+	    lookup_cached_backref(sb, ino, ent)) {
+		scoutfs_inc_counter(sb, dir_backref_cache_hit);
+		list_add(&ent->head, list);
+		ret = 0;
+		goto out;
+	}
+
 	init_dirent_key(&key, SCOUTFS_LINK_BACKREF_TYPE, ino, dir_ino, dir_pos);
 	init_dirent_key(&last_key, SCOUTFS_LINK_BACKREF_TYPE, ino, U64_MAX,
 			U64_MAX);
@@ -1244,8 +1404,6 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 		goto out;
 
 	ret = scoutfs_item_next(sb, &key, &last_key, &val, lock);
-	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
-	lock = NULL;
 	if (ret < 0)
 		goto out;
 
@@ -1263,8 +1421,14 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 	ent->dir_ino = le64_to_cpu(key.skd_major);
 	ent->dir_pos = le64_to_cpu(key.skd_minor);
 	ent->name_len = len;
+
+	/* cache full searches while our lock still covers the result */
+	if (dir_ino == 0 && dir_pos == 0)
+		cache_backref(sb, ent, ino, lock);
 	ret = 0;
 out:
+	if (lock)
+		scoutfs_unlock(sb, lock, DLM_LOCK_PR);
 	trace_scoutfs_dir_add_next_linkref(sb, ino, dir_ino, dir_pos, ret,
 					   ent ? ent->dir_ino : 0,
 					   ent ? ent->dir_pos : 0,
@@ -1759,6 +1923,48 @@ const struct inode_operations scoutfs_dir_iops = {
 	.permission	= scoutfs_permission,
 };
 
+int scoutfs_dir_setup(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct dir_info *dinf;
+	int i;
+
+	dinf = kzalloc(sizeof(struct dir_info), GFP_KERNEL);
+	if (!dinf)
+		return -ENOMEM;
+
+	spin_lock_init(&dinf->lock);
+
+	dinf->backref_entries = vzalloc(BACKREF_CACHE_NR *
+					sizeof(struct backref_cache_entry));
+	if (!dinf->backref_entries) {
+		kfree(dinf);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < BACKREF_CACHE_NR; i++)
+		scoutfs_lock_init_coverage(&dinf->backref_entries[i].cov);
+
+	sbi->dir_info = dinf;
+	return 0;
+}
+
+void scoutfs_dir_destroy(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct dir_info *dinf = sbi->dir_info;
+	int i;
+
+	if (dinf) {
+		for (i = 0; i < BACKREF_CACHE_NR; i++)
+			scoutfs_lock_del_coverage(sb,
+						&dinf->backref_entries[i].cov);
+		vfree(dinf->backref_entries);
+		sbi->dir_info = NULL;
+		kfree(dinf);
+	}
+}
+
 void scoutfs_dir_exit(void)
 {
 	if (dentry_info_cache) {
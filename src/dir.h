@@ -29,6 +29,9 @@ int scoutfs_dir_add_next_linkref(struct super_block *sb, u64 ino,
 int scoutfs_symlink_drop(struct super_block *sb, u64 ino,
 			 struct scoutfs_lock *lock, u64 i_size);
 
+int scoutfs_dir_setup(struct super_block *sb);
+void scoutfs_dir_destroy(struct super_block *sb);
+
 int scoutfs_dir_init(void);
 void scoutfs_dir_exit(void);
 
@@ -53,6 +53,19 @@ ssize_t scoutfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 	return ret;
 }
 
+/*
+ * Writes serialize across mounts on the EX inode group lock even when
+ * they target disjoint regions of one file.
+ *
+ * XXX: byte-range write locks would let non-overlapping writers proceed
+ * in parallel but they can't be layered on the current lock space.
+ * Every buffered write dirties the shared inode item (i_size, mtime,
+ * data_version) in write_begin/write_end under the group lock, and both
+ * the item cache and page cache are invalidated at whole-lock and
+ * whole-file granularity.  Range granularity needs per-range metadata
+ * deltas that can be written concurrently under CW and merged, like the
+ * node zone items, and range-aware cache invalidation.
+ */
 ssize_t scoutfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			       unsigned long nr_segs, loff_t pos)
 {
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "super.h"
+#include "flight.h"
+
+/*
+ * A tiny always-on flight recorder.  The full tracepoints are too heavy
+ * to leave enabled in production and the tseq trees only show live
+ * entries.  Hot paths append compact fixed size records to percpu rings
+ * that are cheap enough to never turn off, and a debugfs file dumps the
+ * rings after the fact to diagnose latency spikes without having had
+ * tracing enabled.
+ *
+ * Recording isn't serialized against readers or other cpus.  A record
+ * can be torn as it's overwritten while being read, which is fine for
+ * forensics.  Times are monotonic nanoseconds so records from all the
+ * cpus can be knit together by the reader.
+ */
+
+struct flight_rec {
+	u64 ns;
+	u64 id;
+	u64 dur_ns;
+	s32 ret;
+	u32 op;
+};
+
+/* power of two records in each cpu's ring */
+#define FLIGHT_NR_RECS 1024
+
+struct flight_cpu {
+	unsigned long head;
+	struct flight_rec recs[FLIGHT_NR_RECS];
+};
+
+struct flight_info {
+	struct dentry *dentry;
+	struct flight_cpu __percpu *cpus;
+};
+
+static char *flight_op_names[] = {
+	[SCOUTFS_FLIGHT_ITEM_LOOKUP]	= "item_lookup",
+	[SCOUTFS_FLIGHT_LOCK_WAIT]	= "lock_wait",
+	[SCOUTFS_FLIGHT_NET_REQUEST]	= "net_request",
+};
+
+/*
+ * Append a record to the calling cpu's ring.  This has to stay cheap:
+ * one ktime read and a handful of stores to a cacheline that only this
+ * cpu writes.
+ */
+void scoutfs_flight_record(struct super_block *sb, u32 op, u64 id,
+			   u64 dur_ns, int ret)
+{
+	struct flight_info *finf = SCOUTFS_SB(sb)->flight_info;
+	struct flight_cpu *fc;
+	struct flight_rec *rec;
+
+	if (!finf)
+		return;
+
+	fc = get_cpu_ptr(finf->cpus);
+	rec = &fc->recs[fc->head++ & (FLIGHT_NR_RECS - 1)];
+	rec->ns = ktime_to_ns(ktime_get());
+	rec->id = id;
+	rec->dur_ns = dur_ns;
+	rec->ret = ret;
+	rec->op = op;
+	put_cpu_ptr(finf->cpus);
+}
+
+static int flight_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct flight_info *finf = SCOUTFS_SB(sb)->flight_info;
+	struct flight_rec rec;
+	struct flight_cpu *fc;
+	unsigned long head;
+	char *name;
+	int cpu;
+	int i;
+
+	for_each_possible_cpu(cpu) {
+		fc = per_cpu_ptr(finf->cpus, cpu);
+		head = ACCESS_ONCE(fc->head);
+
+		/* oldest first, records can be torn by the writer */
+		for (i = 0; i < FLIGHT_NR_RECS; i++) {
+			rec = fc->recs[(head + i) & (FLIGHT_NR_RECS - 1)];
+			if (rec.ns == 0)
+				continue;
+
+			if (rec.op < ARRAY_SIZE(flight_op_names) &&
+			    flight_op_names[rec.op])
+				name = flight_op_names[rec.op];
+			else
+				name = "unknown";
+
+			seq_printf(m, "cpu %u ns %llu op %s id %llu dur_ns %llu ret %d\n",
+				   cpu, rec.ns, name, rec.id, rec.dur_ns,
+				   rec.ret);
+		}
+	}
+
+	return 0;
+}
+
+static int flight_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, flight_show, inode->i_private);
+}
+
+static const struct file_operations flight_fops = {
+	.open		= flight_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int scoutfs_setup_flight(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct flight_info *finf;
+
+	finf = kzalloc(sizeof(struct flight_info), GFP_KERNEL);
+	if (!finf)
+		return -ENOMEM;
+
+	finf->cpus = alloc_percpu(struct flight_cpu);
+	if (!finf->cpus) {
+		kfree(finf);
+		return -ENOMEM;
+	}
+
+	finf->dentry = debugfs_create_file("flight", 0400, sbi->debug_root,
+					   sb, &flight_fops);
+	if (!finf->dentry) {
+		free_percpu(finf->cpus);
+		kfree(finf);
+		return -ENOMEM;
+	}
+
+	sbi->flight_info = finf;
+
+	return 0;
+}
+
+void scoutfs_destroy_flight(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct flight_info *finf = sbi->flight_info;
+
+	if (finf) {
+		debugfs_remove(finf->dentry);
+		free_percpu(finf->cpus);
+		kfree(finf);
+		sbi->flight_info = NULL;
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef _SCOUTFS_FLIGHT_H_
+#define _SCOUTFS_FLIGHT_H_
+
+/* operations recorded in the flight recorder ring */
+enum {
+	SCOUTFS_FLIGHT_ITEM_LOOKUP = 1,
+	SCOUTFS_FLIGHT_LOCK_WAIT,
+	SCOUTFS_FLIGHT_NET_REQUEST,
+	SCOUTFS_FLIGHT_NR_OPS,
+};
+
+void scoutfs_flight_record(struct super_block *sb, u32 op, u64 id,
+			   u64 dur_ns, int ret);
+
+int scoutfs_setup_flight(struct super_block *sb);
+void scoutfs_destroy_flight(struct super_block *sb);
+
+#endif
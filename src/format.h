@@ -109,8 +109,10 @@ struct scoutfs_key {
 #define skfe_last	_sk_second
 
 /*
- * The btree still uses memcmp() to compare keys.  We should fix that
- * before too long.
+ * The big endian encoding sorts bytes from most to least significant
+ * so ordering keys is ordering their encoded bytes.  The btree and
+ * segments store keys in this form so that searches can compare raw
+ * words of the encoding instead of extracting each field.
  */
 struct scoutfs_key_be {
 	__u8	sk_zone;
@@ -227,6 +229,8 @@ struct scoutfs_manifest_btree_key {
 
 struct scoutfs_manifest_btree_val {
 	__le64 segno;
+	/* deletion items in the segment, counted as it was written */
+	__le32 nr_deletions;
 	struct scoutfs_key last_key;
 } __packed;
 
@@ -254,26 +258,89 @@ struct scoutfs_extent_btree_key {
 
 /*
  * Items are packed into segments and linked together in a skip list.
- * Each item's header, links, key, and value are stored contiguously.
- * They're not allowed to cross a block boundary.
+ * Each item's header, links, key suffix, and value are stored
+ * contiguously.  They're not allowed to cross a block boundary.
+ *
+ * Sorted neighbouring keys share long big endian prefixes -- the zone,
+ * inode, and type bytes -- so items don't store their full keys.  Each
+ * item records how many leading key bytes it shares with the key of
+ * its governing fence, the most recent fence at or before the item,
+ * and stores only the remaining suffix bytes.  Fences store full keys,
+ * so any item's key can be rebuilt from its offset alone by finding
+ * its fence in the offset-ordered fence array.
  */
 struct scoutfs_segment_item {
-	struct scoutfs_key key;
+	__u8 key_pfx_len;
+	__u8 key_sfx_len;
 	__le16 val_len;
 	__u8 flags;
 	__u8 nr_links;
 	__le32 skip_links[0];
+	/* __u8 key_sfx[key_sfx_len] */
 	/* __u8 val_bytes[val_len] */
 } __packed;
 
 #define SCOUTFS_ITEM_FLAG_DELETION (1 << 0)
 
+/*
+ * The segment header records a fence for every Nth appended item: the
+ * item's key and its byte offset in the segment.  Key searches binary
+ * search the densely packed fences and then walk at most N items
+ * instead of chasing skip links through items scattered across the
+ * whole segment.
+ *
+ * The static fence array is sized for the worst case segment full of
+ * minimal items with one skip link, a one byte key suffix, and no
+ * value.
+ */
+#define SCOUTFS_SEG_FENCE_EVERY 64
+#define SCOUTFS_SEG_MAX_FENCES					\
+	((SCOUTFS_SEGMENT_SIZE /				\
+	  (offsetof(struct scoutfs_segment_item, skip_links[1]) + 1) + \
+	  SCOUTFS_SEG_FENCE_EVERY - 1) / SCOUTFS_SEG_FENCE_EVERY)
+
+/*
+ * Fences are accessed through the segment's page mappings so they're
+ * padded to a power of two size and the array is aligned in the segment
+ * block so that no single fence ever crosses a page boundary.
+ */
+struct scoutfs_segment_fence {
+	struct scoutfs_key_be key;
+	__le32 off;
+	__u8 _pad[1];
+} __packed;
+
+/*
+ * Each segment's header contains a bloom filter that summarizes the
+ * keys of all the items in the segment.  Point lookups can test the
+ * filter and skip reading segments that can't contain their key.  The
+ * filter size gives around eight bits per item for segments full of
+ * typical small items which keeps the false positive rate in the low
+ * single digits with our three probes.
+ */
+#define SCOUTFS_SEG_BLOOM_LONGS 4096
+#define SCOUTFS_SEG_BLOOM_BITS	(SCOUTFS_SEG_BLOOM_LONGS * 64)
+#define SCOUTFS_SEG_BLOOM_NR	3
+
+/*
+ * The packed items after the segment block header can optionally be
+ * compressed when the segment is written.  The header itself is never
+ * compressed so that bloom and fence lookups only need the header
+ * blocks.  comp_bytes records the compressed length of the item region
+ * and is zero for uncompressed segments.
+ */
+#define SCOUTFS_SEG_COMP_NONE	0
+#define SCOUTFS_SEG_COMP_LZO	1
+
 /*
  * Each large segment starts with a segment block that describes the
  * rest of the blocks that make up the segment.
  *
  * The crc covers the initial total_bytes of the segment but starts
- * after the padding.
+ * after the padding.  Compressed segments crc the compressed bytes.
+ *
+ * The fence array and bloom filter are at the end of the struct so that
+ * the small hot header fields all fall within the segment's first page.
  */
 struct scoutfs_segment_block {
 	__le32 crc;
@@ -284,6 +351,13 @@ struct scoutfs_segment_block {
 	__le32 total_bytes;
 	__le32 nr_items;
 	__le32 skip_links[SCOUTFS_MAX_SKIP_LINKS];
+	/* compressed byte count of the packed items, 0 if uncompressed */
+	__le32 comp_bytes;
+	__u8 comp_codec;
+	/* align the fence array so fences never cross page boundaries */
+	__u8 _align_pad[23];
+	struct scoutfs_segment_fence fences[SCOUTFS_SEG_MAX_FENCES];
+	__le64 bloom[SCOUTFS_SEG_BLOOM_LONGS];
 	/* packed items */
 } __packed;
 
@@ -307,12 +381,14 @@ struct scoutfs_segment_block {
 /* fs zone */
 #define SCOUTFS_INODE_TYPE			1
 #define SCOUTFS_XATTR_TYPE			2
+#define SCOUTFS_XATTR_PACKED_TYPE		9
 #define SCOUTFS_DIRENT_TYPE			3
 #define SCOUTFS_READDIR_TYPE			4
 #define SCOUTFS_LINK_BACKREF_TYPE		5
 #define SCOUTFS_SYMLINK_TYPE			6
 #define SCOUTFS_FILE_EXTENT_TYPE		7
 #define SCOUTFS_ORPHAN_TYPE			8
+#define SCOUTFS_INLINE_DATA_TYPE		10
 
 #define SCOUTFS_MAX_TYPE			16 /* power of 2 is efficient */
 
@@ -340,6 +416,19 @@ struct scoutfs_xattr {
 	__u8 name[0];
 } __packed;
 
+/*
+ * All of an inode's small xattrs are packed into the value of a single
+ * item so that getting or listing them doesn't have to walk an item per
+ * xattr.  The entries reuse the xattr header and are simply
+ * concatenated, the value can't be larger than a single item's max
+ * value so walking the few entries is cheap.  xattrs that don't fit
+ * fall back to the usual part items.
+ */
+struct scoutfs_packed_xattrs {
+	__u8 nr;
+	__u8 entries[0];
+} __packed;
+
 struct scoutfs_betimespec {
 	__be64 sec;
 	__be32 nsec;
@@ -428,7 +517,8 @@ struct scoutfs_inode {
 	struct scoutfs_timespec mtime;
 } __packed;
 
-#define SCOUTFS_INO_FLAG_TRUNCATE 0x1
+#define SCOUTFS_INO_FLAG_TRUNCATE	0x1
+#define SCOUTFS_INO_FLAG_INLINE_DATA	0x2
 
 #define SCOUTFS_ROOT_INO 1
 
@@ -483,6 +573,13 @@ enum {
 
 #define SCOUTFS_MAX_VAL_SIZE	SCOUTFS_XATTR_MAX_PART_SIZE
 
+/*
+ * Small file contents are stored in a single item next to the inode
+ * instead of in an allocated block extent.  The item holds the first
+ * i_size bytes of the file and is converted to extents on growth.
+ */
+#define SCOUTFS_INLINE_DATA_MAX_SIZE	SCOUTFS_MAX_VAL_SIZE
+
 /*
  * structures used by dlm
  */
@@ -550,6 +647,9 @@ enum {
 	SCOUTFS_NET_CMD_GET_MANIFEST_ROOT,
 	SCOUTFS_NET_CMD_STATFS,
 	SCOUTFS_NET_CMD_COMPACT,
+	SCOUTFS_NET_CMD_COMMIT_SEGMENT,
+	SCOUTFS_NET_CMD_RING_ADVERT,
+	SCOUTFS_NET_CMD_GET_SNAP_ROOT,
 	SCOUTFS_NET_CMD_UNKNOWN,
 };
 
@@ -594,11 +694,24 @@ struct scoutfs_net_key_range {
 struct scoutfs_net_manifest_entry {
 	__le64 segno;
 	__le64 seq;
+	__le32 nr_deletions;
 	struct scoutfs_key first;
 	struct scoutfs_key last;
 	__u8 level;
 } __packed;
 
+/*
+ * The server advertises the btree ring region that each commit wrote
+ * to a registered warm standby client which reads the blocks into its
+ * cache so that a promotion to server starts hot.  A client registers
+ * as the standby by sending its node_id in a request with the same
+ * command.
+ */
+struct scoutfs_net_ring_advert {
+	__le64 blkno;
+	__le64 nr;
+} __packed;
+
 struct scoutfs_net_statfs {
 	__le64 total_blocks;		/* total blocks in device */
 	__le64 next_ino;		/* next unused inode number */
@@ -669,6 +782,34 @@ struct scoutfs_net_compact_response {
 	struct scoutfs_net_manifest_entry ents[SCOUTFS_COMPACTION_MAX_OUTPUT];
 } __packed;
 
+/* enough segments per commit that heavy ingest writes large sorted runs */
+#define SCOUTFS_COMMIT_SEGMENT_MAX_NR 8
+
+/*
+ * A commit_segment request combines the three round trips that ended
+ * every client transaction: recording the written level 0 segments in
+ * the manifest, retiring the transaction's seq, and allocating the
+ * segno that the next transaction will write to.  The server performs
+ * them in order under one server commit and the response carries the
+ * next transaction's seq and segno.  A transaction's dirty items can
+ * fill multiple segments and they're all recorded by the one request.
+ */
+struct scoutfs_net_commit_segment {
+	__le64 used_seq;
+	__u8 nr_ments;
+	struct scoutfs_net_manifest_entry ments[0];
+} __packed;
+
+#define SCOUTFS_NET_COMMIT_SEGMENT_BYTES(nr) \
+	offsetof(struct scoutfs_net_commit_segment, ments[nr])
+
+struct scoutfs_net_commit_segment_response {
+	__le64 next_seq;
+	__le64 next_segno;
+	/* segments over level targets, writers throttle as this rises */
+	__le64 compact_debt;
+} __packed;
+
 /*
  * Scoutfs file handle structure - this can be copied out to userspace
  * via open by handle or put on the wire from NFS.
@@ -19,6 +19,7 @@
 #include <linux/pagemap.h>
 #include <linux/sched.h>
 #include <linux/list_sort.h>
+#include <linux/sort.h>
 
 #include "format.h"
 #include "super.h"
@@ -30,7 +31,6 @@
 #include "xattr.h"
 #include "trans.h"
 #include "msg.h"
-#include "kvec.h"
 #include "item.h"
 #include "client.h"
 #include "cmp.h"
@@ -48,8 +48,21 @@
  */
 
 struct inode_sb_info {
+	struct super_block *sb;
+
 	spinlock_t writeback_lock;
 	struct rb_root writeback_inodes;
+
+	/* index locks pinned until commit so updates don't relock */
+	spinlock_t ind_lock_lock;
+	struct list_head ind_lock_list;
+
+	/* evicted inodes queued for batched deletion by the worker */
+	spinlock_t orphan_lock;
+	struct list_head orphan_list;
+	bool orphan_stopped;
+	struct workqueue_struct *orphan_workq;
+	struct work_struct orphan_work;
 };
 
 #define DECLARE_INODE_SB_INFO(sb, name) \
@@ -70,6 +83,10 @@ static void scoutfs_inode_ctor(void *obj)
 	seqcount_init(&ci->seqcount);
 	ci->staging = false;
 	scoutfs_per_task_init(&ci->pt_data_lock);
+	spin_lock_init(&ci->ext_cache_lock);
+	scoutfs_lock_init_coverage(&ci->ext_cache_cov);
+	ci->ext_cache_len = 0;
+	scoutfs_lock_init_coverage(&ci->attr_cov);
 	init_rwsem(&ci->xattr_rwsem);
 	RB_CLEAR_NODE(&ci->writeback_node);
 	spin_lock_init(&ci->ino_alloc.lock);
@@ -133,9 +150,15 @@ static void remove_writeback_inode(struct inode_sb_info *inf,
 void scoutfs_destroy_inode(struct inode *inode)
 {
 	DECLARE_INODE_SB_INFO(inode->i_sb, inf);
+	struct scoutfs_inode_info *ci = SCOUTFS_I(inode);
+
+	/* the cov can't be on a lock's list as the slab object is reused */
+	scoutfs_lock_del_coverage(inode->i_sb, &ci->ext_cache_cov);
+	ci->ext_cache_len = 0;
+	scoutfs_lock_del_coverage(inode->i_sb, &ci->attr_cov);
 
 	spin_lock(&inf->writeback_lock);
-	remove_writeback_inode(inf, SCOUTFS_I(inode));
+	remove_writeback_inode(inf, ci);
 	spin_unlock(&inf->writeback_lock);
 
 	call_rcu(&inode->i_rcu, scoutfs_i_callback);
@@ -274,7 +297,6 @@ int scoutfs_inode_refresh(struct inode *inode, struct scoutfs_lock *lock,
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_key key;
 	struct scoutfs_inode sinode;
-	struct kvec val;
 	const u64 refresh_gen = lock->refresh_gen;
 	int ret;
 
@@ -286,15 +308,16 @@ int scoutfs_inode_refresh(struct inode *inode, struct scoutfs_lock *lock,
 	 */
 	BUG_ON(atomic64_read(&si->last_refreshed) > refresh_gen);
 
-	if (atomic64_read(&si->last_refreshed) == refresh_gen)
-		return 0;
+	if (atomic64_read(&si->last_refreshed) == refresh_gen) {
+		ret = 0;
+		goto out;
+	}
 
 	init_inode_key(&key, scoutfs_ino(inode));
-	kvec_init(&val, &sinode, sizeof(sinode));
-
 	mutex_lock(&si->item_mutex);
 	if (atomic64_read(&si->last_refreshed) < refresh_gen) {
-		ret = scoutfs_item_lookup_exact(sb, &key, &val, lock);
+		ret = scoutfs_item_lookup_exact_buf(sb, &key, &sinode,
+						    sizeof(sinode), lock);
 		if (ret == 0) {
 			load_inode(inode, &sinode);
 			atomic64_set(&si->last_refreshed, refresh_gen);
@@ -304,17 +327,36 @@ int scoutfs_inode_refresh(struct inode *inode, struct scoutfs_lock *lock,
 	}
 	mutex_unlock(&si->item_mutex);
 
+out:
+	/* fields stay current until the lock's coverage is invalidated */
+	if (ret == 0)
+		scoutfs_lock_add_coverage(sb, lock, &si->attr_cov);
+
 	return ret;
 }
 
+/*
+ * Bursts of getattrs, like an NFS server resolving handles over a
+ * directory, are satisfied by the coverage of the one lock grant that
+ * refreshed the first inode in its group instead of each paying for
+ * lock and item calls.
+ */
 int scoutfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 		    struct kstat *stat)
 {
 	struct inode *inode = dentry->d_inode;
+	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_lock *lock = NULL;
 	int ret;
 
+	if (scoutfs_lock_is_covered(sb, &si->attr_cov)) {
+		scoutfs_inc_counter(sb, getattr_cached);
+		generic_fillattr(inode, stat);
+		return 0;
+	}
+
+	scoutfs_inc_counter(sb, getattr_refresh);
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, SCOUTFS_LKF_REFRESH_INODE,
 				 inode, &lock);
 	if (ret == 0) {
@@ -612,6 +654,18 @@ struct inode *scoutfs_iget(struct super_block *sb, u64 ino)
 	struct inode *inode;
 	int ret;
 
+	/* covered cached inodes are current without lock or item calls */
+	inode = scoutfs_ilookup(sb, ino);
+	if (inode) {
+		si = SCOUTFS_I(inode);
+		if (scoutfs_lock_is_covered(sb, &si->attr_cov)) {
+			scoutfs_inc_counter(sb, iget_cached);
+			return inode;
+		}
+		iput(inode);
+	}
+
+	scoutfs_inc_counter(sb, iget_refresh);
 	ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0, ino, &lock);
 	if (ret)
 		return ERR_PTR(ret);
@@ -716,6 +770,7 @@ int scoutfs_dirty_inode_item(struct inode *inode, struct scoutfs_lock *lock)
 struct index_lock {
 	struct list_head head;
 	struct scoutfs_lock *lock;
+	bool borrowed;
 	u8 type;
 	u64 major;
 	u32 minor;
@@ -912,7 +967,6 @@ void scoutfs_update_inode_item(struct inode *inode, struct scoutfs_lock *lock,
 	const u64 ino = scoutfs_ino(inode);
 	struct scoutfs_key key;
 	struct scoutfs_inode sinode;
-	struct kvec val;
 	int ret;
 	int err;
 
@@ -928,9 +982,7 @@ void scoutfs_update_inode_item(struct inode *inode, struct scoutfs_lock *lock,
 	BUG_ON(ret);
 
 	init_inode_key(&key, ino);
-	kvec_init(&val, &sinode, sizeof(sinode));
-
-	err = scoutfs_item_update(sb, &key, &val, lock);
+	err = scoutfs_item_update_buf(sb, &key, &sinode, sizeof(sinode), lock);
 	if (err) {
 		scoutfs_err(sb, "inode %llu update err %d", ino, err);
 		BUG_ON(err);
@@ -1110,6 +1162,96 @@ static int prepare_index_deletion(struct super_block *sb,
 	return ret;
 }
 
+/*
+ * Index locks that updates have finished with are pinned on a per-super
+ * list until the transaction commits instead of being unlocked.  A
+ * stream of inode updates in one transaction hits the same coarse index
+ * lock groups over and over, and if a remote index walker is
+ * invalidating them then unlocking after every update turns each update
+ * into a cluster lock grant.  Pinning bounds that to one grant per
+ * group per commit.  The commit worker unlocks the pinned locks once
+ * writers have drained, so borrowers, who always hold the transaction,
+ * can safely use pinned locks without their own references.
+ */
+static struct scoutfs_lock *find_pinned_index_lock(struct super_block *sb,
+						   struct index_lock *needle)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	struct scoutfs_lock *lock = NULL;
+	struct index_lock *held;
+
+	spin_lock(&inf->ind_lock_lock);
+	list_for_each_entry(held, &inf->ind_lock_list, head) {
+		if (held->type == needle->type &&
+		    held->major == needle->major &&
+		    held->minor == needle->minor &&
+		    held->ino == needle->ino) {
+			lock = held->lock;
+			break;
+		}
+	}
+	spin_unlock(&inf->ind_lock_lock);
+
+	return lock;
+}
+
+/*
+ * Move an acquired index lock entry to the pinned list, or unlock and
+ * free it if another task already pinned the same group.
+ */
+static void pin_index_lock(struct super_block *sb,
+			   struct index_lock *ind_lock)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	struct index_lock *held;
+	bool dup = false;
+
+	spin_lock(&inf->ind_lock_lock);
+	list_for_each_entry(held, &inf->ind_lock_list, head) {
+		if (held->type == ind_lock->type &&
+		    held->major == ind_lock->major &&
+		    held->minor == ind_lock->minor &&
+		    held->ino == ind_lock->ino) {
+			dup = true;
+			break;
+		}
+	}
+	if (!dup)
+		list_move(&ind_lock->head, &inf->ind_lock_list);
+	spin_unlock(&inf->ind_lock_lock);
+
+	if (dup) {
+		scoutfs_unlock(sb, ind_lock->lock, DLM_LOCK_CW);
+		list_del_init(&ind_lock->head);
+		kfree(ind_lock);
+	}
+}
+
+/*
+ * Unlock all the index locks that updates pinned for the current
+ * transaction.  This is called by the commit worker once writers have
+ * drained and by unmount, and the periodic sync deadline commits make
+ * sure locks donated by failed updates don't linger and block remote
+ * index walkers.
+ */
+void scoutfs_inode_index_unlock_pinned(struct super_block *sb)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	struct index_lock *ind_lock;
+	struct index_lock *tmp;
+	LIST_HEAD(list);
+
+	spin_lock(&inf->ind_lock_lock);
+	list_splice_init(&inf->ind_lock_list, &list);
+	spin_unlock(&inf->ind_lock_lock);
+
+	list_for_each_entry_safe(ind_lock, tmp, &list, head) {
+		scoutfs_unlock(sb, ind_lock->lock, DLM_LOCK_CW);
+		list_del_init(&ind_lock->head);
+		kfree(ind_lock);
+	}
+}
+
 /*
  * Sample the transaction sequence before we start checking it to see if
  * indexed meta seq and data seq items will change.
@@ -1140,7 +1282,15 @@ int scoutfs_inode_index_try_lock_hold(struct super_block *sb,
 
 	list_sort(NULL, list, cmp_index_lock);
 
+	/*
+	 * Acquire locks that don't look pinned before holding the
+	 * trans, grants can block for a long time.  The pinned list can
+	 * drain before we hold the trans so this is only a hint.
+	 */
 	list_for_each_entry(ind_lock, list, head) {
+		if (find_pinned_index_lock(sb, ind_lock))
+			continue;
+
 		ret = scoutfs_lock_inode_index(sb, DLM_LOCK_CW, ind_lock->type,
 					       ind_lock->major, ind_lock->ino,
 					       &ind_lock->lock);
@@ -1153,6 +1303,33 @@ int scoutfs_inode_index_try_lock_hold(struct super_block *sb,
 		scoutfs_release_trans(sb);
 		ret = 1;
 	}
+	if (ret)
+		goto out;
+
+	/*
+	 * With the trans held the pinned list is stable and we can
+	 * borrow from it.  Rarely a commit drained a lock we expected
+	 * to borrow and we have to acquire it with the trans held.
+	 */
+	list_for_each_entry(ind_lock, list, head) {
+		if (ind_lock->lock)
+			continue;
+
+		ind_lock->lock = find_pinned_index_lock(sb, ind_lock);
+		if (ind_lock->lock) {
+			ind_lock->borrowed = true;
+			scoutfs_inc_counter(sb, inode_index_lock_borrowed);
+			continue;
+		}
+
+		ret = scoutfs_lock_inode_index(sb, DLM_LOCK_CW, ind_lock->type,
+					       ind_lock->major, ind_lock->ino,
+					       &ind_lock->lock);
+		if (ret) {
+			scoutfs_release_trans(sb);
+			goto out;
+		}
+	}
 
 out:
 	if (ret)
@@ -1180,7 +1357,9 @@ int scoutfs_inode_index_lock_hold(struct inode *inode, struct list_head *list,
 }
 
 /*
- * Unlocks and frees all the locks on the list.
+ * Frees all the locks on the list.  Locks that we acquired are pinned
+ * for the rest of the transaction so that later updates can borrow
+ * them; locks that we borrowed stay pinned under their own entry.
  */
 void scoutfs_inode_index_unlock(struct super_block *sb, struct list_head *list)
 {
@@ -1188,7 +1367,10 @@ void scoutfs_inode_index_unlock(struct super_block *sb, struct list_head *list)
 	struct index_lock *tmp;
 
 	list_for_each_entry_safe(ind_lock, tmp, list, head) {
-		scoutfs_unlock(sb, ind_lock->lock, DLM_LOCK_CW);
+		if (ind_lock->lock && !ind_lock->borrowed) {
+			pin_index_lock(sb, ind_lock);
+			continue;
+		}
 		list_del_init(&ind_lock->head);
 		kfree(ind_lock);
 	}
@@ -1313,7 +1495,6 @@ struct inode *scoutfs_new_inode(struct super_block *sb, struct inode *dir,
 	struct scoutfs_key key;
 	struct scoutfs_inode sinode;
 	struct inode *inode;
-	struct kvec val;
 	int ret;
 
 	inode = new_inode(sb);
@@ -1345,9 +1526,7 @@ struct inode *scoutfs_new_inode(struct super_block *sb, struct inode *dir,
 
 	store_inode(&sinode, inode);
 	init_inode_key(&key, scoutfs_ino(inode));
-	kvec_init(&val, &sinode, sizeof(sinode));
-
-	ret = scoutfs_item_create(sb, &key, &val, lock);
+	ret = scoutfs_item_create_buf(sb, &key, &sinode, sizeof(sinode), lock);
 	if (ret) {
 		iput(inode);
 		return ERR_PTR(ret);
@@ -1382,98 +1561,287 @@ static int remove_orphan_item(struct super_block *sb, u64 ino)
 	return ret;
 }
 
+/* the state of each inode deleted by a batch */
+struct inode_deletion {
+	struct scoutfs_lock *lock;
+	struct scoutfs_inode sinode;
+	struct scoutfs_key key;
+	u64 ino;
+	bool active;
+};
+
+static int cmp_u64s_ptr(const void *A, const void *B)
+{
+	const u64 *a = A;
+	const u64 *b = B;
+
+	return scoutfs_cmp_u64s(*a, *b);
+}
+
 /*
- * Remove all the items associated with a given inode.  This is only
+ * Remove all the items associated with a batch of inodes.  This is only
  * called once nlink has dropped to zero so we don't have to worry about
- * dirents referencing the inode or link backrefs.  Dropping nlink to 0
- * also created an orphan item.  That orphan item will continue
+ * dirents referencing the inodes or link backrefs.  Dropping nlink to 0
+ * also created orphan items.  Those orphan items will continue
  * triggering attempts to finish previous partial deletion until all
- * deletion is complete and the orphan item is removed.
+ * deletion is complete and the orphan items are removed.
+ *
+ * The potentially enormous numbers of data mapping and xattr items are
+ * deleted in their own transactions per inode.  The small known number
+ * of remaining items for all the inodes in the batch are then deleted
+ * in one shared transaction, so mass deletion pays for a commit per
+ * batch instead of per inode.  The inode locks are acquired in sorted
+ * ino order so concurrent batches can't deadlock.
+ *
+ * Failures of one inode don't stop the others.  A failed inode keeps
+ * its orphan item and a future scan retries its deletion.
  */
-static int delete_inode_items(struct super_block *sb, u64 ino)
+static int delete_inode_batch(struct super_block *sb, u64 *inos,
+			      unsigned int nr)
 {
-	struct scoutfs_lock *lock = NULL;
-	struct scoutfs_inode sinode;
-	struct scoutfs_key key;
+	struct inode_deletion *dels;
+	struct inode_deletion *del;
+	struct scoutfs_item_count cnt;
 	LIST_HEAD(ind_locks);
 	bool release = false;
-	struct kvec val;
 	umode_t mode;
 	u64 ind_seq;
 	u64 size;
+	int err = 0;
 	int ret;
+	int i;
 
-	ret = scoutfs_lock_ino(sb, DLM_LOCK_EX, 0, ino, &lock);
-	if (ret)
-		return ret;
+	dels = kcalloc(nr, sizeof(struct inode_deletion), GFP_NOFS);
+	if (!dels)
+		return -ENOMEM;
 
-	init_inode_key(&key, ino);
-	kvec_init(&val, &sinode, sizeof(sinode));
+	sort(inos, nr, sizeof(inos[0]), cmp_u64s_ptr, NULL);
 
-	ret = scoutfs_item_lookup_exact(sb, &key, &val, lock);
-	if (ret < 0) {
-		if (ret == -ENOENT)
-			ret = 0;
-		goto out;
-	}
+	/* lock each inode and delete its data and xattr items */
+	for (i = 0, del = dels; i < nr; i++, del++) {
+		del->ino = inos[i];
+		if (i > 0 && del->ino == dels[i - 1].ino)
+			continue;
 
-	/* XXX corruption, inode probably won't be freed without repair */
-	if (le32_to_cpu(sinode.nlink)) {
-		scoutfs_warn(sb, "Dangling orphan item for inode %llu.", ino);
-		ret = -EIO;
-		goto out;
-	}
+		ret = scoutfs_lock_ino(sb, DLM_LOCK_EX, 0, del->ino,
+				       &del->lock);
+		if (ret) {
+			err = err ?: ret;
+			continue;
+		}
 
-	mode = le32_to_cpu(sinode.mode);
-	size = le64_to_cpu(sinode.size);
-	trace_scoutfs_delete_inode(sb, ino, mode, size);
+		init_inode_key(&del->key, del->ino);
+		ret = scoutfs_item_lookup_exact_buf(sb, &del->key, &del->sinode,
+						    sizeof(del->sinode),
+						    del->lock);
+		if (ret < 0) {
+			if (ret != -ENOENT)
+				err = err ?: ret;
+			continue;
+		}
 
-	/* remove data items in their own transactions */
-	if (S_ISREG(mode)) {
-		ret = scoutfs_data_truncate_items(sb, NULL, ino, 0, ~0ULL,
-						  false, lock);
-		if (ret)
-			goto out;
+		/* XXX corruption, inode probably won't be freed w/o repair */
+		if (le32_to_cpu(del->sinode.nlink)) {
+			scoutfs_warn(sb, "Dangling orphan item for inode %llu.",
+				     del->ino);
+			err = err ?: -EIO;
+			continue;
+		}
+
+		mode = le32_to_cpu(del->sinode.mode);
+		size = le64_to_cpu(del->sinode.size);
+		trace_scoutfs_delete_inode(sb, del->ino, mode, size);
+
+		/* remove data items in their own transactions */
+		if (S_ISREG(mode)) {
+			ret = scoutfs_data_truncate_items(sb, NULL, del->ino, 0,
+							  ~0ULL, false,
+							  del->lock);
+			if (ret) {
+				err = err ?: ret;
+				continue;
+			}
+		}
+
+		ret = scoutfs_xattr_drop(sb, del->ino, del->lock);
+		if (ret) {
+			err = err ?: ret;
+			continue;
+		}
+
+		del->active = true;
 	}
 
-	ret = scoutfs_xattr_drop(sb, ino, lock);
-	if (ret)
+	/* then delete the remaining inode items in one shared transaction */
+	for (i = 0, del = dels; i < nr; i++, del++) {
+		if (del->active)
+			break;
+	}
+	if (i == nr)
 		goto out;
 
-	/* then delete the small known number of remaining inode items */
 retry:
-	ret = scoutfs_inode_index_start(sb, &ind_seq) ?:
-	      prepare_index_deletion(sb, &ind_locks, ino, mode, &sinode) ?:
-	      scoutfs_inode_index_try_lock_hold(sb, &ind_locks, ind_seq,
-						SIC_DROP_INODE(mode, size));
+	ret = scoutfs_inode_index_start(sb, &ind_seq);
+	cnt = SIC_EXACT(0, 0);
+	for (i = 0, del = dels; ret == 0 && i < nr; i++, del++) {
+		if (!del->active)
+			continue;
+		mode = le32_to_cpu(del->sinode.mode);
+		size = le64_to_cpu(del->sinode.size);
+		ret = prepare_index_deletion(sb, &ind_locks, del->ino, mode,
+					     &del->sinode);
+		cnt.items += SIC_DROP_INODE(mode, size).items;
+	}
+	ret = ret ?: scoutfs_inode_index_try_lock_hold(sb, &ind_locks, ind_seq,
+						       cnt);
 	if (ret > 0)
 		goto retry;
-	if (ret)
+	if (ret) {
+		err = err ?: ret;
 		goto out;
+	}
 
 	release = true;
 
-	ret = remove_index_items(sb, ino, &sinode, &ind_locks);
-	if (ret)
-		goto out;
+	for (i = 0, del = dels; i < nr; i++, del++) {
+		if (!del->active)
+			continue;
 
-	if (S_ISLNK(mode)) {
-		ret = scoutfs_symlink_drop(sb, ino, lock, size);
+		mode = le32_to_cpu(del->sinode.mode);
+		size = le64_to_cpu(del->sinode.size);
+
+		ret = remove_index_items(sb, del->ino, &del->sinode,
+					 &ind_locks);
+		if (ret == 0 && S_ISLNK(mode))
+			ret = scoutfs_symlink_drop(sb, del->ino, del->lock,
+						   size);
+		ret = ret ?: scoutfs_item_delete(sb, &del->key, del->lock);
+		ret = ret ?: remove_orphan_item(sb, del->ino);
 		if (ret)
-			goto out;
+			err = err ?: ret;
 	}
 
-	ret = scoutfs_item_delete(sb, &key, lock);
-	if (ret)
-		goto out;
-
-	ret = remove_orphan_item(sb, ino);
+	scoutfs_inc_counter(sb, orphan_delete_batch);
 out:
 	if (release)
 		scoutfs_release_trans(sb);
 	scoutfs_inode_index_unlock(sb, &ind_locks);
-	scoutfs_unlock(sb, lock, DLM_LOCK_EX);
-	return ret;
+	for (i = 0, del = dels; i < nr; i++, del++)
+		scoutfs_unlock(sb, del->lock, DLM_LOCK_EX);
+	kfree(dels);
+	return err;
+}
+
+static int delete_inode_items(struct super_block *sb, u64 ino)
+{
+	return delete_inode_batch(sb, &ino, 1);
+}
+
+/* batches bound the locks and trans reservation a deletion pass holds */
+#define ORPHAN_DELETE_BATCH 16
+
+struct orphan_ino {
+	struct list_head entry;
+	u64 ino;
+};
+
+static int cmp_orphan_ino(void *priv, struct list_head *A, struct list_head *B)
+{
+	struct orphan_ino *a = list_entry(A, struct orphan_ino, entry);
+	struct orphan_ino *b = list_entry(B, struct orphan_ino, entry);
+
+	return scoutfs_cmp_u64s(a->ino, b->ino);
+}
+
+/*
+ * Delete the items of inodes that eviction queued.  Processing the
+ * queue in sorted ino order lets batches share transactions and walks
+ * the deleted items in key order for sequential segment access.
+ * Errors are left for a future orphan scan to retry.
+ */
+static void inode_orphan_worker(struct work_struct *work)
+{
+	struct inode_sb_info *inf = container_of(work, struct inode_sb_info,
+						 orphan_work);
+	struct super_block *sb = inf->sb;
+	u64 inos[ORPHAN_DELETE_BATCH];
+	struct orphan_ino *oino;
+	struct orphan_ino *tmp;
+	unsigned int nr;
+	LIST_HEAD(list);
+
+	spin_lock(&inf->orphan_lock);
+	list_splice_init(&inf->orphan_list, &list);
+	spin_unlock(&inf->orphan_lock);
+
+	list_sort(NULL, &list, cmp_orphan_ino);
+
+	while (!list_empty(&list)) {
+		nr = 0;
+		list_for_each_entry_safe(oino, tmp, &list, entry) {
+			inos[nr++] = oino->ino;
+			list_del_init(&oino->entry);
+			kfree(oino);
+			if (nr == ORPHAN_DELETE_BATCH)
+				break;
+		}
+
+		delete_inode_batch(sb, inos, nr);
+	}
+}
+
+/*
+ * Queue an evicted inode's item deletion for the orphan worker.  The
+ * orphan item that was created as nlink hit zero makes this safe: if we
+ * fall over before the worker gets to the inode then a future orphan
+ * scan finishes the deletion.  If we can't queue we fall back to
+ * deleting synchronously in the evicting task like we used to.
+ */
+static void queue_orphan_deletion(struct super_block *sb, u64 ino)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+	struct orphan_ino *oino;
+	bool stopped;
+
+	oino = kmalloc(sizeof(struct orphan_ino), GFP_NOFS);
+	if (oino) {
+		oino->ino = ino;
+
+		spin_lock(&inf->orphan_lock);
+		stopped = inf->orphan_stopped;
+		if (!stopped)
+			list_add_tail(&oino->entry, &inf->orphan_list);
+		spin_unlock(&inf->orphan_lock);
+
+		if (!stopped) {
+			scoutfs_inc_counter(sb, orphan_delete_queued);
+			queue_work(inf->orphan_workq, &inf->orphan_work);
+			return;
+		}
+
+		kfree(oino);
+	}
+
+	delete_inode_items(sb, ino);
+}
+
+/*
+ * Stop the orphan worker and process deletions that eviction has
+ * already queued.  This is called early in unmount while transactions
+ * and the node_id lock that covers our orphan items are still around.
+ */
+void scoutfs_inode_orphan_stop(struct super_block *sb)
+{
+	DECLARE_INODE_SB_INFO(sb, inf);
+
+	if (!inf)
+		return;
+
+	spin_lock(&inf->orphan_lock);
+	inf->orphan_stopped = true;
+	spin_unlock(&inf->orphan_lock);
+
+	flush_work(&inf->orphan_work);
 }
 
 /*
@@ -1493,7 +1861,7 @@ void scoutfs_evict_inode(struct inode *inode)
 	truncate_inode_pages_final(&inode->i_data);
 
 	if (inode->i_nlink == 0)
-		delete_inode_items(inode->i_sb, scoutfs_ino(inode));
+		queue_orphan_deletion(inode->i_sb, scoutfs_ino(inode));
 clear:
 	clear_inode(inode);
 }
@@ -1508,11 +1876,13 @@ int scoutfs_drop_inode(struct inode *inode)
 }
 
 /*
- * Find orphan items and process each one.
+ * Find orphan items and process them in batches.  The orphan items are
+ * scanned in key order so batch deletion works through the deleted
+ * inodes' items with sequential segment access.
  *
  * Runtime of this will be bounded by the number of orphans, which could
- * theoretically be very large. If that becomes a problem we might want to push
- * this work off to a thread.
+ * theoretically be very large.  The orphan worker is the natural place
+ * to run this off of the caller's back.
  *
  * This only scans orphans for this node.  This will need to be covered by
  * the rest of node zone cleanup.
@@ -1521,8 +1891,10 @@ int scoutfs_scan_orphans(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_lock *lock = sbi->node_id_lock;
+	u64 inos[ORPHAN_DELETE_BATCH];
 	struct scoutfs_key key;
 	struct scoutfs_key last;
+	unsigned int nr = 0;
 	int err = 0;
 	int ret;
 
@@ -1538,9 +1910,13 @@ int scoutfs_scan_orphans(struct super_block *sb)
 		if (ret < 0)
 			goto out;
 
-		ret = delete_inode_items(sb, le64_to_cpu(key.sko_ino));
-		if (ret && ret != -ENOENT && !err)
-			err = ret;
+		inos[nr++] = le64_to_cpu(key.sko_ino);
+		if (nr == ORPHAN_DELETE_BATCH) {
+			ret = delete_inode_batch(sb, inos, nr);
+			if (ret && ret != -ENOENT && !err)
+				err = ret;
+			nr = 0;
+		}
 
 		if (le64_to_cpu(key.sko_ino) == U64_MAX) {
 			ret = -ENOENT;
@@ -1551,6 +1927,12 @@ int scoutfs_scan_orphans(struct super_block *sb)
 
 	ret = 0;
 out:
+	if (nr) {
+		int del = delete_inode_batch(sb, inos, nr);
+
+		if (del && del != -ENOENT && !err)
+			err = del;
+	}
 	return err ? err : ret;
 }
 
@@ -1668,8 +2050,20 @@ int scoutfs_inode_setup(struct super_block *sb)
 	if (!inf)
 		return -ENOMEM;
 
+	inf->sb = sb;
 	spin_lock_init(&inf->writeback_lock);
 	inf->writeback_inodes = RB_ROOT;
+	spin_lock_init(&inf->ind_lock_lock);
+	INIT_LIST_HEAD(&inf->ind_lock_list);
+	spin_lock_init(&inf->orphan_lock);
+	INIT_LIST_HEAD(&inf->orphan_list);
+	INIT_WORK(&inf->orphan_work, inode_orphan_worker);
+
+	inf->orphan_workq = alloc_workqueue("scoutfs_orphan", WQ_UNBOUND, 1);
+	if (!inf->orphan_workq) {
+		kfree(inf);
+		return -ENOMEM;
+	}
 
 	sbi->inode_sb_info = inf;
 
@@ -1680,6 +2074,8 @@ void scoutfs_inode_destroy(struct super_block *sb)
 {
 	struct inode_sb_info *inf = SCOUTFS_SB(sb)->inode_sb_info;
 
+	destroy_workqueue(inf->orphan_workq);
+	scoutfs_inode_index_unlock_pinned(sb);
 	kfree(inf);
 }
 
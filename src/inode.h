@@ -48,6 +48,25 @@ struct scoutfs_inode_info {
 	seqcount_t seqcount;
 	bool staging;			/* holder of i_mutex is staging */
 	struct scoutfs_per_task pt_data_lock;
+
+	/*
+	 * The last mapped file extent fronts the item cache for repeated
+	 * get_block calls.  It's only used while its recorded lock
+	 * coverage holds and is dropped when extent items are removed.
+	 */
+	spinlock_t ext_cache_lock;
+	struct scoutfs_lock_coverage ext_cache_cov;
+	u64 ext_cache_start;
+	u64 ext_cache_len;
+	u64 ext_cache_map;
+
+	/*
+	 * While the refreshing lock's coverage holds, the vfs inode
+	 * fields are current and readers like getattr and iget don't
+	 * need lock or item traffic.
+	 */
+	struct scoutfs_lock_coverage attr_cov;
+
 	struct rw_semaphore xattr_rwsem;
 	struct rb_node writeback_node;
 	struct inode inode;
@@ -87,6 +106,7 @@ int scoutfs_inode_index_lock_hold(struct inode *inode, struct list_head *list,
 				  bool set_data_seq,
 				  const struct scoutfs_item_count cnt);
 void scoutfs_inode_index_unlock(struct super_block *sb, struct list_head *list);
+void scoutfs_inode_index_unlock_pinned(struct super_block *sb);
 
 int scoutfs_dirty_inode_item(struct inode *inode, struct scoutfs_lock *lock);
 void scoutfs_update_inode_item(struct inode *inode, struct scoutfs_lock *lock,
@@ -114,6 +134,7 @@ int scoutfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 int scoutfs_setattr(struct dentry *dentry, struct iattr *attr);
 
 int scoutfs_scan_orphans(struct super_block *sb);
+void scoutfs_inode_orphan_stop(struct super_block *sb);
 
 void scoutfs_inode_queue_writeback(struct inode *inode);
 int scoutfs_inode_walk_writeback(struct super_block *sb, bool write);
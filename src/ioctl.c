@@ -29,6 +29,7 @@
 #include "inode.h"
 #include "item.h"
 #include "data.h"
+#include "extents.h"
 #include "client.h"
 #include "lock.h"
 #include "manifest.h"
@@ -179,6 +180,201 @@ out:
 	return ret;
 }
 
+#define WALK_MORE_BATCH_NR 16
+
+/*
+ * Walk an inode index like walk_inodes but fill each entry with the
+ * fields of the indexed inode so that incremental backup doesn't pay a
+ * stat ioctl round trip per changed inode.
+ *
+ * We can't load inodes while holding the index lock.  Inode locks are
+ * ordered before index locks in the update paths so igetting under the
+ * index lock could deadlock.  Instead we gather a batch of index
+ * positions under the index lock, drop it, and then load each inode and
+ * copy its entry to userspace.  The index can move under us between
+ * batches but callers already have to cope with the indexes only being
+ * stable as of the last synced transaction.
+ */
+static long scoutfs_ioc_walk_inodes_more(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_walk_inodes_more_entry ent;
+	struct scoutfs_ioctl_walk_inodes_entry pos[WALK_MORE_BATCH_NR];
+	struct scoutfs_ioctl_walk_inodes_more walk;
+	struct scoutfs_lock *lock = NULL;
+	struct scoutfs_key next_key;
+	struct scoutfs_key last_key;
+	struct scoutfs_key key;
+	struct inode *inode;
+	bool done = false;
+	u64 last_seq;
+	unsigned int bat;
+	unsigned int i;
+	int ret = 0;
+	u32 nr = 0;
+	u8 type;
+
+	if (!capable(CAP_DAC_READ_SEARCH))
+		return -EPERM;
+
+	if (copy_from_user(&walk, (void __user *)arg, sizeof(walk)))
+		return -EFAULT;
+
+	if (walk.index == SCOUTFS_IOC_WALK_INODES_META_SEQ)
+		type = SCOUTFS_INODE_INDEX_META_SEQ_TYPE;
+	else if (walk.index == SCOUTFS_IOC_WALK_INODES_DATA_SEQ)
+		type = SCOUTFS_INODE_INDEX_DATA_SEQ_TYPE;
+	else
+		return -EINVAL;
+
+	if (walk.entry_bytes == 0)
+		return -EINVAL;
+	walk.entry_bytes = min_t(u64, walk.entry_bytes, sizeof(ent));
+
+	/* clamp results to the inodes in the farthest stable seq */
+	ret = scoutfs_client_get_last_seq(sb, &last_seq);
+	if (ret)
+		return ret;
+
+	if (last_seq < walk.last.major) {
+		walk.last.major = last_seq;
+		walk.last.minor = ~0;
+		walk.last.ino = ~0ULL;
+	}
+
+	scoutfs_inode_init_index_key(&key, type, walk.first.major,
+				     walk.first.minor, walk.first.ino);
+	scoutfs_inode_init_index_key(&last_key, type, walk.last.major,
+				     walk.last.minor, walk.last.ino);
+
+	/* cap nr to the max the ioctl can return to a compat task */
+	walk.nr_entries = min_t(u64, walk.nr_entries, INT_MAX);
+
+	while (!done && nr < walk.nr_entries) {
+
+		ret = scoutfs_lock_inode_index(sb, DLM_LOCK_PR, key.sk_type,
+					       le64_to_cpu(key.skii_major),
+					       le64_to_cpu(key.skii_ino),
+					       &lock);
+		if (ret < 0)
+			goto out;
+
+		bat = 0;
+		while (bat < ARRAY_SIZE(pos) && nr + bat < walk.nr_entries) {
+
+			ret = scoutfs_item_next(sb, &key, &last_key, NULL,
+						lock);
+			if (ret < 0 && ret != -ENOENT)
+				break;
+
+			if (ret == -ENOENT) {
+
+				/* done if lock covers last iteration key */
+				if (scoutfs_key_compare(&last_key,
+							&lock->end) <= 0) {
+					ret = 0;
+					done = true;
+					break;
+				}
+
+				/* continue iterating after empty region */
+				key = lock->end;
+				scoutfs_key_inc(&key);
+
+				scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+				lock = NULL;
+
+				ret = scoutfs_manifest_next_key(sb, &key,
+								&next_key);
+				if (ret < 0 && ret != -ENOENT)
+					goto out;
+
+				if (ret == -ENOENT ||
+				    scoutfs_key_compare(&next_key,
+							&last_key) > 0) {
+					ret = 0;
+					done = true;
+					break;
+				}
+
+				key = next_key;
+
+				ret = scoutfs_lock_inode_index(sb,
+						DLM_LOCK_PR, key.sk_type,
+						le64_to_cpu(key.skii_major),
+						le64_to_cpu(key.skii_ino),
+						&lock);
+				if (ret < 0)
+					goto out;
+
+				continue;
+			}
+
+			pos[bat].major = le64_to_cpu(key.skii_major);
+			pos[bat].minor = 0;
+			pos[bat].ino = le64_to_cpu(key.skii_ino);
+			bat++;
+
+			scoutfs_key_inc(&key);
+		}
+
+		if (lock) {
+			scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+			lock = NULL;
+		}
+		if (ret < 0)
+			break;
+
+		for (i = 0; i < bat; i++) {
+			inode = scoutfs_iget(sb, pos[i].ino);
+			if (IS_ERR(inode)) {
+				ret = PTR_ERR(inode);
+				/* index items can outlive deleted inodes */
+				if (ret == -ENOENT) {
+					ret = 0;
+					continue;
+				}
+				goto out;
+			}
+
+			memset(&ent, 0, sizeof(ent));
+			ent.major = pos[i].major;
+			ent.minor = pos[i].minor;
+			ent.ino = pos[i].ino;
+			ent.size = i_size_read(inode);
+			ent.meta_seq = scoutfs_inode_meta_seq(inode);
+			ent.data_seq = scoutfs_inode_data_seq(inode);
+			ent.data_version = scoutfs_inode_data_version(inode);
+			scoutfs_inode_get_onoff(inode, &ent.online_blocks,
+						&ent.offline_blocks);
+
+			iput(inode);
+
+			if (copy_to_user((void __user *)(unsigned long)
+					 walk.entries_ptr, &ent,
+					 walk.entry_bytes)) {
+				ret = -EFAULT;
+				goto out;
+			}
+
+			nr++;
+			walk.entries_ptr += walk.entry_bytes;
+		}
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+out:
+	if (nr > 0)
+		ret = nr;
+
+	return ret;
+}
+
 /*
  * See the comment above the definition of struct scoutfs_ioctl_ino_path
  * for ioctl semantics.
@@ -269,11 +465,10 @@ out:
  * XXX permissions?
  * XXX a lot of this could be generic file write prep
  */
-static long scoutfs_ioc_release(struct file *file, unsigned long arg)
+static int release_file_blocks(struct inode *inode, u64 block, u64 count,
+			       u64 data_version)
 {
-	struct inode *inode = file_inode(file);
 	struct super_block *sb = inode->i_sb;
-	struct scoutfs_ioctl_release args;
 	struct scoutfs_lock *lock = NULL;
 	loff_t start;
 	loff_t end_inc;
@@ -282,21 +477,11 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 	u64 isize;
 	int ret;
 
-	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
-		return -EFAULT;
-
-	trace_scoutfs_ioc_release(sb, &args);
-
-	if (args.count == 0)
+	if (count == 0)
 		return 0;
-	if ((args.block + args.count) < args.block)
+	if ((block + count) < block)
 		return -EINVAL;
 
-
-	ret = mnt_want_write_file(file);
-	if (ret)
-		return ret;
-
 	mutex_lock(&inode->i_mutex);
 
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_EX, SCOUTFS_LKF_REFRESH_INODE,
@@ -309,12 +494,7 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 		goto out;
 	}
 
-	if (!(file->f_mode & FMODE_WRITE)) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (scoutfs_inode_data_version(inode) != args.data_version) {
+	if (scoutfs_inode_data_version(inode) != data_version) {
 		ret = -ESTALE;
 		goto out;
 	}
@@ -322,13 +502,12 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 	inode_dio_wait(inode);
 
 	/* drop all clean and dirty cached blocks in the range */
-	start = args.block << SCOUTFS_BLOCK_SHIFT;
-	end_inc = ((args.block + args.count) << SCOUTFS_BLOCK_SHIFT) - 1;
+	start = block << SCOUTFS_BLOCK_SHIFT;
+	end_inc = ((block + count) << SCOUTFS_BLOCK_SHIFT) - 1;
 	truncate_inode_pages_range(&inode->i_data, start, end_inc);
 
 	ret = scoutfs_data_truncate_items(sb, inode, scoutfs_ino(inode),
-					  args.block,
-					  args.block + args.count - 1, true,
+					  block, block + count - 1, true,
 					  lock);
 	if (ret == 0) {
 		scoutfs_inode_get_onoff(inode, &online, &offline);
@@ -346,12 +525,104 @@ static long scoutfs_ioc_release(struct file *file, unsigned long arg)
 out:
 	scoutfs_unlock(sb, lock, DLM_LOCK_EX);
 	mutex_unlock(&inode->i_mutex);
-	mnt_drop_write_file(file);
+	return ret;
+}
+
+static long scoutfs_ioc_release(struct file *file, unsigned long arg)
+{
+	struct inode *inode = file_inode(file);
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_ioctl_release args;
+	int ret;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	trace_scoutfs_ioc_release(sb, &args);
 
+	if (!(file->f_mode & FMODE_WRITE)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		goto out;
+
+	ret = release_file_blocks(inode, args.block, args.count,
+				  args.data_version);
+
+	mnt_drop_write_file(file);
+out:
 	trace_scoutfs_ioc_release_ret(sb, ret);
 	return ret;
 }
 
+/*
+ * Release the blocks of an array of files identified by inode number.
+ * Each entry gets the result of its release written back to it and a
+ * failed entry doesn't stop the rest of the batch.  This exists so that
+ * archive movers releasing millions of files aren't limited by an
+ * open/ioctl/close round trip per file.
+ */
+static long scoutfs_ioc_release_batch(struct file *file, unsigned long arg)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct scoutfs_ioctl_release_batch_entry __user *uent;
+	struct scoutfs_ioctl_release_batch_entry ent;
+	struct scoutfs_ioctl_release_batch args;
+	struct inode *inode;
+	long nr_ok = 0;
+	u64 i;
+	int ret;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	uent = (void __user *)(unsigned long)args.entries_ptr;
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < args.nr_entries; i++, uent++) {
+		if (copy_from_user(&ent, uent, sizeof(ent))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		inode = scoutfs_iget(sb, ent.ino);
+		if (IS_ERR(inode)) {
+			ret = PTR_ERR(inode);
+		} else {
+			ret = release_file_blocks(inode, ent.block, ent.count,
+						  ent.data_version);
+			iput(inode);
+		}
+
+		ent.err = ret;
+		if (put_user(ent.err, &uent->err)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (ret == 0)
+			nr_ok++;
+		ret = 0;
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	mnt_drop_write_file(file);
+
+	return ret ?: nr_ok;
+}
+
 /*
  * Write the archived contents of the file back if the data_version
  * still matches.
@@ -540,21 +811,98 @@ static long scoutfs_ioc_item_cache_keys(struct file *file, unsigned long arg)
 	return ret ?: total;
 }
 
+/* a batch of extents per inode lock hold */
+#define FILE_EXTENTS_BATCH_NR 128
+
+/*
+ * Fill the caller's buffer with the file's extents starting from their
+ * iblock cursor.  Returns the number of entries filled, 0 when there
+ * are no more extents.  The caller resumes by setting their cursor to
+ * the last returned extent's iblock + count.
+ */
+static long scoutfs_ioc_file_extents(struct file *file, unsigned long arg)
+{
+	struct inode *inode = file_inode(file);
+	struct scoutfs_ioctl_file_extent __user *uent;
+	struct scoutfs_ioctl_file_extents args;
+	struct scoutfs_ioctl_file_extent ent;
+	struct scoutfs_extent *exts;
+	u64 iblock;
+	u32 filled = 0;
+	int ret = 0;
+	int nr;
+	int i;
+
+	if (copy_from_user(&args, (void __user *)arg, sizeof(args)))
+		return -EFAULT;
+
+	if (args.nr_entries == 0)
+		return 0;
+
+	exts = kmalloc(FILE_EXTENTS_BATCH_NR * sizeof(exts[0]), GFP_KERNEL);
+	if (!exts)
+		return -ENOMEM;
+
+	uent = (void __user *)(unsigned long)args.entries_ptr;
+	iblock = args.iblock;
+
+	while (filled < args.nr_entries) {
+		nr = min_t(u64, args.nr_entries - filled,
+			   FILE_EXTENTS_BATCH_NR);
+
+		ret = scoutfs_data_file_extents(inode, iblock, exts, nr);
+		if (ret <= 0) {
+			if (ret == -ENOENT)
+				ret = 0;
+			break;
+		}
+
+		for (i = 0; i < ret; i++) {
+			memset(&ent, 0, sizeof(ent));
+			ent.iblock = exts[i].start;
+			ent.blkno = exts[i].map;
+			ent.count = exts[i].len;
+			if (exts[i].flags & SEF_OFFLINE)
+				ent.flags |= SCOUTFS_IOC_FEXT_OFFLINE;
+			if (exts[i].flags & SEF_UNWRITTEN)
+				ent.flags |= SCOUTFS_IOC_FEXT_UNWRITTEN;
+
+			if (copy_to_user(&uent[filled], &ent, sizeof(ent))) {
+				ret = -EFAULT;
+				goto out;
+			}
+			filled++;
+		}
+
+		iblock = exts[ret - 1].start + exts[ret - 1].len;
+		ret = 0;
+	}
+out:
+	kfree(exts);
+	return ret ?: filled;
+}
+
 long scoutfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	switch (cmd) {
 	case SCOUTFS_IOC_WALK_INODES:
 		return scoutfs_ioc_walk_inodes(file, arg);
+	case SCOUTFS_IOC_WALK_INODES_MORE:
+		return scoutfs_ioc_walk_inodes_more(file, arg);
 	case SCOUTFS_IOC_INO_PATH:
 		return scoutfs_ioc_ino_path(file, arg);
 	case SCOUTFS_IOC_RELEASE:
 		return scoutfs_ioc_release(file, arg);
+	case SCOUTFS_IOC_RELEASE_BATCH:
+		return scoutfs_ioc_release_batch(file, arg);
 	case SCOUTFS_IOC_STAGE:
 		return scoutfs_ioc_stage(file, arg);
 	case SCOUTFS_IOC_STAT_MORE:
 		return scoutfs_ioc_stat_more(file, arg);
 	case SCOUTFS_IOC_ITEM_CACHE_KEYS:
 		return scoutfs_ioc_item_cache_keys(file, arg);
+	case SCOUTFS_IOC_FILE_EXTENTS:
+		return scoutfs_ioc_file_extents(file, arg);
 	}
 
 	return -ENOTTY;
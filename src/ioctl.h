@@ -229,4 +229,113 @@ enum {
 #define SCOUTFS_IOC_ITEM_CACHE_KEYS _IOW(SCOUTFS_IOCTL_MAGIC, 8, \
 					 struct scoutfs_ioctl_item_cache_keys)
 
+/*
+ * Release the blocks of many files in one call so that archive
+ * migration isn't bound by a syscall round trip per file.  The caller
+ * can be holding any file on the file system and identifies files by
+ * inode number, so it needs CAP_SYS_ADMIN.
+ *
+ * Each entry is released with the same semantics as SCOUTFS_IOC_RELEASE
+ * and its result is written back to its err field: 0 on success or a
+ * negative errno.  Entries are processed in order.
+ *
+ * Returns the number of entries that were released successfully, or a
+ * negative errno if the arguments themselves couldn't be processed.
+ */
+struct scoutfs_ioctl_release_batch_entry {
+	__u64 ino;
+	__u64 block;
+	__u64 count;
+	__u64 data_version;
+	__s32 err;
+	__u32 _pad;
+} __packed;
+
+struct scoutfs_ioctl_release_batch {
+	__u64 entries_ptr;
+	__u64 nr_entries;
+} __packed;
+
+#define SCOUTFS_IOC_RELEASE_BATCH _IOW(SCOUTFS_IOCTL_MAGIC, 9, \
+					struct scoutfs_ioctl_release_batch)
+
+/*
+ * Walk an inode index as in SCOUTFS_IOC_WALK_INODES but also return the
+ * fields of each indexed inode along with its index position.  Backup
+ * agents can discover changed inodes and their sizes and data_versions
+ * with one walk instead of a stat ioctl round trip per returned inode.
+ *
+ * The inodes aren't locked across the whole walk.  Each entry reflects
+ * the inode at the time the walk loaded it.  Index entries whose inode
+ * has been deleted by the time the walk loads it are skipped.
+ *
+ * @entry_bytes works like stat_more's valid_bytes: the caller sets it
+ * to the size of the entry struct that they understand and the kernel
+ * fills and advances by the min of that and the entry size it
+ * understands.  New fields are only added to the end of the entry
+ * struct.
+ *
+ * Returning fields of inodes that the caller may not be able to
+ * traverse to requires CAP_DAC_READ_SEARCH.
+ */
+struct scoutfs_ioctl_walk_inodes_more_entry {
+	__u64 major;
+	__u32 minor;
+	__u64 ino;
+	__u64 size;
+	__u64 meta_seq;
+	__u64 data_seq;
+	__u64 data_version;
+	__u64 online_blocks;
+	__u64 offline_blocks;
+} __packed;
+
+struct scoutfs_ioctl_walk_inodes_more {
+	struct scoutfs_ioctl_walk_inodes_entry first;
+	struct scoutfs_ioctl_walk_inodes_entry last;
+	__u64 entries_ptr;
+	__u64 entry_bytes;
+	__u32 nr_entries;
+	__u8 index;
+} __packed;
+
+#define SCOUTFS_IOC_WALK_INODES_MORE _IOW(SCOUTFS_IOCTL_MAGIC, 10, \
+				struct scoutfs_ioctl_walk_inodes_more)
+
+/*
+ * Fill the user's buffer with the file's extents starting with the
+ * first extent that ends at or after the iblock position, in units of
+ * 4KB blocks.  Archive agents plan staging over enormous sparse files
+ * with this instead of fiemap so that each call can resume from a
+ * cursor instead of re-walking from offset zero.
+ *
+ * To start iterating set iblock to 0.  After each set of results set
+ * iblock to the last returned extent's iblock + count and call again.
+ * The number of entries filled is returned and 0 indicates that there
+ * are no more extents.
+ *
+ * The extents are read under the inode's lock per call, so an
+ * iteration over a file that's being modified sees each batch's
+ * extents consistently but not the whole file.
+ */
+struct scoutfs_ioctl_file_extent {
+	__u64 iblock;
+	__u64 blkno;
+	__u64 count;
+	__u8 flags;
+	__u8 _pad[7];
+} __packed;
+
+#define SCOUTFS_IOC_FEXT_OFFLINE	(1 << 0)
+#define SCOUTFS_IOC_FEXT_UNWRITTEN	(1 << 1)
+
+struct scoutfs_ioctl_file_extents {
+	__u64 iblock;
+	__u64 entries_ptr;
+	__u32 nr_entries;
+} __packed;
+
+#define SCOUTFS_IOC_FILE_EXTENTS _IOW(SCOUTFS_IOCTL_MAGIC, 11, \
+				      struct scoutfs_ioctl_file_extents)
+
 #endif
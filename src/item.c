@@ -14,7 +14,8 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/rbtree_augmented.h>
+#include <linux/hash.h>
+#include <linux/rbtree.h>
 
 #include "super.h"
 #include "format.h"
@@ -23,6 +24,7 @@
 #include "item.h"
 #include "seg.h"
 #include "counters.h"
+#include "flight.h"
 #include "scoutfs_trace.h"
 #include "trans.h"
 
@@ -42,6 +44,17 @@
  * lookups.  We only need deletion items for keys that exist in
  * segments.  We can immediately free non-persistent items when they're
  * deleted.
+ *
+ * The cache is split into a fixed array of shards, each with its own
+ * lock, item and range rbtrees, lru, and dirty item accounting.  Keys
+ * are mapped to shards by hashing contiguous regions of the key space
+ * that line up with the ranges covered by cluster locks: inode groups
+ * in the fs zone, major groups in the index zone, and node ids in the
+ * node zone.  Cached ranges are clipped to those regions as they're
+ * inserted so a given range, and all the items it covers, always live
+ * entirely within one shard.  Point operations then only ever lock the
+ * one shard that their key hashes to and operations on different lock
+ * groups proceed concurrently.
  */
 
 static bool invalid_key_val(struct scoutfs_key *key, struct kvec *val)
@@ -49,24 +62,55 @@ static bool invalid_key_val(struct scoutfs_key *key, struct kvec *val)
 	return WARN_ON_ONCE(val && (val->iov_len > SCOUTFS_MAX_VAL_SIZE));
 }
 
-struct item_cache {
-	struct super_block *sb;
+static bool invalid_key_buf(struct scoutfs_key *key, void *buf,
+			    unsigned int len)
+{
+	return WARN_ON_ONCE(len > SCOUTFS_MAX_VAL_SIZE || (!buf && len));
+}
+
+#define ITEM_SHARD_SHIFT 5
+#define ITEM_NR_SHARDS (1 << ITEM_SHARD_SHIFT)
 
+struct item_shard {
 	spinlock_t lock;
 	struct rb_root items;
 	struct rb_root ranges;
 
+	/*
+	 * Dirty items are indexed by their own rbtree so that marking
+	 * and clearing touches only the dirty index and the commit
+	 * walk only visits dirty items, no matter how many clean items
+	 * surround them in the item tree.
+	 */
+	struct rb_root dirty_items;
 	long nr_dirty_items;
 	long dirty_val_bytes;
 
-	struct shrinker shrinker;
+	/*
+	 * Clean items start on the probation lru and are only promoted
+	 * to the protected lru when they're referenced again.  Items
+	 * that a streaming scan touches once never displace the hot set,
+	 * and the shrinker drains probation before protected.
+	 */
+	struct list_head probation_list;
+	unsigned long probation_nr;
 	struct list_head lru_list;
 	unsigned long lru_nr;
+} ____cacheline_aligned_in_smp;
+
+struct item_cache {
+	struct super_block *sb;
+
+	struct item_shard shards[ITEM_NR_SHARDS];
+
+	struct shrinker shrinker;
 };
 
 /*
- * The dirty bits track if the given item is dirty and if its child
- * subtrees contain any dirty items.
+ * Dirty items sit in their shard's dirty rbtree through dirty_node; an
+ * empty dirty_node means the item is clean.  The saved_dirty bit
+ * remembers dirtiness while a saved item is detached from its shard
+ * between delete_save and restore.
  *
  * The entry list_head typically stores clean items on an lru for shrinking.
  * It's also briefly used to track items in a batch after they're
@@ -79,13 +123,21 @@ struct item_cache {
  */
 struct cached_item {
 	struct rb_node node;
+	struct rb_node dirty_node;
 	struct list_head entry;
 
-	long dirty;
 	unsigned deletion:1,
-		 persistent:1;
-
+		 persistent:1,
+		 protected:1,
+		 saved_dirty:1;
+
+	/*
+	 * The key is also stored in its big endian encoding so that the
+	 * rbtree descents that dominate metadata scans compare words of
+	 * the encodings instead of each key field.
+	 */
 	struct scoutfs_key key;
+	struct scoutfs_key_be key_be;
 	void *val;
 	unsigned int val_len;
 };
@@ -95,55 +147,156 @@ struct cached_range {
 
 	struct scoutfs_key start;
 	struct scoutfs_key end;
+
+	/*
+	 * A detached range covers items that were cached under a lock
+	 * that has since been released.  It isn't usable cache: reads
+	 * miss and the shrinker trims it like any other range.  It
+	 * records the lock's write version and is only made usable
+	 * again if the lock is granted with the version unchanged.
+	 */
+	bool detached;
+	u64 detached_version;
 };
 
 #define trace_range(which, sb, rng) \
 	trace_scoutfs_item_range_##which(sb, (rng), &(rng)->start, &(rng)->end)
 
+/*
+ * Set the caller's key to the last key of the contiguous shard region
+ * that contains the given key.  The regions match the granularity of
+ * the ranges covered by cluster locks so that the ranges cached under a
+ * lock almost never have to be clipped into multiple regions.
+ */
+static void key_shard_end(struct scoutfs_key *key, struct scoutfs_key *end)
+{
+	scoutfs_key_set_ones(end);
+	end->sk_zone = key->sk_zone;
+
+	switch (key->sk_zone) {
+	case SCOUTFS_INODE_INDEX_ZONE:
+		end->_sk_first = key->_sk_first;
+		end->sk_type = key->sk_type;
+		end->_sk_second = key->_sk_second |
+				  cpu_to_le64(SCOUTFS_LOCK_SEQ_GROUP_MASK);
+		break;
+	case SCOUTFS_NODE_ZONE:
+		end->_sk_first = key->_sk_first;
+		break;
+	case SCOUTFS_FS_ZONE:
+		end->_sk_first = key->_sk_first |
+				 cpu_to_le64(SCOUTFS_LOCK_INODE_GROUP_MASK);
+		break;
+	}
+}
+
+/*
+ * Map a key to its shard by hashing its containing region.  All the
+ * keys inside one region hash to the same shard.
+ */
+static struct item_shard *key_shard(struct item_cache *cac,
+				    struct scoutfs_key *key)
+{
+	u64 h = (u64)key->sk_zone << 56;
+
+	switch (key->sk_zone) {
+	case SCOUTFS_INODE_INDEX_ZONE:
+		h ^= ((u64)key->sk_type << 48) ^
+		     (le64_to_cpu(key->_sk_second) &
+		      ~SCOUTFS_LOCK_SEQ_GROUP_MASK);
+		break;
+	case SCOUTFS_NODE_ZONE:
+		h ^= le64_to_cpu(key->_sk_first);
+		break;
+	case SCOUTFS_FS_ZONE:
+		h ^= le64_to_cpu(key->_sk_first) &
+		     ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
+		break;
+	}
+
+	return &cac->shards[hash_64(h, ITEM_SHARD_SHIFT)];
+}
+
 static u8 item_flags(struct cached_item *item)
 {
 	return item->deletion ? SCOUTFS_ITEM_FLAG_DELETION : 0;
 }
 
+/*
+ * Items and ranges come from one slab whose objects are sized for
+ * items.  They have to share because the shrinker reuses the memory of
+ * shrunk items to store the ranges that are split around them.
+ */
+static struct kmem_cache *cached_item_cachep;
+
+/*
+ * Most values are small: dirents, inodes, and xattr parts.  They come
+ * from a dedicated slab instead of hammering the generic kmalloc slabs
+ * as items churn.  The rare values larger than the slab's objects fall
+ * back to kmalloc.
+ */
+#define ITEM_VAL_CACHE_SIZE 192
+static struct kmem_cache *item_val_cachep;
+
+static void *alloc_item_val(unsigned int len)
+{
+	if (len <= ITEM_VAL_CACHE_SIZE)
+		return kmem_cache_alloc(item_val_cachep, GFP_NOFS);
+
+	return kmalloc(len, GFP_NOFS);
+}
+
+static void free_item_val(void *val, unsigned int len)
+{
+	if (val) {
+		if (len <= ITEM_VAL_CACHE_SIZE)
+			kmem_cache_free(item_val_cachep, val);
+		else
+			kfree(val);
+	}
+}
+
 static void free_item(struct super_block *sb, struct cached_item *item)
 {
 	if (!IS_ERR_OR_NULL(item)) {
 		scoutfs_inc_counter(sb, item_free);
 		WARN_ON_ONCE(!list_empty(&item->entry));
 		WARN_ON_ONCE(!RB_EMPTY_NODE(&item->node));
-		kfree(item->val);
-		kfree(item);
+		free_item_val(item->val, item->val_len);
+		kmem_cache_free(cached_item_cachep, item);
 	}
 }
 
 /*
- * The value vec may be null if the item has no value.  Values are
+ * The value buffer may be null if the item has no value.  Values are
  * allocated separately so that we can free them when deleting or swap
  * them in place when updating items.
  */
 static struct cached_item *alloc_item(struct super_block *sb,
 				      struct scoutfs_key *key,
-				      struct kvec *val)
+				      void *val, unsigned int val_len)
 {
 	struct cached_item *item;
 
-	item = kzalloc(sizeof(struct cached_item), GFP_NOFS);
+	item = kmem_cache_zalloc(cached_item_cachep, GFP_NOFS);
 	if (!item)
 		goto out;
 
 	item->key = *key;
+	scoutfs_key_to_be(&item->key_be, key);
 	RB_CLEAR_NODE(&item->node);
+	RB_CLEAR_NODE(&item->dirty_node);
 	INIT_LIST_HEAD(&item->entry);
 
 	if (val) {
-		item->val = kmalloc(val->iov_len, GFP_NOFS);
+		item->val = alloc_item_val(val_len);
 		if (!item->val) {
 			free_item(sb, item);
 			item = NULL;
 			goto out;
 		}
-		item->val_len = val->iov_len;
-		memcpy(item->val, val->iov_base, val->iov_len);
+		item->val_len = val_len;
+		memcpy(item->val, val, val_len);
 	}
 
 	scoutfs_inc_counter(sb, item_alloc);
@@ -152,17 +305,18 @@ out:
 }
 
 /*
- * Copy the cached item's value into the caller's single value vector.
- * The number of bytes that fit in the vec and were copied is returned.
- * A null val returns 0.
+ * Copy the cached item's value into the caller's contiguous buffer.
+ * The number of bytes that fit in the buffer and were copied is
+ * returned.  A null buf returns 0.
  */
-static int copy_item_val(struct kvec *val, struct cached_item *item)
+static int copy_item_buf(void *buf, unsigned int len,
+			 struct cached_item *item)
 {
 	int ret;
 
-	if (val) {
-		ret = min_t(size_t, item->val_len, val->iov_len);
-		memcpy(val->iov_base, item->val, ret);
+	if (buf) {
+		ret = min_t(size_t, item->val_len, len);
+		memcpy(buf, item->val, ret);
 	} else {
 		ret = 0;
 	}
@@ -170,6 +324,15 @@ static int copy_item_val(struct kvec *val, struct cached_item *item)
 	return ret;
 }
 
+/* copy into the caller's single value vector, a null val returns 0 */
+static int copy_item_val(struct kvec *val, struct cached_item *item)
+{
+	if (!val)
+		return 0;
+
+	return copy_item_buf(val->iov_base, val->iov_len, item);
+}
+
 /*
  * Walk the item rbtree and return the item found and the next and
  * prev items.
@@ -180,16 +343,19 @@ static struct cached_item *walk_items(struct rb_root *root,
 				      struct cached_item **next)
 {
 	struct rb_node *node = root->rb_node;
+	struct scoutfs_key_be key_be;
 	struct cached_item *item;
 	int cmp;
 
 	*prev = NULL;
 	*next = NULL;
 
+	scoutfs_key_to_be(&key_be, key);
+
 	while (node) {
 		item = container_of(node, struct cached_item, node);
 
-		cmp = scoutfs_key_compare(key, &item->key);
+		cmp = scoutfs_key_compare_be(&key_be, &item->key_be);
 		if (cmp < 0) {
 			*next = item;
 			node = node->rb_left;
@@ -252,122 +418,71 @@ static struct cached_item *prev_item(struct rb_root *root,
 }
 
 /*
- * We store the dirty bits in a single value so that the simple
- * augmented rbtree implementation gets a single scalar value to compare
- * and store.
+ * We used to track dirty items with augmented bits in the item rbtree
+ * which had every mark and clear walking to the root updating
+ * ancestors, and had the commit walk descending through clean regions
+ * of the tree.  The dirty index keeps those operations proportional to
+ * the number of dirty items alone.
  */
-#define ITEM_DIRTY 0x1
-#define LEFT_DIRTY 0x2
-#define RIGHT_DIRTY 0x4
-
 static bool item_is_dirty(struct cached_item *item)
 {
-	return (item->dirty & ITEM_DIRTY) != 0;
-}
-
-/*
- * Return the given dirty bit if the item with the given node is dirty
- * or has dirty children.
- */
-static long node_dirty_bit(struct rb_node *node, long dirty)
-{
-	struct cached_item *item;
-
-	if (node) {
-		item = container_of(node, struct cached_item, node);
-		if (item->dirty)
-			return dirty;
-	}
-
-	return 0;
-}
-
-static long compute_item_dirty(struct cached_item *item)
-{
-	return (item->dirty & ITEM_DIRTY) |
-	       node_dirty_bit(item->node.rb_left, LEFT_DIRTY) |
-	       node_dirty_bit(item->node.rb_right, RIGHT_DIRTY);
+	return !RB_EMPTY_NODE(&item->dirty_node);
 }
 
-static void scoutfs_item_rb_propagate(struct rb_node *node,
-				      struct rb_node *stop)
+static void dirty_tree_insert(struct item_shard *shard,
+			      struct cached_item *ins)
 {
+	struct rb_node **node = &shard->dirty_items.rb_node;
+	struct rb_node *parent = NULL;
 	struct cached_item *item;
-	long dirty;
-
-	while (node != stop) {
-		item = container_of(node, struct cached_item, node);
-		dirty = compute_item_dirty(item);
+	int cmp;
 
-		if (item->dirty == dirty)
-			break;
+	while (*node) {
+		parent = *node;
+		item = container_of(*node, struct cached_item, dirty_node);
 
-		item->dirty = dirty;
-		node = rb_parent(&item->node);
+		cmp = scoutfs_key_compare_be(&ins->key_be, &item->key_be);
+		BUG_ON(cmp == 0);
+		if (cmp < 0)
+			node = &(*node)->rb_left;
+		else
+			node = &(*node)->rb_right;
 	}
-}
-
-static void scoutfs_item_rb_copy(struct rb_node *old, struct rb_node *new)
-{
-	struct cached_item *n = container_of(new, struct cached_item, node);
 
-	n->dirty = compute_item_dirty(n);
+	rb_link_node(&ins->dirty_node, parent, node);
+	rb_insert_color(&ins->dirty_node, &shard->dirty_items);
 }
 
-/* calculate the new parent last as it depends on the old parent */
-static void scoutfs_item_rb_rotate(struct rb_node *old, struct rb_node *new)
+static void update_dirty_item_counts(struct super_block *sb,
+				     struct item_shard *shard, signed items,
+				     signed vals)
 {
-	struct cached_item *o = container_of(old, struct cached_item, node);
-	struct cached_item *n = container_of(new, struct cached_item, node);
+	shard->nr_dirty_items += items;
+	shard->dirty_val_bytes += vals;
 
-	o->dirty = compute_item_dirty(o);
-	n->dirty = compute_item_dirty(n);
+	scoutfs_trans_track_item(sb, items, vals);
 }
 
-/*
- * The generic RB_DECLARE_CALLBACKS() helpers are built for augmented
- * values that are simple commutative function of the left and right
- * children's augmented values.  During rotation the new parent just
- * gets the old parent's augmented value and then the old parent's value
- * is calculated.
- *
- * Our dirty bits don't work that way.  They are not just an or of the
- * child's bits, the bits depend on the left and right children
- * specifically.  During rotation both parents need to be specifically
- * recalculated.  (They could be masked and asigned based on the
- * direction of the rotation but that's annoying, let's just
- * recalculate.)
- */
-static const struct rb_augment_callbacks scoutfs_item_rb_cb  = {
-	.propagate = scoutfs_item_rb_propagate,
-	.copy = scoutfs_item_rb_copy,
-	.rotate = scoutfs_item_rb_rotate,
-};
-
-/*
- * The caller has changed an item's dirty bit.  Its child dirty bits are
- * still consistent.  But its parent's bits might need to be updated.
- * Its bits are consistent so we don't propagate from the node itself
- * because it would immediately terminate.
- */
-static void update_dirty_parents(struct cached_item *item)
+/* clean items enter the probation lru until they're referenced again */
+static void lru_item_add(struct item_shard *shard, struct cached_item *item)
 {
-	scoutfs_item_rb_propagate(rb_parent(&item->node), NULL);
+	item->protected = 0;
+	list_add_tail(&item->entry, &shard->probation_list);
+	shard->probation_nr++;
 }
 
-static void update_dirty_item_counts(struct super_block *sb, signed items,
-				     signed vals)
+static void lru_item_del(struct item_shard *shard, struct cached_item *item)
 {
-	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
-	struct item_cache *cac = sbi->item_cache;
-
-	cac->nr_dirty_items += items;
-	cac->dirty_val_bytes += vals;
-
-	scoutfs_trans_track_item(sb, items, vals);
+	if (!list_empty(&item->entry)) {
+		list_del_init(&item->entry);
+		if (item->protected)
+			shard->lru_nr--;
+		else
+			shard->probation_nr--;
+	}
 }
 
-static void mark_item_dirty(struct super_block *sb, struct item_cache *cac,
+static void mark_item_dirty(struct super_block *sb, struct item_shard *shard,
 			    struct cached_item *item)
 {
 	if (WARN_ON_ONCE(RB_EMPTY_NODE(&item->node)))
@@ -376,15 +491,13 @@ static void mark_item_dirty(struct super_block *sb, struct item_cache *cac,
 	if (item_is_dirty(item))
 		return;
 
-	item->dirty |= ITEM_DIRTY;
-	list_del_init(&item->entry);
-	cac->lru_nr--;
+	dirty_tree_insert(shard, item);
+	lru_item_del(shard, item);
 
-	update_dirty_item_counts(sb, 1, item->val_len);
-	update_dirty_parents(item);
+	update_dirty_item_counts(sb, shard, 1, item->val_len);
 }
 
-static void clear_item_dirty(struct super_block *sb, struct item_cache *cac,
+static void clear_item_dirty(struct super_block *sb, struct item_shard *shard,
 			     struct cached_item *item)
 {
 	if (WARN_ON_ONCE(RB_EMPTY_NODE(&item->node)))
@@ -393,46 +506,47 @@ static void clear_item_dirty(struct super_block *sb, struct item_cache *cac,
 	if (!item_is_dirty(item))
 		return;
 
-	item->dirty &= ~ITEM_DIRTY;
-	list_add_tail(&item->entry, &cac->lru_list);
-	cac->lru_nr++;
+	rb_erase(&item->dirty_node, &shard->dirty_items);
+	RB_CLEAR_NODE(&item->dirty_node);
+	lru_item_add(shard, item);
 
-	update_dirty_item_counts(sb, -1, -item->val_len);
+	update_dirty_item_counts(sb, shard, -1, -item->val_len);
 
-	WARN_ON_ONCE(cac->nr_dirty_items < 0 || cac->dirty_val_bytes < 0);
-
-	update_dirty_parents(item);
+	WARN_ON_ONCE(shard->nr_dirty_items < 0 || shard->dirty_val_bytes < 0);
 }
 
-static void item_referenced(struct item_cache *cac, struct cached_item *item)
+static void item_referenced(struct item_shard *shard, struct cached_item *item)
 {
-	if (!item->dirty)
-		list_move_tail(&item->entry, &cac->lru_list);
+	if (!item_is_dirty(item)) {
+		if (!item->protected) {
+			item->protected = 1;
+			shard->probation_nr--;
+			shard->lru_nr++;
+		}
+		list_move_tail(&item->entry, &shard->lru_list);
+	}
 }
 
 /* remove the item from its tracking data structures */
-static void unlink_item(struct super_block *sb, struct item_cache *cac,
+static void unlink_item(struct super_block *sb, struct item_shard *shard,
 		        struct cached_item *item)
 {
-	clear_item_dirty(sb, cac, item);
-	rb_erase_augmented(&item->node, &cac->items, &scoutfs_item_rb_cb);
+	clear_item_dirty(sb, shard, item);
+	rb_erase(&item->node, &shard->items);
 	RB_CLEAR_NODE(&item->node);
-	if (!list_empty(&item->entry)) {
-		list_del_init(&item->entry);
-		cac->lru_nr--;
-	}
+	lru_item_del(shard, item);
 }
 
 /*
  * Safely erase an item from the tree.  Make sure to remove its dirty
- * accounting, use the augmented erase, and free it.
+ * accounting and free it.
  */
-static void erase_item(struct super_block *sb, struct item_cache *cac,
+static void erase_item(struct super_block *sb, struct item_shard *shard,
 		       struct cached_item *item)
 {
 	trace_scoutfs_erase_item(sb, item);
 
-	unlink_item(sb, cac, item);
+	unlink_item(sb, shard, item);
 	free_item(sb, item);
 }
 
@@ -445,23 +559,23 @@ static void erase_item(struct super_block *sb, struct item_cache *cac,
  * compaction will remove the old item.  We only need the key for the
  * deletion item so we can free the value.
  */
-static void delete_item(struct super_block *sb, struct item_cache *cac,
+static void delete_item(struct super_block *sb, struct item_shard *shard,
 			struct cached_item *item)
 {
 	if (!item->persistent) {
-		erase_item(sb, cac, item);
+		erase_item(sb, shard, item);
 		return;
 	}
 
 	/* uses val_len to update item accounting */
-	clear_item_dirty(sb, cac, item);
+	clear_item_dirty(sb, shard, item);
 
-	kfree(item->val);
+	free_item_val(item->val, item->val_len);
 	item->val = NULL;
 	item->val_len = 0;
 
 	item->deletion = 1;
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, shard, item);
 	scoutfs_inc_counter(sb, item_delete);
 }
 
@@ -483,11 +597,11 @@ static void delete_item(struct super_block *sb, struct item_cache *cac,
  * with the old version that was just deleted (outside of range caching and
  * locking consistency).
  */
-static int insert_item(struct super_block *sb, struct item_cache *cac,
+static int insert_item(struct super_block *sb, struct item_shard *shard,
 		       struct cached_item *ins, bool logical_overwrite,
 		       bool cache_populate)
 {
-	struct rb_root *root = &cac->items;
+	struct rb_root *root = &shard->items;
 	struct cached_item *item;
 	struct rb_node *parent;
 	struct rb_node **node;
@@ -500,22 +614,18 @@ restart:
 		parent = *node;
 		item = container_of(*node, struct cached_item, node);
 
-		cmp = scoutfs_key_compare(&ins->key, &item->key);
+		cmp = scoutfs_key_compare_be(&ins->key_be, &item->key_be);
 		if (cmp < 0) {
-			if (ins->dirty)
-				item->dirty |= LEFT_DIRTY;
 			node = &(*node)->rb_left;
 		} else if (cmp > 0) {
-			if (ins->dirty)
-				item->dirty |= RIGHT_DIRTY;
 			node = &(*node)->rb_right;
 		} else {
 			if (cache_populate ||
 			    (!item->deletion && !logical_overwrite))
 				return -EEXIST;
 
-			/* sadly there's no augmented replace */
-			erase_item(sb, cac, item);
+			/* erase instead of replace to keep dirty sane */
+			erase_item(sb, shard, item);
 			if (item->persistent)
 				ins->persistent = 1;
 			goto restart;
@@ -525,11 +635,61 @@ restart:
 	trace_scoutfs_item_insertion(sb, &ins->key);
 
 	rb_link_node(&ins->node, parent, node);
-	rb_insert_augmented(&ins->node, root, &scoutfs_item_rb_cb);
+	rb_insert_color(&ins->node, root);
+
+	BUG_ON(item_is_dirty(ins));
+	lru_item_add(shard, ins);
+
+	return 0;
+}
+
+/*
+ * Insert an item that the caller knows sorts after an item it just
+ * inserted.  Sorted batch insertion would pay a full descent from the
+ * root for every item; almost all of them land immediately after their
+ * predecessor so we can link them there directly.  If an existing item
+ * intervenes we fall back to the full descent which handles duplicates
+ * and ordering.  Only clean cache population may use this.
+ */
+static int insert_item_after(struct super_block *sb, struct item_shard *shard,
+			     struct cached_item *prev, struct cached_item *ins)
+{
+	struct rb_node *next_node = rb_next(&prev->node);
+	struct cached_item *next = NULL;
+	struct rb_node *parent;
+	struct rb_node **node;
+	int cmp;
 
 	BUG_ON(item_is_dirty(ins));
-	list_add_tail(&ins->entry, &cac->lru_list);
-	cac->lru_nr++;
+
+	if (WARN_ON_ONCE(scoutfs_key_compare_be(&ins->key_be,
+						&prev->key_be) <= 0))
+		return insert_item(sb, shard, ins, false, true);
+
+	if (next_node) {
+		next = container_of(next_node, struct cached_item, node);
+		cmp = scoutfs_key_compare_be(&ins->key_be, &next->key_be);
+		if (cmp == 0)
+			return -EEXIST;
+		if (cmp > 0)
+			return insert_item(sb, shard, ins, false, true);
+	}
+
+	/* the successor position is a free child of prev or next */
+	if (!prev->node.rb_right) {
+		parent = &prev->node;
+		node = &prev->node.rb_right;
+	} else {
+		parent = &next->node;
+		node = &next->node.rb_left;
+	}
+
+	trace_scoutfs_item_insertion(sb, &ins->key);
+
+	rb_link_node(&ins->node, parent, node);
+	rb_insert_color(&ins->node, &shard->items);
+
+	lru_item_add(shard, ins);
 
 	return 0;
 }
@@ -590,23 +750,21 @@ static struct cached_range *walk_ranges(struct rb_root *root,
 }
 
 /*
- * Return true if the given key is covered by a cached range.  start and
- * end are set to the existing cached range.
+ * Return true if the given key is covered by a cached range in the
+ * key's shard.  start and end are set to the existing cached range.
  *
  * Return false if the key is not covered by a range.  start and end are
  * set to zero.  (Nothing uses these today, this is to avoid tracing
  * uninitialized keys in this case.)
  */
-static bool check_range(struct super_block *sb, struct rb_root *root,
+static bool check_range(struct super_block *sb, struct item_shard *shard,
 			struct scoutfs_key *key, struct scoutfs_key *start,
 			struct scoutfs_key *end)
 {
-	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
-	struct item_cache *cac = sbi->item_cache;
 	struct cached_range *rng;
 
-	rng = walk_ranges(&cac->ranges, key, NULL, NULL);
-	if (rng) {
+	rng = walk_ranges(&shard->ranges, key, NULL, NULL);
+	if (rng && !rng->detached) {
 		scoutfs_inc_counter(sb, item_range_hit);
 		if (start)
 			*start = rng->start;
@@ -624,12 +782,13 @@ static bool check_range(struct super_block *sb, struct rb_root *root,
 	return false;
 }
 
+/* ranges share the item slab, the shrinker converts items to ranges */
 static void free_range(struct super_block *sb, struct cached_range *rng)
 {
 	if (!IS_ERR_OR_NULL(rng)) {
 		scoutfs_inc_counter(sb, item_range_free);
 		trace_range(free, sb, rng);
-		kfree(rng);
+		kmem_cache_free(cached_item_cachep, rng);
 	}
 }
 
@@ -753,6 +912,8 @@ restart:
 
 			swap(rem->start, rem->end);
 			scoutfs_key_inc(&rem->start);
+			rem->detached = rng->detached;
+			rem->detached_version = rng->detached_version;
 			insert = true;
 			goto restart;
 		}
@@ -801,52 +962,67 @@ static bool lock_coverage(struct scoutfs_lock *lock,
 
 /*
  * Find an item with the given key and copy its value into the caller's
- * value vector.  The amount of bytes copied is returned which can be 0
- * or truncated if the caller's buffer isn't big enough or if val is null.
+ * contiguous buffer.  The amount of bytes copied is returned which can
+ * be 0 or truncated if the caller's buffer isn't big enough or if buf
+ * is null.  Almost all values are single small buffers so this is the
+ * native fast path, the kvec wrapper exists for callers that already
+ * have a vec.
  *
  * The end key limits how many keys after the search key can be read
  * and inserted into the cache.
  */
-int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
-			struct kvec *val, struct scoutfs_lock *lock)
+int scoutfs_item_lookup_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
+	ktime_t start;
 	int ret;
 
 	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_PR)))
 		return -EINVAL;
 
 	trace_scoutfs_item_lookup(sb, key);
+	start = ktime_get();
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			item_referenced(cac, item);
-			if (val)
-				ret = copy_item_val(val, item);
-			else
-				ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+			item_referenced(shard, item);
+			ret = copy_item_buf(buf, len, item);
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
+	scoutfs_latency_since(sb, item_lookup, start);
+	scoutfs_flight_record(sb, SCOUTFS_FLIGHT_ITEM_LOOKUP,
+			      le64_to_cpu(key->_sk_first),
+			      ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
 	trace_scoutfs_item_lookup_ret(sb, ret);
 	return ret;
 }
 
+int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
+			struct kvec *val, struct scoutfs_lock *lock)
+{
+	return scoutfs_item_lookup_buf(sb, key, val ? val->iov_base : NULL,
+				       val ? val->iov_len : 0, lock);
+}
+
 /*
  * This requires that the item at the specified key has a value of the
  * same length as the caller's value buffer.  Callers are asserting that
@@ -860,14 +1036,14 @@ int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
  *
  * Returns 0 or -errno.
  */
-int scoutfs_item_lookup_exact(struct super_block *sb,
-			      struct scoutfs_key *key, struct kvec *val,
-			      struct scoutfs_lock *lock)
+int scoutfs_item_lookup_exact_buf(struct super_block *sb,
+				  struct scoutfs_key *key, void *buf,
+				  unsigned int len, struct scoutfs_lock *lock)
 {
 	int ret;
 
-	ret = scoutfs_item_lookup(sb, key, val, lock);
-	if (ret == val->iov_len)
+	ret = scoutfs_item_lookup_buf(sb, key, buf, len, lock);
+	if (ret == len)
 		ret = 0;
 	else if (ret >= 0)
 		ret = -EIO;
@@ -875,6 +1051,14 @@ int scoutfs_item_lookup_exact(struct super_block *sb,
 	return ret;
 }
 
+int scoutfs_item_lookup_exact(struct super_block *sb,
+			      struct scoutfs_key *key, struct kvec *val,
+			      struct scoutfs_lock *lock)
+{
+	return scoutfs_item_lookup_exact_buf(sb, key, val->iov_base,
+					     val->iov_len, lock);
+}
+
 /*
  * Return the next linked node in the tree that isn't a deletion item
  * and which is still within the last allowed key value.
@@ -959,6 +1143,7 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct scoutfs_key pos;
 	struct scoutfs_key range_end;
 	struct cached_item *item;
@@ -983,11 +1168,13 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 
 	pos = *key;
 
-	spin_lock_irqsave(&cac->lock, flags);
-
 	for(;;) {
+		/* the iterator pos can cross into another shard */
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
+
 		/* see if we have cache coverage of our iterator pos */
-		cached = check_range(sb, &cac->ranges, &pos, NULL, &range_end);
+		cached = check_range(sb, shard, &pos, NULL, &range_end);
 
 		trace_scoutfs_item_next_range_check(sb, !!cached, key,
 						    &pos, last, &lock->end,
@@ -995,52 +1182,168 @@ int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 
 		if (!cached) {
 			/* populate missing cached range starting at pos */
-			spin_unlock_irqrestore(&cac->lock, flags);
+			spin_unlock_irqrestore(&shard->lock, flags);
 
 			ret = scoutfs_manifest_read_items(sb, &pos,
 							  &lock->start,
-							  &lock->end);
-
-			spin_lock_irqsave(&cac->lock, flags);
+							  &lock->end,
+							  false);
 			if (ret)
-				break;
-			else
-				continue;
+				goto out;
+			continue;
 		}
 
 		/* see if there's an item in the cached range from pos */
-		item = item_for_next(&cac->items, &pos, &range_end, last);
+		item = item_for_next(&shard->items, &pos, &range_end, last);
 		if (!item) {
 			if (scoutfs_key_compare(&range_end, last) < 0) {
 				/* keep searching after empty cached range */
 				pos = range_end;
 				scoutfs_key_inc(&pos);
+				spin_unlock_irqrestore(&shard->lock, flags);
 				continue;
 			}
 
 			/* no item and cache covers last, done */
 			ret = -ENOENT;
+			spin_unlock_irqrestore(&shard->lock, flags);
 			break;
 		}
 
 		/* we have a next item inside the cached range, done */
 		*key = item->key;
 		if (val) {
-			item_referenced(cac, item);
+			item_referenced(shard, item);
 			ret = copy_item_val(val, item);
 		} else {
 			ret = 0;
 		}
+		spin_unlock_irqrestore(&shard->lock, flags);
 		break;
 	}
-
-	spin_unlock_irqrestore(&cac->lock, flags);
 out:
 
 	trace_scoutfs_item_next_ret(sb, ret);
 	return ret;
 }
 
+/*
+ * Return a batch of next items starting with the given key and
+ * returning items up to the last key at most, all copied under a
+ * single shard lock hold instead of re-walking the tree from the root
+ * for every item.
+ *
+ * The caller provides parallel arrays of keys and value kvecs.  Each
+ * kvec's iov_len is the capacity on entry and is set to the copied
+ * value length on return.  The number of copied items is returned; the
+ * caller continues iterating from after the last returned key.  The
+ * batch ends early at the edge of contiguous cache coverage or the end
+ * of a shard, the next call re-enters the population machinery.
+ *
+ * -ENOENT is returned as in scoutfs_item_next when there's no next
+ * item at all.
+ */
+int scoutfs_item_next_batch(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_key *last,
+			    struct scoutfs_key *keys, struct kvec *vals,
+			    unsigned int nr, struct scoutfs_lock *lock)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
+	struct scoutfs_key pos;
+	struct scoutfs_key range_end;
+	struct scoutfs_key *lim;
+	struct cached_item *item;
+	unsigned long flags;
+	unsigned int count;
+	bool cached;
+	int ret;
+
+	if (WARN_ON_ONCE(nr == 0))
+		return -EINVAL;
+
+	/* use the end key as the last key if it's closer to reduce compares */
+	if (scoutfs_key_compare(&lock->end, last) < 0)
+		last = &lock->end;
+
+	/* convenience to avoid searching if caller iterates past their last */
+	if (scoutfs_key_compare(key, last) > 0) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_PR))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	pos = *key;
+
+	for(;;) {
+		/* the iterator pos can cross into another shard */
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
+
+		/* see if we have cache coverage of our iterator pos */
+		cached = check_range(sb, shard, &pos, NULL, &range_end);
+
+		if (!cached) {
+			/* populate missing cached range starting at pos */
+			spin_unlock_irqrestore(&shard->lock, flags);
+
+			ret = scoutfs_manifest_read_items(sb, &pos,
+							  &lock->start,
+							  &lock->end,
+							  false);
+			if (ret)
+				goto out;
+			continue;
+		}
+
+		/* see if there's an item in the cached range from pos */
+		item = item_for_next(&shard->items, &pos, &range_end, last);
+		if (!item) {
+			if (scoutfs_key_compare(&range_end, last) < 0) {
+				/* keep searching after empty cached range */
+				pos = range_end;
+				scoutfs_key_inc(&pos);
+				spin_unlock_irqrestore(&shard->lock, flags);
+				continue;
+			}
+
+			/* no item and cache covers last, done */
+			ret = -ENOENT;
+			spin_unlock_irqrestore(&shard->lock, flags);
+			break;
+		}
+
+		/* copy items while they're within the covered range */
+		lim = scoutfs_key_compare(&range_end, last) < 0 ?
+			&range_end : last;
+		count = 0;
+		while (item && count < nr) {
+			item_referenced(shard, item);
+			ret = copy_item_val(&vals[count], item);
+			if (ret < 0)
+				break;
+			keys[count] = item->key;
+			vals[count].iov_len = ret;
+			count++;
+
+			item = next_item_node(&shard->items, item, lim);
+		}
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (count)
+			ret = count;
+		break;
+	}
+out:
+	trace_scoutfs_item_next_ret(sb, ret);
+	return ret;
+}
+
 /*
  * Return the prev linked node in the tree that isn't a deletion item
  * and which is still within the first allowed key value.
@@ -1125,6 +1428,7 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct scoutfs_key range_start;
 	struct scoutfs_key pos;
 	struct cached_item *item;
@@ -1149,12 +1453,13 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 
 	pos = *key;
 
-	spin_lock_irqsave(&cac->lock, flags);
-
 	for(;;) {
+		/* the iterator pos can cross into another shard */
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
+
 		/* see if we have cache coverage of our iterator pos */
-		cached = check_range(sb, &cac->ranges, &pos,
-				     &range_start, NULL);
+		cached = check_range(sb, shard, &pos, &range_start, NULL);
 
 		trace_scoutfs_item_prev_range_check(sb, !!cached, key,
 						    &pos, first, &lock->start,
@@ -1162,46 +1467,45 @@ int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 
 		if (!cached) {
 			/* populate missing cached range starting at pos */
-			spin_unlock_irqrestore(&cac->lock, flags);
+			spin_unlock_irqrestore(&shard->lock, flags);
 
 			ret = scoutfs_manifest_read_items(sb, &pos,
 							  &lock->start,
-							  &lock->end);
-
-			spin_lock_irqsave(&cac->lock, flags);
+							  &lock->end,
+							  false);
 			if (ret)
-				break;
-			else
-				continue;
+				goto out;
+			continue;
 		}
 
 		/* see if there's an item in the cached range from pos */
-		item = item_for_prev(&cac->items, &pos, &range_start, first);
+		item = item_for_prev(&shard->items, &pos, &range_start, first);
 		if (!item) {
 			if (scoutfs_key_compare(&range_start, first) > 0) {
 				/* keep searching before empty cached range */
 				pos = range_start;
 				scoutfs_key_dec(&pos);
+				spin_unlock_irqrestore(&shard->lock, flags);
 				continue;
 			}
 
 			/* no item and cache covers first, done */
 			ret = -ENOENT;
+			spin_unlock_irqrestore(&shard->lock, flags);
 			break;
 		}
 
 		/* we have a prev item inside the cached range, done */
 		*key = item->key;
 		if (val) {
-			item_referenced(cac, item);
+			item_referenced(shard, item);
 			ret = copy_item_val(val, item);
 		} else {
 			ret = 0;
 		}
+		spin_unlock_irqrestore(&shard->lock, flags);
 		break;
 	}
-
-	spin_unlock_irqrestore(&cac->lock, flags);
 out:
 
 	trace_scoutfs_item_prev_ret(sb, ret);
@@ -1209,48 +1513,50 @@ out:
 }
 
 /*
- * Create a new dirty item in the cache.  Returns -EEXIST if an item
- * already exists with the given key.
+ * Create a new dirty item in the cache from a contiguous value buffer.
+ * Returns -EEXIST if an item already exists with the given key.
  */
-int scoutfs_item_create(struct super_block *sb, struct scoutfs_key *key,
-			struct kvec *val, struct scoutfs_lock *lock)
+int scoutfs_item_create_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
 
-	if (invalid_key_val(key, val) ||
+	if (invalid_key_buf(key, buf, len) ||
 	    WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_EX))) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	item = alloc_item(sb, key, val);
+	item = alloc_item(sb, key, buf, len);
 	if (!item) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		if (!check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		if (!check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENODATA;
 		} else {
-			ret = insert_item(sb, cac, item, false, false);
+			ret = insert_item(sb, shard, item, false, false);
 			if (!ret) {
 				scoutfs_inc_counter(sb, item_create);
-				mark_item_dirty(sb, cac, item);
+				mark_item_dirty(sb, shard, item);
 			}
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	if (ret)
 		free_item(sb, item);
@@ -1260,6 +1566,13 @@ out:
 	return ret;
 }
 
+int scoutfs_item_create(struct super_block *sb, struct scoutfs_key *key,
+			struct kvec *val, struct scoutfs_lock *lock)
+{
+	return scoutfs_item_create_buf(sb, key, val ? val->iov_base : NULL,
+				       val ? val->iov_len : 0, lock);
+}
+
 /*
  * "force" an item creation without first reading to see if the item
  * exist.  The caller is asserting that they know it's correct to
@@ -1275,6 +1588,7 @@ int scoutfs_item_create_force(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1285,15 +1599,16 @@ int scoutfs_item_create_force(struct super_block *sb,
 	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_CW)))
 		return -EINVAL;
 
-	item = alloc_item(sb, key, val);
+	item = alloc_item(sb, key, val ? val->iov_base : NULL,
+			  val ? val->iov_len : 0);
 	if (!item)
 		return -ENOMEM;
 
 	item->persistent = 1;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
-	ret = insert_item(sb, cac, item, true, false);
+	ret = insert_item(sb, shard, item, true, false);
 	if (ret) {
 		printk(KERN_EMERG "Scoutfs: corrupted item cache found while"
 		       " creating item "SK_FMT" on fs %llu\n", SK_ARG(key),
@@ -1301,9 +1616,9 @@ int scoutfs_item_create_force(struct super_block *sb,
 		BUG_ON(ret);
 	}
 	scoutfs_inc_counter(sb, item_create);
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, shard, item);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	if (ret)
 		free_item(sb, item);
@@ -1325,7 +1640,8 @@ int scoutfs_item_add_batch(struct super_block *sb, struct list_head *list,
 	if (invalid_key_val(key, val))
 		return -EINVAL;
 
-	item = alloc_item(sb, key, val);
+	item = alloc_item(sb, key, val ? val->iov_base : NULL,
+			  val ? val->iov_len : 0);
 	if (item) {
 		list_add_tail(&item->entry, list);
 		ret = 0;
@@ -1348,9 +1664,10 @@ int scoutfs_item_add_batch(struct super_block *sb, struct list_head *list,
  * The batch atomically adds the items and updates the cached range to
  * include the callers range that covers the items.
  *
- * It's safe to re-add items to the batch list after they aren't
- * inserted because _safe iteration will always be past the head entry
- * that will be inserted.
+ * The caller's range can cross shard region boundaries so we clip it
+ * into per-region pieces and insert each piece, and the sorted items it
+ * covers, into its shard.  Typically lock ranges don't cross regions
+ * and there's only one piece.
  */
 int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 			      struct scoutfs_key *start,
@@ -1358,10 +1675,15 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct cached_range *rng;
 	struct cached_item *item;
-	struct cached_item *tmp;
+	struct cached_item *prev;
+	struct scoutfs_key shard_end;
+	struct scoutfs_key piece_end;
+	struct scoutfs_key pos;
 	unsigned long flags;
+	LIST_HEAD(dups);
 	int ret;
 
 	trace_scoutfs_item_insert_batch(sb, start, end);
@@ -1369,36 +1691,60 @@ int scoutfs_item_insert_batch(struct super_block *sb, struct list_head *list,
 	if (WARN_ON_ONCE(scoutfs_key_compare(start, end) > 0))
 		return -EINVAL;
 
-	scoutfs_inc_counter(sb, item_range_alloc);
-	rng = kzalloc(sizeof(struct cached_range), GFP_NOFS);
-	if (!rng) {
-		free_range(sb, rng);
-		ret = -ENOMEM;
-		goto out;
-	}
+	pos = *start;
+	for (;;) {
+		key_shard_end(&pos, &shard_end);
+		if (scoutfs_key_compare(&shard_end, end) < 0)
+			piece_end = shard_end;
+		else
+			piece_end = *end;
 
-	rng->start = *start;
-	rng->end = *end;
+		scoutfs_inc_counter(sb, item_range_alloc);
+		rng = kmem_cache_zalloc(cached_item_cachep, GFP_NOFS);
+		if (!rng) {
+			ret = -ENOMEM;
+			goto out;
+		}
 
-	spin_lock_irqsave(&cac->lock, flags);
+		rng->start = pos;
+		rng->end = piece_end;
 
-	insert_range(sb, &cac->ranges, rng);
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
 
-	list_for_each_entry_safe(item, tmp, list, entry) {
-		list_del_init(&item->entry);
-		item->persistent = 1;
-		if (insert_item(sb, cac, item, false, true)) {
-			scoutfs_inc_counter(sb, item_batch_duplicate);
-			list_add(&item->entry, list);
-		} else {
-			scoutfs_inc_counter(sb, item_batch_inserted);
+		insert_range(sb, &shard->ranges, rng);
+
+		prev = NULL;
+		while ((item = list_first_entry_or_null(list,
+						struct cached_item, entry)) &&
+		       scoutfs_key_compare(&item->key, &piece_end) <= 0) {
+			list_del_init(&item->entry);
+			item->persistent = 1;
+			if (prev)
+				ret = insert_item_after(sb, shard, prev, item);
+			else
+				ret = insert_item(sb, shard, item, false, true);
+			if (ret) {
+				scoutfs_inc_counter(sb, item_batch_duplicate);
+				list_add_tail(&item->entry, &dups);
+			} else {
+				scoutfs_inc_counter(sb, item_batch_inserted);
+				prev = item;
+			}
 		}
-	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (scoutfs_key_compare(&piece_end, end) >= 0)
+			break;
+
+		pos = piece_end;
+		scoutfs_key_inc(&pos);
+	}
 
 	ret = 0;
 out:
+	list_splice_init(&dups, list);
 	scoutfs_item_free_batch(sb, list);
 	return ret;
 }
@@ -1424,6 +1770,7 @@ int scoutfs_item_dirty(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1432,87 +1779,99 @@ int scoutfs_item_dirty(struct super_block *sb, struct scoutfs_key *key,
 		return -EINVAL;
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			mark_item_dirty(sb, cac, item);
+			mark_item_dirty(sb, shard, item);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	trace_scoutfs_item_dirty_ret(sb, ret);
 	return ret;
 }
 
 /*
- * Set the value of an existing item in the tree.  The item is marked dirty
- * and the previous value is freed.  The provided value may be null.
+ * Set the value of an existing item in the tree from a contiguous
+ * buffer.  The item is marked dirty and the previous value is freed.
+ * The provided buffer may be null.
  *
  * Returns -ENOENT if the item doesn't exist.
  */
-int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
-			struct kvec *val, struct scoutfs_lock *lock)
+int scoutfs_item_update_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
+	unsigned int up_len = 0;
 	void *up_val = NULL;
 	int ret;
 
-	if (invalid_key_val(key, val))
+	if (invalid_key_buf(key, buf, len))
 		return -EINVAL;
 
 	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_EX)))
 		return -EINVAL;
 
-	if (val) {
-		up_val = kmalloc(val->iov_len, GFP_NOFS);
+	if (buf) {
+		up_len = len;
+		up_val = alloc_item_val(up_len);
 		if (!up_val) {
 			ret = -ENOMEM;
 			goto out;
 		}
-		memcpy(up_val, val->iov_base, val->iov_len);
+		memcpy(up_val, buf, len);
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			clear_item_dirty(sb, cac, item);
+			clear_item_dirty(sb, shard, item);
 			swap(up_val, item->val);
-			item->val_len = val ? val->iov_len : 0;
-			mark_item_dirty(sb, cac, item);
+			swap(up_len, item->val_len);
+			mark_item_dirty(sb, shard, item);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 out:
-	kfree(up_val);
+	free_item_val(up_val, up_len);
 
 	trace_scoutfs_item_update_ret(sb, ret);
 	return ret;
 }
 
+int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
+			struct kvec *val, struct scoutfs_lock *lock)
+{
+	return scoutfs_item_update_buf(sb, key, val ? val->iov_base : NULL,
+				       val ? val->iov_len : 0, lock);
+}
+
 /*
  * Delete an existing item with the given key.
  *
@@ -1530,6 +1889,7 @@ int scoutfs_item_delete(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1540,23 +1900,23 @@ int scoutfs_item_delete(struct super_block *sb, struct scoutfs_key *key,
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
-			delete_item(sb, cac, item);
+			delete_item(sb, shard, item);
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 out:
 	trace_scoutfs_item_delete(sb, key, ret);
@@ -1577,6 +1937,7 @@ int scoutfs_item_delete_force(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	int ret;
@@ -1584,14 +1945,14 @@ int scoutfs_item_delete_force(struct super_block *sb,
 	if (WARN_ON_ONCE(!lock_coverage(lock, key, DLM_LOCK_CW)))
 		return -EINVAL;
 
-	item = alloc_item(sb, key, NULL);
+	item = alloc_item(sb, key, NULL, 0);
 	if (!item)
 		return -ENOMEM;
 
 	item->persistent = 1;
 
-	spin_lock_irqsave(&cac->lock, flags);
-	ret = insert_item(sb, cac, item, true, false);
+	spin_lock_irqsave(&shard->lock, flags);
+	ret = insert_item(sb, shard, item, true, false);
 	if (ret) {
 		printk(KERN_EMERG "Scoutfs: corrupted item cache found while"
 		       " deleting item "SK_FMT" on fs %llu\n", SK_ARG(key),
@@ -1599,10 +1960,10 @@ int scoutfs_item_delete_force(struct super_block *sb,
 		BUG_ON(ret);
 	}
 	scoutfs_inc_counter(sb, item_create);
-	mark_item_dirty(sb, cac, item);
+	mark_item_dirty(sb, shard, item);
 
-	delete_item(sb, cac, item);
-	spin_unlock_irqrestore(&cac->lock, flags);
+	delete_item(sb, shard, item);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	return ret;
 }
@@ -1612,8 +1973,8 @@ int scoutfs_item_delete_force(struct super_block *sb,
  * later.
  *
  * The deleted items can be dirty or not.. we maintain an accurate dirty
- * count as we remove the deleted items and leave their dirty flag set
- * so that restore can mark them dirty again.
+ * count as we remove the deleted items and record their dirtiness in
+ * saved_dirty so that restore can mark them dirty again.
  *
  * Returns -ENOENT if the item didn't exist and couldn't be deleted.
  */
@@ -1624,6 +1985,7 @@ int scoutfs_item_delete_save(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	struct cached_item *del;
 	unsigned long flags;
@@ -1635,40 +1997,39 @@ int scoutfs_item_delete_save(struct super_block *sb,
 		goto out;
 	}
 
-	del = alloc_item(sb, key, NULL);
+	del = alloc_item(sb, key, NULL, 0);
 	if (!del) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
 	do {
-		spin_lock_irqsave(&cac->lock, flags);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		item = find_item(sb, &cac->items, key);
+		item = find_item(sb, &shard->items, key);
 		if (item) {
 			was_dirty = item_is_dirty(item);
-			unlink_item(sb, cac, item);
+			unlink_item(sb, shard, item);
 			list_add_tail(&item->entry, list);
-			if (was_dirty)
-				item->dirty |= ITEM_DIRTY;
+			item->saved_dirty = was_dirty;
 
 			del->persistent = item->persistent;
-			ret = insert_item(sb, cac, del, false, false);
+			ret = insert_item(sb, shard, del, false, false);
 			BUG_ON(ret);
-			delete_item(sb, cac, del);
+			delete_item(sb, shard, del);
 			del = NULL;
 			ret = 0;
-		} else if (check_range(sb, &cac->ranges, key, NULL, NULL)) {
+		} else if (check_range(sb, shard, key, NULL, NULL)) {
 			ret = -ENOENT;
 		} else {
 			ret = -ENODATA;
 		}
 
-		spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 	} while (ret == -ENODATA &&
 		 (ret = scoutfs_manifest_read_items(sb, key, &lock->start,
-						    &lock->end)) == 0);
+						    &lock->end, true)) == 0);
 
 	free_item(sb, del);
 out:
@@ -1689,48 +2050,52 @@ int scoutfs_item_restore(struct super_block *sb, struct list_head *list,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct cached_item *existing;
 	struct cached_item *item;
 	struct cached_item *tmp;
 	unsigned long flags;
 	bool was_dirty;
+	bool bad;
 	int mode;
-	int ret;
 
 	if (list_empty(list))
 		return 0;
 
-	spin_lock_irqsave(&cac->lock, flags);
-
 	/* make sure all the items are locked and cached */
 	list_for_each_entry(item, list, entry) {
-		mode = item_is_dirty(item) ? DLM_LOCK_EX : DLM_LOCK_PR;
-		if (WARN_ON_ONCE(!lock_coverage(lock, &item->key, mode)) ||
-		    WARN_ON_ONCE(!check_range(sb, &cac->ranges, &item->key,
-				 NULL, NULL))) {
-			ret = -EINVAL;
-			goto out;
-		}
+		shard = key_shard(cac, &item->key);
+		mode = item->saved_dirty ? DLM_LOCK_EX : DLM_LOCK_PR;
+
+		spin_lock_irqsave(&shard->lock, flags);
+		bad = WARN_ON_ONCE(!lock_coverage(lock, &item->key, mode)) ||
+		      WARN_ON_ONCE(!check_range(sb, shard, &item->key,
+						NULL, NULL));
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (bad)
+			return -EINVAL;
 	}
 
 	list_for_each_entry_safe(item, tmp, list, entry) {
-		was_dirty = item_is_dirty(item);
-		item->dirty &= ~ITEM_DIRTY;
+		shard = key_shard(cac, &item->key);
+		was_dirty = item->saved_dirty;
+		item->saved_dirty = 0;
 		list_del_init(&item->entry);
 
-		existing = find_item(sb, &cac->items, &item->key);
+		spin_lock_irqsave(&shard->lock, flags);
+
+		existing = find_item(sb, &shard->items, &item->key);
 		if (existing)
-			erase_item(sb, cac, existing);
-		insert_item(sb, cac, item, false, false);
+			erase_item(sb, shard, existing);
+		insert_item(sb, shard, item, false, false);
 		if (was_dirty)
-			mark_item_dirty(sb, cac, item);
-	}
+			mark_item_dirty(sb, shard, item);
 
-	ret = 0;
-out:
-	spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
-	return ret;
+	return 0;
 }
 
 /*
@@ -1743,16 +2108,17 @@ void scoutfs_item_delete_dirty(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
-	item = find_item(sb, &cac->items, key);
+	item = find_item(sb, &shard->items, key);
 	if (item)
-		delete_item(sb, cac, item);
+		delete_item(sb, shard, item);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 }
 
 /*
@@ -1767,14 +2133,15 @@ void scoutfs_item_update_dirty(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard = key_shard(cac, key);
 	struct cached_item *item;
 	unsigned long flags;
 	unsigned int new_len = val ? val->iov_len : 0;
 	signed delta;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
-	item = find_item(sb, &cac->items, key);
+	item = find_item(sb, &shard->items, key);
 
 	BUG_ON(!item || !item_is_dirty(item) || new_len > item->val_len);
 
@@ -1782,96 +2149,70 @@ void scoutfs_item_update_dirty(struct super_block *sb,
 	if (val)
 		memcpy(item->val, val->iov_base, new_len);
 	item->val_len = new_len;
-	update_dirty_item_counts(sb, 0, delta);
+	update_dirty_item_counts(sb, shard, 0, delta);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 }
 
-/*
- * Return the first dirty node in the subtree starting at the given node.
- */
-static struct cached_item *first_dirty(struct rb_node *node)
+static struct cached_item *first_dirty(struct rb_root *root)
 {
-	struct cached_item *ret = NULL;
-	struct cached_item *item;
-
-	while (node) {
-		item = container_of(node, struct cached_item, node);
-
-		if (item->dirty & LEFT_DIRTY) {
-			node = item->node.rb_left;
-		} else if (item_is_dirty(item)) {
-			ret = item;
-			break;
-		} else if (item->dirty & RIGHT_DIRTY) {
-			node = item->node.rb_right;
-		} else {
-			break;
-		}
-	}
+	struct rb_node *node = rb_first(root);
 
-	return ret;
+	return node ? container_of(node, struct cached_item, dirty_node) :
+		      NULL;
 }
 
-/*
- * Find the next dirty item after a given item.  First we see if we have
- * a dirty item in our right subtree.  If not we ascend through parents
- * skipping those that are less than us.  If we find a parent that's
- * greater than us then we see if it's dirty, if not we start the search
- * all over again by checking its right subtree then ascending.
- */
 static struct cached_item *next_dirty(struct cached_item *item)
 {
-	struct rb_node *parent;
-	struct rb_node *node;
-
-	while (item) {
-		if (item->dirty & RIGHT_DIRTY)
-			return first_dirty(item->node.rb_right);
-
-		/* find next greatest parent */
-		node = &item->node;
-		while ((parent = rb_parent(node)) && parent->rb_right == node)
-			node = parent;
-		if (!parent)
-			break;
+	struct rb_node *node = rb_next(&item->dirty_node);
 
-		/* done if our next greatest parent itself is dirty */
-		item = container_of(parent, struct cached_item, node);
-		if (item_is_dirty(item))
-			return item;
-
-		/* continue to check right subtree */
-	}
-
-	return NULL;
+	return node ? container_of(node, struct cached_item, dirty_node) :
+		      NULL;
 }
 
-static bool dirty_item_within(struct rb_root *root,
+/* search the dirty index for the first dirty item in the range */
+static bool dirty_item_within(struct item_shard *shard,
 			      struct scoutfs_key *from,
 			      struct scoutfs_key *end)
 {
+	struct rb_node *node = shard->dirty_items.rb_node;
+	struct cached_item *found = NULL;
 	struct cached_item *item;
+	struct scoutfs_key_be from_be;
+
+	scoutfs_key_to_be(&from_be, from);
+
+	while (node) {
+		item = container_of(node, struct cached_item, dirty_node);
 
-	item = next_item(root, from);
-	if (item && !item_is_dirty(item))
-		item = next_dirty(item);
+		if (scoutfs_key_compare_be(&from_be, &item->key_be) <= 0) {
+			found = item;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
 
-	return item && scoutfs_key_compare(&item->key, end) <= 0;
+	return found && scoutfs_key_compare(&found->key, end) <= 0;
 }
 
 bool scoutfs_item_has_dirty(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	unsigned long flags;
-	bool has;
+	long nr = 0;
+	int i;
 
-	spin_lock_irqsave(&cac->lock, flags);
-	has = cac->nr_dirty_items != 0;
-	spin_unlock_irqrestore(&cac->lock, flags);
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
+		nr += shard->nr_dirty_items;
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
-	return has;
+	return nr != 0;
 }
 
 /*
@@ -1888,50 +2229,107 @@ bool scoutfs_item_range_cached(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct cached_range *next;
 	struct cached_range *rng;
 	unsigned long flags;
 	bool cached = false;
+	int i;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	for (i = 0; i < ITEM_NR_SHARDS && !cached; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
 
-	if (dirty) {
-		if (dirty_item_within(&cac->items, start, end))
-			cached = true;
-	} else {
-		rng = walk_ranges(&cac->ranges, start, NULL, &next);
-		if (rng ||
-		    (next && scoutfs_key_compare(&next->start, end) <= 0))
-			cached = true;
-	}
+		if (dirty) {
+			if (dirty_item_within(shard, start, end))
+				cached = true;
+		} else {
+			rng = walk_ranges(&shard->ranges, start, NULL, &next);
+			rng = rng ?: next;
+			/* detached ranges aren't usable cache */
+			while (rng && rng->detached)
+				rng = rb_next_rng(rng);
+			if (rng &&
+			    scoutfs_key_compare(&rng->start, end) <= 0)
+				cached = true;
+		}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
 	return cached;
 }
 
 /*
- * Returns true if adding more items with the given count, keys, and values
- * still fits in a single item along with the current dirty items.
+ * Returns true if adding more items with the given count, keys, and
+ * values still fits in a commit's worth of segments along with the
+ * current dirty items.
  */
-bool scoutfs_item_dirty_fits_single(struct super_block *sb, u32 nr_items,
-			            u32 val_bytes)
+bool scoutfs_item_dirty_fits(struct super_block *sb, u32 nr_items,
+			     u32 val_bytes)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	unsigned long flags;
-	bool fits;
+	long dirty_items = 0;
+	long dirty_vals = 0;
+	int i;
 
-	spin_lock_irqsave(&cac->lock, flags);
-	fits = scoutfs_seg_fits_single(nr_items + cac->nr_dirty_items,
-				       val_bytes + cac->dirty_val_bytes);
-	spin_unlock_irqrestore(&cac->lock, flags);
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
+		dirty_items += shard->nr_dirty_items;
+		dirty_vals += shard->dirty_val_bytes;
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
-	return fits;
+	return scoutfs_seg_fits(nr_items + dirty_items,
+				val_bytes + dirty_vals,
+				SCOUTFS_COMMIT_SEGMENT_MAX_NR);
 }
 
 /*
- * Fill the given segment with sorted dirty items.
+ * Return true if the dirty items consume more than pct percent of a
+ * commit's worth of segments.  Scaling the dirty counts up by the
+ * inverse of the threshold lets us reuse the fit calculation.
+ */
+bool scoutfs_item_dirty_over_pct(struct super_block *sb, unsigned int pct)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
+	unsigned long flags;
+	u64 dirty_items = 0;
+	u64 dirty_vals = 0;
+	int i;
+
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
+		dirty_items += shard->nr_dirty_items;
+		dirty_vals += shard->dirty_val_bytes;
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
+
+	return !scoutfs_seg_fits(div_u64(dirty_items * 100, pct),
+				 div_u64(dirty_vals * 100, pct),
+				 SCOUTFS_COMMIT_SEGMENT_MAX_NR);
+}
+
+/*
+ * Fill the given segment with sorted dirty items.  Returns 0 when all
+ * the dirty items have been written and 1 when the segment filled with
+ * dirty items remaining; the caller writes the rest to more segments.
+ *
+ * Each shard's dirty items are sorted but the shards overlap in key
+ * space so we merge them, always appending the least dirty key across
+ * all the shards.  Dirty items are pinned: the shrinker and
+ * invalidation never free them, and the transaction machinery has
+ * stopped writers while we're writing, so it's safe to hold the
+ * per-shard merge positions across the shard locks.  The locks are
+ * only needed for the dirty accounting and final erasure of deletion
+ * items, not for reading the pinned items themselves.
  *
  * The caller is responsible for the consistency of the dirty items once
  * they're in its seg.  We can consider them clean once we store them.
@@ -1944,22 +2342,54 @@ int scoutfs_item_dirty_seg(struct super_block *sb, struct scoutfs_segment *seg)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct cached_item *items[ITEM_NR_SHARDS];
 	__le32 *links[SCOUTFS_MAX_SKIP_LINKS];
-	struct cached_item *item = NULL;
-	struct cached_item *del;
+	struct item_shard *shard;
+	struct cached_item *item;
 	unsigned long flags;
 	struct kvec val;
 	bool appended;
+	int ret = 0;
+	int i;
+	int s;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
+		items[i] = first_dirty(&shard->dirty_items);
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
-	item = first_dirty(cac->items.rb_node);
-	while (item) {
+	for (;;) {
+		s = -1;
+		for (i = 0; i < ITEM_NR_SHARDS; i++) {
+			if (items[i] &&
+			    (s < 0 || scoutfs_key_compare(&items[i]->key,
+							  &items[s]->key) < 0))
+				s = i;
+		}
+		if (s < 0)
+			break;
+
+		shard = &cac->shards[s];
+		item = items[s];
+
+		/*
+		 * The item is pinned and its key and value are stable so
+		 * we can copy it into the segment, including the value
+		 * memcpy and bloom bit setting, without holding the
+		 * shard lock.  Keeping the copies outside the irq-off
+		 * critical sections stops a large commit from stalling
+		 * concurrent readers of the shards.
+		 */
 		kvec_init(&val, item->val, item->val_len);
 		appended = scoutfs_seg_append_item(sb, seg, &item->key, &val,
 						   item_flags(item), links);
-		/* trans reservation should have limited dirty */
-		BUG_ON(!appended);
+		if (!appended) {
+			/* segment full, caller writes the rest to the next */
+			ret = 1;
+			break;
+		}
 
 		if (item->deletion)
 			scoutfs_inc_counter(sb, trans_write_deletion_item);
@@ -1969,19 +2399,21 @@ int scoutfs_item_dirty_seg(struct super_block *sb, struct scoutfs_segment *seg)
 		/* non-persistent should have been freed (safe to write) */
 		WARN_ON_ONCE(item->deletion && !item->persistent);
 
-		clear_item_dirty(sb, cac, item);
+		spin_lock_irqsave(&shard->lock, flags);
+
+		/* find the next dirty item before clearing unlinks this one */
+		items[s] = next_dirty(item);
+
+		clear_item_dirty(sb, shard, item);
 		item->persistent = 1;
 
-		del = item;
-		item = next_dirty(item);
+		if (item->deletion)
+			erase_item(sb, shard, item);
 
-		if (del->deletion)
-			erase_item(sb, cac, del);
+		spin_unlock_irqrestore(&shard->lock, flags);
 	}
 
-	spin_unlock_irqrestore(&cac->lock, flags);
-
-	return 0;
+	return ret;
 }
 
 /*
@@ -1997,23 +2429,30 @@ int scoutfs_item_writeback(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	unsigned long flags;
 	bool sync = false;
+	long total = 0;
 	int count = 0;
 	int ret = 0;
+	int i;
 
 	/* XXX think about racing with trans write */
 
-	spin_lock_irqsave(&cac->lock, flags);
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_irqsave(&shard->lock, flags);
 
-	if (cac->nr_dirty_items && dirty_item_within(&cac->items, start, end)) {
-		sync = true;
-		count = cac->nr_dirty_items;
-	}
+		total += shard->nr_dirty_items;
+		if (shard->nr_dirty_items &&
+		    dirty_item_within(&shard->items, start, end))
+			sync = true;
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
+	}
 
 	if (sync) {
+		count = total;
 		scoutfs_inc_counter(sb, trans_commit_item_flush);
 		ret = scoutfs_trans_sync(sb, 1);
 	}
@@ -2025,6 +2464,9 @@ int scoutfs_item_writeback(struct super_block *sb,
  * The caller wants us to drop any items within the range on the floor.
  * They should have ensured that items in this range won't be dirty.
  *
+ * The range can cross shard regions so we clip it and remove each
+ * per-region piece from its shard.
+ *
  * Returns errors or the count of the items invalidated.
  */
 int scoutfs_item_invalidate(struct super_block *sb,
@@ -2033,9 +2475,13 @@ int scoutfs_item_invalidate(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct cached_range *rng;
 	struct cached_item *next;
 	struct cached_item *item;
+	struct scoutfs_key shard_end;
+	struct scoutfs_key piece_end;
+	struct scoutfs_key pos;
 	struct rb_node *node;
 	unsigned long flags;
 	int count = 0;
@@ -2045,38 +2491,54 @@ int scoutfs_item_invalidate(struct super_block *sb,
 
 	/* XXX think about racing with trans write */
 
-	scoutfs_inc_counter(sb, item_range_alloc);
-	rng = kzalloc(sizeof(struct cached_range), GFP_NOFS);
-	if (!rng) {
-		free_range(sb, rng);
-		ret = -ENOMEM;
-		goto out;
-	}
+	pos = *start;
+	for (;;) {
+		key_shard_end(&pos, &shard_end);
+		if (scoutfs_key_compare(&shard_end, end) < 0)
+			piece_end = shard_end;
+		else
+			piece_end = *end;
 
-	rng->start = *start;
-	rng->end = *end;
+		scoutfs_inc_counter(sb, item_range_alloc);
+		rng = kmem_cache_zalloc(cached_item_cachep, GFP_NOFS);
+		if (!rng) {
+			ret = -ENOMEM;
+			goto out;
+		}
 
-	spin_lock_irqsave(&cac->lock, flags);
+		rng->start = pos;
+		rng->end = piece_end;
 
-	for (item = next_item(&cac->items, start);
-	     item && scoutfs_key_compare(&item->key, end) <= 0;
-	     item = next) {
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
 
-		/* XXX seems like this should be a helper? */
-		node = rb_next(&item->node);
-		if (node)
-			next = container_of(node, struct cached_item, node);
-		else
-			next = NULL;
+		for (item = next_item(&shard->items, &pos);
+		     item && scoutfs_key_compare(&item->key, &piece_end) <= 0;
+		     item = next) {
 
-		WARN_ON_ONCE(item_is_dirty(item));
-		erase_item(sb, cac, item);
-		count++;
-	}
+			/* XXX seems like this should be a helper? */
+			node = rb_next(&item->node);
+			if (node)
+				next = container_of(node, struct cached_item,
+						    node);
+			else
+				next = NULL;
+
+			WARN_ON_ONCE(item_is_dirty(item));
+			erase_item(sb, shard, item);
+			count++;
+		}
+
+		remove_range(sb, &shard->ranges, rng);
 
-	remove_range(sb, &cac->ranges, rng);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		if (scoutfs_key_compare(&piece_end, end) >= 0)
+			break;
+
+		pos = piece_end;
+		scoutfs_key_inc(&pos);
+	}
 
 	ret = 0;
 out:
@@ -2103,6 +2565,146 @@ static struct cached_item *rb_prev_item(struct cached_item *item)
 	return NULL;
 }
 
+/*
+ * The lock that covered cached items in the range is being released.
+ * Instead of tossing the items we mark their cached ranges as detached,
+ * recording the lock's write version.  Detached ranges aren't usable
+ * cache: reads miss outside of them and the shrinker trims them like
+ * any other range.  If the lock is granted again with its write version
+ * unchanged then _reattach makes the surviving cache usable again
+ * without re-reading segments.
+ *
+ * Cached ranges are only ever populated within the range of a lock so
+ * we always see whole ranges inside the caller's range, never partial
+ * overlap.  Detached ranges only exist while the lock isn't locally
+ * granted and every grant sweeps them, so reads can't insert ranges
+ * that overlap with detached ranges.
+ */
+void scoutfs_item_range_detach(struct super_block *sb,
+			       struct scoutfs_key *start,
+			       struct scoutfs_key *end, u64 version)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
+	struct cached_range *next;
+	struct cached_range *rng;
+	struct scoutfs_key shard_end;
+	struct scoutfs_key piece_end;
+	struct scoutfs_key pos;
+	unsigned long flags;
+
+	pos = *start;
+	for (;;) {
+		key_shard_end(&pos, &shard_end);
+		if (scoutfs_key_compare(&shard_end, end) < 0)
+			piece_end = shard_end;
+		else
+			piece_end = *end;
+
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
+
+		rng = walk_ranges(&shard->ranges, &pos, NULL, &next) ?: next;
+		while (rng &&
+		       scoutfs_key_compare(&rng->start, &piece_end) <= 0) {
+			WARN_ON_ONCE(rng->detached);
+			rng->detached = true;
+			rng->detached_version = version;
+			scoutfs_inc_counter(sb, item_range_detach);
+			rng = rb_next_rng(rng);
+		}
+
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (scoutfs_key_compare(&piece_end, end) >= 0)
+			break;
+
+		pos = piece_end;
+		scoutfs_key_inc(&pos);
+	}
+}
+
+/*
+ * The lock that covers the range is being granted with the given write
+ * version.  Detached ranges that recorded the same version weren't
+ * written under any other grant of the lock so their cache is still
+ * consistent and we make it usable again.  Mismatched ranges, or any
+ * ranges when the version is 0 because it was lost, have their items
+ * dropped so reads under the new grant re-read segments.
+ *
+ * This is called while locks are being granted, nested under the lock
+ * info spinlock, so it must not allocate or block.
+ */
+void scoutfs_item_range_reattach(struct super_block *sb,
+				 struct scoutfs_key *start,
+				 struct scoutfs_key *end, u64 version)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
+	struct cached_range *next_rng;
+	struct cached_range *next;
+	struct cached_range *rng;
+	struct cached_item *item_next;
+	struct cached_item *item;
+	struct scoutfs_key shard_end;
+	struct scoutfs_key piece_end;
+	struct scoutfs_key pos;
+	unsigned long flags;
+
+	pos = *start;
+	for (;;) {
+		key_shard_end(&pos, &shard_end);
+		if (scoutfs_key_compare(&shard_end, end) < 0)
+			piece_end = shard_end;
+		else
+			piece_end = *end;
+
+		shard = key_shard(cac, &pos);
+		spin_lock_irqsave(&shard->lock, flags);
+
+		rng = walk_ranges(&shard->ranges, &pos, NULL, &next) ?: next;
+		while (rng &&
+		       scoutfs_key_compare(&rng->start, &piece_end) <= 0) {
+			next_rng = rb_next_rng(rng);
+
+			if (rng->detached &&
+			    version && rng->detached_version == version) {
+				rng->detached = false;
+				rng->detached_version = 0;
+				scoutfs_inc_counter(sb, item_range_reattach);
+
+			} else if (rng->detached) {
+				for (item = next_item(&shard->items,
+						      &rng->start);
+				     item && scoutfs_key_compare(&item->key,
+							&rng->end) <= 0;
+				     item = item_next) {
+					item_next = rb_next_item(item);
+					WARN_ON_ONCE(item_is_dirty(item));
+					erase_item(sb, shard, item);
+				}
+
+				rb_erase(&rng->node, &shard->ranges);
+				free_range(sb, rng);
+				scoutfs_inc_counter(sb,
+						item_range_reattach_miss);
+			}
+
+			rng = next_rng;
+		}
+
+		spin_unlock_irqrestore(&shard->lock, flags);
+
+		if (scoutfs_key_compare(&piece_end, end) >= 0)
+			break;
+
+		pos = piece_end;
+		scoutfs_key_inc(&pos);
+	}
+}
+
 /*
  * Find the bounds of an item cache shrinking operation.  Starting from
  * an item, walk through either next items to the right or prev items to
@@ -2190,10 +2792,9 @@ static struct cached_item *shrink_boundary(struct super_block *sb,
  * remove items from the middle of a range we use the memory from some
  * removed items to store the new split range.
  */
-static int shrink_around(struct super_block *sb, struct cached_range *rng,
-			 struct cached_item *item)
+static int shrink_around(struct super_block *sb, struct item_shard *shard,
+			 struct cached_range *rng, struct cached_item *item)
 {
-	struct item_cache *cac = SCOUTFS_SB(sb)->item_cache;
 	struct scoutfs_key rng_end;
 	struct scoutfs_key key;
 	struct cached_range *new_rng;
@@ -2247,9 +2848,9 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 		item = last;
 		last = rb_prev_item(last);
 
-		unlink_item(sb, cac, item);
+		unlink_item(sb, shard, item);
 		key = item->key;
-		kfree(item->val);
+		free_item_val(item->val, item->val_len);
 		nr++;
 
 		new_rng = (void *)item;
@@ -2259,14 +2860,16 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 		new_rng->end = rng_end;
 		new_rng->start = key;
 		scoutfs_key_inc(&new_rng->start);
-		insert_range(sb, &cac->ranges, new_rng);
+		new_rng->detached = rng->detached;
+		new_rng->detached_version = rng->detached_version;
+		insert_range(sb, &shard->ranges, new_rng);
 
 		scoutfs_inc_counter(sb, item_shrink_split_range);
 	}
 
 	/* totally emptied the range */
 	if (!prev && !next) {
-		rb_erase(&rng->node, &cac->ranges);
+		rb_erase(&rng->node, &shard->ranges);
 		free_range(sb, rng);
 	}
 
@@ -2276,7 +2879,7 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 	     item = next) {
 		trace_scoutfs_item_shrink(sb, &item->key);
 		scoutfs_inc_counter(sb, item_shrink);
-		erase_item(sb, cac, item);
+		erase_item(sb, shard, item);
 		nr++;
 	}
 
@@ -2284,7 +2887,7 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
 }
 
 /*
- * Shrink the item cache. 
+ * Shrink the item cache.
  *
  * Unfortunately this is complicated by the rbtree of ranges that track
  * the validity of the cache.  If we free items we have to make sure
@@ -2295,66 +2898,94 @@ static int shrink_around(struct super_block *sb, struct cached_range *rng,
  *
  * We can also hit items in the lru which aren't covered by ranges, we
  * free those immediately.
+ *
+ * Each shard has its own lru so we sweep the shards in turn until
+ * we've scanned enough.
  */
 static int item_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 {
 	struct item_cache *cac = container_of(shrink, struct item_cache,
 					      shrinker);
 	struct super_block *sb = cac->sb;
+	struct item_shard *shard;
 	struct cached_range *rng;
 	struct cached_item *item;
-	struct cached_item *first_moved = NULL;
+	struct cached_item *first_moved;
 	unsigned long flags;
+	unsigned long count;
 	unsigned long nr;
 	int ret;
+	int i;
 
 	nr = sc->nr_to_scan;
 	if (nr == 0)
 		goto out;
 
-	spin_lock_irqsave(&cac->lock, flags);
-
-	while (nr &&
-	       (item = list_first_entry_or_null(&cac->lru_list,
-						struct cached_item, entry))) {
-
-		/* can't have dirty items on the lru */
-		BUG_ON(item_is_dirty(item));
-
-		/* if we're not in a range just shrink the item */
-		rng = walk_ranges(&cac->ranges, &item->key, NULL, NULL);
-		if (!rng) {
-			scoutfs_inc_counter(sb, item_shrink_outside);
-			erase_item(sb, cac, item);
-			nr--;
-			continue;
+	for (i = 0; i < ITEM_NR_SHARDS && nr; i++) {
+		struct list_head *lists[2];
+		int l;
+
+		shard = &cac->shards[i];
+		lists[0] = &shard->probation_list;
+		lists[1] = &shard->lru_list;
+
+		spin_lock_irqsave(&shard->lock, flags);
+
+		/* drain single-use probation items before the hot set */
+		for (l = 0; l < ARRAY_SIZE(lists) && nr; l++) {
+			first_moved = NULL;
+
+			while (nr &&
+			       (item = list_first_entry_or_null(lists[l],
+							struct cached_item,
+							entry))) {
+
+				/* can't have dirty items on the lru */
+				BUG_ON(item_is_dirty(item));
+
+				/* if we're not in a range just shrink the item */
+				rng = walk_ranges(&shard->ranges, &item->key,
+						  NULL, NULL);
+				if (!rng) {
+					scoutfs_inc_counter(sb,
+							item_shrink_outside);
+					erase_item(sb, shard, item);
+					nr--;
+					continue;
+				}
+
+				ret = shrink_around(sb, shard, rng, item);
+				if (ret == 0) {
+					if (first_moved && first_moved == item)
+						break;
+					else if (!first_moved)
+						first_moved = item;
+					list_move_tail(&item->entry, lists[l]);
+					continue;
+				}
+
+				nr -= min_t(unsigned long, nr, ret);
+			}
 		}
 
-		ret = shrink_around(sb, rng, item);
-		if (ret == 0) {
-			if (first_moved && first_moved == item)
-				break;
-			else if (!first_moved)
-				first_moved = item;
-			list_move_tail(&item->entry, &cac->lru_list);
-			continue;
+		/* always try to free empty ranges */
+		while (RB_EMPTY_ROOT(&shard->items) &&
+		       (rng = rb_first_rng(&shard->ranges))) {
+			scoutfs_inc_counter(sb, item_shrink_empty_range);
+			rb_erase(&rng->node, &shard->ranges);
+			free_range(sb, rng);
 		}
 
-		nr -= min_t(unsigned long, nr, ret);
+		spin_unlock_irqrestore(&shard->lock, flags);
 	}
 
-	/* always try to free empty ranges */
-	while (RB_EMPTY_ROOT(&cac->items) &&
-	       (rng = rb_first_rng(&cac->ranges))) {
-		scoutfs_inc_counter(sb, item_shrink_empty_range);
-		rb_erase(&rng->node, &cac->ranges);
-		free_range(sb, rng);
-	}
-
-	spin_unlock_irqrestore(&cac->lock, flags);
-
 out:
-	ret = min_t(unsigned long, cac->lru_nr, INT_MAX);
+	count = 0;
+	for (i = 0; i < ITEM_NR_SHARDS; i++)
+		count += cac->shards[i].probation_nr +
+			 cac->shards[i].lru_nr;
+
+	ret = min_t(unsigned long, count, INT_MAX);
 	trace_scoutfs_item_shrink_exit(sb, sc->nr_to_scan, ret);
 	return ret;
 }
@@ -2363,6 +2994,10 @@ out:
  * Copy the keys of the sorted cached ranges starting with the search
  * key into the caller's key array.  The number of copied range keys is
  * returned which will always be a multiple of two.
+ *
+ * The shards each hold an arbitrary subset of the ranges so each
+ * copied range comes from finding the least next range across all the
+ * shards.
  */
 int scoutfs_item_copy_range_keys(struct super_block *sb,
 				 struct scoutfs_key *key,
@@ -2370,40 +3005,53 @@ int scoutfs_item_copy_range_keys(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
-	struct rb_node *node = cac->ranges.rb_node;
-	struct cached_range *next = NULL;
+	struct item_shard *shard;
+	struct cached_range *next;
 	struct cached_range *rng;
+	struct scoutfs_key best_start;
+	struct scoutfs_key best_end;
+	struct scoutfs_key ones;
+	struct scoutfs_key pos;
 	unsigned long flags;
+	bool found;
 	int ret = 0;
-	int cmp;
+	int i;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	scoutfs_key_set_ones(&ones);
+	pos = *key;
 
-	while (node) {
-		rng = container_of(node, struct cached_range, node);
+	while (ret + 2 <= nr) {
+		found = false;
+
+		for (i = 0; i < ITEM_NR_SHARDS; i++) {
+			shard = &cac->shards[i];
+			spin_lock_irqsave(&shard->lock, flags);
+
+			rng = walk_ranges(&shard->ranges, &pos, NULL, &next) ?:
+			      next;
+			if (rng && (!found ||
+				    scoutfs_key_compare(&rng->start,
+							&best_start) < 0)) {
+				best_start = rng->start;
+				best_end = rng->end;
+				found = true;
+			}
 
-		cmp = scoutfs_key_compare_ranges(key, key,
-						 &rng->start, &rng->end);
-		if (cmp < 0) {
-			next = rng;
-			node = node->rb_left;
-		} else if (cmp > 0) {
-			node = node->rb_right;
-		} else {
-			next = rng;
-			break;
+			spin_unlock_irqrestore(&shard->lock, flags);
 		}
-	}
 
-	for (rng = next; rng; rng = rb_next_rng(rng)) {
-		if (ret + 2 > nr)
+		if (!found)
 			break;
 
-		keys[ret++] = rng->start;
-		keys[ret++] = rng->end;
-	}
+		keys[ret++] = best_start;
+		keys[ret++] = best_end;
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		if (scoutfs_key_compare(&best_end, &ones) == 0)
+			break;
+
+		pos = best_end;
+		scoutfs_key_inc(&pos);
+	}
 
 	return ret;
 }
@@ -2411,39 +3059,95 @@ int scoutfs_item_copy_range_keys(struct super_block *sb,
 /*
  * Copy keys for the sorted cached items starting with the search key
  * into the caller's key array.  The number of copied keys is returned.
+ *
+ * Like _copy_range_keys, we merge the per-shard sorted items by always
+ * copying the least next key across all the shards.
  */
 int scoutfs_item_copy_keys(struct super_block *sb, struct scoutfs_key *key,
 			   struct scoutfs_key *keys, unsigned nr)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
-	struct cached_item *item = NULL;
+	struct item_shard *shard;
+	struct cached_item *item;
+	struct scoutfs_key best;
+	struct scoutfs_key ones;
+	struct scoutfs_key pos;
 	unsigned long flags;
+	bool found;
 	int ret = 0;
+	int i;
+
+	scoutfs_key_set_ones(&ones);
+	pos = *key;
 
-	spin_lock_irqsave(&cac->lock, flags);
+	while (ret < nr) {
+		found = false;
 
-	for (item = next_item(&cac->items, key); item;
-	     item = rb_next_item(item)) {
+		for (i = 0; i < ITEM_NR_SHARDS; i++) {
+			shard = &cac->shards[i];
+			spin_lock_irqsave(&shard->lock, flags);
 
-		if (ret == nr)
+			item = next_item(&shard->items, &pos);
+			while (item && item->deletion)
+				item = rb_next_item(item);
+
+			if (item && (!found ||
+				     scoutfs_key_compare(&item->key,
+							 &best) < 0)) {
+				best = item->key;
+				found = true;
+			}
+
+			spin_unlock_irqrestore(&shard->lock, flags);
+		}
+
+		if (!found)
 			break;
 
-		if (item->deletion)
-			continue;
+		keys[ret++] = best;
 
-		keys[ret++] = item->key;
-	}
+		if (scoutfs_key_compare(&best, &ones) == 0)
+			break;
 
-	spin_unlock_irqrestore(&cac->lock, flags);
+		pos = best;
+		scoutfs_key_inc(&pos);
+	}
 
 	return ret;
 }
 
+/*
+ * Give sysfs the total occupancy of the two clean lru pools across the
+ * shards.  The sums race with the shards changing, they're only for
+ * observation.
+ */
+void scoutfs_item_lru_counts(struct super_block *sb, unsigned long *probation,
+			     unsigned long *protected)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_cache *cac = sbi->item_cache;
+	int i;
+
+	*probation = 0;
+	*protected = 0;
+
+	/* the sysfs dir exists before setup and after destroy */
+	if (!cac)
+		return;
+
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		*probation += cac->shards[i].probation_nr;
+		*protected += cac->shards[i].lru_nr;
+	}
+}
+
 int scoutfs_item_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct item_shard *shard;
 	struct item_cache *cac;
+	int i;
 
 	cac = kzalloc(sizeof(struct item_cache), GFP_KERNEL);
 	if (!cac)
@@ -2451,13 +3155,18 @@ int scoutfs_item_setup(struct super_block *sb)
 	sbi->item_cache = cac;
 
 	cac->sb = sb;
-	spin_lock_init(&cac->lock);
-	cac->items = RB_ROOT;
-	cac->ranges = RB_ROOT;
+	for (i = 0; i < ITEM_NR_SHARDS; i++) {
+		shard = &cac->shards[i];
+		spin_lock_init(&shard->lock);
+		shard->items = RB_ROOT;
+		shard->ranges = RB_ROOT;
+		shard->dirty_items = RB_ROOT;
+		INIT_LIST_HEAD(&shard->probation_list);
+		INIT_LIST_HEAD(&shard->lru_list);
+	}
 	cac->shrinker.shrink = item_lru_shrink;
 	cac->shrinker.seeks = DEFAULT_SEEKS;
 	register_shrinker(&cac->shrinker);
-	INIT_LIST_HEAD(&cac->lru_list);
 
 	return 0;
 }
@@ -2470,27 +3179,67 @@ void scoutfs_item_destroy(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct item_cache *cac = sbi->item_cache;
+	struct item_shard *shard;
 	struct cached_item *item;
 	struct cached_item *pos_item;
 	struct cached_range *rng;
 	struct cached_range *pos_rng;
+	int i;
 
 	if (cac) {
 		if (cac->shrinker.shrink == item_lru_shrink)
 			unregister_shrinker(&cac->shrinker);
 
-		rbtree_postorder_for_each_entry_safe(item, pos_item,
-						     &cac->items, node) {
-			RB_CLEAR_NODE(&item->node);
-			INIT_LIST_HEAD(&item->entry);
-			free_item(sb, item);
-		}
+		for (i = 0; i < ITEM_NR_SHARDS; i++) {
+			shard = &cac->shards[i];
 
-		rbtree_postorder_for_each_entry_safe(rng, pos_rng,
-						     &cac->ranges, node) {
-			free_range(sb, rng);
+			rbtree_postorder_for_each_entry_safe(item, pos_item,
+							     &shard->items,
+							     node) {
+				RB_CLEAR_NODE(&item->node);
+				INIT_LIST_HEAD(&item->entry);
+				free_item(sb, item);
+			}
+
+			rbtree_postorder_for_each_entry_safe(rng, pos_rng,
+							     &shard->ranges,
+							     node) {
+				free_range(sb, rng);
+			}
 		}
 
 		kfree(cac);
 	}
 }
+
+void scoutfs_item_exit(void)
+{
+	if (item_val_cachep) {
+		kmem_cache_destroy(item_val_cachep);
+		item_val_cachep = NULL;
+	}
+	if (cached_item_cachep) {
+		kmem_cache_destroy(cached_item_cachep);
+		cached_item_cachep = NULL;
+	}
+}
+
+int scoutfs_item_init(void)
+{
+	/* the shrinker reuses item memory to store split ranges */
+	BUILD_BUG_ON(sizeof(struct cached_item) <
+		     sizeof(struct cached_range));
+
+	cached_item_cachep = kmem_cache_create("scoutfs_cached_item",
+					       sizeof(struct cached_item), 0,
+					       SLAB_RECLAIM_ACCOUNT, NULL);
+	item_val_cachep = kmem_cache_create("scoutfs_item_val",
+					    ITEM_VAL_CACHE_SIZE, 0,
+					    SLAB_RECLAIM_ACCOUNT, NULL);
+	if (!cached_item_cachep || !item_val_cachep) {
+		scoutfs_item_exit();
+		return -ENOMEM;
+	}
+
+	return 0;
+}
@@ -8,17 +8,31 @@ struct scoutfs_key;
 
 int scoutfs_item_lookup(struct super_block *sb, struct scoutfs_key *key,
 			struct kvec *val, struct scoutfs_lock *lock);
+int scoutfs_item_lookup_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock);
 int scoutfs_item_lookup_exact(struct super_block *sb,
 			      struct scoutfs_key *key, struct kvec *val,
 			      struct scoutfs_lock *lock);
+int scoutfs_item_lookup_exact_buf(struct super_block *sb,
+				  struct scoutfs_key *key, void *buf,
+				  unsigned int len,
+				  struct scoutfs_lock *lock);
 int scoutfs_item_next(struct super_block *sb, struct scoutfs_key *key,
 		      struct scoutfs_key *last, struct kvec *val,
 		      struct scoutfs_lock *lock);
+int scoutfs_item_next_batch(struct super_block *sb, struct scoutfs_key *key,
+			    struct scoutfs_key *last,
+			    struct scoutfs_key *keys, struct kvec *vals,
+			    unsigned int nr, struct scoutfs_lock *lock);
 int scoutfs_item_prev(struct super_block *sb, struct scoutfs_key *key,
 		      struct scoutfs_key *first, struct kvec *val,
 		      struct scoutfs_lock *lock);
 int scoutfs_item_create(struct super_block *sb, struct scoutfs_key *key,
 		        struct kvec *val, struct scoutfs_lock *lock);
+int scoutfs_item_create_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock);
 int scoutfs_item_create_force(struct super_block *sb,
 			      struct scoutfs_key *key,
 			      struct kvec *val, struct scoutfs_lock *lock);
@@ -26,6 +40,9 @@ int scoutfs_item_dirty(struct super_block *sb, struct scoutfs_key *key,
 		       struct scoutfs_lock *lock);
 int scoutfs_item_update(struct super_block *sb, struct scoutfs_key *key,
 			struct kvec *val, struct scoutfs_lock *lock);
+int scoutfs_item_update_buf(struct super_block *sb, struct scoutfs_key *key,
+			    void *buf, unsigned int len,
+			    struct scoutfs_lock *lock);
 void scoutfs_item_delete_dirty(struct super_block *sb,
 			       struct scoutfs_key *key);
 void scoutfs_item_update_dirty(struct super_block *sb,
@@ -53,8 +70,9 @@ bool scoutfs_item_has_dirty(struct super_block *sb);
 bool scoutfs_item_range_cached(struct super_block *sb,
 			       struct scoutfs_key *start,
 			       struct scoutfs_key *end, bool dirty);
-bool scoutfs_item_dirty_fits_single(struct super_block *sb, u32 nr_items,
-			            u32 val_bytes);
+bool scoutfs_item_dirty_fits(struct super_block *sb, u32 nr_items,
+			     u32 val_bytes);
+bool scoutfs_item_dirty_over_pct(struct super_block *sb, unsigned int pct);
 int scoutfs_item_dirty_seg(struct super_block *sb, struct scoutfs_segment *seg);
 int scoutfs_item_writeback(struct super_block *sb,
 			   struct scoutfs_key *start,
@@ -62,6 +80,12 @@ int scoutfs_item_writeback(struct super_block *sb,
 int scoutfs_item_invalidate(struct super_block *sb,
 			    struct scoutfs_key *start,
 			    struct scoutfs_key *end);
+void scoutfs_item_range_detach(struct super_block *sb,
+			       struct scoutfs_key *start,
+			       struct scoutfs_key *end, u64 version);
+void scoutfs_item_range_reattach(struct super_block *sb,
+				 struct scoutfs_key *start,
+				 struct scoutfs_key *end, u64 version);
 
 int scoutfs_item_copy_range_keys(struct super_block *sb,
 				 struct scoutfs_key *key,
@@ -69,7 +93,13 @@ int scoutfs_item_copy_range_keys(struct super_block *sb,
 int scoutfs_item_copy_keys(struct super_block *sb, struct scoutfs_key *key,
 			   struct scoutfs_key *keys, unsigned nr);
 
+void scoutfs_item_lru_counts(struct super_block *sb, unsigned long *probation,
+			     unsigned long *protected);
+
 int scoutfs_item_setup(struct super_block *sb);
 void scoutfs_item_destroy(struct super_block *sb);
 
+int scoutfs_item_init(void);
+void scoutfs_item_exit(void);
+
 #endif
@@ -2,6 +2,7 @@
 #define _SCOUTFS_KEY_H_
 
 #include <linux/types.h>
+#include <asm/unaligned.h>
 #include "format.h"
 #include "cmp.h"
 #include "endian_swap.h"
@@ -99,6 +100,33 @@ static inline int scoutfs_key_compare(struct scoutfs_key *a,
 	  scoutfs_cmp(a->_sk_fourth, b->_sk_fourth);
 }
 
+/*
+ * Compare keys that are stored in their big endian encoding.  The
+ * encoding sorts bytes from most to least significant so ordering the
+ * keys is ordering their bytes, and we can compare unaligned words of
+ * the encoding instead of extracting each field.  This only wins when
+ * both keys are already stored encoded; converting them for each
+ * comparison would cost more than the field comparisons.
+ */
+static inline int scoutfs_key_compare_be(struct scoutfs_key_be *a,
+					 struct scoutfs_key_be *b)
+{
+	u8 *ab = (u8 *)a;
+	u8 *bb = (u8 *)b;
+
+	BUILD_BUG_ON(sizeof(struct scoutfs_key_be) != 27);
+
+	return scoutfs_cmp(get_unaligned_be64(ab),
+			   get_unaligned_be64(bb)) ?:
+	       scoutfs_cmp(get_unaligned_be64(ab + 8),
+			   get_unaligned_be64(bb + 8)) ?:
+	       scoutfs_cmp(get_unaligned_be64(ab + 16),
+			   get_unaligned_be64(bb + 16)) ?:
+	       scoutfs_cmp(get_unaligned_be16(ab + 24),
+			   get_unaligned_be16(bb + 24)) ?:
+	       scoutfs_cmp(ab[26], bb[26]);
+}
+
 /*
  * Compare ranges of keys where overlapping is equality.  Returns:
  *      -1: a_end < b_start
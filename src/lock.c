@@ -18,6 +18,7 @@
 #include <linux/mm.h>
 #include <linux/sort.h>
 #include <linux/ctype.h>
+#include <linux/random.h>
 
 #include "super.h"
 #include "lock.h"
@@ -31,6 +32,7 @@
 #include "endian_swap.h"
 #include "triggers.h"
 #include "tseq.h"
+#include "flight.h"
 
 /*
  * scoutfs manages internode item cache consistency using the kernel's
@@ -77,6 +79,8 @@ struct lock_info {
 	unsigned long long lru_nr;
 	struct workqueue_struct *workq;
 	dlm_lockspace_t *lockspace;
+	/* snapshot mounts hand out one static PR lock instead of the dlm */
+	struct scoutfs_lock *snap_lock;
 	atomic64_t next_refresh_gen;
 	struct dentry *tseq_dentry;
 	struct scoutfs_tseq_tree tseq_tree;
@@ -157,11 +161,27 @@ retry:
 			}
 		}
 
-		ret = scoutfs_item_invalidate(sb, start, end);
-		if (ret > 0) {
-			scoutfs_add_counter(sb, lock_invalidate_clean_item,
-					    ret);
+		/*
+		 * fs zone locks detach their cached items instead of
+		 * dropping them so that the cache can be used again if
+		 * the lock is re-granted with its write version
+		 * unchanged.  Other zones can hold CW which writes
+		 * without being able to maintain the lvb, so they
+		 * always invalidate.
+		 */
+		if (lock->name.zone == SCOUTFS_FS_ZONE &&
+		    prev != DLM_LOCK_CW) {
+			scoutfs_item_range_detach(sb, start, end,
+						  lock->write_version);
 			ret = 0;
+		} else {
+			ret = scoutfs_item_invalidate(sb, start, end);
+			if (ret > 0) {
+				scoutfs_add_counter(sb,
+						    lock_invalidate_clean_item,
+						    ret);
+				ret = 0;
+			}
 		}
 	}
 
@@ -224,6 +244,7 @@ static struct scoutfs_lock *lock_alloc(struct super_block *sb,
 
 	lock->sb = sb;
 	lock->name = *name;
+	lock->lksb.sb_lvbptr = (char *)&lock->lvb;
 	init_waitqueue_head(&lock->waitq);
 	INIT_WORK(&lock->work, scoutfs_lock_work);
 	INIT_DELAYED_WORK(&lock->grace_work, scoutfs_lock_grace_work);
@@ -546,8 +567,26 @@ static void scoutfs_lock_ast(void *arg)
 		    !lock_mode_can_read(lock->work_prev_mode)) {
 			lock->refresh_gen =
 				atomic64_inc_return(&linfo->next_refresh_gen);
+
+			/*
+			 * The grant read the lvb into our lksb.  Any
+			 * detached item cache left from previous grants
+			 * of the name is reattached if the write
+			 * version is unchanged and dropped if it
+			 * changed or the lvb was lost.
+			 */
+			if (lock->lksb.sb_flags & DLM_SBF_VALNOTVALID)
+				lock->write_version = 0;
+			else
+				lock->write_version = le64_to_cpu(lock->lvb);
+			if (lock->name.zone == SCOUTFS_FS_ZONE &&
+			    !RB_EMPTY_NODE(&lock->range_node))
+				scoutfs_item_range_reattach(sb, &lock->start,
+							&lock->end,
+							lock->write_version);
 		}
 		lock->granted_mode = lock->work_mode;
+		lock->stat_grants++;
 
 	} else if (status == -DLM_EUNLOCK) {
 		lock->granted_mode = DLM_LOCK_IV;
@@ -639,8 +678,26 @@ static void scoutfs_lock_bast(void *arg, int blocked_mode)
 	/* greater is safe, only try nl < all or pr < ex */
 	if (lock_mode_valid_and_greater(lock->granted_mode, bast_mode) ||
 	    lock_mode_valid_and_greater(lock->work_mode, bast_mode) ||
-	    lock_mode_valid_and_greater(lock->bast_mode, bast_mode))
+	    lock_mode_valid_and_greater(lock->bast_mode, bast_mode)) {
 		lock->bast_mode = bast_mode;
+		lock->stat_revokes++;
+
+		/*
+		 * The eventual down conversion has to write out any
+		 * dirty items under the lock before calling the dlm.
+		 * Kick the commit now so that it overlaps with holders
+		 * finishing and the grace period, instead of adding a
+		 * full commit latency once the conversion work runs.
+		 */
+		if ((lock->granted_mode == DLM_LOCK_CW ||
+		     lock->granted_mode == DLM_LOCK_EX) &&
+		    !RB_EMPTY_NODE(&lock->range_node) &&
+		    scoutfs_item_range_cached(sb, &lock->start, &lock->end,
+					      true)) {
+			scoutfs_inc_counter(sb, lock_bast_commit_kick);
+			scoutfs_trans_sync(sb, 0);
+		}
+	}
 
 	trace_scoutfs_lock_bast(sb, lock);
 	lock_process(linfo, lock);
@@ -660,6 +717,7 @@ static void scoutfs_lock_work(struct work_struct *work)
 	struct super_block *sb = lock->sb;
 	DECLARE_LOCK_INFO(sb, linfo);
 	int dlm_flags;
+	u64 version;
 	int prev;
 	int mode;
 	int ret;
@@ -678,6 +736,22 @@ static void scoutfs_lock_work(struct work_struct *work)
 
 	spin_unlock(&linfo->lock);
 
+	/*
+	 * Leaving EX means we could have written items under the lock.
+	 * Record a new write version in the lvb which the dlm writes to
+	 * the master as we unlock or downconvert.  Random nonzero
+	 * versions that are only compared for equality can't be fooled
+	 * by the dlm zeroing the lvb when the resource is tossed, which
+	 * an incrementing counter could be.
+	 */
+	if (prev == DLM_LOCK_EX && mode != DLM_LOCK_EX) {
+		do {
+			version = ((u64)prandom_u32() << 32) | prandom_u32();
+		} while (version == 0);
+		lock->write_version = version;
+		lock->lvb = cpu_to_le64(version);
+	}
+
 	if (!RB_EMPTY_NODE(&lock->range_node)) {
 		ret = lock_invalidate(sb, lock, prev, mode);
 		BUG_ON(ret);
@@ -686,10 +760,10 @@ static void scoutfs_lock_work(struct work_struct *work)
 	scoutfs_inc_counter(sb, lock_dlm_call);
 
 	if (mode == DLM_LOCK_NL) {
-		ret = dlm_unlock(linfo->lockspace, lock->lksb.sb_lkid, 0,
-				 &lock->lksb, lock);
+		ret = dlm_unlock(linfo->lockspace, lock->lksb.sb_lkid,
+				 DLM_LKF_VALBLK, &lock->lksb, lock);
 	} else {
-		dlm_flags = DLM_LKF_NOORDER;
+		dlm_flags = DLM_LKF_NOORDER | DLM_LKF_VALBLK;
 		if (prev >= 0)
 			dlm_flags |= DLM_LKF_CONVERT;
 		ret = dlm_lock(linfo->lockspace, mode, &lock->lksb, dlm_flags,
@@ -789,26 +863,41 @@ static bool lock_wait(struct lock_info *linfo, struct scoutfs_lock *lock,
 }
 
 /*
- * Acquire a coherent lock on the given range of keys.  On success the
- * caller can use the given mode to interact with the item cache.  While
- * holding the lock the cache won't be invalidated and other conflicting
- * lock users will be serialized.  The item cache can be invalidated
- * once the lock is unlocked.
+ * Start acquiring a lock without waiting for it to be granted.  The
+ * attempt is recorded as a waiter on the lock and processing is kicked
+ * so that a grant request can be in flight while the caller does other
+ * work, typically submitting more requests so that their round trips
+ * overlap.  Every successfully submitted request must be completed with
+ * a _request_wait() call.
  */
-static int lock_name_keys(struct super_block *sb, int mode, int flags,
-			  struct scoutfs_lock_name *name,
-			  struct scoutfs_key *start, struct scoutfs_key *end,
-			  struct scoutfs_lock **ret_lock)
+static int lock_name_keys_request(struct super_block *sb, int mode, int flags,
+				  struct scoutfs_lock_name *name,
+				  struct scoutfs_key *start,
+				  struct scoutfs_key *end,
+				  struct scoutfs_lock_request *req)
 {
 	DECLARE_LOCK_INFO(sb, linfo);
 	struct scoutfs_lock *lock;
 	struct scoutfs_lock *ins;
-	int wait_ret;
-	int ret;
+	int ret = 0;
 
 	scoutfs_inc_counter(sb, lock_lock);
 
-	*ret_lock = NULL;
+	req->lock = NULL;
+	req->mode = mode;
+	req->flags = flags;
+
+	/*
+	 * A snapshot mount reads from one frozen root so there's nothing
+	 * for locking to keep coherent.  Every read request gets the
+	 * statically granted lock and write attempts are refused.
+	 */
+	if (linfo && linfo->snap_lock) {
+		if (WARN_ON_ONCE(mode != DLM_LOCK_PR))
+			return -EROFS;
+		req->lock = linfo->snap_lock;
+		return 0;
+	}
 
 	/* maybe catch _setup() order mistakes */
 	if (WARN_ON_ONCE(!linfo || linfo->lockspace == NULL))
@@ -852,56 +941,157 @@ retry:
 	}
 
 	lock_inc_count(lock->waiters, mode);
+	/* kick off a grant request before the caller gets around to waiting */
+	lock_process(linfo, lock);
 	spin_unlock(&linfo->lock);
 
+	req->lock = lock;
+out:
+	return ret;
+}
+
+/*
+ * Wait for a submitted lock request to resolve.  On success the caller
+ * holds the lock as a user in the requested mode.
+ */
+static int lock_request_wait(struct super_block *sb,
+			     struct scoutfs_lock_request *req,
+			     struct scoutfs_lock **ret_lock)
+{
+	DECLARE_LOCK_INFO(sb, linfo);
+	struct scoutfs_lock *lock = req->lock;
+	ktime_t start_time;
+	int wait_ret;
+	int ret;
+
+	*ret_lock = NULL;
+
+	if (WARN_ON_ONCE(!lock))
+		return -EINVAL;
+
+	/* the static snapshot lock is always granted */
+	if (lock == linfo->snap_lock) {
+		*ret_lock = lock;
+		req->lock = NULL;
+		return 0;
+	}
+
+	start_time = ktime_get();
 	ret = wait_event_interruptible(lock->waitq,
-				       lock_wait(linfo, lock, mode, flags,
-					         &wait_ret));
+				       lock_wait(linfo, lock, req->mode,
+						 req->flags, &wait_ret));
+	scoutfs_latency_since(sb, lock_wait, start_time);
 	if (ret == 0)
 		ret = wait_ret;
+
+	spin_lock(&linfo->lock);
+	lock->stat_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), start_time));
 	if (ret) {
 		scoutfs_inc_counter(sb, lock_lock_error);
-		spin_lock(&linfo->lock);
-		lock_dec_count(lock->waiters, mode);
+		lock_dec_count(lock->waiters, req->mode);
 		lock_process(linfo, lock);
-		spin_unlock(&linfo->lock);
-	} else {
-		*ret_lock = lock;
 	}
-out:
+	spin_unlock(&linfo->lock);
+
+	scoutfs_flight_record(sb, SCOUTFS_FLIGHT_LOCK_WAIT,
+			      le64_to_cpu(lock->name.first),
+			      ktime_to_ns(ktime_sub(ktime_get(), start_time)),
+			      ret);
+
+	if (ret == 0)
+		*ret_lock = lock;
+
+	req->lock = NULL;
 	return ret;
 }
 
-int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
-		     struct scoutfs_lock **ret_lock)
+/*
+ * Acquire a coherent lock on the given range of keys.  On success the
+ * caller can use the given mode to interact with the item cache.  While
+ * holding the lock the cache won't be invalidated and other conflicting
+ * lock users will be serialized.  The item cache can be invalidated
+ * once the lock is unlocked.
+ */
+static int lock_name_keys(struct super_block *sb, int mode, int flags,
+			  struct scoutfs_lock_name *name,
+			  struct scoutfs_key *start, struct scoutfs_key *end,
+			  struct scoutfs_lock **ret_lock)
 {
-	struct scoutfs_lock_name name;
-	struct scoutfs_key start;
-	struct scoutfs_key end;
+	struct scoutfs_lock_request req;
+	int ret;
+
+	*ret_lock = NULL;
 
+	ret = lock_name_keys_request(sb, mode, flags, name, start, end, &req);
+	if (ret == 0)
+		ret = lock_request_wait(sb, &req, ret_lock);
+
+	return ret;
+}
+
+static void init_ino_name_keys(u64 ino, struct scoutfs_lock_name *name,
+			       struct scoutfs_key *start,
+			       struct scoutfs_key *end)
+{
 	ino &= ~(u64)SCOUTFS_LOCK_INODE_GROUP_MASK;
 
-	name.scope = SCOUTFS_LOCK_SCOPE_FS_ITEMS;
-	name.zone = SCOUTFS_FS_ZONE;
-	name.type = SCOUTFS_INODE_TYPE;
-	name.first = cpu_to_le64(ino);
-	name.second = 0;
+	name->scope = SCOUTFS_LOCK_SCOPE_FS_ITEMS;
+	name->zone = SCOUTFS_FS_ZONE;
+	name->type = SCOUTFS_INODE_TYPE;
+	name->first = cpu_to_le64(ino);
+	name->second = 0;
 
-	start = (struct scoutfs_key) {
+	*start = (struct scoutfs_key) {
 		.sk_zone = SCOUTFS_FS_ZONE,
 		.ski_ino = cpu_to_le64(ino),
 		.sk_type = 0,
 	};
 
-	end = (struct scoutfs_key) {
+	*end = (struct scoutfs_key) {
 		.sk_zone = SCOUTFS_FS_ZONE,
 		.ski_ino = cpu_to_le64(ino + SCOUTFS_LOCK_INODE_GROUP_NR - 1),
 		.sk_type = U8_MAX,
 	};
+}
+
+int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
+		     struct scoutfs_lock **ret_lock)
+{
+	struct scoutfs_lock_name name;
+	struct scoutfs_key start;
+	struct scoutfs_key end;
+
+	init_ino_name_keys(ino, &name, &start, &end);
 
 	return lock_name_keys(sb, mode, flags, &name, &start, &end, ret_lock);
 }
 
+/*
+ * Start acquiring an inode lock without waiting for the grant.  Bulk
+ * callers submit requests for all the inodes they'll need and then wait
+ * for each, overlapping the grant round trips instead of paying them
+ * serially.
+ */
+int scoutfs_lock_ino_request(struct super_block *sb, int mode, int flags,
+			     u64 ino, struct scoutfs_lock_request *req)
+{
+	struct scoutfs_lock_name name;
+	struct scoutfs_key start;
+	struct scoutfs_key end;
+
+	init_ino_name_keys(ino, &name, &start, &end);
+
+	return lock_name_keys_request(sb, mode, flags, &name, &start, &end,
+				      req);
+}
+
+int scoutfs_lock_request_wait(struct super_block *sb,
+			      struct scoutfs_lock_request *req,
+			      struct scoutfs_lock **ret_lock)
+{
+	return lock_request_wait(sb, req, ret_lock);
+}
+
 /*
  * Acquire a lock on an inode.
  *
@@ -982,7 +1172,10 @@ int scoutfs_lock_inodes(struct super_block *sb, int mode, int flags,
 	struct lock_inodes_arg args[] = {
 		{a, a_lock}, {b, b_lock}, {c, c_lock}, {d, D_lock},
 	};
+	struct scoutfs_lock_request reqs[ARRAY_SIZE(args)];
+	int err;
 	int ret;
+	int nr;
 	int i;
 
 	/* set all lock pointers to null and validating input */
@@ -999,12 +1192,29 @@ int scoutfs_lock_inodes(struct super_block *sb, int mode, int flags,
 	/* sort by having an inode then inode number */
 	sort(args, ARRAY_SIZE(args), sizeof(args[0]), cmp_arg, swap_arg);
 
-	/* lock unique inodes */
+	/* submit grant requests for all the inodes in parallel */
+	nr = 0;
 	for (i = 0; i < ARRAY_SIZE(args) && args[i].inode; i++) {
-		ret = scoutfs_lock_inode(sb, mode, flags, args[i].inode,
-					 args[i].lockp);
+		ret = scoutfs_lock_ino_request(sb, mode, flags,
+					       scoutfs_ino(args[i].inode),
+					       &reqs[i]);
 		if (ret)
 			break;
+		nr++;
+	}
+
+	/* always wait for submitted requests, in sorted order */
+	for (i = 0; i < nr; i++) {
+		err = scoutfs_lock_request_wait(sb, &reqs[i], args[i].lockp);
+		if (err && !ret)
+			ret = err;
+	}
+
+	/* refresh vfs inodes once all their locks are held */
+	for (i = 0; ret == 0 && (flags & SCOUTFS_LKF_REFRESH_INODE) &&
+	     i < nr; i++) {
+		ret = scoutfs_inode_refresh(args[i].inode, *args[i].lockp,
+					    flags);
 	}
 
 	/* unlock on error */
@@ -1141,6 +1351,10 @@ void scoutfs_unlock(struct super_block *sb, struct scoutfs_lock *lock, int mode)
 	if (IS_ERR_OR_NULL(lock))
 		return;
 
+	/* the static snapshot lock is never released */
+	if (lock == linfo->snap_lock)
+		return;
+
 	scoutfs_inc_counter(sb, lock_unlock);
 
 	spin_lock(&linfo->lock);
@@ -1276,7 +1490,7 @@ static void lock_tseq_show(struct seq_file *m, struct scoutfs_tseq_entry *ent)
 	struct scoutfs_lock *lock =
 		container_of(ent, struct scoutfs_lock, tseq_entry);
 
-	seq_printf(m, "name "LN_FMT" start "SK_FMT" end "SK_FMT" refresh_gen %llu error %d granted %d bast %d prev %d work %d waiters: pr %u ex %u cw %u users: pr %u ex %u cw %u dlmlksb: status %d lkid 0x%x flags 0x%x\n",
+	seq_printf(m, "name "LN_FMT" start "SK_FMT" end "SK_FMT" refresh_gen %llu error %d granted %d bast %d prev %d work %d waiters: pr %u ex %u cw %u users: pr %u ex %u cw %u dlmlksb: status %d lkid 0x%x flags 0x%x stats: grants %llu revokes %llu wait_ns %llu\n",
 			   LN_ARG(&lock->name), SK_ARG(&lock->start),
 			   SK_ARG(&lock->end), lock->refresh_gen, lock->error,
 			   lock->granted_mode, lock->bast_mode,
@@ -1289,7 +1503,10 @@ static void lock_tseq_show(struct seq_file *m, struct scoutfs_tseq_entry *ent)
 			   lock->users[DLM_LOCK_CW],
 			   lock->lksb.sb_status,
 			   lock->lksb.sb_lkid,
-			   lock->lksb.sb_flags);
+			   lock->lksb.sb_flags,
+			   lock->stat_grants,
+			   lock->stat_revokes,
+			   lock->stat_wait_ns);
 }
 
 /*
@@ -1399,6 +1616,8 @@ void scoutfs_lock_destroy(struct super_block *sb)
 		node = rb_next(node);
 		lock_free(linfo, lock);
 	}
+	if (linfo->snap_lock)
+		lock_free(linfo, linfo->snap_lock);
 	spin_unlock(&linfo->lock);
 
 	kfree(linfo);
@@ -1408,7 +1627,10 @@ void scoutfs_lock_destroy(struct super_block *sb)
 int scoutfs_lock_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_lock_name snap_name;
 	char name[DLM_LOCKSPACE_LEN];
+	struct scoutfs_key start;
+	struct scoutfs_key end;
 	struct lock_info *linfo;
 	int ret;
 
@@ -1452,6 +1674,28 @@ int scoutfs_lock_setup(struct super_block *sb)
 		goto out;
 	}
 
+	/*
+	 * A snapshot mount reads from one frozen root that nobody else
+	 * modifies, so it doesn't join the lockspace.  Every lock
+	 * request is handed this one statically granted PR lock that
+	 * covers all keys and is never revoked.
+	 */
+	if (sbi->opts.snapshot) {
+		memset(&snap_name, 0, sizeof(snap_name));
+		scoutfs_key_set_zeros(&start);
+		scoutfs_key_set_ones(&end);
+		linfo->snap_lock = lock_alloc(sb, &snap_name, &start, &end);
+		if (!linfo->snap_lock) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		linfo->snap_lock->granted_mode = DLM_LOCK_PR;
+		linfo->snap_lock->refresh_gen =
+			atomic64_inc_return(&linfo->next_refresh_gen);
+		ret = 0;
+		goto out;
+	}
+
 	snprintf(name, DLM_LOCKSPACE_LEN, "scoutfs_fsid_%llx",
 		 le64_to_cpu(sbi->super.hdr.fsid));
 
@@ -27,6 +27,16 @@ struct scoutfs_lock {
 	wait_queue_head_t waitq;
 	struct work_struct work;
 	struct dlm_lksb lksb;
+
+	/*
+	 * The dlm lock value block stores the write version for the
+	 * lock's name: a new random nonzero value recorded each time an
+	 * EX holder releases the lock.  Detached item cache ranges
+	 * record the version they were cached under and are only usable
+	 * again if the lock is granted with the version unchanged.
+	 */
+	__le64 lvb;
+	u64 write_version;
 	ktime_t grace_deadline;
 	struct delayed_work grace_work;
 	bool grace_pending;
@@ -42,6 +52,11 @@ struct scoutfs_lock {
 	unsigned int waiters[SCOUTFS_LOCK_NR_MODES];
 	unsigned int users[SCOUTFS_LOCK_NR_MODES];
 
+	/* cumulative stats shown in the locks tseq debugfs file */
+	u64 stat_grants;
+	u64 stat_revokes;
+	u64 stat_wait_ns;
+
 	struct scoutfs_tseq_entry tseq_entry;
 };
 
@@ -51,10 +66,25 @@ struct scoutfs_lock_coverage {
 	struct list_head head;
 };
 
+/*
+ * A lock acquisition that has been submitted but not yet waited on.
+ * Every submitted request must be resolved with a _request_wait() call.
+ */
+struct scoutfs_lock_request {
+	struct scoutfs_lock *lock;
+	int mode;
+	int flags;
+};
+
 int scoutfs_lock_inode(struct super_block *sb, int mode, int flags,
 		       struct inode *inode, struct scoutfs_lock **ret_lock);
 int scoutfs_lock_ino(struct super_block *sb, int mode, int flags, u64 ino,
 		     struct scoutfs_lock **ret_lock);
+int scoutfs_lock_ino_request(struct super_block *sb, int mode, int flags,
+			     u64 ino, struct scoutfs_lock_request *req);
+int scoutfs_lock_request_wait(struct super_block *sb,
+			      struct scoutfs_lock_request *req,
+			      struct scoutfs_lock **ret_lock);
 void scoutfs_lock_get_index_item_range(u8 type, u64 major, u64 ino,
 				       struct scoutfs_key *start,
 				       struct scoutfs_key *end);
@@ -14,7 +14,8 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/list_sort.h>
+#include <linux/sort.h>
+#include <linux/rbtree.h>
 
 #include "super.h"
 #include "format.h"
@@ -46,16 +47,55 @@ struct manifest {
 	struct rw_semaphore rwsem;
 	u8 nr_levels;
 
-	/* calculated on mount, const thereafter */
-	u64 level_limits[SCOUTFS_MANIFEST_MAX_LEVEL + 1];
 	u64 compacts_pending[SCOUTFS_MANIFEST_MAX_LEVEL + 1];
 	struct scoutfs_spbm segno_busy;
 
 	unsigned long flags;
 
 	struct scoutfs_key compact_keys[SCOUTFS_MANIFEST_MAX_LEVEL + 1];
+
+	/* amplified reads record keys that bias compaction to hot ranges */
+	spinlock_t read_hint_lock;
+	struct scoutfs_key read_hint_keys[SCOUTFS_MANIFEST_MAX_LEVEL + 1];
+	bool read_hint_set[SCOUTFS_MANIFEST_MAX_LEVEL + 1];
+
+	/* detects iterators advancing through adjacent ranges */
+	spinlock_t ra_lock;
+	struct scoutfs_key ra_next;
+	unsigned int ra_streak;
+
+	/* in-memory copies of recently used segment bloom filters */
+	spinlock_t bloom_lock;
+	struct rb_root bloom_root;
+	struct list_head bloom_lru;
+	unsigned long bloom_nr;
+};
+
+/* only start readahead once an iterator shows a sequential pattern */
+#define MANIFEST_RA_MIN_STREAK 2
+
+/*
+ * Cached bloom filters let point lookup misses test segments, level 0
+ * in particular, without re-reading their header blocks every time.
+ * Each filter copy is 32k so a full cache costs a megabyte.
+ */
+#define MANIFEST_BLOOM_CACHE_NR 32
+
+struct manifest_bloom {
+	struct rb_node node;
+	struct list_head lru_entry;
+	u64 segno;
+	u64 seq;
+	__le64 *longs;
 };
 
+/*
+ * The compaction candidate search looks this far past the level's sweep
+ * hand for an entry with more deletion items.  It bounds the btree
+ * walking per request while still finding tombstone-heavy segments.
+ */
+#define MANIFEST_COMPACT_SCAN_NR 16
+
 #define MANI_FLAG_LEVEL0_FULL (1 << 0)
 
 #define DECLARE_MANIFEST(sb, name) \
@@ -71,8 +111,6 @@ struct manifest {
  * their reallocated and reused.
  */
 struct manifest_ref {
-	struct list_head entry;
-
 	u64 segno;
 	u64 seq;
 	struct scoutfs_segment *seg;
@@ -85,6 +123,18 @@ struct manifest_ref {
 	struct scoutfs_key last;
 };
 
+/*
+ * Readers collect their refs in a small growable array.  The merge loop
+ * visits every ref for each item it copies so walking a contiguous
+ * array keeps it in a few cache lines instead of chasing list pointers
+ * through separately allocated entries.
+ */
+struct manifest_refs {
+	unsigned int nr;
+	unsigned int alloc;
+	struct manifest_ref *refs;
+};
+
 /*
  * Change the level count under the manifest lock.  We then maintain a
  * bit that can be tested outside the lock to determine if the caller
@@ -133,6 +183,7 @@ void scoutfs_manifest_init_entry(struct scoutfs_manifest_entry *ment,
 	ment->level = level;
 	ment->segno = segno;
 	ment->seq = seq;
+	ment->nr_deletions = 0;
 	scoutfs_key_copy_or_zeros(&ment->first, first);
 	scoutfs_key_copy_or_zeros(&ment->last, last);
 }
@@ -146,9 +197,11 @@ static void init_btree_key(struct scoutfs_manifest_btree_key *mkey,
 }
 
 static void init_btree_val(struct scoutfs_manifest_btree_val *mval,
-			   u64 segno, struct scoutfs_key *last)
+			   u64 segno, u32 nr_deletions,
+			   struct scoutfs_key *last)
 {
 	mval->segno = cpu_to_le64(segno);
+	mval->nr_deletions = cpu_to_le32(nr_deletions);
 	mval->last_key = *last;
 }
 
@@ -163,6 +216,7 @@ static void init_ment_iref(struct scoutfs_manifest_entry *ment,
 	scoutfs_key_from_be(&ment->first, &mkey->first_key);
 	ment->seq = be64_to_cpu(mkey->seq);
 	ment->segno = le64_to_cpu(mval->segno);
+	ment->nr_deletions = le32_to_cpu(mval->nr_deletions);
 	ment->last = mval->last_key;
 }
 
@@ -186,7 +240,7 @@ int scoutfs_manifest_add(struct super_block *sb,
 	lockdep_assert_held(&mani->rwsem);
 
 	init_btree_key(&mkey, ment->level, ment->seq, &ment->first);
-	init_btree_val(&mval, ment->segno, &ment->last);
+	init_btree_val(&mval, ment->segno, ment->nr_deletions, &ment->last);
 
 	trace_scoutfs_manifest_add(sb, ment->level, ment->segno, ment->seq,
 				   &ment->first, &ment->last);
@@ -255,27 +309,41 @@ int scoutfs_manifest_unlock(struct super_block *sb)
 	return 0;
 }
 
-static void free_ref(struct super_block *sb, struct manifest_ref *ref)
+static void free_refs(struct super_block *sb, struct manifest_refs *mrefs)
 {
-	if (!IS_ERR_OR_NULL(ref)) {
-		WARN_ON_ONCE(!list_empty(&ref->entry));
-		scoutfs_seg_put(ref->seg);
-		kfree(ref);
-	}
+	unsigned int i;
+
+	for (i = 0; i < mrefs->nr; i++)
+		scoutfs_seg_put(mrefs->refs[i].seg);
+	kfree(mrefs->refs);
+	mrefs->refs = NULL;
+	mrefs->nr = 0;
+	mrefs->alloc = 0;
 }
 
 /*
- * Allocate a reading manifest ref so that we can work with segments
- * described by the callers manifest entry.
+ * Append a reading manifest ref so that we can work with the segment
+ * described by the caller's manifest entry, doubling the array as it
+ * fills.
  */
-static int alloc_manifest_ref(struct super_block *sb, struct list_head *ref_list,
-			      struct scoutfs_manifest_entry *ment)
+static int add_manifest_ref(struct super_block *sb,
+			    struct manifest_refs *mrefs,
+			    struct scoutfs_manifest_entry *ment)
 {
 	struct manifest_ref *ref;
+	unsigned int alloc;
+
+	if (mrefs->nr == mrefs->alloc) {
+		alloc = mrefs->alloc ? mrefs->alloc * 2 : 8;
+		ref = krealloc(mrefs->refs, alloc * sizeof(*ref), GFP_NOFS);
+		if (!ref)
+			return -ENOMEM;
+		mrefs->refs = ref;
+		mrefs->alloc = alloc;
+	}
 
-	ref = kzalloc(sizeof(struct manifest_ref), GFP_NOFS);
-	if (!ref)
-		return -ENOMEM;
+	ref = &mrefs->refs[mrefs->nr++];
+	memset(ref, 0, sizeof(*ref));
 
 	ref->first = ment->first;
 	ref->last = ment->last;
@@ -283,8 +351,6 @@ static int alloc_manifest_ref(struct super_block *sb, struct list_head *ref_list
 	ref->segno = ment->segno;
 	ref->seq = ment->seq;
 
-	list_add_tail(&ref->entry, ref_list);
-
 	return 0;
 }
 
@@ -353,7 +419,7 @@ static int get_zero_refs(struct super_block *sb,
 			 struct scoutfs_btree_root *root,
 			 struct scoutfs_key *start,
 			 struct scoutfs_key *end,
-			 struct list_head *ref_list)
+			 struct manifest_refs *mrefs)
 {
 	struct scoutfs_manifest_btree_key mkey;
 	struct scoutfs_manifest_entry ment;
@@ -391,7 +457,7 @@ static int get_zero_refs(struct super_block *sb,
 		}
 
 		if (cmp == 0) {
-			ret = alloc_manifest_ref(sb, ref_list, &ment);
+			ret = add_manifest_ref(sb, mrefs, &ment);
 			if (ret)
 				break;
 		}
@@ -426,7 +492,7 @@ static int get_nonzero_refs(struct super_block *sb,
 			    struct scoutfs_key *key,
 			    struct scoutfs_key *start,
 			    struct scoutfs_key *end,
-			    struct list_head *ref_list)
+			    struct manifest_refs *mrefs)
 {
 	struct scoutfs_manifest_btree_key mkey;
 	struct scoutfs_manifest_entry ment;
@@ -456,7 +522,7 @@ static int get_nonzero_refs(struct super_block *sb,
 		    (end && scoutfs_key_compare(&ment.first, end) > 0))
 			continue;
 
-		ret = alloc_manifest_ref(sb, ref_list, &ment);
+		ret = add_manifest_ref(sb, mrefs, &ment);
 		if (ret)
 			break;
 
@@ -496,11 +562,10 @@ static int handle_stale_btree(struct super_block *sb,
 	return ret;
 }
 
-static int cmp_ment_ref_segno(void *priv, struct list_head *A,
-			      struct list_head *B)
+static int cmp_ment_ref_segno(const void *A, const void *B)
 {
-	struct manifest_ref *a = list_entry(A, struct manifest_ref, entry);
-	struct manifest_ref *b = list_entry(B, struct manifest_ref, entry);
+	const struct manifest_ref *a = A;
+	const struct manifest_ref *b = B;
 
 	return scoutfs_cmp_u64s(a->segno, b->segno);
 }
@@ -509,11 +574,10 @@ static int cmp_ment_ref_segno(void *priv, struct list_head *A,
  * Sort by from most to least recent item contents.. from lowest to higest
  * level and from highest to loweset seq in level 0.
  */
-static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
-				  struct list_head *B)
+static int cmp_ment_ref_level_seq(const void *A, const void *B)
 {
-	struct manifest_ref *a = list_entry(A, struct manifest_ref, entry);
-	struct manifest_ref *b = list_entry(B, struct manifest_ref, entry);
+	const struct manifest_ref *a = A;
+	const struct manifest_ref *b = B;
 
 	if (a->level == 0 && b->level == 0)
 		return -scoutfs_cmp_u64s(a->seq, b->seq);
@@ -521,6 +585,244 @@ static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
 	return a->level < b->level ? -1 : a->level > b->level ? 1 : 0;
 }
 
+static struct manifest_bloom *bloom_rb_find(struct manifest *mani, u64 segno)
+{
+	struct rb_node *node = mani->bloom_root.rb_node;
+	struct manifest_bloom *mb;
+
+	while (node) {
+		mb = container_of(node, struct manifest_bloom, node);
+
+		if (segno < mb->segno)
+			node = node->rb_left;
+		else if (segno > mb->segno)
+			node = node->rb_right;
+		else
+			return mb;
+	}
+
+	return NULL;
+}
+
+static void bloom_rb_insert(struct manifest *mani, struct manifest_bloom *ins)
+{
+	struct rb_node **node = &mani->bloom_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct manifest_bloom *mb;
+
+	while (*node) {
+		parent = *node;
+		mb = container_of(*node, struct manifest_bloom, node);
+
+		if (ins->segno < mb->segno)
+			node = &(*node)->rb_left;
+		else
+			node = &(*node)->rb_right;
+	}
+
+	rb_link_node(&ins->node, parent, node);
+	rb_insert_color(&ins->node, &mani->bloom_root);
+}
+
+static void bloom_erase(struct manifest *mani, struct manifest_bloom *mb)
+{
+	rb_erase(&mb->node, &mani->bloom_root);
+	list_del(&mb->lru_entry);
+	mani->bloom_nr--;
+}
+
+static void bloom_free(struct manifest_bloom *mb)
+{
+	if (mb) {
+		kfree(mb->longs);
+		kfree(mb);
+	}
+}
+
+/*
+ * Test a point lookup key against an in-memory copy of a segment's
+ * bloom filter, copying the filter from just the segment's header
+ * blocks to fill the cache on a miss.  Level 0 segments all overlap so
+ * every lookup miss has to consider each of them; the cached filters
+ * let us dismiss them without any IO at all.
+ *
+ * Returns 0 if the segment can't contain the key and 1 if it might, or
+ * if we couldn't get filter bits, so that callers fall back to the full
+ * segment read path which knows how to retry.
+ */
+static int manifest_bloom_check(struct super_block *sb, u64 segno, u64 seq,
+				struct scoutfs_key *key)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct manifest_bloom *mb;
+	bool cached = false;
+	int ret = 1;
+
+	spin_lock(&mani->bloom_lock);
+	mb = bloom_rb_find(mani, segno);
+	if (mb && mb->seq != seq) {
+		/* the segno was rewritten, the old filter is useless */
+		bloom_erase(mani, mb);
+		bloom_free(mb);
+		mb = NULL;
+	}
+	if (mb) {
+		list_move(&mb->lru_entry, &mani->bloom_lru);
+		ret = !!scoutfs_seg_bloom_test_longs(mb->longs, key);
+		cached = true;
+	}
+	spin_unlock(&mani->bloom_lock);
+
+	if (cached) {
+		scoutfs_inc_counter(sb, manifest_bloom_cache_hit);
+		goto out;
+	}
+
+	mb = kzalloc(sizeof(struct manifest_bloom), GFP_NOFS);
+	if (mb)
+		mb->longs = kmalloc(SCOUTFS_SEG_BLOOM_LONGS * sizeof(__le64),
+				    GFP_NOFS);
+	if (!mb || !mb->longs) {
+		bloom_free(mb);
+		ret = 1;
+		goto out;
+	}
+
+	if (scoutfs_seg_bloom_read(sb, segno, seq, mb->longs)) {
+		bloom_free(mb);
+		ret = 1;
+		goto out;
+	}
+
+	mb->segno = segno;
+	mb->seq = seq;
+	ret = !!scoutfs_seg_bloom_test_longs(mb->longs, key);
+
+	spin_lock(&mani->bloom_lock);
+	if (bloom_rb_find(mani, segno)) {
+		/* lost the race to fill, theirs is as good as ours */
+		spin_unlock(&mani->bloom_lock);
+		bloom_free(mb);
+	} else {
+		bloom_rb_insert(mani, mb);
+		list_add(&mb->lru_entry, &mani->bloom_lru);
+		if (++mani->bloom_nr > MANIFEST_BLOOM_CACHE_NR) {
+			mb = list_last_entry(&mani->bloom_lru,
+					     struct manifest_bloom, lru_entry);
+			bloom_erase(mani, mb);
+		} else {
+			mb = NULL;
+		}
+		spin_unlock(&mani->bloom_lock);
+		bloom_free(mb);
+	}
+out:
+	if (ret)
+		scoutfs_inc_counter(sb, seg_bloom_hit);
+	else
+		scoutfs_inc_counter(sb, seg_bloom_miss);
+	return ret;
+}
+
+/*
+ * An iterating reader just cached items up to batch_end and will come
+ * back for the keys after it once its consumer crosses the range.  If
+ * consecutive reads have been advancing through adjacent ranges then
+ * submit reads for the segments that cover the next key so that they're
+ * in the segment cache, or in flight, by the time the reader returns.
+ *
+ * Readahead is advisory so we ignore errors and never wait.  We drop
+ * our segment refs immediately; the segment cache holds the segments
+ * until the shrinker gets to them.
+ */
+static void readahead_next_segments(struct super_block *sb,
+				    struct scoutfs_btree_root *root,
+				    struct scoutfs_key *key,
+				    struct scoutfs_key *batch_end)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct manifest_refs mrefs = {0,};
+	struct scoutfs_segment *seg;
+	struct scoutfs_key next;
+	struct scoutfs_key ones;
+	bool streaking;
+	unsigned int i;
+	int ret;
+
+	/* can't advance past the end of the key space */
+	scoutfs_key_set_ones(&ones);
+	if (scoutfs_key_compare(batch_end, &ones) == 0)
+		return;
+
+	next = *batch_end;
+	scoutfs_key_inc(&next);
+
+	spin_lock(&mani->ra_lock);
+	if (scoutfs_key_compare(key, &mani->ra_next) == 0)
+		mani->ra_streak++;
+	else
+		mani->ra_streak = 0;
+	streaking = mani->ra_streak >= MANIFEST_RA_MIN_STREAK;
+	mani->ra_next = next;
+	spin_unlock(&mani->ra_lock);
+
+	if (!streaking)
+		return;
+
+	ret = get_nonzero_refs(sb, root, &next, NULL, NULL, &mrefs) ?:
+	      get_zero_refs(sb, root, &next, &next, &mrefs);
+	if (ret)
+		goto out;
+
+	sort(mrefs.refs, mrefs.nr, sizeof(struct manifest_ref),
+	     cmp_ment_ref_segno, NULL);
+
+	for (i = 0; i < mrefs.nr; i++) {
+		seg = scoutfs_seg_submit_read(sb, mrefs.refs[i].segno);
+		if (IS_ERR(seg))
+			break;
+
+		scoutfs_inc_counter(sb, manifest_readahead_segment);
+		scoutfs_seg_put(seg);
+	}
+
+out:
+	free_refs(sb, &mrefs);
+}
+
+/*
+ * A read that had to merge multiple segments is suffering read
+ * amplification.  Record the key per level so that the compaction
+ * scheduler can push the ranges that reads actually touch down the tree
+ * ahead of cold ranges.  Level 0 is excluded because its compaction
+ * always takes the oldest segment.
+ *
+ * The hints only steer compaction when this mount is also running the
+ * server that hands out compaction requests; like counters they aren't
+ * forwarded between nodes.
+ */
+static void record_read_hints(struct super_block *sb,
+			      struct manifest_refs *mrefs,
+			      struct scoutfs_key *key)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct manifest_ref *ref;
+	unsigned int i;
+
+	if (mrefs->nr < 2)
+		return;
+
+	spin_lock(&mani->read_hint_lock);
+	for (i = 0; i < mrefs->nr; i++) {
+		ref = &mrefs->refs[i];
+		if (ref->level > 0) {
+			mani->read_hint_keys[ref->level] = *key;
+			mani->read_hint_set[ref->level] = true;
+		}
+	}
+	spin_unlock(&mani->read_hint_lock);
+}
+
 /*
  * The caller found a hole in the item cache that they'd like populated.
  * We can only trust items in the segments within their range (they hold
@@ -551,11 +853,18 @@ static int cmp_ment_ref_level_seq(void *priv, struct list_head *A,
  *
  * The segments are immutable at this point so we can use their contents
  * as long as we hold refs.
+ *
+ * Point lookup callers only need the cache to contain their single key.
+ * If every segment's bloom filter says that it can't contain the key
+ * then we can negatively cache just the key without reading any of the
+ * segments.  A single false positive falls back to the full read.
+ * Iterating callers always read the segments so that they populate wide
+ * cached ranges.
  */
 int scoutfs_manifest_read_items(struct super_block *sb,
 				struct scoutfs_key *key,
 				struct scoutfs_key *start,
-				struct scoutfs_key *end)
+				struct scoutfs_key *end, bool point)
 {
 	struct scoutfs_key item_key;
 	struct scoutfs_key found_key;
@@ -563,16 +872,16 @@ int scoutfs_manifest_read_items(struct super_block *sb,
 	struct scoutfs_key seg_start;
 	struct scoutfs_key seg_end;
 	struct scoutfs_btree_root root;
+	struct manifest_refs mrefs = {0,};
 	struct scoutfs_segment *seg;
 	struct manifest_ref *ref;
-	struct manifest_ref *tmp;
 	__le64 last_root_seq;
 	struct kvec found_val;
 	struct kvec item_val;
-	LIST_HEAD(ref_list);
 	LIST_HEAD(batch);
 	u8 found_flags = 0;
 	u8 item_flags;
+	unsigned int i;
 	int found_ctr;
 	bool found;
 	bool added;
@@ -597,23 +906,47 @@ retry_stale:
 		goto out;
 
 	/* get non-zero segments that intersect with the key, shrinks range */
-	ret = get_nonzero_refs(sb, &root, key, &seg_start, &seg_end, &ref_list);
+	ret = get_nonzero_refs(sb, &root, key, &seg_start, &seg_end, &mrefs);
 	if (ret)
 		goto out;
 
 	trace_scoutfs_read_item_keys(sb, key, start, end, &seg_start, &seg_end);
 
 	/* then get level 0s that intersect with our search range */
-	ret = get_zero_refs(sb, &root, &seg_start, &seg_end, &ref_list);
+	ret = get_zero_refs(sb, &root, &seg_start, &seg_end, &mrefs);
 	if (ret)
 		goto out;
 
 	/* sort by segment to issue advancing reads */
-	list_sort(NULL, &ref_list, cmp_ment_ref_segno);
+	sort(mrefs.refs, mrefs.nr, sizeof(struct manifest_ref),
+	     cmp_ment_ref_segno, NULL);
+
+	/*
+	 * If no segment's bloom filter can contain a point lookup's key
+	 * then negatively cache just the key without reading segments.
+	 */
+	if (point) {
+		for (i = 0; i < mrefs.nr; i++) {
+			ref = &mrefs.refs[i];
+			if (manifest_bloom_check(sb, ref->segno, ref->seq,
+						 key))
+				break;
+		}
+		if (i == mrefs.nr) {
+			scoutfs_inc_counter(sb, manifest_bloom_skip_read);
+			seg_start = *key;
+			batch_end = *key;
+			ret = scoutfs_item_insert_batch(sb, &batch, &seg_start,
+							&batch_end);
+			goto out;
+		}
+	}
 
 resubmit:
 	/* submit reads for all the segments */
-	list_for_each_entry(ref, &ref_list, entry) {
+	for (i = 0; i < mrefs.nr; i++) {
+		ref = &mrefs.refs[i];
+
 		/* don't resubmit if we've read */
 		if (ref->seg)
 			continue;
@@ -632,7 +965,9 @@ resubmit:
 	}
 
 	/* always wait for submitted segments */
-	list_for_each_entry(ref, &ref_list, entry) {
+	for (i = 0; i < mrefs.nr; i++) {
+		ref = &mrefs.refs[i];
+
 		if (!ref->seg)
 			continue;
 
@@ -650,12 +985,16 @@ resubmit:
 	if (ret)
 		goto out;
 
+	record_read_hints(sb, &mrefs, key);
+
 	/* now sort refs by item age */
-	list_sort(NULL, &ref_list, cmp_ment_ref_level_seq);
+	sort(mrefs.refs, mrefs.nr, sizeof(struct manifest_ref),
+	     cmp_ment_ref_level_seq, NULL);
 
 	/* walk items from the start of our range */
-	list_for_each_entry(ref, &ref_list, entry)
-		ref->off = scoutfs_seg_find_off(ref->seg, &seg_start);
+	for (i = 0; i < mrefs.nr; i++)
+		mrefs.refs[i].off = scoutfs_seg_find_off(mrefs.refs[i].seg,
+							 &seg_start);
 
 	found_ctr = 0;
 
@@ -665,7 +1004,9 @@ resubmit:
 		found_ctr++;
 
 		/* find the next least key from the off in each segment */
-		list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
+		for (i = 0; i < mrefs.nr; i++) {
+			ref = &mrefs.refs[i];
+
 			if (ref->off < 0)
 				continue;
 
@@ -740,7 +1081,8 @@ resubmit:
 		}
 
 		/* advance all the positions that had the found key */
-		list_for_each_entry(ref, &ref_list, entry) {
+		for (i = 0; i < mrefs.nr; i++) {
+			ref = &mrefs.refs[i];
 			if (ref->found_ctr == found_ctr)
 				ref->off = scoutfs_seg_next_off(ref->seg,
 								ref->off);
@@ -756,12 +1098,11 @@ resubmit:
 			scoutfs_inc_counter(sb, manifest_read_excluded_key);
 		ret = scoutfs_item_insert_batch(sb, &batch, &seg_start,
 						&batch_end);
+		if (ret == 0 && !point)
+			readahead_next_segments(sb, &root, key, &batch_end);
 	}
 out:
-	list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
-		list_del_init(&ref->entry);
-		free_ref(sb, ref);
-	}
+	free_refs(sb, &mrefs);
 
 	ret = handle_stale_btree(sb, &root, last_root_seq, ret);
 	if (ret == -EAGAIN) {
@@ -792,11 +1133,11 @@ int scoutfs_manifest_next_key(struct super_block *sb, struct scoutfs_key *key,
 {
 	struct scoutfs_key item_key;
 	struct scoutfs_btree_root root;
+	struct manifest_refs mrefs = {0,};
 	struct scoutfs_segment *seg;
 	struct manifest_ref *ref;
-	struct manifest_ref *tmp;
 	__le64 last_root_seq;
-	LIST_HEAD(ref_list);
+	unsigned int i;
 	bool found;
 	int ret;
 	int err;
@@ -807,29 +1148,32 @@ retry_stale:
 	if (ret)
 		goto out;
 
-	ret = get_zero_refs(sb, &root, key, key, &ref_list) ?:
-	      get_nonzero_refs(sb, &root, key, NULL, NULL, &ref_list);
+	ret = get_zero_refs(sb, &root, key, key, &mrefs) ?:
+	      get_nonzero_refs(sb, &root, key, NULL, NULL, &mrefs);
 	if (ret)
 		goto out;
 
-	if (list_empty(&ref_list)) {
+	if (mrefs.nr == 0) {
 		ret = -ENOENT;
 		goto out;
 	}
 
-	list_sort(NULL, &ref_list, cmp_ment_ref_segno);
+	sort(mrefs.refs, mrefs.nr, sizeof(struct manifest_ref),
+	     cmp_ment_ref_segno, NULL);
 
-	list_for_each_entry(ref, &ref_list, entry) {
-		seg = scoutfs_seg_submit_read(sb, ref->segno);
+	for (i = 0; i < mrefs.nr; i++) {
+		seg = scoutfs_seg_submit_read(sb, mrefs.refs[i].segno);
 		if (IS_ERR(seg)) {
 			ret = PTR_ERR(seg);
 			break;
 		}
 
-		ref->seg = seg;
+		mrefs.refs[i].seg = seg;
 	}
 
-	list_for_each_entry(ref, &ref_list, entry) {
+	for (i = 0; i < mrefs.nr; i++) {
+		ref = &mrefs.refs[i];
+
 		if (!ref->seg)
 			break;
 
@@ -840,11 +1184,14 @@ retry_stale:
 	if (ret)
 		goto out;
 
-	list_sort(NULL, &ref_list, cmp_ment_ref_level_seq);
+	sort(mrefs.refs, mrefs.nr, sizeof(struct manifest_ref),
+	     cmp_ment_ref_level_seq, NULL);
 
 	/* default to returning the nearest segment limit and find offsets */
 	found = false;
-	list_for_each_entry(ref, &ref_list, entry) {
+	for (i = 0; i < mrefs.nr; i++) {
+		ref = &mrefs.refs[i];
+
 		if (ref->level > 0 &&
 		    (!found ||
 		     scoutfs_key_compare(&ref->last, next_key) < 0)) {
@@ -856,7 +1203,9 @@ retry_stale:
 	}
 
 	/* return the nearest item in the segments */
-	list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
+	for (i = 0; i < mrefs.nr; i++) {
+		ref = &mrefs.refs[i];
+
 		if (ref->off < 0)
 			continue;
 
@@ -873,10 +1222,7 @@ retry_stale:
 
 	ret = 0;
 out:
-	list_for_each_entry_safe(ref, tmp, &ref_list, entry) {
-		list_del_init(&ref->entry);
-		free_ref(sb, ref);
-	}
+	free_refs(sb, &mrefs);
 
 	ret = handle_stale_btree(sb, &root, last_root_seq, ret);
 	if (ret == -EAGAIN) {
@@ -887,6 +1233,26 @@ out:
 	return ret;
 }
 
+/*
+ * A level is over its size target when it holds more than fanout^level
+ * segments.  The fanout is read from the tunable option each time so
+ * that an admin can reshape the tree for their workload without
+ * remounting.  Level 0 always compacts so that a single l0 segment
+ * doesn't linger and force every read to merge it.
+ */
+static u64 level_limit(struct super_block *sb, int level)
+{
+	u64 fanout = scoutfs_option_u32(sb, Opt_manifest_fanout) ?:
+		     SCOUTFS_MANIFEST_FANOUT;
+	u64 limit = 0;
+	int i;
+
+	for (i = 1; i <= level; i++)
+		limit = limit ? limit * fanout : fanout;
+
+	return limit;
+}
+
 static bool level_should_compact(struct super_block *sb, int level)
 {
 	DECLARE_MANIFEST(sb, mani);
@@ -895,7 +1261,35 @@ static bool level_should_compact(struct super_block *sb, int level)
 	BUG_ON(!rwsem_is_locked(&mani->rwsem));
 
 	return ((s64)le64_to_cpu(super->manifest.level_counts[level]) -
-	        (s64)mani->compacts_pending[level]) > mani->level_limits[level];
+	        (s64)mani->compacts_pending[level]) > level_limit(sb, level);
+}
+
+/*
+ * Compaction debt is the total number of segments that levels hold over
+ * their targets, after crediting compactions already in flight.  Level
+ * 0's target is zero so every level 0 segment counts.  The server hands
+ * the current debt to clients in commit responses so that they can ease
+ * off before level 0 fills and commits block outright.
+ */
+u64 scoutfs_manifest_compact_debt(struct super_block *sb)
+{
+	DECLARE_MANIFEST(sb, mani);
+	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
+	u64 debt = 0;
+	s64 over;
+	int level;
+
+	down_read(&mani->rwsem);
+	for (level = mani->nr_levels - 1; level >= 0; level--) {
+		over = (s64)le64_to_cpu(super->manifest.level_counts[level]) -
+		       (s64)mani->compacts_pending[level] -
+		       (s64)level_limit(sb, level);
+		if (over > 0)
+			debt += over;
+	}
+	up_read(&mani->rwsem);
+
+	return debt;
 }
 
 int scoutfs_manifest_should_compact(struct super_block *sb)
@@ -1023,7 +1417,7 @@ static int add_entry_unless_busy(struct super_block *sb,
  *  -errno:   fatal error
  *
  * XXX this could be more clever:
- *  - prioritize segments with deletion or incremental records
+ *  - prioritize segments with incremental records
  *  - prioritize partial segments
  *  - maybe compact segments by age in a given level
  */
@@ -1036,13 +1430,17 @@ static int next_compact_req(struct super_block *sb, int level,
 	struct scoutfs_manifest_btree_key mkey;
 	struct scoutfs_manifest_entry next;
 	struct scoutfs_manifest_entry ment;
+	struct scoutfs_manifest_entry cand;
 	struct scoutfs_manifest_entry over;
 	SCOUTFS_BTREE_ITEM_REF(iref);
 	SCOUTFS_BTREE_ITEM_REF(over_iref);
 	SCOUTFS_BTREE_ITEM_REF(prev);
 	static struct scoutfs_key zeros;
+	struct scoutfs_key hint;
+	bool hinted = false;
 	bool wrapped;
 	bool sticky;
+	int scan;
 	int ret;
 	int nr = 0;
 	int i;
@@ -1085,8 +1483,21 @@ static int next_compact_req(struct super_block *sb, int level,
 		}
 
 	} else {
-		/* find the next segment after the compaction at this level */
-		init_btree_key(&mkey, level, 0, &mani->compact_keys[level]);
+		/* start from a recently read hot range if one was recorded */
+		spin_lock(&mani->read_hint_lock);
+		if (mani->read_hint_set[level]) {
+			hint = mani->read_hint_keys[level];
+			mani->read_hint_set[level] = false;
+			hinted = true;
+		}
+		spin_unlock(&mani->read_hint_lock);
+
+		if (hinted)
+			scoutfs_inc_counter(sb, manifest_compact_read_hint);
+
+		/* else the next segment after the compaction at this level */
+		init_btree_key(&mkey, level, 0,
+			       hinted ? &hint : &mani->compact_keys[level]);
 		wrapped = false;
 again:
 		ret = scoutfs_btree_next(sb, &super->manifest.root,
@@ -1103,6 +1514,37 @@ again:
 			wrapped = true;
 			goto again;
 		}
+
+		/*
+		 * Deletion items inflate every search between here and
+		 * the last level until compaction finally drops them.
+		 * Look a little past the sweep hand and prefer the
+		 * entry with the most deletion items so tombstone-heavy
+		 * segments are pushed down first.
+		 */
+		if (ret == 0) {
+			cand = ment;
+			for (scan = 0; scan < MANIFEST_COMPACT_SCAN_NR;
+			     scan++) {
+				init_btree_key(&mkey, level, cand.seq + 1,
+					       &cand.first);
+				if (scoutfs_btree_next(sb,
+						&super->manifest.root,
+						&mkey, sizeof(mkey),
+						&iref) != 0)
+					break;
+				init_ment_iref(&cand, &iref);
+				scoutfs_btree_put_iref(&iref);
+				if (cand.level != level)
+					break;
+
+				if (cand.nr_deletions > ment.nr_deletions) {
+					ment = cand;
+					scoutfs_inc_counter(sb,
+						manifest_compact_deletions);
+				}
+			}
+		}
 	}
 
 	if (ret < 0) {
@@ -1260,6 +1702,13 @@ int scoutfs_manifest_setup(struct super_block *sb)
 
 	init_rwsem(&mani->rwsem);
 	scoutfs_spbm_init(&mani->segno_busy);
+	spin_lock_init(&mani->ra_lock);
+	scoutfs_key_set_zeros(&mani->ra_next);
+	spin_lock_init(&mani->bloom_lock);
+	mani->bloom_root = RB_ROOT;
+	INIT_LIST_HEAD(&mani->bloom_lru);
+
+	spin_lock_init(&mani->read_hint_lock);
 
 	for (i = 0; i < ARRAY_SIZE(mani->compact_keys); i++)
 		scoutfs_key_set_zeros(&mani->compact_keys[i]);
@@ -1271,14 +1720,6 @@ int scoutfs_manifest_setup(struct super_block *sb)
 		}
 	}
 
-	/* always trigger a compaction if there's a single l0 segment? */
-	mani->level_limits[0] = 0;
-	mani->level_limits[1] = SCOUTFS_MANIFEST_FANOUT;
-	for (i = 2; i < ARRAY_SIZE(mani->level_limits); i++) {
-		mani->level_limits[i] = mani->level_limits[i - 1] *
-					SCOUTFS_MANIFEST_FANOUT;
-	}
-
 	sbi->manifest = mani;
 
 	return 0;
@@ -1288,8 +1729,12 @@ void scoutfs_manifest_destroy(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct manifest *mani = sbi->manifest;
+	struct manifest_bloom *mb;
+	struct manifest_bloom *tmp;
 
 	if (mani) {
+		list_for_each_entry_safe(mb, tmp, &mani->bloom_lru, lru_entry)
+			bloom_free(mb);
 		scoutfs_spbm_destroy(&mani->segno_busy);
 		kfree(mani);
 		sbi->manifest = NULL;
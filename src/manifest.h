@@ -15,6 +15,7 @@ struct scoutfs_manifest_entry {
 	u8 level;
 	u64 segno;
 	u64 seq;
+	u32 nr_deletions;
 	struct scoutfs_key first;
 	struct scoutfs_key last;
 };
@@ -34,10 +35,11 @@ int scoutfs_manifest_unlock(struct super_block *sb);
 int scoutfs_manifest_read_items(struct super_block *sb,
 				struct scoutfs_key *key,
 				struct scoutfs_key *start,
-				struct scoutfs_key *end);
+				struct scoutfs_key *end, bool point);
 int scoutfs_manifest_next_key(struct super_block *sb, struct scoutfs_key *key,
 			      struct scoutfs_key *next_key);
 
+u64 scoutfs_manifest_compact_debt(struct super_block *sb);
 int scoutfs_manifest_should_compact(struct super_block *sb);
 int scoutfs_manifest_next_compact(struct super_block *sb,
 				  struct scoutfs_net_compact_request *req);
@@ -23,6 +23,7 @@
 
 #include "format.h"
 #include "counters.h"
+#include "flight.h"
 #include "inode.h"
 #include "btree.h"
 #include "manifest.h"
@@ -219,6 +220,39 @@ static struct message_send *find_request(struct scoutfs_net_connection *conn,
 	return msend;
 }
 
+/*
+ * Bulk transfer commands can carry large payloads and nothing latency
+ * sensitive waits on them.  Everything else is small control traffic
+ * that sync paths block on, so it's queued ahead of any bulk messages
+ * instead of suffering head-of-line blocking behind them.
+ */
+static bool cmd_is_bulk(u8 cmd)
+{
+	return cmd == SCOUTFS_NET_CMD_COMPACT ||
+	       cmd == SCOUTFS_NET_CMD_RECORD_SEGMENT ||
+	       cmd == SCOUTFS_NET_CMD_FREE_EXTENTS ||
+	       cmd == SCOUTFS_NET_CMD_COMMIT_SEGMENT;
+}
+
+static void queue_send_message(struct scoutfs_net_connection *conn,
+			       struct message_send *msend)
+{
+	struct message_send *pos;
+
+	assert_spin_locked(&conn->lock);
+
+	if (!cmd_is_bulk(msend->nh.cmd)) {
+		list_for_each_entry(pos, &conn->send_queue, head) {
+			if (cmd_is_bulk(pos->nh.cmd)) {
+				list_add_tail(&msend->head, &pos->head);
+				return;
+			}
+		}
+	}
+
+	list_add_tail(&msend->head, &conn->send_queue);
+}
+
 /*
  * Complete a send message by moving it to the send queue and marking it
  * to be freed.  It won't be visible to callers trying to find sends.
@@ -394,7 +428,7 @@ static int submit_send(struct super_block *sb,
 
 	if (conn->established &&
 	    (conn->valid_greeting || cmd == SCOUTFS_NET_CMD_GREETING)) {
-		list_add_tail(&msend->head, &conn->send_queue);
+		queue_send_message(conn, msend);
 		queue_work(conn->workq, &conn->send_work);
 	} else {
 		list_add_tail(&msend->head, &conn->resend_queue);
@@ -439,6 +473,15 @@ static void saw_valid_greeting(struct scoutfs_net_connection *conn, u64 node_id)
 		conn->notify_up(sb, conn, conn->info, node_id);
 }
 
+/*
+ * Give request processing the node_id that was assigned to the sending
+ * client during its greeting.  It's 0 until a valid greeting is seen.
+ */
+u64 scoutfs_net_client_node_id(struct scoutfs_net_connection *conn)
+{
+	return conn->node_id;
+}
+
 /*
  * Process an incoming response.  The greeting should ensure that the
  * sender won't send us unknown commands.  We return an error if we see
@@ -452,6 +495,7 @@ static int process_request(struct scoutfs_net_connection *conn,
 	struct super_block *sb = conn->sb;
 	scoutfs_net_request_t req_func;
 	struct scoutfs_net_greeting *gr;
+	ktime_t start;
 	int ret;
 
 	if (mrecv->nh.cmd < SCOUTFS_NET_CMD_UNKNOWN)
@@ -464,8 +508,11 @@ static int process_request(struct scoutfs_net_connection *conn,
 		return -EINVAL;
 	}
 
+	start = ktime_get();
 	ret = req_func(sb, conn, mrecv->nh.cmd, le64_to_cpu(mrecv->nh.id),
 		       mrecv->nh.data, le16_to_cpu(mrecv->nh.data_len));
+	scoutfs_flight_record(sb, SCOUTFS_FLIGHT_NET_REQUEST, mrecv->nh.cmd,
+			      ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
 
 	/*
 	 * Greeting response updates our *request* node_id so that
@@ -670,26 +717,37 @@ static void scoutfs_net_recv_worker(struct work_struct *work)
 	trace_scoutfs_net_recv_work_exit(sb, 0, ret);
 }
 
-static int sendmsg_full(struct socket *sock, void *buf, unsigned len)
+/*
+ * Send all the bytes described by the kvec array, advancing through the
+ * vectors as partial sends consume them.  The caller's vectors are
+ * modified.
+ */
+static int sendmsg_kvecs(struct socket *sock, struct kvec *kvs, unsigned nr,
+			 unsigned len)
 {
 	struct msghdr msg;
-	struct kvec kv;
 	int ret;
 
 	while (len) {
 		memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = (struct iovec *)&kv;
-		msg.msg_iovlen = 1;
+		msg.msg_iov = (struct iovec *)kvs;
+		msg.msg_iovlen = nr;
 		msg.msg_flags = MSG_NOSIGNAL;
-		kv.iov_base = buf;
-		kv.iov_len = len;
 
-		ret = kernel_sendmsg(sock, &msg, &kv, 1, len);
+		ret = kernel_sendmsg(sock, &msg, kvs, nr, len);
 		if (ret <= 0)
 			return -ECONNABORTED;
 
 		len -= ret;
-		buf += ret;
+		while (ret && ret >= kvs->iov_len) {
+			ret -= kvs->iov_len;
+			kvs++;
+			nr--;
+		}
+		if (ret) {
+			kvs->iov_base += ret;
+			kvs->iov_len -= ret;
+		}
 	}
 
 	return 0;
@@ -702,6 +760,9 @@ static void free_msend(struct net_info *ninf, struct message_send *msend)
 	kfree(msend);
 }
 
+/* gathering more queued messages per sendmsg mostly helps tiny messages */
+#define NET_SEND_BATCH_NR 16
+
 /*
  * Each connection has a single worker that sends queued messages down
  * the connection's socket.  The work is queued whenever a message is
@@ -709,6 +770,12 @@ static void free_msend(struct net_info *ninf, struct message_send *msend)
  * don't have to worry about resuming partial sends or hooking into
  * data_ready.  Send errors shut down the connection.
  *
+ * Queued messages are drained in batches that are sent with a single
+ * sendmsg so that bursts of small lock and allocation messages turn
+ * into full packets instead of a packet per message.  The batch stays
+ * on the send queue while the worker sends without the lock, just as a
+ * single message used to.
+ *
  * The worker is responsible for freeing messages so that other contexts
  * don't have to worry about freeing a message while we're blocked
  * sending it without the lock held.
@@ -718,43 +785,67 @@ static void scoutfs_net_send_worker(struct work_struct *work)
 	DEFINE_CONN_FROM_WORK(conn, work, send_work);
 	struct super_block *sb = conn->sb;
 	struct net_info *ninf = SCOUTFS_SB(sb)->net_info;
+	struct message_send *batch[NET_SEND_BATCH_NR];
+	struct kvec kvs[NET_SEND_BATCH_NR];
 	struct message_send *msend;
+	struct message_send *tmp;
+	unsigned int total;
+	unsigned int nr;
 	int ret = 0;
 	int len;
+	int i;
 
 	trace_scoutfs_net_send_work_enter(sb, 0, 0);
 
 	spin_lock(&conn->lock);
 
-	while ((msend = list_first_entry_or_null(&conn->send_queue,
-						 struct message_send, head))) {
+	for (;;) {
+		nr = 0;
+		total = 0;
+		list_for_each_entry_safe(msend, tmp, &conn->send_queue, head) {
+			if (msend->dead) {
+				free_msend(ninf, msend);
+				continue;
+			}
 
-		if (msend->dead) {
-			free_msend(ninf, msend);
-			continue;
+			len = nh_bytes(le16_to_cpu(msend->nh.data_len));
+			batch[nr] = msend;
+			kvs[nr].iov_base = &msend->nh;
+			kvs[nr].iov_len = len;
+			total += len;
+			if (++nr == NET_SEND_BATCH_NR)
+				break;
 		}
 
-		spin_unlock(&conn->lock);
+		if (nr == 0)
+			break;
 
-		len = nh_bytes(le16_to_cpu(msend->nh.data_len));
+		spin_unlock(&conn->lock);
 
-		scoutfs_inc_counter(sb, net_send_messages);
-		scoutfs_add_counter(sb, net_send_bytes, len);
-		trace_scoutfs_net_send_message(sb, &conn->sockname,
-					       &conn->peername, &msend->nh);
+		scoutfs_add_counter(sb, net_send_messages, nr);
+		scoutfs_add_counter(sb, net_send_bytes, total);
+		for (i = 0; i < nr; i++)
+			trace_scoutfs_net_send_message(sb, &conn->sockname,
+						       &conn->peername,
+						       &batch[i]->nh);
 
-		ret = sendmsg_full(conn->sock, &msend->nh, len);
+		ret = sendmsg_kvecs(conn->sock, kvs, nr, total);
 
 		spin_lock(&conn->lock);
 
 		if (ret)
 			break;
 
-		/* active requests are resent, everything else is freed */
-		if (nh_is_request(&msend->nh) && !msend->dead)
-			list_move_tail(&msend->head, &conn->resend_queue);
-		else
-			msend->dead = 1;
+		for (i = 0; i < nr; i++) {
+			msend = batch[i];
+
+			/* active requests are resent, everything else is freed */
+			if (nh_is_request(&msend->nh) && !msend->dead)
+				list_move_tail(&msend->head,
+					       &conn->resend_queue);
+			else
+				msend->dead = 1;
+		}
 	}
 
 	spin_unlock(&conn->lock);
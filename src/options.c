@@ -29,12 +29,21 @@
 static const match_table_t tokens = {
 	{Opt_listen, "listen=%s"},
 	{Opt_cluster, "cluster=%s"},
+	{Opt_compress, "compress=%s"},
+	{Opt_snapshot, "snapshot"},
+	{Opt_standby, "standby"},
+	{Opt_warm_inos, "warm_inos=%s"},
+	{Opt_warm_index, "warm_index=%s"},
 	{Opt_err, NULL}
 };
 
 struct options_sb_info {
 	struct dentry *debugfs_dir;
 	u32 btree_force_tiny_blocks;
+	u32 manifest_fanout;
+	u32 server_commit_delay_ms;
+	u32 seg_comp_cache_mb;
+	u32 trans_commit_fill_pct;
 };
 
 u32 scoutfs_option_u32(struct super_block *sb, int token)
@@ -45,6 +54,14 @@ u32 scoutfs_option_u32(struct super_block *sb, int token)
 	switch(token) {
 		case Opt_btree_force_tiny_blocks:
 			return osi->btree_force_tiny_blocks;
+		case Opt_manifest_fanout:
+			return osi->manifest_fanout;
+		case Opt_server_commit_delay_ms:
+			return osi->server_commit_delay_ms;
+		case Opt_seg_comp_cache_mb:
+			return osi->seg_comp_cache_mb;
+		case Opt_trans_commit_fill_pct:
+			return osi->trans_commit_fill_pct;
 	}
 
 	WARN_ON_ONCE(1);
@@ -56,8 +73,13 @@ int scoutfs_parse_options(struct super_block *sb, char *options,
 {
 	char ipstr[INET_ADDRSTRLEN + 1];
 	substring_t args[MAX_OPT_ARGS];
+	char range[42];
+	char zone[10];
+	char codec[8];
 	int token, len;
 	__be32 addr;
+	u64 from;
+	u64 to;
 	char *p;
 
 	/* Set defaults */
@@ -86,6 +108,53 @@ int scoutfs_parse_options(struct super_block *sb, char *options,
 			match_strlcpy(parsed->cluster_name, args,
 				      MAX_CLUSTER_NAME_LEN);
 			break;
+		case Opt_compress:
+			match_strlcpy(codec, args, ARRAY_SIZE(codec));
+			if (!strcmp(codec, "none")) {
+				parsed->compress = SCOUTFS_SEG_COMP_NONE;
+			} else if (!strcmp(codec, "lzo")) {
+				parsed->compress = SCOUTFS_SEG_COMP_LZO;
+			} else {
+				scoutfs_err(sb, "Unknown compress codec, \"%s\"\n",
+					    codec);
+				return -EINVAL;
+			}
+			break;
+		case Opt_snapshot:
+			parsed->snapshot = true;
+			break;
+		case Opt_standby:
+			parsed->standby = true;
+			break;
+		case Opt_warm_inos:
+			if (parsed->nr_warm_inos == SCOUTFS_WARM_NR_RANGES) {
+				scoutfs_err(sb, "More than %u warm_inos ranges\n",
+					    SCOUTFS_WARM_NR_RANGES);
+				return -EINVAL;
+			}
+			match_strlcpy(range, args, ARRAY_SIZE(range));
+			if (sscanf(range, "%llu-%llu", &from, &to) != 2 ||
+			    from > to) {
+				scoutfs_err(sb, "Malformed warm_inos range, \"%s\"\n",
+					    range);
+				return -EINVAL;
+			}
+			parsed->warm_inos[parsed->nr_warm_inos].start = from;
+			parsed->warm_inos[parsed->nr_warm_inos].end = to;
+			parsed->nr_warm_inos++;
+			break;
+		case Opt_warm_index:
+			match_strlcpy(zone, args, ARRAY_SIZE(zone));
+			if (!strcmp(zone, "meta_seq")) {
+				parsed->warm_meta_seq = true;
+			} else if (!strcmp(zone, "data_seq")) {
+				parsed->warm_data_seq = true;
+			} else {
+				scoutfs_err(sb, "Unknown warm_index zone, \"%s\"\n",
+					    zone);
+				return -EINVAL;
+			}
+			break;
 		default:
 			scoutfs_err(sb, "Unknown or malformed option, \"%s\"\n",
 				    p);
@@ -121,6 +190,49 @@ int scoutfs_options_setup(struct super_block *sb)
 		goto out;
 	}
 
+	osi->manifest_fanout = SCOUTFS_MANIFEST_FANOUT;
+	if (!debugfs_create_u32("manifest_fanout", 0644, osi->debugfs_dir,
+				&osi->manifest_fanout)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* a small delay batches commits without being visible in latency */
+	osi->server_commit_delay_ms = 2;
+	if (!debugfs_create_u32("server_commit_delay_ms", 0644,
+				osi->debugfs_dir,
+				&osi->server_commit_delay_ms)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * Compressed copies of evicted segments turn re-reads of a
+	 * working set that's a bit bigger than memory into decompression
+	 * instead of disk reads.  0 disables the tier.
+	 */
+	osi->seg_comp_cache_mb = 128;
+	if (!debugfs_create_u32("seg_comp_cache_mb", 0644,
+				osi->debugfs_dir,
+				&osi->seg_comp_cache_mb)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * Committing when dirty items approach a commit's segment
+	 * capacity writes steadily full level 0 segments instead of
+	 * stalling holders against the reservation wall.  0 or 100
+	 * fall back to the deadline and full commit triggers.
+	 */
+	osi->trans_commit_fill_pct = 75;
+	if (!debugfs_create_u32("trans_commit_fill_pct", 0644,
+				osi->debugfs_dir,
+				&osi->trans_commit_fill_pct)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	ret = 0;
 out:
 	if (ret)
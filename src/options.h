@@ -7,19 +7,52 @@
 enum {
 	Opt_listen = 0,
 	Opt_cluster,
+	Opt_compress,
 	/*
 	 * For debugging we can quickly create huge trees by limiting
 	 * the number of items in each block as though the blocks were tiny.
 	 */
 	Opt_btree_force_tiny_blocks,
+	/* per-level manifest size multiplier used to trigger compaction */
+	Opt_manifest_fanout,
+	/* ms to delay server commits so concurrent requests batch */
+	Opt_server_commit_delay_ms,
+	/* MB of compressed evicted segments to keep in memory */
+	Opt_seg_comp_cache_mb,
+	/* read-only mount of a pinned snapshot root without cluster locks */
+	Opt_snapshot,
+	Opt_standby,
+	/* commit once dirty items fill this much of a commit's segments */
+	Opt_trans_commit_fill_pct,
+	/* inode ranges and index zones to read into the cache after mount */
+	Opt_warm_inos,
+	Opt_warm_index,
 	Opt_err,
 };
 
+/* arbitrary cap that keeps the parsed option struct small */
+#define SCOUTFS_WARM_NR_RANGES 8
+
 #define MAX_CLUSTER_NAME_LEN 17
 struct mount_options
 {
 	struct scoutfs_inet_addr	listen_addr;
 	char				cluster_name[MAX_CLUSTER_NAME_LEN];
+	/* SCOUTFS_SEG_COMP_ codec for written segments */
+	u8				compress;
+	/* read from a pinned snapshot root without cluster locks */
+	bool				snapshot;
+	/* register as the warm standby that mirrors server btree writes */
+	bool				standby;
+	/* inode number ranges whose items are read after mount */
+	struct {
+		u64			start;
+		u64			end;
+	}				warm_inos[SCOUTFS_WARM_NR_RANGES];
+	unsigned int			nr_warm_inos;
+	/* inode index zones whose items are read after mount */
+	bool				warm_meta_seq;
+	bool				warm_data_seq;
 };
 
 int scoutfs_parse_options(struct super_block *sb, char *options,
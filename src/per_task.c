@@ -13,40 +13,64 @@
 #include <linux/sched.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/hash.h>
 
 #include "per_task.h"
 
 /*
  * There are times when we'd like to pass data from a caller to its
  * callee but we're bouncing through functions and callbacks that don't
- * provide per-task storage.  We add a trivial little locked list that
- * lets a caller store a pointer for callees.  The lists are put in the
- * scope of the sharing so the contention is rare and limited to real
- * concurrency -- imagine, for example, concurrent file reading on an
- * inode.
+ * provide per-task storage.  We let a caller store a pointer for
+ * callees to find.
+ *
+ * A task only ever looks up entries that it added itself, so the
+ * entries are kept in a global table of buckets hashed by the task,
+ * like futex hash buckets.  Concurrent tasks working on one shared
+ * structure land in different buckets and never touch each other's
+ * locks, where hashing by the shared structure would serialize all the
+ * tasks pounding on one hot file.  Lookup walks only the entries of the
+ * few tasks that collide in the bucket.
  */
 
+#define PER_TASK_HASH_BITS	8
+#define PER_TASK_NR_BUCKETS	(1 << PER_TASK_HASH_BITS)
+
+static struct per_task_bucket {
+	spinlock_t lock;
+	struct hlist_head list;
+} per_task_buckets[PER_TASK_NR_BUCKETS] = {
+	[0 ... PER_TASK_NR_BUCKETS - 1] = {
+		.lock = __SPIN_LOCK_UNLOCKED(per_task_buckets.lock),
+	},
+};
+
+static struct per_task_bucket *task_bucket(struct task_struct *task)
+{
+	return &per_task_buckets[hash_ptr(task, PER_TASK_HASH_BITS)];
+}
+
 /*
- * Return the pointer that our caller added for us on the given list.
- * The expected promise is that the pointer is valid until we return to
- * the caller who will remove it from the list.
+ * Return the pointer that our caller added for us under the given
+ * scope.  The expected promise is that the pointer is valid until we
+ * return to the caller who will remove it.
  */
 void *scoutfs_per_task_get(struct scoutfs_per_task *pt)
 {
-	const struct task_struct *task = current;
+	struct task_struct *task = current;
+	struct per_task_bucket *b = task_bucket(task);
 	struct scoutfs_per_task_entry *ent;
 	void *ret = NULL;
 
-	spin_lock(&pt->lock);
+	spin_lock(&b->lock);
 
-	list_for_each_entry(ent, &pt->list, head) {
-		if (ent->task == task){
+	hlist_for_each_entry(ent, &b->list, node) {
+		if (ent->task == task && ent->pt == pt) {
 			ret = ent->ptr;
 			break;
 		}
 	}
 
-	spin_unlock(&pt->lock);
+	spin_unlock(&b->lock);
 
 	return ret;
 }
@@ -54,28 +78,33 @@ void *scoutfs_per_task_get(struct scoutfs_per_task *pt)
 void scoutfs_per_task_add(struct scoutfs_per_task *pt,
 			  struct scoutfs_per_task_entry *ent, void *ptr)
 {
+	struct per_task_bucket *b = task_bucket(current);
+
+	ent->pt = pt;
 	ent->task = current;
 	ent->ptr = ptr;
 
-	spin_lock(&pt->lock);
-	list_add(&ent->head, &pt->list);
-	spin_unlock(&pt->lock);
+	spin_lock(&b->lock);
+	hlist_add_head(&ent->node, &b->list);
+	spin_unlock(&b->lock);
 }
 
 void scoutfs_per_task_del(struct scoutfs_per_task *pt,
 			  struct scoutfs_per_task_entry *ent)
 {
-	BUG_ON(!list_empty(&ent->head) && ent->task != current);
+	struct per_task_bucket *b;
+
+	BUG_ON(ent->pt && ent->task != current);
 
-	if (!list_empty(&ent->head)) {
-		spin_lock(&pt->lock);
-		list_del_init(&ent->head);
-		spin_unlock(&pt->lock);
+	if (ent->pt) {
+		b = task_bucket(ent->task);
+		spin_lock(&b->lock);
+		hlist_del(&ent->node);
+		spin_unlock(&b->lock);
+		ent->pt = NULL;
 	}
 }
 
 void scoutfs_per_task_init(struct scoutfs_per_task *pt)
 {
-	spin_lock_init(&pt->lock);
-	INIT_LIST_HEAD(&pt->list);
 }
@@ -1,20 +1,25 @@
 #ifndef _SCOUTFS_PER_TASK_H_
 #define _SCOUTFS_PER_TASK_H_
 
+/*
+ * Entries are stored in a global task-hashed table.  This struct only
+ * provides the unique address that scopes entries to their sharers,
+ * for example the tasks doing IO to one inode.
+ */
 struct scoutfs_per_task {
-	spinlock_t lock;
-	struct list_head list;
+	unsigned char unused;
 };
 
 struct scoutfs_per_task_entry {
-	struct list_head head;
+	struct hlist_node node;
+	struct scoutfs_per_task *pt;
 	struct task_struct *task;
 	void *ptr;
 };
 
 #define SCOUTFS_DECLARE_PER_TASK_ENTRY(name)			\
 	struct scoutfs_per_task_entry name = {			\
-		.head      = LIST_HEAD_INIT((name).head),	\
+		.pt = NULL,					\
 	}
 
 
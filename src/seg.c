@@ -15,7 +15,10 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 #include <linux/crc32c.h>
+#include <linux/workqueue.h>
 
 #include "super.h"
 #include "format.h"
@@ -42,15 +45,60 @@
  *  - just wait on pages instead of weird flags?
  */
 
+/*
+ * A small per-NUMA-node pool of segment pages.  Segment lifetimes churn
+ * through full segments of pages at a time and the pools recycle them
+ * across frees instead of going back to the page allocator.  Pages are
+ * pooled by the node they were allocated on and handed out to tasks
+ * running on that node, so the workers that fill and merge segments
+ * keep working in node local memory.
+ */
+struct seg_page_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned long nr;
+} ____cacheline_aligned;
+
+#define SEG_PAGE_POOL_LIMIT	(2 * SCOUTFS_SEGMENT_PAGES)
+
 struct segment_cache {
 	struct super_block *sb;
 	spinlock_t lock;
 	struct rb_root root;
 	wait_queue_head_t waitq;
+	struct workqueue_struct *verify_wq;
 
 	struct shrinker shrinker;
 	struct list_head lru_list;
 	unsigned long lru_nr;
+
+	struct seg_page_pool *pools;
+
+	/* compressed copies of evicted segments, capped by an option */
+	spinlock_t comp_lock;
+	struct rb_root comp_root;
+	struct list_head comp_lru_list;
+	unsigned long comp_nr_pages;
+	struct mutex comp_mutex;
+	void *comp_wrkmem;
+};
+
+/*
+ * The shrinker stashes a compressed copy of each segment it evicts
+ * instead of throwing the pages away.  A read that misses the segment
+ * cache but finds a compressed copy rehydrates it with a decompress
+ * instead of a full segment of random disk reads.  The copies are kept
+ * in their own rbtree and lru and the oldest are dropped to stay under
+ * the seg_comp_cache_mb option's cap.
+ */
+struct comp_seg {
+	struct rb_node node;
+	struct list_head lru_entry;
+	u64 segno;
+	u32 total_bytes;
+	u32 comp_bytes;
+	unsigned int nr_pages;
+	struct page *pages[];
 };
 
 
@@ -59,8 +107,13 @@ enum {
 	SF_CALC_CRC_STARTED,
 	SF_CALC_CRC_DONE,
 	SF_INVALID_CRC,
+	SF_DECOMPRESS_STARTED,
+	SF_DECOMPRESS_DONE,
 };
 
+static int seg_decompress(struct super_block *sb, struct scoutfs_segment *seg);
+static void seg_verify_worker(struct work_struct *work);
+
 static void *off_ptr(struct scoutfs_segment *seg, u32 off)
 {
 	unsigned int pg = off >> PAGE_SHIFT;
@@ -69,6 +122,259 @@ static void *off_ptr(struct scoutfs_segment *seg, u32 off)
 	return page_address(seg->pages[pg]) + pg_off;
 }
 
+/*
+ * Zero a byte region of the segment, taking care to never cross a page
+ * boundary in any single memset.
+ */
+static void zero_seg_bytes(struct scoutfs_segment *seg, u32 off, u32 len)
+{
+	unsigned int bytes;
+
+	while (len) {
+		bytes = min_t(u32, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		memset(off_ptr(seg, off), 0, bytes);
+		off += bytes;
+		len -= bytes;
+	}
+}
+
+/*
+ * Allocate a segment page, preferring recycled pages from the calling
+ * task's node so that whoever fills the segment writes local memory.
+ * Falls back to the page allocator which also prefers the local node.
+ */
+static struct page *seg_alloc_page(struct super_block *sb)
+{
+	struct segment_cache *cac = SCOUTFS_SB(sb)->segment_cache;
+	struct seg_page_pool *pool = &cac->pools[numa_node_id()];
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->pages)) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del_init(&page->lru);
+		pool->nr--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page) {
+		scoutfs_inc_counter(sb, seg_page_pool_hit);
+		return page;
+	}
+
+	scoutfs_inc_counter(sb, seg_page_pool_miss);
+	return alloc_pages_node(numa_node_id(), GFP_NOFS, 0);
+}
+
+/*
+ * Return a segment page to the pool of the node it was allocated on,
+ * or give it back to the page allocator if that pool is full.
+ */
+static void seg_free_page(struct super_block *sb, struct page *page)
+{
+	struct segment_cache *cac = SCOUTFS_SB(sb)->segment_cache;
+	struct seg_page_pool *pool = &cac->pools[page_to_nid(page)];
+
+	spin_lock(&pool->lock);
+	if (pool->nr < SEG_PAGE_POOL_LIMIT) {
+		list_add(&page->lru, &pool->pages);
+		pool->nr++;
+		page = NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page)
+		__free_page(page);
+}
+
+static void free_comp_seg(struct super_block *sb, struct comp_seg *cseg)
+{
+	int i;
+
+	for (i = 0; i < cseg->nr_pages; i++)
+		seg_free_page(sb, cseg->pages[i]);
+	kfree(cseg);
+}
+
+static struct comp_seg *find_comp_seg(struct rb_root *root, u64 segno)
+{
+	struct rb_node *node = root->rb_node;
+	struct comp_seg *cseg;
+	int cmp;
+
+	while (node) {
+		cseg = container_of(node, struct comp_seg, node);
+
+		cmp = scoutfs_cmp_u64s(segno, cseg->segno);
+		if (cmp < 0)
+			node = node->rb_left;
+		else if (cmp > 0)
+			node = node->rb_right;
+		else
+			return cseg;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remove the compressed copy of the segno if there is one.  The caller
+ * frees it outside the lock.
+ */
+static struct comp_seg *erase_comp_seg(struct segment_cache *cac, u64 segno)
+{
+	struct comp_seg *cseg;
+
+	cseg = find_comp_seg(&cac->comp_root, segno);
+	if (cseg) {
+		rb_erase(&cseg->node, &cac->comp_root);
+		list_del_init(&cseg->lru_entry);
+		cac->comp_nr_pages -= cseg->nr_pages;
+	}
+
+	return cseg;
+}
+
+/*
+ * Insert a compressed copy and drop the oldest copies to stay under the
+ * option's cap.  A racing copy of the same segno is replaced.  Frees
+ * everything dropped outside the lock.
+ */
+static void insert_comp_seg(struct super_block *sb, struct comp_seg *ins,
+			    unsigned long limit_pages)
+{
+	struct segment_cache *cac = SCOUTFS_SB(sb)->segment_cache;
+	struct rb_node **node;
+	struct rb_node *parent = NULL;
+	struct comp_seg *cseg;
+	struct comp_seg *tmp;
+	LIST_HEAD(list);
+	int cmp;
+
+	spin_lock(&cac->comp_lock);
+
+	cseg = erase_comp_seg(cac, ins->segno);
+	if (cseg)
+		list_add_tail(&cseg->lru_entry, &list);
+
+	node = &cac->comp_root.rb_node;
+	while (*node) {
+		parent = *node;
+		cseg = container_of(*node, struct comp_seg, node);
+
+		cmp = scoutfs_cmp_u64s(ins->segno, cseg->segno);
+		if (cmp < 0)
+			node = &(*node)->rb_left;
+		else
+			node = &(*node)->rb_right;
+	}
+	rb_link_node(&ins->node, parent, node);
+	rb_insert_color(&ins->node, &cac->comp_root);
+	list_add_tail(&ins->lru_entry, &cac->comp_lru_list);
+	cac->comp_nr_pages += ins->nr_pages;
+
+	while (cac->comp_nr_pages > limit_pages &&
+	       !list_empty(&cac->comp_lru_list)) {
+		cseg = list_first_entry(&cac->comp_lru_list, struct comp_seg,
+					lru_entry);
+		rb_erase(&cseg->node, &cac->comp_root);
+		list_del_init(&cseg->lru_entry);
+		cac->comp_nr_pages -= cseg->nr_pages;
+		list_add_tail(&cseg->lru_entry, &list);
+		scoutfs_inc_counter(sb, seg_comp_cache_drop);
+	}
+
+	spin_unlock(&cac->comp_lock);
+
+	list_for_each_entry_safe(cseg, tmp, &list, lru_entry) {
+		list_del_init(&cseg->lru_entry);
+		free_comp_seg(sb, cseg);
+	}
+}
+
+/*
+ * Try to stash a compressed copy of a segment that the shrinker is
+ * about to evict.  Only final verified contents are copied: a segment
+ * that has its crc calculated and valid is either a completed verified
+ * read or has been fully built and submitted for writing, while a
+ * segment that's still being appended to hasn't had its crc calculated
+ * yet.  Copies that don't compress to less than half their size aren't
+ * worth the memory they'd occupy.
+ *
+ * This is strictly opportunistic.  Allocation or codec failures just
+ * evict the segment like they always have.
+ */
+static void stash_comp_seg(struct super_block *sb, struct scoutfs_segment *seg)
+{
+	struct segment_cache *cac = SCOUTFS_SB(sb)->segment_cache;
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	unsigned long limit_pages;
+	struct comp_seg *cseg = NULL;
+	size_t comp_len;
+	unsigned int nr;
+	void *virt = NULL;
+	void *buf = NULL;
+	u32 total;
+	u32 off;
+	int i;
+
+	limit_pages = (unsigned long)scoutfs_option_u32(sb,
+					Opt_seg_comp_cache_mb) <<
+		      (20 - PAGE_SHIFT);
+	if (limit_pages == 0 || !cac->comp_wrkmem)
+		return;
+
+	if (seg->err || !test_bit(SF_CALC_CRC_DONE, &seg->flags) ||
+	    test_bit(SF_INVALID_CRC, &seg->flags) || sblk->comp_bytes)
+		return;
+
+	total = scoutfs_seg_total_bytes(seg);
+	if (total == 0 || total > SCOUTFS_SEGMENT_SIZE)
+		return;
+
+	virt = vmap(seg->pages, SCOUTFS_SEGMENT_PAGES, VM_MAP, PAGE_KERNEL);
+	buf = vmalloc(lzo1x_worst_compress(total));
+	if (!virt || !buf)
+		goto out;
+
+	mutex_lock(&cac->comp_mutex);
+	i = lzo1x_1_compress(virt, total, buf, &comp_len, cac->comp_wrkmem);
+	mutex_unlock(&cac->comp_mutex);
+	if (i != LZO_E_OK || comp_len > total / 2)
+		goto out;
+
+	nr = DIV_ROUND_UP(comp_len, PAGE_SIZE);
+	cseg = kzalloc(offsetof(struct comp_seg, pages[nr]), GFP_NOFS);
+	if (!cseg)
+		goto out;
+
+	INIT_LIST_HEAD(&cseg->lru_entry);
+	cseg->segno = seg->segno;
+	cseg->total_bytes = total;
+	cseg->comp_bytes = comp_len;
+
+	for (i = 0; i < nr; i++) {
+		cseg->pages[i] = seg_alloc_page(sb);
+		if (!cseg->pages[i])
+			goto out;
+		cseg->nr_pages++;
+	}
+
+	for (i = 0, off = 0; off < comp_len; i++, off += PAGE_SIZE)
+		memcpy(page_address(cseg->pages[i]), buf + off,
+		       min_t(u32, comp_len - off, PAGE_SIZE));
+
+	scoutfs_inc_counter(sb, seg_comp_cache_store);
+	insert_comp_seg(sb, cseg, limit_pages);
+	cseg = NULL;
+out:
+	if (cseg)
+		free_comp_seg(sb, cseg);
+	if (virt)
+		vunmap(virt);
+	vfree(buf);
+}
+
 static struct scoutfs_segment *alloc_seg(struct super_block *sb, u64 segno)
 {
 	struct scoutfs_segment *seg;
@@ -85,11 +391,12 @@ static struct scoutfs_segment *alloc_seg(struct super_block *sb, u64 segno)
 	seg->sb = sb;
 	RB_CLEAR_NODE(&seg->node);
 	INIT_LIST_HEAD(&seg->lru_entry);
+	INIT_WORK(&seg->verify_work, seg_verify_worker);
 	atomic_set(&seg->refcount, 1);
 	seg->segno = segno;
 
 	for (i = 0; i < SCOUTFS_SEGMENT_PAGES; i++) {
-		page = alloc_page(GFP_NOFS);
+		page = seg_alloc_page(sb);
 		if (!page) {
 			scoutfs_seg_put(seg);
 			return ERR_PTR(-ENOMEM);
@@ -120,7 +427,14 @@ void scoutfs_seg_put(struct scoutfs_segment *seg)
 		WARN_ON_ONCE(!list_empty(&seg->lru_entry));
 		for (i = 0; i < SCOUTFS_SEGMENT_PAGES; i++)
 			if (seg->pages[i])
-				__free_page(seg->pages[i]);
+				seg_free_page(seg->sb, seg->pages[i]);
+		if (seg->comp_pages) {
+			for (i = 0; i < seg->nr_comp_pages; i++)
+				if (seg->comp_pages[i])
+					seg_free_page(seg->sb,
+						      seg->comp_pages[i]);
+			kfree(seg->comp_pages);
+		}
 		kfree(seg);
 	}
 }
@@ -167,11 +481,19 @@ static void lru_check(struct segment_cache *cac, struct scoutfs_segment *seg)
 
 static __le32 calc_seg_crc(struct scoutfs_segment *seg)
 {
-	u32 total = scoutfs_seg_total_bytes(seg);
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	u32 total;
 	u32 crc = ~0;
 	u32 off;
 	u32 len;
 
+	/* compressed segments only store the compressed item bytes */
+	if (sblk->comp_bytes)
+		total = sizeof(struct scoutfs_segment_block) +
+			le32_to_cpu(sblk->comp_bytes);
+	else
+		total = scoutfs_seg_total_bytes(seg);
+
 	off = offsetof(struct scoutfs_segment_block, _padding) +
 	       FIELD_SIZEOF(struct scoutfs_segment_block, _padding);
 
@@ -185,6 +507,72 @@ static __le32 calc_seg_crc(struct scoutfs_segment *seg)
 	return cpu_to_le32(crc);
 }
 
+/*
+ * Verify the crc of a freshly read segment exactly once.  The verify
+ * worker and waiting readers can race to get here so the started bit
+ * elects a winner and everyone else waits for the done bit.
+ */
+static void seg_calc_crc_once(struct super_block *sb,
+			      struct scoutfs_segment *seg)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segment_cache *cac = sbi->segment_cache;
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+
+	if (!test_bit(SF_CALC_CRC_DONE, &seg->flags) &&
+	    !test_and_set_bit(SF_CALC_CRC_STARTED, &seg->flags)) {
+		if (sblk->crc != calc_seg_crc(seg)) {
+			scoutfs_inc_counter(sb, seg_csum_error);
+			set_bit(SF_INVALID_CRC, &seg->flags);
+		}
+		set_bit(SF_CALC_CRC_DONE, &seg->flags);
+		wake_up(&cac->waitq);
+	}
+}
+
+/*
+ * Decompress a freshly read segment exactly once, with the same racing
+ * rules as crc calculation.
+ */
+static void seg_decompress_once(struct super_block *sb,
+				struct scoutfs_segment *seg)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segment_cache *cac = sbi->segment_cache;
+	int err;
+
+	if (!test_bit(SF_DECOMPRESS_DONE, &seg->flags) &&
+	    !test_and_set_bit(SF_DECOMPRESS_STARTED, &seg->flags)) {
+		err = seg_decompress(sb, seg);
+		if (err)
+			seg->err = err;
+		set_bit(SF_DECOMPRESS_DONE, &seg->flags);
+		wake_up(&cac->waitq);
+	}
+}
+
+/*
+ * Read completion hands each segment to the verify workqueue so that
+ * crc calculation and decompression of a batch of segments is spread
+ * across cpus instead of being serialized in the task that waits for
+ * them one by one.  Waiters that get there first do the work themselves
+ * so this is strictly an optimization.
+ */
+static void seg_verify_worker(struct work_struct *work)
+{
+	struct scoutfs_segment *seg = container_of(work,
+						   struct scoutfs_segment,
+						   verify_work);
+	struct super_block *sb = seg->sb;
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+
+	seg_calc_crc_once(sb, seg);
+	if (!test_bit(SF_INVALID_CRC, &seg->flags) && sblk->comp_bytes)
+		seg_decompress_once(sb, seg);
+
+	scoutfs_seg_put(seg);
+}
+
 /*
  * This always inserts the segment into the rbtree.  If there's already
  * a segment at the given seg then it is removed and returned.  The
@@ -262,10 +650,18 @@ static void seg_end_io(struct super_block *sb, void *data, int err)
 
 	spin_unlock_irqrestore(&cac->lock, flags);
 
+	scoutfs_latency_since(sb, seg_read, seg->submit_time);
+
 	smp_mb__after_atomic();
 	if (waitqueue_active(&cac->waitq))
 		wake_up(&cac->waitq);
 
+	/* verify and decompress read segments concurrently off cpu */
+	if (!err) {
+		scoutfs_seg_get(seg);
+		queue_work(cac->verify_wq, &seg->verify_work);
+	}
+
 	if (erased)
 		scoutfs_seg_put(seg);
 	scoutfs_seg_put(seg);
@@ -276,6 +672,201 @@ static u64 segno_to_blkno(u64 blkno)
 	return blkno << (SCOUTFS_SEGMENT_SHIFT - SCOUTFS_BLOCK_SHIFT);
 }
 
+/* the number of leading blocks that contain the header and bloom filter */
+#define SEG_HDR_BLOCKS \
+	DIV_ROUND_UP(sizeof(struct scoutfs_segment_block), SCOUTFS_BLOCK_SIZE)
+
+/*
+ * Fill the caller's array with the bloom bit numbers for the key.  The
+ * classic double hashing construction derives all the probes from two
+ * crc32c hashes of the key with different seeds.
+ */
+static void bloom_bit_nrs(struct scoutfs_key *key,
+			  u32 nrs[SCOUTFS_SEG_BLOOM_NR])
+{
+	u32 h1 = crc32c(~0, key, sizeof(struct scoutfs_key));
+	u32 h2 = crc32c(0, key, sizeof(struct scoutfs_key));
+	int i;
+
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NR; i++)
+		nrs[i] = (h1 + i * h2) % SCOUTFS_SEG_BLOOM_BITS;
+}
+
+/*
+ * The bloom filter crosses page boundaries in the segment so each long
+ * has to be mapped through the segment's pages.
+ */
+static __le64 *seg_bloom_long(struct scoutfs_segment *seg, u32 nr)
+{
+	return off_ptr(seg, offsetof(struct scoutfs_segment_block,
+				     bloom[nr >> 6]));
+}
+
+static void seg_bloom_set(struct scoutfs_segment *seg, struct scoutfs_key *key)
+{
+	u32 nrs[SCOUTFS_SEG_BLOOM_NR];
+	int i;
+
+	bloom_bit_nrs(key, nrs);
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NR; i++)
+		*seg_bloom_long(seg, nrs[i]) |=
+			cpu_to_le64(1ULL << (nrs[i] & 63));
+}
+
+/*
+ * Return true if the segment's bloom filter says that the segment might
+ * contain the key, false if it definitely does not.
+ */
+bool scoutfs_seg_bloom_may_contain(struct scoutfs_segment *seg,
+				   struct scoutfs_key *key)
+{
+	u32 nrs[SCOUTFS_SEG_BLOOM_NR];
+	int i;
+
+	bloom_bit_nrs(key, nrs);
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NR; i++) {
+		if (!(*seg_bloom_long(seg, nrs[i]) &
+		      cpu_to_le64(1ULL << (nrs[i] & 63))))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Test a contiguous copy of a segment's bloom filter for the key.
+ * Returns false if the segment definitely can't contain the key.
+ */
+bool scoutfs_seg_bloom_test_longs(__le64 *longs, struct scoutfs_key *key)
+{
+	u32 nrs[SCOUTFS_SEG_BLOOM_NR];
+	int i;
+
+	bloom_bit_nrs(key, nrs);
+	for (i = 0; i < SCOUTFS_SEG_BLOOM_NR; i++) {
+		if (!(longs[nrs[i] >> 6] &
+		      cpu_to_le64(1ULL << (nrs[i] & 63))))
+			return false;
+	}
+
+	return true;
+}
+
+/* copy bytes out of the segment, never crossing a page in one memcpy */
+static void read_seg_bytes(struct scoutfs_segment *seg, u32 off, void *buf,
+			   u32 len)
+{
+	unsigned int bytes;
+
+	while (len) {
+		bytes = min_t(u32, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		memcpy(buf, off_ptr(seg, off), bytes);
+		buf += bytes;
+		off += bytes;
+		len -= bytes;
+	}
+}
+
+/*
+ * Copy a segment's bloom filter into the caller's contiguous longs
+ * without reading the whole segment.  If the segment is cached we copy
+ * it in place, otherwise we read just the leading header blocks that
+ * contain the filter.
+ *
+ * The header read isn't covered by the segment crc so we verify that
+ * the segno and seq match the caller's manifest reference.  Segments
+ * are immutable once written so a matching header can only give us
+ * valid bloom bits.
+ *
+ * Returns 0 and fills the longs on success, -ESTALE if the segment
+ * doesn't match the reference, and -errno on failure.
+ */
+int scoutfs_seg_bloom_read(struct super_block *sb, u64 segno, u64 seq,
+			   __le64 *longs)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct segment_cache *cac = sbi->segment_cache;
+	struct page *pages[DIV_ROUND_UP(SEG_HDR_BLOCKS * SCOUTFS_BLOCK_SIZE,
+					PAGE_SIZE)];
+	struct scoutfs_segment_block *sblk;
+	struct scoutfs_segment *seg;
+	unsigned long flags;
+	unsigned int nr_pages = ARRAY_SIZE(pages);
+	unsigned int bytes;
+	void *buf;
+	u32 off;
+	u32 len;
+	int ret;
+	int i;
+
+	/* copy from a cached segment in place */
+	spin_lock_irqsave(&cac->lock, flags);
+	seg = find_seg(&cac->root, segno);
+	if (seg && (!test_bit(SF_END_IO, &seg->flags) || seg->err))
+		seg = NULL;
+	if (seg)
+		atomic_inc(&seg->refcount);
+	spin_unlock_irqrestore(&cac->lock, flags);
+
+	if (seg) {
+		sblk = off_ptr(seg, 0);
+		if (le64_to_cpu(sblk->segno) == segno &&
+		    le64_to_cpu(sblk->seq) == seq) {
+			read_seg_bytes(seg,
+				       offsetof(struct scoutfs_segment_block,
+					        bloom),
+				       longs, SCOUTFS_SEG_BLOOM_LONGS *
+					      sizeof(__le64));
+			ret = 0;
+		} else {
+			ret = -ESTALE;
+		}
+		scoutfs_seg_put(seg);
+		goto out;
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = seg_alloc_page(sb);
+		if (!pages[i]) {
+			while (i-- > 0)
+				seg_free_page(sb, pages[i]);
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = scoutfs_bio_read(sb, pages, segno_to_blkno(segno),
+			       SEG_HDR_BLOCKS);
+	if (ret)
+		goto out_free;
+
+	sblk = page_address(pages[0]);
+	if (le64_to_cpu(sblk->segno) != segno ||
+	    le64_to_cpu(sblk->seq) != seq) {
+		ret = -ESTALE;
+		goto out_free;
+	}
+
+	off = offsetof(struct scoutfs_segment_block, bloom);
+	len = SCOUTFS_SEG_BLOOM_LONGS * sizeof(__le64);
+	buf = longs;
+	while (len) {
+		bytes = min_t(u32, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		memcpy(buf, page_address(pages[off >> PAGE_SHIFT]) +
+			    (off & ~PAGE_MASK), bytes);
+		buf += bytes;
+		off += bytes;
+		len -= bytes;
+	}
+	ret = 0;
+
+out_free:
+	for (i = 0; i < nr_pages; i++)
+		seg_free_page(sb, pages[i]);
+out:
+	return ret;
+}
+
 int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 		      struct scoutfs_segment **seg_ret)
 {
@@ -296,8 +887,7 @@ int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 	set_bit(SF_END_IO, &seg->flags);
 
 	/* zero the block header so the caller knows to initialize */
-	memset(page_address(seg->pages[0]), 0,
-	       sizeof(struct scoutfs_segment_block));
+	zero_seg_bytes(seg, 0, sizeof(struct scoutfs_segment_block));
 
 	/* XXX always remove existing segs, is that necessary? */
 	spin_lock_irqsave(&cac->lock, flags);
@@ -316,6 +906,77 @@ out:
 }
 
 
+/*
+ * A read missed the segment cache but we have a compressed copy of the
+ * segment from a past eviction.  Rehydrate it into a fresh segment
+ * instead of reading from disk.  The copy's contents were verified
+ * before it was stashed so the segment is marked as having a valid crc
+ * and readers go straight to checking its segno and seq as usual.
+ *
+ * Returns NULL on any failure and the caller falls back to reading
+ * from disk.
+ */
+static struct scoutfs_segment *rehydrate_comp_seg(struct super_block *sb,
+						  u64 segno)
+{
+	struct segment_cache *cac = SCOUTFS_SB(sb)->segment_cache;
+	struct scoutfs_segment *existing;
+	struct scoutfs_segment *seg = NULL;
+	struct comp_seg *cseg;
+	unsigned long flags;
+	size_t out_len;
+	void *cvirt = NULL;
+	void *virt = NULL;
+	int err = -EIO;
+
+	spin_lock(&cac->comp_lock);
+	cseg = erase_comp_seg(cac, segno);
+	spin_unlock(&cac->comp_lock);
+	if (!cseg)
+		return NULL;
+
+	seg = alloc_seg(sb, segno);
+	if (IS_ERR_OR_NULL(seg)) {
+		seg = NULL;
+		goto out;
+	}
+
+	virt = vmap(seg->pages, SCOUTFS_SEGMENT_PAGES, VM_MAP, PAGE_KERNEL);
+	cvirt = vmap(cseg->pages, cseg->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!virt || !cvirt)
+		goto out;
+
+	out_len = cseg->total_bytes;
+	if (lzo1x_decompress_safe(cvirt, cseg->comp_bytes, virt, &out_len) !=
+	    LZO_E_OK || out_len != cseg->total_bytes)
+		goto out;
+
+	set_bit(SF_END_IO, &seg->flags);
+	set_bit(SF_CALC_CRC_STARTED, &seg->flags);
+	set_bit(SF_CALC_CRC_DONE, &seg->flags);
+
+	spin_lock_irqsave(&cac->lock, flags);
+	atomic_inc(&seg->refcount);
+	existing = replace_seg(cac, seg);
+	spin_unlock_irqrestore(&cac->lock, flags);
+	if (existing)
+		scoutfs_seg_put(existing);
+
+	scoutfs_inc_counter(sb, seg_comp_cache_hit);
+	err = 0;
+out:
+	if (err && seg) {
+		scoutfs_seg_put(seg);
+		seg = NULL;
+	}
+	if (cvirt)
+		vunmap(cvirt);
+	if (virt)
+		vunmap(virt);
+	free_comp_seg(sb, cseg);
+	return seg;
+}
+
 /*
  * The bios submitted by this don't have page references themselves.  If
  * this succeeds then the caller must call _wait before putting their
@@ -342,6 +1003,10 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
 	if (seg)
 		return seg;
 
+	seg = rehydrate_comp_seg(sb, segno);
+	if (seg)
+		return seg;
+
 	seg = alloc_seg(sb, segno);
 	if (IS_ERR(seg))
 		return seg;
@@ -355,6 +1020,7 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
 		scoutfs_seg_put(existing);
 
 	atomic_inc(&seg->refcount);
+	seg->submit_time = ktime_get();
 	scoutfs_bio_submit(sb, READ, seg->pages, segno_to_blkno(seg->segno),
 			   SCOUTFS_SEGMENT_BLOCKS, seg_end_io, seg);
 
@@ -365,6 +1031,95 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
  * The caller has ensured that the segment won't be modified while
  * it is in flight.
  */
+/*
+ * Try to build a compressed image of the segment for writing.  The
+ * header is copied as is and the packed item region is compressed after
+ * it.  The in-memory segment is left uncompressed so that cached
+ * readers and manifest entry initialization keep working on it; the
+ * compressed pages hang off the seg until it's freed so they stay
+ * around for the duration of the write.
+ *
+ * Returns 1 and submits the write if the compressed image was built,
+ * returns 0 if the caller should write the uncompressed segment.
+ * Compression is strictly opportunistic so allocation or codec failures
+ * just fall back to the uncompressed write.
+ */
+static int submit_compressed_write(struct super_block *sb,
+				   struct scoutfs_segment *seg,
+				   struct scoutfs_bio_completion *comp)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_segment_block *csblk;
+	u32 off = sizeof(struct scoutfs_segment_block);
+	u32 total = scoutfs_seg_total_bytes(seg);
+	size_t comp_len;
+	void *wrkmem = NULL;
+	void *cvirt = NULL;
+	void *virt = NULL;
+	void *buf = NULL;
+	unsigned int nr;
+	u32 crc_off;
+	int ret = 0;
+	int i;
+
+	if (sbi->opts.compress != SCOUTFS_SEG_COMP_LZO || total <= off)
+		return 0;
+
+	virt = vmap(seg->pages, SCOUTFS_SEGMENT_PAGES, VM_MAP, PAGE_KERNEL);
+	buf = vmalloc(lzo1x_worst_compress(total - off));
+	wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!virt || !buf || !wrkmem)
+		goto out;
+
+	if (lzo1x_1_compress(virt + off, total - off, buf, &comp_len,
+			     wrkmem) != LZO_E_OK ||
+	    comp_len >= total - off)
+		goto out;
+
+	nr = DIV_ROUND_UP(off + comp_len, PAGE_SIZE);
+	seg->comp_pages = kcalloc(nr, sizeof(struct page *), GFP_NOFS);
+	if (!seg->comp_pages)
+		goto out;
+	seg->nr_comp_pages = nr;
+
+	for (i = 0; i < nr; i++) {
+		seg->comp_pages[i] = seg_alloc_page(sb);
+		if (!seg->comp_pages[i])
+			goto out;
+	}
+
+	cvirt = vmap(seg->comp_pages, nr, VM_MAP, PAGE_KERNEL);
+	if (!cvirt)
+		goto out;
+
+	memcpy(cvirt, virt, off);
+	memcpy(cvirt + off, buf, comp_len);
+
+	csblk = cvirt;
+	csblk->comp_bytes = cpu_to_le32(comp_len);
+	csblk->comp_codec = SCOUTFS_SEG_COMP_LZO;
+
+	crc_off = offsetof(struct scoutfs_segment_block, _padding) +
+		  FIELD_SIZEOF(struct scoutfs_segment_block, _padding);
+	csblk->crc = cpu_to_le32(crc32c(~0, cvirt + crc_off,
+					off + comp_len - crc_off));
+
+	scoutfs_inc_counter(sb, seg_compress_write);
+	scoutfs_bio_submit_comp(sb, WRITE, seg->comp_pages,
+				segno_to_blkno(seg->segno),
+				DIV_ROUND_UP(off + comp_len,
+					     SCOUTFS_BLOCK_SIZE), comp);
+	ret = 1;
+out:
+	if (cvirt)
+		vunmap(cvirt);
+	if (virt)
+		vunmap(virt);
+	vfree(wrkmem);
+	vfree(buf);
+	return ret;
+}
+
 int scoutfs_seg_submit_write(struct super_block *sb,
 			     struct scoutfs_segment *seg,
 			     struct scoutfs_bio_completion *comp)
@@ -373,11 +1128,37 @@ int scoutfs_seg_submit_write(struct super_block *sb,
 
 	trace_scoutfs_seg_submit_write(sb, seg->segno);
 
+	if (submit_compressed_write(sb, seg, comp)) {
+		/* the cached uncompressed copy still needs a valid crc */
+		sblk->crc = calc_seg_crc(seg);
+		/* the contents are final, readers don't need to verify */
+		set_bit(SF_CALC_CRC_STARTED, &seg->flags);
+		set_bit(SF_CALC_CRC_DONE, &seg->flags);
+		return 0;
+	}
+
+	/*
+	 * Submit everything after the first page before calculating the
+	 * crc so that checksumming a megabyte overlaps with the bulk of
+	 * the io instead of delaying its submission.  The item bytes
+	 * are stable once we're called so the crc covers what's in
+	 * flight.  The first page is submitted last once the crc in its
+	 * header is final.
+	 */
+	scoutfs_bio_submit_comp(sb, WRITE, seg->pages + 1,
+				segno_to_blkno(seg->segno) +
+				SCOUTFS_BLOCKS_PER_PAGE,
+				SCOUTFS_SEGMENT_BLOCKS -
+				SCOUTFS_BLOCKS_PER_PAGE, comp);
+
 	sblk->crc = calc_seg_crc(seg);
+	/* the contents are final, readers don't need to verify */
+	set_bit(SF_CALC_CRC_STARTED, &seg->flags);
+	set_bit(SF_CALC_CRC_DONE, &seg->flags);
 
 	scoutfs_bio_submit_comp(sb, WRITE, seg->pages,
 				segno_to_blkno(seg->segno),
-				SCOUTFS_SEGMENT_BLOCKS, comp);
+				SCOUTFS_BLOCKS_PER_PAGE, comp);
 
 	return 0;
 }
@@ -416,16 +1197,8 @@ int scoutfs_seg_wait(struct super_block *sb, struct scoutfs_segment *seg,
 		goto out;
 	}
 
-	/* calc crc in waiting task instead of end_io */
-	if (!test_bit(SF_CALC_CRC_DONE, &seg->flags) &&
-	    !test_and_set_bit(SF_CALC_CRC_STARTED, &seg->flags)) {
-		if (sblk->crc != calc_seg_crc(seg)) {
-			scoutfs_inc_counter(sb, seg_csum_error);
-			set_bit(SF_INVALID_CRC, &seg->flags);
-		}
-		set_bit(SF_CALC_CRC_DONE, &seg->flags);
-		wake_up(&cac->waitq);
-	}
+	/* calc crc here if we beat the verify worker to it */
+	seg_calc_crc_once(sb, seg);
 
 	/* very rarely race waiting for calc to finish */
 	ret = wait_event_interruptible(cac->waitq,
@@ -448,19 +1221,135 @@ int scoutfs_seg_wait(struct super_block *sb, struct scoutfs_segment *seg,
 		scoutfs_inc_counter(sb, seg_stale_read);
 		ret = -ESTALE;
 	}
+
+	/* decompress freshly read segments, racing with the worker */
+	if (ret == 0 && sblk->comp_bytes) {
+		seg_decompress_once(sb, seg);
+
+		ret = wait_event_interruptible(cac->waitq,
+				test_bit(SF_DECOMPRESS_DONE, &seg->flags));
+		if (ret == 0 && seg->err)
+			ret = seg->err;
+	}
+out:
+	return ret;
+}
+
+/*
+ * Decompress the packed item region of a freshly read segment back to
+ * its natural offsets.  The crc has already validated the compressed
+ * bytes so any codec failure here is corruption.  Once the items are
+ * back in place the header is marked uncompressed so the segment looks
+ * like any other cached segment.
+ */
+static int seg_decompress(struct super_block *sb, struct scoutfs_segment *seg)
+{
+	struct scoutfs_segment_block *sblk;
+	u32 off = sizeof(struct scoutfs_segment_block);
+	size_t out_len;
+	void *virt;
+	void *buf;
+	u32 total;
+	u32 comp;
+	int ret;
+
+	virt = vmap(seg->pages, SCOUTFS_SEGMENT_PAGES, VM_MAP, PAGE_KERNEL);
+	if (!virt)
+		return -ENOMEM;
+
+	sblk = virt;
+	comp = le32_to_cpu(sblk->comp_bytes);
+	total = le32_to_cpu(sblk->total_bytes);
+
+	if (sblk->comp_codec != SCOUTFS_SEG_COMP_LZO || total <= off ||
+	    total > SCOUTFS_SEGMENT_SIZE || comp >= total - off) {
+		ret = -EIO;
+		goto out;
+	}
+
+	buf = vmalloc(total - off);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	out_len = total - off;
+	if (lzo1x_decompress_safe(virt + off, comp, buf, &out_len) !=
+	    LZO_E_OK || out_len != total - off) {
+		ret = -EIO;
+	} else {
+		memcpy(virt + off, buf, out_len);
+		sblk->comp_bytes = 0;
+		sblk->comp_codec = SCOUTFS_SEG_COMP_NONE;
+		scoutfs_inc_counter(sb, seg_decompress);
+		ret = 0;
+	}
+
+	vfree(buf);
 out:
+	vunmap(virt);
 	return ret;
 }
 
-static u32 item_bytes(u8 nr_links, u16 val_len)
+static u32 item_bytes(u8 nr_links, u8 sfx_len, u16 val_len)
 {
 	return offsetof(struct scoutfs_segment_item, skip_links[nr_links]) +
-		val_len;
+		sfx_len + val_len;
+}
+
+static inline void *item_sfx_ptr(struct scoutfs_segment_item *item)
+{
+	return (void *)item + item_bytes(item->nr_links, 0, 0);
 }
 
 static inline void *item_val_ptr(struct scoutfs_segment_item *item)
 {
-	return (void *)item + item_bytes(item->nr_links, 0);
+	return item_sfx_ptr(item) + item->key_sfx_len;
+}
+
+static struct scoutfs_segment_fence *seg_fence(struct scoutfs_segment *seg,
+					       u32 nr)
+{
+	return off_ptr(seg, offsetof(struct scoutfs_segment_block,
+				     fences[nr]));
+}
+
+/*
+ * Find the item's governing fence: the most recent fence at or before
+ * the item's offset.  Fences are recorded in append order so their
+ * offsets are sorted and we can binary search them.
+ */
+static struct scoutfs_segment_fence *item_fence(struct scoutfs_segment *seg,
+						u32 off)
+{
+	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
+	u32 nr_fences = DIV_ROUND_UP(le32_to_cpu(sblk->nr_items),
+				     SCOUTFS_SEG_FENCE_EVERY);
+	u32 start = 0;
+	u32 end = nr_fences;
+	u32 mid;
+
+	while (end - start > 1) {
+		mid = start + ((end - start) >> 1);
+		if (le32_to_cpu(seg_fence(seg, mid)->off) <= off)
+			start = mid;
+		else
+			end = mid;
+	}
+
+	return seg_fence(seg, start);
+}
+
+/* rebuild the item's full big endian key from its fence key and suffix */
+static void get_item_key_be(struct scoutfs_segment *seg, u32 off,
+			    struct scoutfs_segment_item *item,
+			    struct scoutfs_key_be *key_be)
+{
+	struct scoutfs_segment_fence *fence = item_fence(seg, off);
+
+	memcpy(key_be, &fence->key, item->key_pfx_len);
+	memcpy((u8 *)key_be + item->key_pfx_len, item_sfx_ptr(item),
+	       item->key_sfx_len);
 }
 
 /* copy the item key into the caller's key and init their val to ref the val */
@@ -468,9 +1357,12 @@ static void get_item_key_val(struct scoutfs_segment *seg, int off,
 			     struct scoutfs_key *key, struct kvec *val)
 {
 	struct scoutfs_segment_item *item = off_ptr(seg, off);
+	struct scoutfs_key_be key_be;
 
-	if (key)
-		*key = item->key;
+	if (key) {
+		get_item_key_be(seg, off, item, &key_be);
+		scoutfs_key_from_be(key, &key_be);
+	}
 
 	if (val)
 		kvec_init(val, item_val_ptr(item), le16_to_cpu(item->val_len));
@@ -550,45 +1442,60 @@ static u8 skip_most_nr(u32 nr_items)
  * than or equal to the search key.  -ENOENT is returned if there's no
  * item that matches.
  *
- * This is a standard skip list search from the segment block through
- * the items.  Follow high less frequent links while the key is greater
- * than the items and descend down to lower more frequent links when the
- * search key is less.
+ * We binary search the fence array for the greatest fence whose key
+ * isn't greater than the search key and then walk the level 0 skip
+ * links from its item.  The walk compares at most the fence interval's
+ * worth of packed items which are laid out in append order, unlike a
+ * skip list descent which chases links through items scattered across
+ * the whole segment.
+ *
+ * The search key is encoded once so that fence probes are word
+ * comparisons of the stored big endian keys.  Walked item keys are
+ * rebuilt from their fence key and stored suffix before comparing.
  */
 int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key)
 {
 	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
 	struct scoutfs_segment_item *item;
-	__le32 *links;
-	int cmp;
-	int ret;
-	int i;
+	struct scoutfs_key_be item_key;
+	struct scoutfs_key_be key_be;
+	u32 nr_fences;
+	u32 start;
+	u32 end;
+	u32 mid;
 	int off;
 
-	links = sblk->skip_links;
-	ret = -ENOENT;
-	for (i = skip_most_nr(le32_to_cpu(sblk->nr_items)) - 1; i >= 0; i--) {
-		if (links[i] == 0)
-			continue;
+	if (sblk->nr_items == 0)
+		return -ENOENT;
 
-		off = le32_to_cpu(links[i]);
-		item = off_ptr(seg, off);
+	scoutfs_key_to_be(&key_be, key);
 
-		cmp = scoutfs_key_compare(key, &item->key);
-		if (cmp == 0) {
-			ret = off;
-			break;
-		}
+	nr_fences = DIV_ROUND_UP(le32_to_cpu(sblk->nr_items),
+				 SCOUTFS_SEG_FENCE_EVERY);
 
-		if (cmp > 0) {
-			links = item->skip_links;
-			i++;
-		} else {
-			ret = off;
-		}
+	/* find the greatest fence with fence key <= search key */
+	start = 0;
+	end = nr_fences;
+	while (end - start > 1) {
+		mid = start + ((end - start) >> 1);
+		if (scoutfs_key_compare_be(&seg_fence(seg, mid)->key,
+					   &key_be) <= 0)
+			start = mid;
+		else
+			end = mid;
 	}
 
-	return ret;
+	/* the first fence is the first item, search key can precede it */
+	off = le32_to_cpu(seg_fence(seg, start)->off);
+	while (off) {
+		item = off_ptr(seg, off);
+		get_item_key_be(seg, off, item, &item_key);
+		if (scoutfs_key_compare_be(&item_key, &key_be) >= 0)
+			return off;
+		off = le32_to_cpu(item->skip_links[0]);
+	}
+
+	return -ENOENT;
 }
 
 /*
@@ -621,8 +1528,9 @@ u32 scoutfs_seg_total_bytes(struct scoutfs_segment *seg)
 }
 
 /*
- * Returns true if the given item population will fit in a single
- * segment.
+ * Returns true if the given item population will fit in the given
+ * number of segments.  Each segment pays the header cost and the items
+ * and values fill whatever remains.
  *
  * We don't have items cross block boundaries.  It would be too
  * expensive to maintain packing of sorted dirty items in bins.  Instead
@@ -632,17 +1540,25 @@ u32 scoutfs_seg_total_bytes(struct scoutfs_segment *seg)
  *
  * Our pattern of item link counts ensures that there will always be fewer
  * than two links per item.  We assume the worst case items have the
- * max number of links.
+ * max number of links.  We also assume items store their full keys as
+ * suffixes; prefix encoding against the fences can only shrink them.
  */
-bool scoutfs_seg_fits_single(u32 nr_items, u32 val_bytes)
+bool scoutfs_seg_fits(u32 nr_items, u32 val_bytes, u32 nr_segs)
 {
 	u32 header = sizeof(struct scoutfs_segment_block);
-	u32 items = nr_items * item_bytes(2, 0);
+	u32 items = nr_items * item_bytes(2, sizeof(struct scoutfs_key_be), 0);
 	u32 item_pad = item_bytes(skip_most_nr(nr_items),
+				  sizeof(struct scoutfs_key_be),
 				  SCOUTFS_MAX_VAL_SIZE) - 1;
 	u32 padding = (SCOUTFS_SEGMENT_SIZE / SCOUTFS_BLOCK_SIZE) * item_pad;
 
-	return (header + items + val_bytes + padding) <= SCOUTFS_SEGMENT_SIZE;
+	return ((u64)(header + padding) * nr_segs + items + val_bytes) <=
+	       (u64)nr_segs * SCOUTFS_SEGMENT_SIZE;
+}
+
+bool scoutfs_seg_fits_single(u32 nr_items, u32 val_bytes)
+{
+	return scoutfs_seg_fits(nr_items, val_bytes, 1);
 }
 
 static u32 align_item_off(struct scoutfs_segment *seg, u32 item_off, u32 bytes)
@@ -671,10 +1587,16 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	struct scoutfs_super_block *super = &sbi->super;
 	struct scoutfs_segment_block *sblk = off_ptr(seg, 0);
 	struct scoutfs_segment_item *item;
+	struct scoutfs_segment_fence *fence;
+	struct scoutfs_key_be key_be;
+	struct scoutfs_key prev;
 	struct kvec item_val;
 	u8 nr_links;
+	u8 pfx_len;
+	u8 sfx_len;
 	u32 val_len;
 	u32 bytes;
+	u32 nr;
 	u32 off;
 	int i;
 
@@ -705,14 +1627,35 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	 */
 	off = le32_to_cpu(sblk->last_item_off);
 	if (off) {
-		item = off_ptr(seg, off);
-		scoutfs_bug_on(sb, scoutfs_key_compare(key, &item->key) <= 0,
+		get_item_key_val(seg, off, &prev, NULL);
+		scoutfs_bug_on(sb, scoutfs_key_compare(key, &prev) <= 0,
 			       "key "SK_FMT" item->key "SK_FMT,
-			       SK_ARG(key), SK_ARG(&item->key));
+			       SK_ARG(key), SK_ARG(&prev));
 	}
 
-	nr_links = skip_next_nr(le32_to_cpu(sblk->nr_items));
-	bytes = item_bytes(nr_links, val_len);
+	scoutfs_key_to_be(&key_be, key);
+
+	/*
+	 * Fence items record their full key in the fence and store no
+	 * suffix.  Other items share a prefix with the last fence,
+	 * which was recorded by the time they're appended, and store
+	 * the rest.
+	 */
+	nr = le32_to_cpu(sblk->nr_items);
+	if ((nr % SCOUTFS_SEG_FENCE_EVERY) == 0) {
+		pfx_len = sizeof(key_be);
+	} else {
+		fence = seg_fence(seg, nr / SCOUTFS_SEG_FENCE_EVERY);
+		for (pfx_len = 0; pfx_len < sizeof(key_be); pfx_len++) {
+			if (((u8 *)&fence->key)[pfx_len] !=
+			    ((u8 *)&key_be)[pfx_len])
+				break;
+		}
+	}
+	sfx_len = sizeof(key_be) - pfx_len;
+
+	nr_links = skip_next_nr(nr);
+	bytes = item_bytes(nr_links, sfx_len, val_len);
 	off = align_item_off(seg, le32_to_cpu(sblk->total_bytes), bytes);
 
 	if ((off + bytes) > SCOUTFS_SEGMENT_SIZE)
@@ -722,8 +1665,19 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 	sblk->total_bytes = cpu_to_le32(off + bytes);
 	le32_add_cpu(&sblk->nr_items, 1);
 
+	/* record a fence for every Nth item, the array spans pages */
+	if ((nr % SCOUTFS_SEG_FENCE_EVERY) == 0) {
+		fence = seg_fence(seg, nr / SCOUTFS_SEG_FENCE_EVERY);
+		fence->key = key_be;
+		fence->off = cpu_to_le32(off);
+	}
+
+	/* deletion items set bloom bits too, readers need to find them */
+	seg_bloom_set(seg, key);
+
 	item = off_ptr(seg, off);
-	item->key = *key;
+	item->key_pfx_len = pfx_len;
+	item->key_sfx_len = sfx_len;
 	item->val_len = cpu_to_le16(val_len);
 	item->flags = flags;
 
@@ -735,10 +1689,15 @@ bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg
 		links[i] = &item->skip_links[i];
 	}
 
+	memcpy(item_sfx_ptr(item), (u8 *)&key_be + pfx_len, sfx_len);
+
 	get_item_key_val(seg, off, NULL, &item_val);
 	if (val_len)
 		memcpy(item_val.iov_base, val->iov_base, val_len);
 
+	if (flags & SCOUTFS_ITEM_FLAG_DELETION)
+		seg->nr_deletions++;
+
 	return true;
 }
 
@@ -753,6 +1712,7 @@ void scoutfs_seg_init_ment(struct scoutfs_manifest_entry *ment, int level,
 
 	scoutfs_manifest_init_entry(ment, level, le64_to_cpu(sblk->segno),
 				    le64_to_cpu(sblk->seq), &first, &last);
+	ment->nr_deletions = seg->nr_deletions;
 }
 
 /*
@@ -812,6 +1772,9 @@ static int seg_lru_shrink(struct shrinker *shrink, struct shrink_control *sc)
 		trace_scoutfs_seg_shrink(seg);
 		scoutfs_inc_counter(sb, seg_shrink);
 		list_del_init(&seg->lru_entry);
+		/* compressing allocates, only try when reclaim allows fs */
+		if (sc->gfp_mask & __GFP_FS)
+			stash_comp_seg(sb, seg);
 		scoutfs_seg_put(seg);
 	}
 
@@ -826,6 +1789,14 @@ int scoutfs_seg_setup(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct segment_cache *cac;
+	int i;
+
+	/* fences and bloom longs are mapped and can't cross page boundaries */
+	BUILD_BUG_ON(sizeof(struct scoutfs_segment_fence) != 32);
+	BUILD_BUG_ON(offsetof(struct scoutfs_segment_block, fences) %
+		     sizeof(struct scoutfs_segment_fence));
+	BUILD_BUG_ON(offsetof(struct scoutfs_segment_block, bloom) %
+		     sizeof(__le64));
 
 	cac = kzalloc(sizeof(struct segment_cache), GFP_KERNEL);
 	if (!cac)
@@ -837,6 +1808,33 @@ int scoutfs_seg_setup(struct super_block *sb)
 	cac->root = RB_ROOT;
 	init_waitqueue_head(&cac->waitq);
 
+	cac->pools = kcalloc(nr_node_ids, sizeof(struct seg_page_pool),
+			     GFP_KERNEL);
+	if (!cac->pools) {
+		kfree(cac);
+		sbi->segment_cache = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr_node_ids; i++) {
+		spin_lock_init(&cac->pools[i].lock);
+		INIT_LIST_HEAD(&cac->pools[i].pages);
+	}
+
+	cac->verify_wq = alloc_workqueue("scoutfs_seg_verify", WQ_UNBOUND, 0);
+	if (!cac->verify_wq) {
+		kfree(cac->pools);
+		kfree(cac);
+		sbi->segment_cache = NULL;
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&cac->comp_lock);
+	cac->comp_root = RB_ROOT;
+	INIT_LIST_HEAD(&cac->comp_lru_list);
+	mutex_init(&cac->comp_mutex);
+	/* the comp cache is opportunistic, without a workspace it's off */
+	cac->comp_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+
 	cac->shrinker.shrink = seg_lru_shrink;
 	cac->shrinker.seeks = DEFAULT_SEEKS;
 	register_shrinker(&cac->shrinker);
@@ -850,12 +1848,20 @@ void scoutfs_seg_destroy(struct super_block *sb)
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct segment_cache *cac = sbi->segment_cache;
 	struct scoutfs_segment *seg;
+	struct comp_seg *cseg;
 	struct rb_node *node;
+	struct page *page;
+	struct page *tmp;
+	int i;
 
 	if (cac) {
 		if (cac->shrinker.shrink == seg_lru_shrink)
 			unregister_shrinker(&cac->shrinker);
 
+		/* pending verify work holds seg refs */
+		if (cac->verify_wq)
+			destroy_workqueue(cac->verify_wq);
+
 		for (node = rb_first(&cac->root); node; ) {
 			seg = container_of(node, struct scoutfs_segment, node);
 			node = rb_next(node);
@@ -863,6 +1869,25 @@ void scoutfs_seg_destroy(struct super_block *sb)
 			scoutfs_seg_put(seg);
 		}
 
+		for (node = rb_first(&cac->comp_root); node; ) {
+			cseg = container_of(node, struct comp_seg, node);
+			node = rb_next(node);
+			rb_erase(&cseg->node, &cac->comp_root);
+			list_del_init(&cseg->lru_entry);
+			free_comp_seg(sb, cseg);
+		}
+		vfree(cac->comp_wrkmem);
+
+		/* the final puts above can refill the pools */
+		for (i = 0; i < nr_node_ids; i++) {
+			list_for_each_entry_safe(page, tmp,
+						 &cac->pools[i].pages, lru) {
+				list_del_init(&page->lru);
+				__free_page(page);
+			}
+		}
+
+		kfree(cac->pools);
 		kfree(cac);
 	}
 }
@@ -14,8 +14,15 @@ struct scoutfs_segment {
 	atomic_t refcount;
 	u64 segno;
 	unsigned long flags;
+	/* deletion items appended, recorded in the manifest entry */
+	u32 nr_deletions;
+	ktime_t submit_time;
 	int err;
+	struct work_struct verify_work;
 	struct page *pages[SCOUTFS_SEGMENT_PAGES];
+	/* compressed image built for writing, in flight until freed */
+	struct page **comp_pages;
+	unsigned int nr_comp_pages;
 };
 
 struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
@@ -23,6 +30,12 @@ struct scoutfs_segment *scoutfs_seg_submit_read(struct super_block *sb,
 int scoutfs_seg_wait(struct super_block *sb, struct scoutfs_segment *seg,
 		     u64 segno, u64 seq);
 
+bool scoutfs_seg_bloom_may_contain(struct scoutfs_segment *seg,
+				   struct scoutfs_key *key);
+bool scoutfs_seg_bloom_test_longs(__le64 *longs, struct scoutfs_key *key);
+int scoutfs_seg_bloom_read(struct super_block *sb, u64 segno, u64 seq,
+			   __le64 *longs);
+
 int scoutfs_seg_find_off(struct scoutfs_segment *seg, struct scoutfs_key *key);
 int scoutfs_seg_next_off(struct scoutfs_segment *seg, int off);
 u32 scoutfs_seg_total_bytes(struct scoutfs_segment *seg);
@@ -34,6 +47,7 @@ void scoutfs_seg_put(struct scoutfs_segment *seg);
 
 int scoutfs_seg_alloc(struct super_block *sb, u64 segno,
 		      struct scoutfs_segment **seg_ret);
+bool scoutfs_seg_fits(u32 nr_items, u32 val_bytes, u32 nr_segs);
 bool scoutfs_seg_fits_single(u32 nr_items, u32 val_bytes);
 bool scoutfs_seg_append_item(struct super_block *sb, struct scoutfs_segment *seg,
 			     struct scoutfs_key *key, struct kvec *val,
@@ -32,7 +32,9 @@
 #include "msg.h"
 #include "server.h"
 #include "net.h"
+#include "options.h"
 #include "endian_swap.h"
+#include "spbm.h"
 
 /*
  * XXX pre commit:
@@ -64,12 +66,19 @@ struct server_info {
 	/* request processing coordinates committing manifest and alloc */
 	struct rw_semaphore commit_rwsem;
 	struct llist_head commit_waiters;
-	struct work_struct commit_work;
+	struct delayed_work commit_dwork;
 
 	/* server remembers the stable manifest root for clients */
 	seqcount_t stable_seqcount;
 	struct scoutfs_btree_root stable_manifest_root;
 
+	/* a standby client is told which ring blocks commits wrote */
+	u64 standby_node_id;
+	u64 ring_advertised;
+
+	/* snapshot mounts pin roots which defers applying frees */
+	struct list_head snap_pins;
+
 	/* server tracks seq use */
 	spinlock_t seq_lock;
 	struct list_head pending_seqs;
@@ -77,6 +86,7 @@ struct server_info {
 	/* server tracks pending frees to be applied during commit */
 	struct rw_semaphore alloc_rwsem;
 	struct list_head pending_frees;
+	struct scoutfs_spbm free_segnos;
 
 	struct list_head clients;
 	unsigned long nr_clients;
@@ -229,6 +239,39 @@ static int server_extent_io(struct super_block *sb, int op,
 	return ret;
 }
 
+/*
+ * The server keeps an in-memory index of free segnos so that segment
+ * allocation doesn't have to search the persistent extent items.  A set
+ * bit means that the segment's blocks are entirely free in the extent
+ * index.  Clear bits don't promise anything: setting bits can fail to
+ * allocate and searches fall back to sweeping the extents.  The index
+ * is rebuilt from the extents each time a server starts up and is
+ * protected by the alloc_rwsem.
+ */
+static void set_free_segnos(struct super_block *sb, u64 start, u64 len)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	u64 blkno = ALIGN(start, SCOUTFS_SEGMENT_BLOCKS);
+
+	/* only set segnos whose blocks are entirely inside the extent */
+	while (blkno + SCOUTFS_SEGMENT_BLOCKS <= start + len) {
+		if (scoutfs_spbm_set(&server->free_segnos,
+				     blkno >> SCOUTFS_SEGMENT_BLOCK_SHIFT))
+			break;
+		blkno += SCOUTFS_SEGMENT_BLOCKS;
+	}
+}
+
+static void clear_free_segnos(struct super_block *sb, u64 start, u64 len)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	u64 segno = start >> SCOUTFS_SEGMENT_BLOCK_SHIFT;
+	u64 last = (start + len - 1) >> SCOUTFS_SEGMENT_BLOCK_SHIFT;
+
+	while (segno <= last)
+		scoutfs_spbm_clear(&server->free_segnos, segno++);
+}
+
 /*
  * Allocate an extent of the given length in the first smallest free
  * extent that contains it.  We allocate in multiples of segment blocks
@@ -276,6 +319,8 @@ static int alloc_extent(struct super_block *sb, u64 blocks,
 	if (ret)
 		goto out;
 
+	clear_free_segnos(sb, ext.start, ext.len);
+
 	trace_scoutfs_server_alloc_extent_allocated(sb, &ext);
 
 	*start = ext.start;
@@ -299,6 +344,43 @@ struct pending_free_extent {
 	u64 len;
 };
 
+/*
+ * Each snapshot mount pins the manifest root that was stable when it
+ * first asked.  While any pins exist freed extents stay on the pending
+ * list instead of being returned to the allocator so that the segments
+ * referenced by pinned roots can't be overwritten.
+ */
+struct snap_pin {
+	struct list_head head;
+	u64 node_id;
+	struct scoutfs_btree_root root;
+};
+
+static struct snap_pin *find_snap_pin(struct server_info *server, u64 node_id)
+{
+	struct snap_pin *pin;
+
+	list_for_each_entry(pin, &server->snap_pins, head) {
+		if (pin->node_id == node_id)
+			return pin;
+	}
+
+	return NULL;
+}
+
+static void free_snap_pins(struct server_info *server)
+{
+	struct snap_pin *pin;
+	struct snap_pin *tmp;
+
+	spin_lock(&server->lock);
+	list_for_each_entry_safe(pin, tmp, &server->snap_pins, head) {
+		list_del_init(&pin->head);
+		kfree(pin);
+	}
+	spin_unlock(&server->lock);
+}
+
 /*
  * Now that the transaction's done we can apply all the pending frees.
  * The list entries are totally unsorted so this is the first time that
@@ -316,6 +398,19 @@ static int apply_pending_frees(struct super_block *sb)
 	struct scoutfs_extent ext;
 	int ret;
 
+	/*
+	 * Freed extents can still be referenced by pinned snapshot
+	 * roots.  Leave them pending until the last pin is dropped, the
+	 * commit after that applies the backlog.
+	 */
+	spin_lock(&server->lock);
+	if (!list_empty(&server->snap_pins)) {
+		spin_unlock(&server->lock);
+		scoutfs_inc_counter(sb, server_snap_defer_frees);
+		return 0;
+	}
+	spin_unlock(&server->lock);
+
 	down_write(&server->alloc_rwsem);
 
 	list_for_each_entry_safe(pfe, tmp, &server->pending_frees, head) {
@@ -329,6 +424,9 @@ static int apply_pending_frees(struct super_block *sb)
 			break;
 		}
 
+		/* freed segments are only visible to allocation on commit */
+		set_free_segnos(sb, pfe->start, pfe->len);
+
 		list_del_init(&pfe->head);
 		kfree(pfe);
 	}
@@ -343,7 +441,9 @@ static int apply_pending_frees(struct super_block *sb)
  * shut down cleanly and that's not well supported today so we want to
  * have it holler if this happens.  In the future we'd cleanly support
  * forced shutdown that had been told that it's OK to throw away dirty
- * state.
+ * state.  Snapshot pins that survive until shutdown also leave their
+ * deferred frees here, leaking the extents until repair, and deserve
+ * the same hollering.
  */
 static int destroy_pending_frees(struct super_block *sb)
 {
@@ -417,11 +517,13 @@ static int free_segno(struct super_block *sb, u64 segno)
  * we address segments with aligned segment numbers instead of block
  * offsets.
  *
- * We can use a simple cursor sweep of the index by start because all
- * server extents are multiples of the segment size.  Sweeping through
- * the volume tries to spread out new segment writes and make it more
- * rare to write to a recently freed segment which can cause a client to
- * have to re-read the manifest.
+ * The free segno index usually finds the next free segment at the
+ * cursor position without searching the persistent extents at all.  If
+ * the index comes up empty we fall back to a cursor sweep of the extent
+ * index by start, which works because all server extents are multiples
+ * of the segment size.  Sweeping through the volume tries to spread out
+ * new segment writes and make it more rare to write to a recently freed
+ * segment which can cause a client to have to re-read the manifest.
  */
 static int alloc_segno(struct super_block *sb, u64 *segno)
 {
@@ -429,6 +531,7 @@ static int alloc_segno(struct super_block *sb, u64 *segno)
 	struct scoutfs_super_block *super = &SCOUTFS_SB(sb)->super;
 	struct scoutfs_extent ext;
 	u64 curs;
+	u64 bit;
 	int ret;
 
 	down_write(&server->alloc_rwsem);
@@ -436,6 +539,22 @@ static int alloc_segno(struct super_block *sb, u64 *segno)
 	curs = ALIGN(le64_to_cpu(super->alloc_cursor), SCOUTFS_SEGMENT_BLOCKS);
 	*segno = 0;
 
+	ret = scoutfs_spbm_next_set(&server->free_segnos,
+				    curs >> SCOUTFS_SEGMENT_BLOCK_SHIFT, &bit);
+	if (ret == -ENOENT && curs)
+		ret = scoutfs_spbm_next_set(&server->free_segnos, 0, &bit);
+	if (ret == 0) {
+		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
+				    bit << SCOUTFS_SEGMENT_BLOCK_SHIFT,
+				    SCOUTFS_SEGMENT_BLOCKS, 0, 0);
+		ret = scoutfs_extent_remove(sb, server_extent_io, &ext, NULL);
+		if (ret == 0) {
+			scoutfs_spbm_clear(&server->free_segnos, bit);
+			scoutfs_inc_counter(sb, server_alloc_segno_indexed);
+			goto found;
+		}
+	}
+
 	do {
 		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
 				    curs, 1, 0, 0);
@@ -449,6 +568,9 @@ static int alloc_segno(struct super_block *sb, u64 *segno)
 
 	trace_scoutfs_server_alloc_segno_next(sb, &ext);
 
+	/* repair the index with the found extent before trimming it */
+	set_free_segnos(sb, ext.start, ext.len);
+
 	/* use cursor if within extent, otherwise start of next extent */
 	if (ext.start < curs)
 		ext.start = curs;
@@ -458,6 +580,11 @@ static int alloc_segno(struct super_block *sb, u64 *segno)
 	if (ret)
 		goto out;
 
+	scoutfs_spbm_clear(&server->free_segnos,
+			   ext.start >> SCOUTFS_SEGMENT_BLOCK_SHIFT);
+	scoutfs_inc_counter(sb, server_alloc_segno_sweep);
+
+found:
 	super->alloc_cursor = cpu_to_le64(ext.start + ext.len);
 
 	*segno = ext.start >> SCOUTFS_SEGMENT_BLOCK_SHIFT;
@@ -490,7 +617,41 @@ static int remove_segno(struct super_block *sb, u64 segno)
 
 	down_write(&server->alloc_rwsem);
 	ret = scoutfs_extent_remove(sb, server_extent_io, &ext, NULL);
+	if (ret == 0)
+		scoutfs_spbm_clear(&server->free_segnos, segno);
+	up_write(&server->alloc_rwsem);
+	return ret;
+}
+
+/*
+ * Populate the free segno index from the persistent free extents as the
+ * server starts up.
+ */
+static int build_free_segnos(struct super_block *sb)
+{
+	struct server_info *server = SCOUTFS_SB(sb)->server_info;
+	struct scoutfs_extent ext;
+	u64 start = 0;
+	int ret;
+
+	down_write(&server->alloc_rwsem);
+
+	for (;;) {
+		scoutfs_extent_init(&ext, SCOUTFS_FREE_EXTENT_BLKNO_TYPE, 0,
+				    start, 1, 0, 0);
+		ret = scoutfs_extent_next(sb, server_extent_io, &ext, NULL);
+		if (ret) {
+			if (ret == -ENOENT)
+				ret = 0;
+			break;
+		}
+
+		set_free_segnos(sb, ext.start, ext.len);
+		start = ext.start + ext.len;
+	}
+
 	up_write(&server->alloc_rwsem);
+
 	return ret;
 }
 
@@ -526,21 +687,28 @@ static void try_queue_compact(struct server_info *server)
  * another work run in the future.  This caller can return from
  * wait_for_commit() while the commit_work is still queued.
  *
- * This could queue delayed work but we're first trying to have batching
- * work by having concurrent modification line up behind a commit in
- * flight.  Once the commit finishes it'll unlock and hopefully everyone
- * will race to make their changes and they'll all be applied by the
- * next commit after that.
+ * Concurrent modification naturally lines up behind a commit in
+ * flight, but the first request after an idle commit used to pay a
+ * full write cycle all by itself.  A small tunable delay before the
+ * commit work runs lets requests arriving from many clients pile onto
+ * one commit.  Queueing delayed work that's already queued doesn't
+ * push out the existing timer, so the delay caps the latency added to
+ * the first waiter rather than restarting for each one.
  */
 static void queue_commit_work(struct server_info *server,
 			      struct commit_waiter *cw)
 {
+	unsigned long delay;
+
 	lockdep_assert_held(&server->commit_rwsem);
 
 	cw->ret = 0;
 	init_completion(&cw->comp);
 	llist_add(&cw->node, &server->commit_waiters);
-	queue_work(server->wq, &server->commit_work);
+
+	delay = msecs_to_jiffies(scoutfs_option_u32(server->sb,
+						Opt_server_commit_delay_ms));
+	queue_delayed_work(server->wq, &server->commit_dwork, delay);
 }
 
 /*
@@ -552,6 +720,48 @@ static inline int wait_for_commit(struct commit_waiter *cw)
 	return cw->ret;
 }
 
+/*
+ * Tell the standby client, if one has registered, which btree ring
+ * blocks were written since the last advert.  The positions are offsets
+ * into the ring so a commit that wrapped into the other half produces
+ * two adverts.  The standby only reads the blocks ahead of promotion so
+ * we fire and forget, ignoring responses and send errors.
+ */
+static void send_ring_adverts(struct super_block *sb, u64 from, u64 to)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	struct scoutfs_btree_ring *bring = &SCOUTFS_SB(sb)->super.bring;
+	struct scoutfs_net_ring_advert adv;
+	u64 first = le64_to_cpu(bring->first_blkno);
+	u64 node_id;
+
+	spin_lock(&server->lock);
+	node_id = server->standby_node_id;
+	spin_unlock(&server->lock);
+
+	if (node_id == 0 || from == to)
+		return;
+
+	if (to < from) {
+		adv.blkno = cpu_to_le64(first + from);
+		adv.nr = cpu_to_le64(le64_to_cpu(bring->nr_blocks) - from);
+		scoutfs_net_submit_request_node(sb, server->conn, node_id,
+						SCOUTFS_NET_CMD_RING_ADVERT,
+						&adv, sizeof(adv),
+						NULL, NULL, NULL);
+		from = 0;
+	}
+
+	if (from < to) {
+		adv.blkno = cpu_to_le64(first + from);
+		adv.nr = cpu_to_le64(to - from);
+		scoutfs_net_submit_request_node(sb, server->conn, node_id,
+						SCOUTFS_NET_CMD_RING_ADVERT,
+						&adv, sizeof(adv),
+						NULL, NULL, NULL);
+	}
+}
+
 /*
  * A core function of request processing is to modify the manifest and
  * allocator.  Often the processing needs to make the modifications
@@ -574,7 +784,7 @@ static inline int wait_for_commit(struct commit_waiter *cw)
 static void scoutfs_server_commit_func(struct work_struct *work)
 {
 	struct server_info *server = container_of(work, struct server_info,
-						  commit_work);
+						  commit_dwork.work);
 	struct super_block *sb = server->sb;
 	struct commit_waiter *cw;
 	struct commit_waiter *pos;
@@ -615,6 +825,12 @@ static void scoutfs_server_commit_func(struct work_struct *work)
 	server->stable_manifest_root = SCOUTFS_SB(sb)->super.manifest.root;
 	write_seqcount_end(&server->stable_seqcount);
 
+	/* the ring position only advances while we're the only writer */
+	send_ring_adverts(sb, server->ring_advertised,
+			  le64_to_cpu(SCOUTFS_SB(sb)->super.bring.next_block));
+	server->ring_advertised =
+		le64_to_cpu(SCOUTFS_SB(sb)->super.bring.next_block);
+
 	scoutfs_advance_dirty_super(sb);
 	ret = 0;
 
@@ -636,6 +852,7 @@ void scoutfs_init_ment_to_net(struct scoutfs_net_manifest_entry *net_ment,
 {
 	net_ment->segno = cpu_to_le64(ment->segno);
 	net_ment->seq = cpu_to_le64(ment->seq);
+	net_ment->nr_deletions = cpu_to_le32(ment->nr_deletions);
 	net_ment->first = ment->first;
 	net_ment->last = ment->last;
 	net_ment->level = ment->level;
@@ -646,6 +863,7 @@ void scoutfs_init_ment_from_net(struct scoutfs_manifest_entry *ment,
 {
 	ment->segno = le64_to_cpu(net_ment->segno);
 	ment->seq = le64_to_cpu(net_ment->seq);
+	ment->nr_deletions = le32_to_cpu(net_ment->nr_deletions);
 	ment->level = net_ment->level;
 	ment->first = net_ment->first;
 	ment->last = net_ment->last;
@@ -930,6 +1148,115 @@ out:
 				    &next_seq, sizeof(next_seq));
 }
 
+/*
+ * Finish a client's transaction commit in one round trip: add the
+ * written segments to the manifest, retire the seq they used and hand
+ * out the next one, and allocate the segno for its next transaction.
+ * The pieces are the same as the individual record_segment,
+ * advance_seq, and alloc_segno requests but they share a single server
+ * commit.  A commit's segments are all added once level 0 has room so
+ * the count can briefly overshoot the limit by a commit's worth.
+ */
+static int server_commit_segment(struct super_block *sb,
+				 struct scoutfs_net_connection *conn,
+				 u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct scoutfs_super_block *super = &sbi->super;
+	struct scoutfs_net_commit_segment_response resp = {0,};
+	struct scoutfs_net_commit_segment *ncs;
+	struct scoutfs_manifest_entry ment;
+	struct pending_seq *next_ps;
+	struct pending_seq *ps;
+	struct commit_waiter cw;
+	__le64 next_seq;
+	u64 segno;
+	int ret;
+	int i;
+
+	if (arg_len < SCOUTFS_NET_COMMIT_SEGMENT_BYTES(0)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ncs = arg;
+
+	if (ncs->nr_ments < 1 ||
+	    ncs->nr_ments > SCOUTFS_COMMIT_SEGMENT_MAX_NR ||
+	    arg_len != SCOUTFS_NET_COMMIT_SEGMENT_BYTES(ncs->nr_ments)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	next_ps = kmalloc(sizeof(struct pending_seq), GFP_NOFS);
+	if (!next_ps) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+retry:
+	down_read(&server->commit_rwsem);
+	scoutfs_manifest_lock(sb);
+
+	if (scoutfs_manifest_level0_full(sb)) {
+		scoutfs_manifest_unlock(sb);
+		up_read(&server->commit_rwsem);
+		/* XXX waits indefinitely?  io errors? */
+		wait_event(server->waitq, !scoutfs_manifest_level0_full(sb));
+		goto retry;
+	}
+
+	ret = 0;
+	for (i = 0; i < ncs->nr_ments && ret == 0; i++) {
+		scoutfs_init_ment_from_net(&ment, &ncs->ments[i]);
+		ret = scoutfs_manifest_add(sb, &ment);
+	}
+	scoutfs_manifest_unlock(sb);
+
+	if (ret == 0)
+		ret = alloc_segno(sb, &segno);
+
+	if (ret == 0) {
+		spin_lock(&server->seq_lock);
+
+		list_for_each_entry(ps, &server->pending_seqs, head) {
+			if (ps->seq == le64_to_cpu(ncs->used_seq)) {
+				list_del_init(&ps->head);
+				kfree(ps);
+				break;
+			}
+		}
+
+		next_seq = super->next_seq;
+		le64_add_cpu(&super->next_seq, 1);
+
+		next_ps->seq = le64_to_cpu(next_seq);
+		list_add_tail(&next_ps->head, &server->pending_seqs);
+
+		spin_unlock(&server->seq_lock);
+		queue_commit_work(server, &cw);
+	} else {
+		kfree(next_ps);
+	}
+	up_read(&server->commit_rwsem);
+
+	if (ret == 0) {
+		ret = wait_for_commit(&cw);
+		if (ret == 0)
+			try_queue_compact(server);
+	}
+	if (ret)
+		goto out;
+
+	resp.next_seq = next_seq;
+	resp.next_segno = cpu_to_le64(segno);
+	resp.compact_debt = cpu_to_le64(scoutfs_manifest_compact_debt(sb));
+out:
+	return scoutfs_net_response(sb, conn, cmd, id, ret,
+				    &resp, sizeof(resp));
+}
+
 static int server_get_last_seq(struct super_block *sb,
 			       struct scoutfs_net_connection *conn,
 			       u8 cmd, u64 id, void *arg, u16 arg_len)
@@ -985,6 +1312,62 @@ static int server_get_manifest_root(struct super_block *sb,
 				    &root, sizeof(root));
 }
 
+/*
+ * A snapshot mount wants a manifest root that stays valid for its
+ * lifetime.  We record a pin for the node before replying so that
+ * apply_pending_frees won't return the root's segments to the allocator
+ * until the node goes away.  Repeated requests from a node get its
+ * originally pinned root so reconnects don't see the tree change.
+ */
+static int server_get_snap_root(struct super_block *sb,
+				struct scoutfs_net_connection *conn,
+				u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	struct scoutfs_btree_root root;
+	struct snap_pin *pin;
+	struct snap_pin *existing;
+	u64 node_id = scoutfs_net_client_node_id(conn);
+	unsigned int start;
+	int ret;
+
+	if (arg_len != 0) {
+		memset(&root, 0, sizeof(root));
+		ret = -EINVAL;
+		goto out;
+	}
+
+	pin = kzalloc(sizeof(struct snap_pin), GFP_NOFS);
+	if (!pin) {
+		memset(&root, 0, sizeof(root));
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	do {
+		start = read_seqcount_begin(&server->stable_seqcount);
+		pin->root = server->stable_manifest_root;
+	} while (read_seqcount_retry(&server->stable_seqcount, start));
+	pin->node_id = node_id;
+
+	spin_lock(&server->lock);
+	existing = find_snap_pin(server, node_id);
+	if (existing) {
+		root = existing->root;
+	} else {
+		list_add_tail(&pin->head, &server->snap_pins);
+		root = pin->root;
+		pin = NULL;
+	}
+	spin_unlock(&server->lock);
+
+	kfree(pin);
+	ret = 0;
+out:
+	return scoutfs_net_response(sb, conn, cmd, id, ret,
+				    &root, sizeof(root));
+}
+
 /*
  * Sample the super stats that the client wants for statfs by serializing
  * with each component.
@@ -1686,6 +2069,33 @@ out:
 	trace_scoutfs_server_compact_work_exit(sb, 0, ret);
 }
 
+/*
+ * A client sends its node_id to register as the warm standby.  From
+ * then on it's sent adverts for the btree ring blocks that each commit
+ * writes so that its cache tracks the server's btree.  The last client
+ * to register wins, we only track one standby.
+ */
+static int server_ring_advert(struct super_block *sb,
+			      struct scoutfs_net_connection *conn,
+			      u8 cmd, u64 id, void *arg, u16 arg_len)
+{
+	DECLARE_SERVER_INFO(sb, server);
+	__le64 lenode_id;
+	int ret;
+
+	if (arg_len == sizeof(lenode_id)) {
+		memcpy(&lenode_id, arg, sizeof(lenode_id));
+		spin_lock(&server->lock);
+		server->standby_node_id = le64_to_cpu(lenode_id);
+		spin_unlock(&server->lock);
+		ret = 0;
+	} else {
+		ret = -EINVAL;
+	}
+
+	return scoutfs_net_response(sb, conn, cmd, id, ret, NULL, 0);
+}
+
 /*
  * This relies on the caller having read the current super and advanced
  * its seq so that it's dirty.  This will go away when we communicate
@@ -1709,9 +2119,12 @@ static scoutfs_net_request_t server_req_funcs[] = {
 	[SCOUTFS_NET_CMD_ALLOC_SEGNO]		= server_alloc_segno,
 	[SCOUTFS_NET_CMD_RECORD_SEGMENT]	= server_record_segment,
 	[SCOUTFS_NET_CMD_ADVANCE_SEQ]		= server_advance_seq,
+	[SCOUTFS_NET_CMD_COMMIT_SEGMENT]	= server_commit_segment,
 	[SCOUTFS_NET_CMD_GET_LAST_SEQ]		= server_get_last_seq,
 	[SCOUTFS_NET_CMD_GET_MANIFEST_ROOT]	= server_get_manifest_root,
+	[SCOUTFS_NET_CMD_GET_SNAP_ROOT]		= server_get_snap_root,
 	[SCOUTFS_NET_CMD_STATFS]		= server_statfs,
+	[SCOUTFS_NET_CMD_RING_ADVERT]		= server_ring_advert,
 };
 
 static void server_notify_up(struct super_block *sb,
@@ -1740,15 +2153,22 @@ static void server_notify_down(struct super_block *sb,
 {
 	struct server_client_info *sci = info;
 	DECLARE_SERVER_INFO(sb, server);
+	struct snap_pin *pin;
 
 	if (node_id != 0) {
 		spin_lock(&server->lock);
 		list_del_init(&sci->head);
 		server->nr_clients--;
+		if (server->standby_node_id == node_id)
+			server->standby_node_id = 0;
+		pin = find_snap_pin(server, node_id);
+		if (pin)
+			list_del_init(&pin->head);
 		trace_scoutfs_server_client_down(sb, node_id,
 						 server->nr_clients);
 		spin_unlock(&server->lock);
 
+		kfree(pin);
 		forget_client_compacts(sb, sci);
 		try_queue_compact(server);
 	} else {
@@ -1826,12 +2246,15 @@ static void scoutfs_server_worker(struct work_struct *work)
 
 	/* start up the server subsystems before accepting */
 	ret = scoutfs_btree_setup(sb) ?:
-	      scoutfs_manifest_setup(sb);
+	      scoutfs_manifest_setup(sb) ?:
+	      build_free_segnos(sb);
 	if (ret)
 		goto shutdown;
 
 	scoutfs_advance_dirty_super(sb);
 	server->stable_manifest_root = super->manifest.root;
+	server->standby_node_id = 0;
+	server->ring_advertised = le64_to_cpu(super->bring.next_block);
 
 	scoutfs_info(sb, "server started on "SIN_FMT, SIN_ARG(&sin));
 
@@ -1850,10 +2273,12 @@ shutdown:
 	/* drain compact work queued by responses */
 	cancel_work_sync(&server->compact_work);
 	/* wait for commit queued by request processing */
-	flush_work(&server->commit_work);
+	flush_delayed_work(&server->commit_dwork);
 	server->conn = NULL;
 
+	free_snap_pins(server);
 	destroy_pending_frees(sb);
+	scoutfs_spbm_destroy(&server->free_segnos);
 	scoutfs_manifest_destroy(sb);
 	scoutfs_btree_destroy(sb);
 
@@ -1892,14 +2317,22 @@ int scoutfs_server_setup(struct super_block *sb)
 	INIT_DELAYED_WORK(&server->dwork, scoutfs_server_worker);
 	init_rwsem(&server->commit_rwsem);
 	init_llist_head(&server->commit_waiters);
-	INIT_WORK(&server->commit_work, scoutfs_server_commit_func);
+	INIT_DELAYED_WORK(&server->commit_dwork, scoutfs_server_commit_func);
 	seqcount_init(&server->stable_seqcount);
 	spin_lock_init(&server->seq_lock);
 	INIT_LIST_HEAD(&server->pending_seqs);
 	init_rwsem(&server->alloc_rwsem);
 	INIT_LIST_HEAD(&server->pending_frees);
+	INIT_LIST_HEAD(&server->snap_pins);
+	scoutfs_spbm_init(&server->free_segnos);
 	INIT_LIST_HEAD(&server->clients);
-	server->compacts_per_client = 2;
+	/*
+	 * Clients process each compaction request in its own work and
+	 * pipeline the segment IO so they can make good use of a few
+	 * requests in flight.  The manifest only hands out compactions
+	 * with disjoint input segments so they're safe to overlap.
+	 */
+	server->compacts_per_client = 4;
 	INIT_LIST_HEAD(&server->compacts);
 	INIT_WORK(&server->compact_work, scoutfs_server_compact_worker);
 
@@ -1927,7 +2360,7 @@ void scoutfs_server_destroy(struct super_block *sb)
 		/* wait for server work to wait for everything to shut down */
 		cancel_delayed_work_sync(&server->dwork);
 		/* recv work/compaction could have left commit_work queued */
-		cancel_work_sync(&server->commit_work);
+		cancel_delayed_work_sync(&server->commit_dwork);
 
 		trace_scoutfs_server_workqueue_destroy(sb, 0, 0);
 		destroy_workqueue(server->wq);
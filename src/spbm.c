@@ -121,6 +121,51 @@ int scoutfs_spbm_test(struct scoutfs_spbm *spbm, u64 bit)
 	return 0;
 }
 
+/*
+ * Find the first set bit at or after the given bit, returning -ENOENT
+ * if there are none.  Nodes whose bits are all clear are freed so the
+ * populated rbtree acts as a summary of the bit space: the descent
+ * lands on the first candidate node and at most one partially searched
+ * node is skipped before a node that must contain a set bit.
+ */
+int scoutfs_spbm_next_set(struct scoutfs_spbm *spbm, u64 from, u64 *bit_ret)
+{
+	struct rb_node *node = spbm->root.rb_node;
+	struct spbm_node *next = NULL;
+	struct spbm_node *sn;
+	u64 index;
+	int from_nr;
+	int nr;
+
+	calc_index_nr(&index, &from_nr, from);
+
+	while (node) {
+		sn = container_of(node, struct spbm_node, node);
+
+		if (index <= sn->index) {
+			next = sn;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	while (next) {
+		nr = find_next_bit(next->bits, SPBM_BITS,
+				   next->index == index ? from_nr : 0);
+		if (nr < SPBM_BITS) {
+			*bit_ret = (next->index << SPBM_SHIFT) + nr;
+			return 0;
+		}
+
+		node = rb_next(&next->node);
+		next = node ? container_of(node, struct spbm_node, node) :
+			      NULL;
+	}
+
+	return -ENOENT;
+}
+
 static void free_node(struct scoutfs_spbm *spbm, struct spbm_node *sn)
 {
 	rb_erase(&sn->node, &spbm->root);
@@ -30,6 +30,9 @@
 #include "msg.h"
 #include "counters.h"
 #include "triggers.h"
+#include "bench.h"
+#include "flight.h"
+#include "warm.h"
 #include "trans.h"
 #include "item.h"
 #include "manifest.h"
@@ -121,7 +124,14 @@ static void scoutfs_put_super(struct super_block *sb)
 
 	sbi->shutdown = true;
 
+	/* queued deletions need transactions and the node_id lock */
+	scoutfs_inode_orphan_stop(sb);
+
+	/* the warming walk holds locks, stop it before teardown */
+	scoutfs_destroy_warm(sb);
+
 	scoutfs_data_destroy(sb);
+	scoutfs_dir_destroy(sb);
 
 	scoutfs_unlock(sb, sbi->node_id_lock, DLM_LOCK_EX);
 	sbi->node_id_lock = NULL;
@@ -134,6 +144,8 @@ static void scoutfs_put_super(struct super_block *sb)
 	scoutfs_lock_shutdown(sb);
 	scoutfs_server_destroy(sb);
 	scoutfs_net_destroy(sb);
+	scoutfs_destroy_bench(sb);
+	scoutfs_destroy_flight(sb);
 	scoutfs_seg_destroy(sb);
 	scoutfs_lock_destroy(sb);
 
@@ -317,6 +329,13 @@ static int scoutfs_fill_super(struct super_block *sb, void *data, int silent)
 
 	sbi->opts = opts;
 
+	/* snapshot mounts never write so they can't be mounted rw */
+	if (opts.snapshot && !(sb->s_flags & MS_RDONLY)) {
+		scoutfs_err(sb, "snapshot mounts require -o ro");
+		ret = -EINVAL;
+		goto out;
+	}
+
 	ret = scoutfs_setup_sysfs(sb) ?:
 	      scoutfs_setup_counters(sb) ?:
 	      scoutfs_read_super(sb, &SCOUTFS_SB(sb)->super) ?:
@@ -325,16 +344,22 @@ static int scoutfs_fill_super(struct super_block *sb, void *data, int silent)
 	      scoutfs_setup_triggers(sb) ?:
 	      scoutfs_seg_setup(sb) ?:
 	      scoutfs_item_setup(sb) ?:
+	      scoutfs_setup_bench(sb) ?:
+	      scoutfs_setup_flight(sb) ?:
 	      scoutfs_inode_setup(sb) ?:
 	      scoutfs_data_setup(sb) ?:
+	      scoutfs_dir_setup(sb) ?:
 	      scoutfs_setup_trans(sb) ?:
 	      scoutfs_lock_setup(sb) ?:
 	      scoutfs_net_setup(sb) ?:
-	      scoutfs_server_setup(sb) ?:
+	      /* snapshot mounts never become the server or write items */
+	      (opts.snapshot ? 0 : scoutfs_server_setup(sb)) ?:
 	      scoutfs_client_setup(sb) ?:
 	      scoutfs_client_wait_node_id(sb) ?:
-	      scoutfs_lock_node_id(sb, DLM_LOCK_EX, 0, sbi->node_id,
-				   &sbi->node_id_lock);
+	      (opts.snapshot ? 0 :
+	       scoutfs_lock_node_id(sb, DLM_LOCK_EX, 0, sbi->node_id,
+				    &sbi->node_id_lock)) ?:
+	      scoutfs_setup_warm(sb);
 	if (ret)
 		goto out;
 
@@ -350,9 +375,11 @@ static int scoutfs_fill_super(struct super_block *sb, void *data, int silent)
 		goto out;
 	}
 
-	ret = scoutfs_client_advance_seq(sb, &sbi->trans_seq);
-	if (ret)
-		goto out;
+	if (!opts.snapshot) {
+		ret = scoutfs_client_advance_seq(sb, &sbi->trans_seq);
+		if (ret)
+			goto out;
+	}
 
 	scoutfs_trans_restart_sync_deadline(sb);
 //	scoutfs_scan_orphans(sb);
@@ -394,6 +421,7 @@ MODULE_ALIAS_FS("scoutfs");
 static void teardown_module(void)
 {
 	debugfs_remove(scoutfs_debugfs_root);
+	scoutfs_item_exit();
 	scoutfs_dir_exit();
 	scoutfs_inode_exit();
 	scoutfs_sysfs_exit();
@@ -425,6 +453,7 @@ static int __init scoutfs_module_init(void)
 	}
 	ret = scoutfs_inode_init() ?:
 	      scoutfs_dir_init() ?:
+	      scoutfs_item_init() ?:
 	      register_filesystem(&scoutfs_fs_type);
 out:
 	if (ret)
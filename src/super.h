@@ -9,11 +9,14 @@
 
 struct scoutfs_counters;
 struct scoutfs_triggers;
+struct bench_info;
+struct flight_info;
 struct item_cache;
 struct manifest;
 struct segment_cache;
 struct compact_info;
 struct data_info;
+struct dir_info;
 struct trans_info;
 struct lock_info;
 struct client_info;
@@ -23,6 +26,7 @@ struct btree_info;
 struct sysfs_info;
 struct options_sb_info;
 struct net_info;
+struct warm_info;
 
 struct scoutfs_sb_info {
 	struct super_block *sb;
@@ -41,6 +45,7 @@ struct scoutfs_sb_info {
 	struct seg_alloc *seg_alloc;
 	struct compact_info *compact_info;
 	struct data_info *data_info;
+	struct dir_info *dir_info;
 	struct inode_sb_info *inode_sb_info;
 	struct btree_info *btree_info;
 	struct net_info *net_info;
@@ -65,6 +70,9 @@ struct scoutfs_sb_info {
 
 	struct scoutfs_counters *counters;
 	struct scoutfs_triggers *triggers;
+	struct bench_info *bench_info;
+	struct flight_info *flight_info;
+	struct warm_info *warm_info;
 
 	struct mount_options opts;
 	struct options_sb_info *options;
@@ -15,6 +15,8 @@
 #include <linux/fs.h>
 
 #include "super.h"
+#include "item.h"
+#include "client.h"
 #include "sysfs.h"
 
 static struct kset *scoutfs_kset;
@@ -47,6 +49,47 @@ static ssize_t fsid_show(struct kobject *kobj, struct attribute *attr,
 }
 ATTR_FUNCS_RO(fsid);
 
+/*
+ * Segments over their level compaction targets, as of our last commit
+ * response from the server.  Job schedulers can watch this to steer
+ * ingest load away from the mount before writers start throttling.
+ */
+static ssize_t compact_debt_show(struct kobject *kobj, struct attribute *attr,
+				 char *buf)
+{
+	struct super_block *sb = KOBJ_TO_SB(kobj, sb_id_kobj);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			scoutfs_client_compact_debt(sb));
+}
+ATTR_FUNCS_RO(compact_debt);
+
+static ssize_t item_cache_probation_show(struct kobject *kobj,
+					 struct attribute *attr, char *buf)
+{
+	struct super_block *sb = KOBJ_TO_SB(kobj, sb_id_kobj);
+	unsigned long probation;
+	unsigned long protected;
+
+	scoutfs_item_lru_counts(sb, &probation, &protected);
+
+	return snprintf(buf, PAGE_SIZE, "%lu\n", probation);
+}
+ATTR_FUNCS_RO(item_cache_probation);
+
+static ssize_t item_cache_protected_show(struct kobject *kobj,
+					 struct attribute *attr, char *buf)
+{
+	struct super_block *sb = KOBJ_TO_SB(kobj, sb_id_kobj);
+	unsigned long probation;
+	unsigned long protected;
+
+	scoutfs_item_lru_counts(sb, &probation, &protected);
+
+	return snprintf(buf, PAGE_SIZE, "%lu\n", protected);
+}
+ATTR_FUNCS_RO(item_cache_protected);
+
 /*
  * ops are defined per type, not per attribute.  To have attributes with
  * different types that want different funcs we wrap them with a struct
@@ -82,6 +125,9 @@ static ssize_t attr_funcs_show(struct kobject *kobj, struct attribute *attr,
 
 static struct attribute *sb_id_attrs[] = {
 	&fsid_attr_funcs.attr,
+	&compact_debt_attr_funcs.attr,
+	&item_cache_probation_attr_funcs.attr,
+	&item_cache_protected_attr_funcs.attr,
 	NULL,
 };
 KTYPE(sb_id);
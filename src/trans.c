@@ -17,6 +17,7 @@
 #include <linux/atomic.h>
 #include <linux/writeback.h>
 #include <linux/slab.h>
+#include <linux/delay.h>
 
 #include "super.h"
 #include "trans.h"
@@ -54,6 +55,9 @@
 /* sync dirty data at least this often */
 #define TRANS_SYNC_DELAY (HZ * 10)
 
+/* throttled holders sleep at most this long per hold */
+#define TRANS_THROTTLE_MAX_MS 50
+
 /*
  * XXX move the rest of the super trans_ fields here.
  */
@@ -61,6 +65,7 @@ struct trans_info {
 	spinlock_t lock;
 	unsigned reserved_items;
 	unsigned reserved_vals;
+	/* tasks with reservations, nested holds stay in the task's rsv */
 	unsigned holders;
 	bool writing;
 };
@@ -111,15 +116,39 @@ void scoutfs_trans_write_func(struct work_struct *work)
 	struct super_block *sb = sbi->sb;
 	DECLARE_TRANS_INFO(sb, tri);
 	struct scoutfs_bio_completion comp;
+	struct scoutfs_segment *segs[SCOUTFS_COMMIT_SEGMENT_MAX_NR];
 	struct scoutfs_segment *seg = NULL;
+	unsigned int nr_segs = 0;
+	bool more;
 	u64 segno;
 	int ret = 0;
+	int i;
 
 	scoutfs_bio_init_comp(&comp);
 	sbi->trans_task = current;
 
+	/*
+	 * Overlap the expensive commit prep with the writers that we're
+	 * about to drain.  Submitting writeback of the data pages that
+	 * are dirty so far, the segno allocation round trip to the
+	 * server, and allocating the segment's pages don't depend on
+	 * the final dirty item set.  A second writeback pass after the
+	 * holders drain submits the pages they dirtied in the mean
+	 * time.
+	 */
+	if (scoutfs_item_has_dirty(sb)) {
+		ret = scoutfs_inode_walk_writeback(sb, true) ?:
+		      scoutfs_client_alloc_segno(sb, &segno) ?:
+		      scoutfs_seg_alloc(sb, segno, &seg);
+		if (ret)
+			goto out;
+	}
+
 	wait_event(sbi->trans_hold_wq, drained_holders(tri));
 
+	/* no writers left to borrow the pinned index locks */
+	scoutfs_inode_index_unlock_pinned(sb);
+
 	trace_scoutfs_trans_write_func(sb, scoutfs_item_has_dirty(sb));
 
 
@@ -131,23 +160,54 @@ void scoutfs_trans_write_func(struct work_struct *work)
 		 * about leaking segnos nor duplicate manifest entries
 		 * on crashes between us and the server.
 		 */
-		ret = scoutfs_inode_walk_writeback(sb, true) ?:
-		      scoutfs_client_alloc_segno(sb, &segno) ?:
-		      scoutfs_seg_alloc(sb, segno, &seg) ?:
-		      scoutfs_item_dirty_seg(sb, seg) ?:
-		      scoutfs_seg_submit_write(sb, seg, &comp) ?:
+		ret = scoutfs_inode_walk_writeback(sb, true);
+
+		/*
+		 * The dirty items can fill multiple segments.  Each
+		 * segment's write is submitted as it's filled so it
+		 * streams to the device while we fill the next.  The
+		 * trans reservation limited dirty to what fits in a
+		 * commit's worth of segments.
+		 */
+		more = true;
+		while (ret == 0 && more) {
+			BUG_ON(nr_segs == ARRAY_SIZE(segs));
+
+			if (!seg)
+				ret = scoutfs_client_alloc_segno(sb, &segno) ?:
+				      scoutfs_seg_alloc(sb, segno, &seg);
+			if (ret == 0)
+				ret = scoutfs_item_dirty_seg(sb, seg);
+			if (ret >= 0) {
+				more = ret > 0;
+				ret = scoutfs_seg_submit_write(sb, seg,
+							       &comp);
+			}
+			if (ret == 0) {
+				segs[nr_segs++] = seg;
+				seg = NULL;
+			}
+		}
+
+		ret = ret ?:
 		      scoutfs_inode_walk_writeback(sb, false) ?:
 		      scoutfs_bio_wait_comp(sb, &comp) ?:
-		      scoutfs_client_record_segment(sb, seg, 0) ?:
-		      scoutfs_client_advance_seq(sb, &sbi->trans_seq);
-		scoutfs_seg_put(seg);
+		      scoutfs_client_commit_segments(sb, segs, nr_segs,
+						     &sbi->trans_seq);
+
+		for (i = 0; i < nr_segs; i++) {
+			if (ret == 0) {
+				scoutfs_inc_counter(sb,
+						    trans_level0_seg_writes);
+				scoutfs_add_counter(sb,
+					trans_level0_seg_write_bytes,
+					scoutfs_seg_total_bytes(segs[i]));
+			}
+			scoutfs_seg_put(segs[i]);
+		}
 		if (ret)
 			goto out;
 
-		scoutfs_inc_counter(sb, trans_level0_seg_writes);
-		scoutfs_add_counter(sb, trans_level0_seg_write_bytes,
-				    scoutfs_seg_total_bytes(seg));
-
 	} else if (sbi->trans_deadline_expired) {
 		/*
 		 * If we're not writing data then we only advance the
@@ -160,6 +220,9 @@ void scoutfs_trans_write_func(struct work_struct *work)
 	}
 
 out:
+	/* a prepped seg isn't consumed if the dirty items went away */
+	scoutfs_seg_put(seg);
+
 	/* XXX this all needs serious work for dealing with errors */
 	WARN_ON_ONCE(ret);
 
@@ -305,10 +368,6 @@ static bool acquired_hold(struct super_block *sb,
 					  tri->reserved_items,
 					  tri->reserved_vals);
 
-	/* use a caller's existing reservation */
-	if (rsv->holders)
-		goto hold;
-
 	/* wait until the writing thread is finished */
 	if (tri->writing)
 		goto out;
@@ -316,7 +375,7 @@ static bool acquired_hold(struct super_block *sb,
 	/* see if we can reserve space for our item count */
 	items = tri->reserved_items + cnt->items;
 	vals = tri->reserved_vals + cnt->vals;
-	fits = scoutfs_item_dirty_fits_single(sb, items, vals);
+	fits = scoutfs_item_dirty_fits(sb, items, vals);
 	if (!fits) {
 		scoutfs_inc_counter(sb, trans_commit_full);
 		queue_trans_work(sbi);
@@ -329,8 +388,7 @@ static bool acquired_hold(struct super_block *sb,
 	rsv->reserved.items = cnt->items;
 	rsv->reserved.vals = cnt->vals;
 
-hold:
-	rsv->holders++;
+	rsv->holders = 1;
 	tri->holders++;
 	acquired = true;
 
@@ -346,6 +404,8 @@ int scoutfs_hold_trans(struct super_block *sb,
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_reservation *rsv;
+	ktime_t start;
+	u64 debt;
 	int ret;
 
 	/*
@@ -371,8 +431,36 @@ int scoutfs_hold_trans(struct super_block *sb,
 
 	BUG_ON(rsv->magic != SCOUTFS_RESERVATION_MAGIC);
 
+	/*
+	 * Nested holds ride on the task's existing reservation.  The
+	 * trans can't be drained while the task already holds it so
+	 * there's no shared hold state or waiters to update; the count
+	 * stays in the task's cpu cache.
+	 */
+	if (rsv->holders > 0) {
+		rsv->holders++;
+		scoutfs_inc_counter(sb, trans_hold_nested);
+		return 0;
+	}
+
+	/*
+	 * Ease off as compaction falls behind.  Each hold sleeps a
+	 * little longer as the server reports more segments over their
+	 * level targets, slowing ingest smoothly instead of having
+	 * commits slam into the server's wait for level 0 to drain.
+	 * Nested holders above don't sleep, they're already accounted
+	 * for in the transaction.
+	 */
+	debt = scoutfs_client_compact_debt(sb);
+	if (debt > 0) {
+		scoutfs_inc_counter(sb, trans_hold_throttle);
+		msleep(min_t(u64, debt, TRANS_THROTTLE_MAX_MS));
+	}
+
+	start = ktime_get();
 	ret = wait_event_interruptible(sbi->trans_hold_wq,
 				       acquired_hold(sb, rsv, &cnt));
+	scoutfs_latency_since(sb, trans_hold, start);
 	if (ret && rsv->holders == 0) {
 		current->journal_info = NULL;
 		kfree(rsv);
@@ -425,23 +513,30 @@ void scoutfs_trans_track_item(struct super_block *sb, signed items,
 }
 
 /*
- * As we drop the last hold in the reservation we try and wake other
- * hold attempts that were waiting for space.  As we drop the last trans
- * holder we try to wake a writing thread that was waiting for us to
- * finish.
+ * Nested releases only drop the hold count in the task's private
+ * reservation.  Dropping the last hold releases the reservation's space
+ * and wakes hold attempts that were waiting for space or a writing
+ * thread that was waiting for holders to drain, but only if someone is
+ * actually waiting so that uncontended releases don't touch the shared
+ * waitqueue cacheline.
  */
 void scoutfs_release_trans(struct super_block *sb)
 {
 	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
 	struct scoutfs_reservation *rsv;
 	DECLARE_TRANS_INFO(sb, tri);
-	bool wake = false;
+	bool drained;
+	u32 pct;
 
 	if (current == sbi->trans_task)
 		return;
 
 	rsv = current->journal_info;
 	BUG_ON(!rsv || rsv->magic != SCOUTFS_RESERVATION_MAGIC);
+	BUG_ON(rsv->holders <= 0);
+
+	if (--rsv->holders > 0)
+		return;
 
 	spin_lock(&tri->lock);
 
@@ -449,23 +544,38 @@ void scoutfs_release_trans(struct super_block *sb)
 				    &rsv->actual, tri->holders, tri->writing,
 				    tri->reserved_items, tri->reserved_vals);
 
-	BUG_ON(rsv->holders <= 0);
 	BUG_ON(tri->holders <= 0);
 
-	if (--rsv->holders == 0) {
-		tri->reserved_items -= rsv->reserved.items;
-		tri->reserved_vals -= rsv->reserved.vals;
-		current->journal_info = NULL;
-		kfree(rsv);
-		wake = true;
-	}
-
-	if (--tri->holders == 0)
-		wake = true;
+	tri->reserved_items -= rsv->reserved.items;
+	tri->reserved_vals -= rsv->reserved.vals;
+	tri->holders--;
+	drained = tri->holders == 0 && !tri->writing;
+	current->journal_info = NULL;
 
 	spin_unlock(&tri->lock);
 
-	if (wake)
+	kfree(rsv);
+
+	/*
+	 * Commit once the dirty items approach the capacity of a
+	 * commit's segments rather than waiting for the deadline or for
+	 * a hold to hit the reservation wall.  This writes steadily
+	 * full level 0 segments which compact more efficiently.  We
+	 * only check as the last holder leaves so the write can start
+	 * immediately and the check stays off the nested fast path.
+	 */
+	if (drained) {
+		pct = scoutfs_option_u32(sb, Opt_trans_commit_fill_pct);
+		if (pct > 0 && pct < 100 &&
+		    scoutfs_item_dirty_over_pct(sb, pct)) {
+			scoutfs_inc_counter(sb, trans_commit_fill);
+			queue_trans_work(sbi);
+		}
+	}
+
+	/* wait_event waiters are on the queue before testing conditions */
+	smp_mb();
+	if (waitqueue_active(&sbi->trans_hold_wq))
 		wake_up(&sbi->trans_hold_wq);
 }
 
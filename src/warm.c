@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2019 Versity Software, Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/dlm.h>
+
+#include "super.h"
+#include "format.h"
+#include "key.h"
+#include "counters.h"
+#include "item.h"
+#include "lock.h"
+#include "manifest.h"
+#include "inode.h"
+#include "msg.h"
+#include "warm.h"
+
+/*
+ * The first queries after a mount crawl as every item miss reads cold
+ * segments.  The warm_inos and warm_index mount options declare the
+ * steady-state working set, inode number ranges and inode index zones,
+ * and a background worker reads their items into the item cache right
+ * after the mount comes up so applications start against a warm cache.
+ *
+ * The worker walks the declared ranges with next calls under read
+ * locks.  Each miss populates the cache from the manifest which keeps
+ * several segment reads in flight with its readahead.  Warming is
+ * purely advisory: errors or unmount just end the walk.
+ */
+
+struct warm_info {
+	struct super_block *sb;
+	struct workqueue_struct *workq;
+	struct work_struct work;
+	bool stop;
+};
+
+/*
+ * Read all the fs zone items for a range of inode numbers: the inodes
+ * themselves and their entries, xattrs, and symlink targets.  Inode
+ * locks cover groups of inode numbers so we walk a locked group at a
+ * time.
+ */
+static int warm_ino_range(struct warm_info *warminf, u64 ino, u64 last_ino)
+{
+	struct super_block *sb = warminf->sb;
+	struct scoutfs_lock *lock;
+	struct scoutfs_key last_key;
+	struct scoutfs_key key;
+	u64 next_ino;
+	int ret = 0;
+
+	while (ino <= last_ino && !warminf->stop) {
+		ret = scoutfs_lock_ino(sb, DLM_LOCK_PR, 0, ino, &lock);
+		if (ret)
+			break;
+
+		key = lock->start;
+		last_key = lock->end;
+		next_ino = le64_to_cpu(lock->end.ski_ino) + 1;
+
+		while (!warminf->stop) {
+			ret = scoutfs_item_next(sb, &key, &last_key, NULL,
+						lock);
+			if (ret < 0) {
+				if (ret == -ENOENT)
+					ret = 0;
+				break;
+			}
+
+			scoutfs_inc_counter(sb, warm_read_item);
+			scoutfs_key_inc(&key);
+		}
+
+		scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+
+		if (ret < 0 || next_ino == 0)
+			break;
+		ino = next_ino;
+	}
+
+	return ret;
+}
+
+/*
+ * Read all the items in an inode index zone.  Index majors are sparse
+ * sequence numbers so instead of iterating over every possible locked
+ * region we hop over unlocked empty space to the next key in the
+ * manifest, just like the inode walk ioctls.
+ */
+static int warm_index(struct warm_info *warminf, u8 type)
+{
+	struct super_block *sb = warminf->sb;
+	struct scoutfs_key next_key;
+	struct scoutfs_key last_key;
+	struct scoutfs_key key;
+	struct scoutfs_lock *lock;
+	int ret;
+
+	scoutfs_inode_init_index_key(&key, type, 0, 0, 0);
+	scoutfs_inode_init_index_key(&last_key, type, ~0ULL, ~0U, ~0ULL);
+
+	ret = scoutfs_lock_inode_index(sb, DLM_LOCK_PR, type, 0, 0, &lock);
+	if (ret)
+		goto out;
+
+	while (!warminf->stop) {
+		ret = scoutfs_item_next(sb, &key, &last_key, NULL, lock);
+		if (ret < 0 && ret != -ENOENT)
+			break;
+
+		if (ret == -ENOENT) {
+			/* done if the lock covers the last key */
+			if (scoutfs_key_compare(&last_key, &lock->end) <= 0) {
+				ret = 0;
+				break;
+			}
+
+			/* continue after the locked empty region */
+			key = lock->end;
+			scoutfs_key_inc(&key);
+
+			scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+			lock = NULL;
+
+			ret = scoutfs_manifest_next_key(sb, &key, &next_key);
+			if (ret < 0) {
+				if (ret == -ENOENT)
+					ret = 0;
+				goto out;
+			}
+
+			if (scoutfs_key_compare(&next_key, &last_key) > 0) {
+				ret = 0;
+				goto out;
+			}
+
+			key = next_key;
+
+			ret = scoutfs_lock_inode_index(sb, DLM_LOCK_PR,
+						key.sk_type,
+						le64_to_cpu(key.skii_major),
+						le64_to_cpu(key.skii_ino),
+						&lock);
+			if (ret)
+				goto out;
+			continue;
+		}
+
+		scoutfs_inc_counter(sb, warm_read_item);
+		scoutfs_key_inc(&key);
+	}
+
+	scoutfs_unlock(sb, lock, DLM_LOCK_PR);
+out:
+	return ret;
+}
+
+static void scoutfs_warm_worker(struct work_struct *work)
+{
+	struct warm_info *warminf = container_of(work, struct warm_info, work);
+	struct super_block *sb = warminf->sb;
+	struct mount_options *opts = &SCOUTFS_SB(sb)->opts;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < opts->nr_warm_inos && ret == 0; i++)
+		ret = warm_ino_range(warminf, opts->warm_inos[i].start,
+				     opts->warm_inos[i].end);
+
+	if (ret == 0 && opts->warm_meta_seq)
+		ret = warm_index(warminf, SCOUTFS_INODE_INDEX_META_SEQ_TYPE);
+	if (ret == 0 && opts->warm_data_seq)
+		ret = warm_index(warminf, SCOUTFS_INODE_INDEX_DATA_SEQ_TYPE);
+
+	if (ret < 0)
+		scoutfs_info(sb, "cache warming stopped, error %d", ret);
+}
+
+/*
+ * Start warming once the mount is far enough along that locking and
+ * reads work.  Mounts without warming options don't pay for anything.
+ */
+int scoutfs_setup_warm(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct mount_options *opts = &sbi->opts;
+	struct warm_info *warminf;
+
+	if (opts->nr_warm_inos == 0 && !opts->warm_meta_seq &&
+	    !opts->warm_data_seq)
+		return 0;
+
+	warminf = kzalloc(sizeof(struct warm_info), GFP_KERNEL);
+	if (!warminf)
+		return -ENOMEM;
+
+	warminf->sb = sb;
+	INIT_WORK(&warminf->work, scoutfs_warm_worker);
+	warminf->workq = alloc_workqueue("scoutfs_warm", WQ_UNBOUND, 1);
+	if (!warminf->workq) {
+		kfree(warminf);
+		return -ENOMEM;
+	}
+
+	sbi->warm_info = warminf;
+	queue_work(warminf->workq, &warminf->work);
+
+	return 0;
+}
+
+void scoutfs_destroy_warm(struct super_block *sb)
+{
+	struct scoutfs_sb_info *sbi = SCOUTFS_SB(sb);
+	struct warm_info *warminf = sbi->warm_info;
+
+	if (warminf) {
+		warminf->stop = true;
+		destroy_workqueue(warminf->workq);
+		kfree(warminf);
+		sbi->warm_info = NULL;
+	}
+}
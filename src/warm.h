@@ -0,0 +1,7 @@
+#ifndef _SCOUTFS_WARM_H_
+#define _SCOUTFS_WARM_H_
+
+int scoutfs_setup_warm(struct super_block *sb);
+void scoutfs_destroy_warm(struct super_block *sb);
+
+#endif
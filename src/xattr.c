@@ -28,10 +28,13 @@
 #include "scoutfs_trace.h"
 
 /*
- * Extended attributes are packed into multiple smaller file system
- * items.  The common case only uses one item.
+ * All of an inode's small xattrs are packed into the value of a single
+ * item so that getting or listing them only has to look up one item.
+ * xattrs that don't fit in the packed item alongside the inode's other
+ * small xattrs fall back to being stored in multiple smaller file
+ * system items.
  *
- * The xattr keys contain the hash of the xattr name and a unique
+ * The part item keys contain the hash of the xattr name and a unique
  * identifier used to differentiate xattrs whose names hash to the same
  * value.  xattr lookup has to walk all the xattrs with the matching
  * name hash to compare the names.
@@ -81,6 +84,119 @@ static void init_xattr_key(struct scoutfs_key *key, u64 ino, u32 name_hash,
 	};
 }
 
+static void init_packed_key(struct scoutfs_key *key, u64 ino)
+{
+	*key = (struct scoutfs_key) {
+		.sk_zone = SCOUTFS_FS_ZONE,
+		.skx_ino = cpu_to_le64(ino),
+		.sk_type = SCOUTFS_XATTR_PACKED_TYPE,
+	};
+}
+
+/* walk the concatenated xattr entries in a packed item's value */
+#define for_each_packed_xattr(pxs, xat, i)				\
+	for (i = 0, xat = (void *)(pxs)->entries;			\
+	     i < (pxs)->nr;						\
+	     i++, xat = (void *)xat + xattr_full_bytes(xat))
+
+static bool packed_entry_ok(struct scoutfs_packed_xattrs *pxs, int bytes,
+			    struct scoutfs_xattr *xat)
+{
+	void *end = (void *)pxs + bytes;
+
+	return (void *)xat + sizeof(struct scoutfs_xattr) <= end &&
+	       xat->name_len > 0 &&
+	       (void *)xat + xattr_full_bytes(xat) <= end;
+}
+
+/*
+ * Copy the inode's packed xattr item value into the caller's buffer,
+ * which must have room for the largest possible item value.  Returns
+ * the value bytes copied, 0 with an empty header if the inode doesn't
+ * have a packed item, or -errno.
+ */
+static int read_packed_xattrs(struct inode *inode,
+			      struct scoutfs_packed_xattrs *pxs,
+			      struct scoutfs_lock *lock)
+{
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_key key;
+	int ret;
+
+	init_packed_key(&key, scoutfs_ino(inode));
+
+	ret = scoutfs_item_lookup_buf(sb, &key, pxs, SCOUTFS_MAX_VAL_SIZE,
+				      lock);
+	if (ret == -ENOENT) {
+		pxs->nr = 0;
+		ret = 0;
+	} else if (ret >= 0 && ret < sizeof(struct scoutfs_packed_xattrs)) {
+		/* XXX corruption, item smaller than its header */
+		ret = -EIO;
+	}
+
+	return ret;
+}
+
+/*
+ * Find the packed entry with the given name.  Returns NULL if it's not
+ * packed and -EIO if an entry falls outside of the item bytes.
+ */
+static struct scoutfs_xattr *find_packed_xattr(struct scoutfs_packed_xattrs *pxs,
+					       int bytes, const char *name,
+					       unsigned int name_len)
+{
+	struct scoutfs_xattr *xat;
+	int i;
+
+	for_each_packed_xattr(pxs, xat, i) {
+		/* XXX corruption */
+		if (!packed_entry_ok(pxs, bytes, xat))
+			return ERR_PTR(-EIO);
+
+		if (xattr_names_equal(name, name_len, xat->name,
+				      xat->name_len))
+			return xat;
+	}
+
+	return NULL;
+}
+
+/*
+ * Store the caller's modified packed item value.  The caller dirtied
+ * the existing item before modifying other items when the value only
+ * shrinks so that storing it here can't fail after the point of no
+ * return; only growing or creating the packed item can fail and the
+ * caller does that before modifying anything else it can't restore.
+ */
+static int write_packed_xattrs(struct inode *inode,
+			       struct scoutfs_packed_xattrs *pxs, int bytes,
+			       bool existed, bool dirtied,
+			       struct scoutfs_lock *lock)
+{
+	struct super_block *sb = inode->i_sb;
+	struct scoutfs_key key;
+	struct kvec val;
+
+	init_packed_key(&key, scoutfs_ino(inode));
+
+	if (pxs->nr == 0) {
+		if (existed)
+			scoutfs_item_delete_dirty(sb, &key);
+		return 0;
+	}
+
+	kvec_init(&val, pxs, bytes);
+
+	if (!existed)
+		return scoutfs_item_create_buf(sb, &key, pxs, bytes, lock);
+	if (!dirtied)
+		return scoutfs_item_update_buf(sb, &key, pxs, bytes, lock);
+
+	scoutfs_item_update_dirty(sb, &key, &val);
+	return 0;
+}
+
 static int unknown_prefix(const char *name)
 {
 	return strncmp(name, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN) &&
@@ -212,7 +328,6 @@ static int create_xattr_items(struct inode *inode, u64 id,
 	struct super_block *sb = inode->i_sb;
 	struct scoutfs_key key;
 	unsigned int part_bytes;
-	struct kvec val;
 	int total;
 	int ret;
 
@@ -223,9 +338,9 @@ static int create_xattr_items(struct inode *inode, u64 id,
 	ret = 0;
 	while (total < bytes) {
 		part_bytes = min(bytes - total, SCOUTFS_XATTR_MAX_PART_SIZE);
-		kvec_init(&val, (void *)xat + total, part_bytes);
 
-		ret = scoutfs_item_create(sb, &key, &val, lock);
+		ret = scoutfs_item_create_buf(sb, &key, (void *)xat + total,
+					      part_bytes, lock);
 		if (ret) {
 			while (key.skx_part-- > 0)
 				scoutfs_item_delete_dirty(sb, &key);
@@ -271,8 +386,10 @@ ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 	struct inode *inode = dentry->d_inode;
 	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
+	struct scoutfs_packed_xattrs *pxs = NULL;
 	struct scoutfs_xattr *xat = NULL;
 	struct scoutfs_lock *lck = NULL;
+	struct scoutfs_xattr *pxat;
 	struct scoutfs_key key;
 	unsigned int bytes;
 	size_t name_len;
@@ -288,8 +405,11 @@ ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 	/* only need enough for caller's name and value sizes */
 	bytes = sizeof(struct scoutfs_xattr) + name_len + size;
 	xat = kmalloc(bytes, GFP_NOFS);
-	if (!xat)
-		return -ENOMEM;
+	pxs = kmalloc(SCOUTFS_MAX_VAL_SIZE, GFP_NOFS);
+	if (!xat || !pxs) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	ret = scoutfs_lock_inode(sb, DLM_LOCK_PR, 0, inode, &lck);
 	if (ret)
@@ -297,8 +417,24 @@ ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 
 	down_read(&si->xattr_rwsem);
 
-	ret = get_next_xattr(inode, &key, xat, bytes,
-			     name, name_len, 0, 0, lck);
+	/* small xattrs are found in the single packed item */
+	ret = read_packed_xattrs(inode, pxs, lck);
+	if (ret > 0) {
+		pxat = find_packed_xattr(pxs, ret, name, name_len);
+		if (IS_ERR(pxat))
+			ret = PTR_ERR(pxat);
+		else if (pxat)
+			ret = min_t(int, xattr_full_bytes(pxat), bytes);
+		else
+			ret = 0;
+		if (ret > 0)
+			memcpy(xat, pxat, ret);
+	}
+
+	/* fall back to walking the multi-item xattrs */
+	if (ret == 0)
+		ret = get_next_xattr(inode, &key, xat, bytes,
+				     name, name_len, 0, 0, lck);
 
 	up_read(&si->xattr_rwsem);
 	scoutfs_unlock(sb, lck, DLM_LOCK_PR);
@@ -331,6 +467,7 @@ ssize_t scoutfs_getxattr(struct dentry *dentry, const char *name, void *buffer,
 	memcpy(buffer, &xat->name[xat->name_len], ret);
 out:
 	kfree(xat);
+	kfree(pxs);
 	return ret;
 }
 
@@ -351,14 +488,22 @@ static int scoutfs_xattr_set(struct dentry *dentry, const char *name,
 	struct inode *inode = dentry->d_inode;
 	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
+	struct scoutfs_packed_xattrs *pxs = NULL;
 	struct scoutfs_xattr *xat = NULL;
 	struct scoutfs_lock *lck = NULL;
 	size_t name_len = strlen(name);
+	struct scoutfs_xattr *pxat;
+	struct scoutfs_key pkey;
 	struct scoutfs_key key;
 	LIST_HEAD(ind_locks);
 	LIST_HEAD(saved);
+	bool packed_existed;
+	bool old_packed;
+	bool new_packed;
 	u8 found_parts;
 	unsigned int bytes;
+	int pxs_bytes;
+	size_t tail;
 	u64 ind_seq;
 	u64 id;
 	int ret;
@@ -380,7 +525,8 @@ static int scoutfs_xattr_set(struct dentry *dentry, const char *name,
 
 	bytes = sizeof(struct scoutfs_xattr) + name_len + size;
 	xat = kmalloc(bytes, GFP_NOFS);
-	if (!xat) {
+	pxs = kmalloc(SCOUTFS_MAX_VAL_SIZE, GFP_NOFS);
+	if (!xat || !pxs) {
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -392,33 +538,73 @@ static int scoutfs_xattr_set(struct dentry *dentry, const char *name,
 
 	down_write(&si->xattr_rwsem);
 
-	/* find an existing xattr to delete */
-	ret = get_next_xattr(inode, &key, xat,
-			     sizeof(struct scoutfs_xattr) + name_len,
-			     name, name_len, 0, 0, lck);
-	if (ret < 0 && ret != -ENOENT)
+	/* find an existing packed entry to replace */
+	ret = read_packed_xattrs(inode, pxs, lck);
+	if (ret < 0)
 		goto unlock;
+	packed_existed = ret > 0;
+	pxs_bytes = ret ?: sizeof(struct scoutfs_packed_xattrs);
+
+	pxat = find_packed_xattr(pxs, pxs_bytes, name, name_len);
+	if (IS_ERR(pxat)) {
+		ret = PTR_ERR(pxat);
+		goto unlock;
+	}
+	old_packed = pxat != NULL;
+
+	/* find an existing multi-item xattr to delete */
+	found_parts = 0;
+	if (!old_packed) {
+		ret = get_next_xattr(inode, &key, xat,
+				     sizeof(struct scoutfs_xattr) + name_len,
+				     name, name_len, 0, 0, lck);
+		if (ret < 0 && ret != -ENOENT)
+			goto unlock;
+		if (ret >= 0)
+			found_parts = xattr_nr_parts(xat);
+	}
 
 	/* check existence constraint flags */
-	if (ret == -ENOENT && (flags & XATTR_REPLACE)) {
+	if (!old_packed && !found_parts && (flags & XATTR_REPLACE)) {
 		ret = -ENODATA;
 		goto unlock;
-	} else if (ret >= 0 && (flags & XATTR_CREATE)) {
+	} else if ((old_packed || found_parts) && (flags & XATTR_CREATE)) {
 		ret = -EEXIST;
 		goto unlock;
 	}
 
 	/* not an error to delete something that doesn't exist */
-	if (ret == -ENOENT && !value) {
+	if (!old_packed && !found_parts && !value) {
 		ret = 0;
 		goto unlock;
 	}
 
-	/* found fields in key will also be used */
-	found_parts = ret >= 0 ? xattr_nr_parts(xat) : 0;
+	/* small xattrs go in the packed item if they fit alongside the rest */
+	new_packed = value &&
+		     (pxs_bytes - (old_packed ? xattr_full_bytes(pxat) : 0) +
+		      sizeof(struct scoutfs_xattr) + name_len + size) <=
+		     SCOUTFS_MAX_VAL_SIZE;
+
+	/* modify the packed value in our buffer before storing it */
+	if (old_packed) {
+		tail = pxs_bytes - ((void *)pxat - (void *)pxs) -
+		       xattr_full_bytes(pxat);
+		pxs_bytes -= xattr_full_bytes(pxat);
+		memmove(pxat, (void *)pxat + xattr_full_bytes(pxat), tail);
+		pxs->nr--;
+	}
+	if (new_packed) {
+		pxat = (void *)pxs + pxs_bytes;
+		pxat->name_len = name_len;
+		pxat->val_len = cpu_to_le16(size);
+		memcpy(pxat->name, name, name_len);
+		memcpy(&pxat->name[name_len], value, size);
+		pxs_bytes += xattr_full_bytes(pxat);
+		pxs->nr++;
+	}
 
-	/* prepare our xattr */
-	if (value) {
+	/* prepare our multi-item xattr */
+	if (value && !new_packed) {
 		id = si->next_xattr_id++;
 		xat->name_len = name_len;
 		xat->val_len = cpu_to_le16(size);
@@ -442,13 +628,30 @@ retry:
 	if (ret < 0)
 		goto release;
 
+	/*
+	 * Pin the packed item dirty when its value will only shrink so
+	 * that storing it after the restorable multi-item changes can't
+	 * fail.  Growing or creating it can fail and is done before the
+	 * multi-item changes are committed.
+	 */
+	if (old_packed && !new_packed) {
+		init_packed_key(&pkey, scoutfs_ino(inode));
+		ret = scoutfs_item_dirty(sb, &pkey, lck);
+		if (ret < 0)
+			goto release;
+	}
+
 	ret = 0;
 	if (found_parts)
 		ret = delete_xattr_items(inode, le64_to_cpu(key.skx_name_hash),
 					 le64_to_cpu(key.skx_id), found_parts,
 					 &saved, lck);
-	if (value && ret == 0)
+	if (value && !new_packed && ret == 0)
 		ret = create_xattr_items(inode, id, xat, bytes, lck);
+	if ((old_packed || new_packed) && ret == 0)
+		ret = write_packed_xattrs(inode, pxs, pxs_bytes,
+					  packed_existed,
+					  old_packed && !new_packed, lck);
 	if (ret < 0) {
 		scoutfs_item_restore(sb, &saved, lck);
 		goto release;
@@ -469,6 +672,7 @@ unlock:
 	scoutfs_unlock(sb, lck, DLM_LOCK_EX);
 out:
 	kfree(xat);
+	kfree(pxs);
 
 	return ret;
 }
@@ -492,19 +696,24 @@ ssize_t scoutfs_listxattr(struct dentry *dentry, char *buffer, size_t size)
 	struct inode *inode = dentry->d_inode;
 	struct scoutfs_inode_info *si = SCOUTFS_I(inode);
 	struct super_block *sb = inode->i_sb;
+	struct scoutfs_packed_xattrs *pxs = NULL;
 	struct scoutfs_xattr *xat = NULL;
 	struct scoutfs_lock *lck = NULL;
+	struct scoutfs_xattr *pxat;
 	struct scoutfs_key key;
 	unsigned int bytes;
+	int pxs_bytes;
 	ssize_t total;
 	u32 name_hash;
 	u64 id;
 	int ret;
+	int i;
 
 	/* need a buffer large enough for all possible names */
 	bytes = sizeof(struct scoutfs_xattr) + SCOUTFS_XATTR_MAX_NAME_LEN;
 	xat = kmalloc(bytes, GFP_NOFS);
-	if (!xat) {
+	pxs = kmalloc(SCOUTFS_MAX_VAL_SIZE, GFP_NOFS);
+	if (!xat || !pxs) {
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -519,6 +728,33 @@ ssize_t scoutfs_listxattr(struct dentry *dentry, char *buffer, size_t size)
 	id = 0;
 	total = 0;
 
+	/* all the small xattr names come from the single packed item */
+	ret = read_packed_xattrs(inode, pxs, lck);
+	if (ret < 0)
+		goto up;
+	pxs_bytes = ret;
+
+	for_each_packed_xattr(pxs, pxat, i) {
+		/* XXX corruption */
+		if (!packed_entry_ok(pxs, pxs_bytes, pxat)) {
+			ret = -EIO;
+			goto up;
+		}
+
+		total += pxat->name_len + 1;
+
+		if (size) {
+			if (total > size) {
+				ret = -ERANGE;
+				goto up;
+			}
+
+			memcpy(buffer, pxat->name, pxat->name_len);
+			buffer += pxat->name_len;
+			*(buffer++) = '\0';
+		}
+	}
+
 	for (;;) {
 		ret = get_next_xattr(inode, &key, xat, bytes,
 				     NULL, 0, name_hash, id, lck);
@@ -545,10 +781,12 @@ ssize_t scoutfs_listxattr(struct dentry *dentry, char *buffer, size_t size)
 		id = le64_to_cpu(key.skx_id) + 1;
 	}
 
+up:
 	up_read(&si->xattr_rwsem);
 	scoutfs_unlock(sb, lck, DLM_LOCK_PR);
 out:
 	kfree(xat);
+	kfree(pxs);
 
 	return ret;
 }
@@ -571,6 +809,18 @@ int scoutfs_xattr_drop(struct super_block *sb, u64 ino,
 	bool holding = false;
 	int ret;
 
+	/* the packed item covers all of the inode's small xattrs */
+	init_packed_key(&key, ino);
+	ret = scoutfs_hold_trans(sb, SIC_EXACT(1, 0));
+	if (ret)
+		return ret;
+	ret = scoutfs_item_delete(sb, &key, lock);
+	if (ret == -ENOENT)
+		ret = 0;
+	scoutfs_release_trans(sb);
+	if (ret)
+		return ret;
+
 	init_xattr_key(&key, ino, 0, 0);
 	init_xattr_key(&last, ino, U32_MAX, U64_MAX);
 